@@ -0,0 +1,182 @@
+// Counts the heap allocations of volume key presses once the app is up, by
+//   replacing the global operator new (and, with glibc, malloc). The keys go
+//   through the key state machine and the dispatcher to the fake provider,
+//   like on Linux; the first presses bring up the lanes and the snapshot
+//   entries and aren't counted. Any allocation after that fails the run.
+//
+// The snapshot writer isn't started, its writes are the one thing off the
+//   key path allowed to allocate. Presses are recorded in the index still.
+#include "unicode.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <atomic>
+#include <chrono>
+#include <new>
+
+#include "key_actions.hpp"
+#include "volume_control.hpp"
+#include "volume_dispatch.hpp"
+#include "fade_engine.hpp"
+#include "fake_volume_control.hpp"
+
+static std::atomic<bool> counting(false);
+static std::atomic<unsigned long> allocations(0);
+
+static inline void count_allocation()
+{
+	if (counting.load(std::memory_order_relaxed))
+		allocations.fetch_add(1, std::memory_order_relaxed);
+}
+
+#ifdef __GLIBC__
+extern "C" void* __libc_malloc(size_t size);
+extern "C" void* __libc_calloc(size_t count, size_t size);
+extern "C" void* __libc_realloc(void* p, size_t size);
+
+extern "C" void* malloc(size_t size)
+{
+	count_allocation();
+	return __libc_malloc(size);
+}
+extern "C" void* calloc(size_t count, size_t size)
+{
+	count_allocation();
+	return __libc_calloc(count, size);
+}
+extern "C" void* realloc(void* p, size_t size)
+{
+	count_allocation();
+	return __libc_realloc(p, size);
+}
+#endif
+
+void* operator new(size_t size)
+{
+	count_allocation();
+	if (void* p = malloc(size ? size : 1))
+		return p;
+	throw std::bad_alloc();
+}
+void* operator new[](size_t size)
+{
+	return operator new(size);
+}
+void* operator new(size_t size, std::nothrow_t const&) noexcept
+{
+	count_allocation();
+	return malloc(size ? size : 1);
+}
+void* operator new[](size_t size, std::nothrow_t const&) noexcept
+{
+	return operator new(size, std::nothrow);
+}
+void operator delete(void* p) noexcept
+{
+	free(p);
+}
+void operator delete[](void* p) noexcept
+{
+	free(p);
+}
+void operator delete(void* p, size_t) noexcept
+{
+	free(p);
+}
+void operator delete[](void* p, size_t) noexcept
+{
+	free(p);
+}
+
+// Called through a volatile pointer, the compiler may drop a new paired
+//   with a delete otherwise
+static void* (*volatile newProbe)(size_t) = &::operator new;
+
+// Whether the replacement is the one in use, else every run counts 0
+static bool counter_works()
+{
+	allocations.store(0);
+	counting.store(true);
+	::operator delete(newProbe(16));
+	counting.store(false);
+	return allocations.load() != 0;
+}
+
+static KeyStateMachine keys;
+
+static void press(MediaKey key, unsigned int modifiers)
+{
+	KeyAction action = keys.key_down(key, modifiers, false);
+	if (action.type == KeyAction::ACTION_VOLUME_CHANGE)
+		volume_change(action.amount);
+	else if (action.type == KeyAction::ACTION_MUTE)
+		volume_mute();
+	keys.key_up(key);
+}
+
+// The presses of a user going up and down, with a mute now and then
+static void press_round(unsigned int i)
+{
+	press(i & 1 ? MEDIAKEY_VOLUME_DOWN : MEDIAKEY_VOLUME_UP, i & 2 ? MODIFIER_SHIFT : MODIFIER_NONE);
+	if (i % 16 == 15)
+		press(MEDIAKEY_VOLUME_MUTE, MODIFIER_NONE);
+}
+
+// Allocations in count presses, -1 if there was no session to change
+static long run(unsigned int fadeTime, unsigned int count, double& nsPerPress)
+{
+	fade_engine_start(fadeTime);
+	for (unsigned int i = 0; i < 32; ++i)
+		press_round(i);
+
+	allocations.store(0);
+	counting.store(true);
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	for (unsigned int i = 0; i < count; ++i)
+		press_round(i);
+	std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+	counting.store(false);
+	fade_engine_stop();
+
+	nsPerPress = elapsed.count() / count;
+	return (long)allocations.load();
+}
+
+int main(int argc, char** argv)
+{
+	unsigned int count = argc > 1 ? (unsigned int)atoi(argv[1]) : 100000;
+	if (count < 1)
+		count = 1;
+
+	FakeVolumeControlProvider* provider = new FakeVolumeControlProvider();
+	provider->add_session("vlc", .5f);
+	provider->add_session("mpv", .5f);
+	provider->add_session("wmplayer.exe", .5f);
+	add_volume_control(provider);
+	volume_dispatch_start(DISPATCH_BROADCAST, 0);
+
+	if (!counter_works())
+	{
+		fputs("operator new isn't replaced, nothing would be counted\n", stderr);
+		return 1;
+	}
+
+	int ret = 0;
+	printf("%-10s %10s %12s %12s\n", "fade", "presses", "allocations", "per press");
+	static unsigned int const fadeTimes[] = { 0, 200 };
+	for (unsigned int const* fadeTime = fadeTimes; fadeTime != fadeTimes + sizeof(fadeTimes) / sizeof(*fadeTimes); ++fadeTime)
+	{
+		double ns;
+		long n = run(*fadeTime, count, ns);
+		printf("%7u ms %10u %12ld %9.1f ns\n", *fadeTime, count, n, ns);
+		if (n != 0)
+			ret = 1;
+	}
+
+	volume_dispatch_stop(1000);
+	delete_volume_controls();
+	if (ret)
+		fputs("the key path allocated\n", stderr);
+	return ret;
+}
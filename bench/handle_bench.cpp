@@ -0,0 +1,161 @@
+// Compares the handle types of handles.hpp with the raw handles they wrap.
+//   Both the close function and the refcounted object live behind noinline
+//   calls, so what's left to measure is the wrapper itself. The per-iteration
+//   times should be the same within noise.
+#include "unicode.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <chrono>
+#include <vector>
+
+#include "handles.hpp"
+
+#if defined(__GNUC__)
+#define BENCH_NOINLINE __attribute__((noinline))
+#elif defined(_MSC_VER)
+#define BENCH_NOINLINE __declspec(noinline)
+#else
+#define BENCH_NOINLINE
+#endif
+
+static volatile long closed;
+static volatile long live;
+
+BENCH_NOINLINE static int open_fake(int i)
+{
+	return i & 0xFFFF;
+}
+BENCH_NOINLINE static void close_fake(int)
+{
+	closed = closed + 1;
+}
+
+struct FakeDeleter
+{
+	static int invalid() noexcept
+	{
+		return -1;
+	}
+	void operator()(int value) const noexcept
+	{
+		close_fake(value);
+	}
+};
+typedef UniqueHandle<int, FakeDeleter> UniqueFake;
+
+// Refcounted like a COM object, without COM
+struct FakeInterface
+{
+	long refs;
+
+	BENCH_NOINLINE unsigned long AddRef()
+	{
+		return ++refs;
+	}
+	BENCH_NOINLINE unsigned long Release()
+	{
+		return --refs;
+	}
+};
+
+BENCH_NOINLINE static void get_fake(FakeInterface* object, FakeInterface** out)
+{
+	object->AddRef();
+	*out = object;
+}
+
+static_assert(sizeof(UniqueFake) == sizeof(int), "UniqueHandle must be handle sized");
+static_assert(sizeof(ComPtr<FakeInterface>) == sizeof(FakeInterface*), "ComPtr must be pointer sized");
+
+template<typename Function>
+static double measure(Function f, long iterations)
+{
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	f(iterations);
+	std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+	return elapsed.count() / iterations;
+}
+
+static void raw_handle(long n)
+{
+	for (long i = 0; i < n; ++i)
+	{
+		int h = open_fake((int)i);
+		if (h != -1)
+			close_fake(h);
+	}
+}
+static void unique_handle(long n)
+{
+	for (long i = 0; i < n; ++i)
+		UniqueFake h(open_fake((int)i));
+}
+
+static void raw_com(long n)
+{
+	FakeInterface object = { 1 };
+	for (long i = 0; i < n; ++i)
+	{
+		FakeInterface* p;
+		get_fake(&object, &p);
+		live = (long)p->refs;
+		p->Release();
+	}
+}
+static void com_ptr(long n)
+{
+	FakeInterface object = { 1 };
+	for (long i = 0; i < n; ++i)
+	{
+		ComPtr<FakeInterface> p;
+		get_fake(&object, p.put());
+		live = (long)p->refs;
+	}
+}
+
+// Moving through a vector is what AutoCleanup couldn't do
+static void raw_vector(long n)
+{
+	std::vector<int> v;
+	v.reserve(1024);
+	for (long i = 0; i < n; i += 1024)
+	{
+		for (int j = 0; j < 1024; ++j)
+			v.push_back(open_fake(j));
+		for (std::vector<int>::iterator start = v.begin(), end = v.end(); start != end; ++start)
+			close_fake(*start);
+		v.clear();
+	}
+}
+static void unique_vector(long n)
+{
+	std::vector<UniqueFake> v;
+	v.reserve(1024);
+	for (long i = 0; i < n; i += 1024)
+	{
+		for (int j = 0; j < 1024; ++j)
+			v.emplace_back(open_fake(j));
+		v.clear();
+	}
+}
+
+int main(int argc, char** argv)
+{
+	long iterations = argc > 1 ? atol(argv[1]) : 50000000L;
+	if (iterations < 1024)
+		iterations = 1024;
+
+	// Warm up
+	measure(raw_handle, iterations / 10);
+	measure(unique_handle, iterations / 10);
+
+	printf("%-24s %8.3f ns\n", "raw handle", measure(raw_handle, iterations));
+	printf("%-24s %8.3f ns\n", "UniqueHandle", measure(unique_handle, iterations));
+	printf("%-24s %8.3f ns\n", "raw interface pointer", measure(raw_com, iterations));
+	printf("%-24s %8.3f ns\n", "ComPtr", measure(com_ptr, iterations));
+	printf("%-24s %8.3f ns\n", "vector<int>", measure(raw_vector, iterations));
+	printf("%-24s %8.3f ns\n", "vector<UniqueHandle>", measure(unique_vector, iterations));
+	return 0;
+}
@@ -0,0 +1,75 @@
+// Case-insensitive comparison and hashing of process names: utf8_iequal and
+//   utf8_ihash against a towlower per character loop, the way names were
+//   compared before, for ASCII names of player length and longer ones and
+//   for names that aren't ASCII.
+#include "unicode.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <wctype.h>
+
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include "utf8.hpp"
+
+static bool towlower_iequal(std::string const& a, std::string const& b)
+{
+	if (a.length() != b.length())
+		return false;
+	for (std::string::size_type i = 0; i != a.length(); ++i)
+		if (towlower((unsigned char)a[i]) != towlower((unsigned char)b[i]))
+			return false;
+	return true;
+}
+
+static std::string upper(std::string str)
+{
+	for (std::string::iterator start = str.begin(), end = str.end(); start != end; ++start)
+		if (*start >= 'a' && *start <= 'z')
+			*start -= 'a' - 'A';
+	return str;
+}
+
+template<typename Function>
+static double ns_per_call(int rounds, std::vector<std::string> const& a, std::vector<std::string> const& b, Function function, unsigned long& sink)
+{
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	for (int round = 0; round < rounds; ++round)
+		for (std::vector<std::string>::size_type i = 0; i != a.size(); ++i)
+			sink += function(a[i], b[i]);
+	std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+	return elapsed.count() / ((double)rounds * a.size());
+}
+
+int main(int argc, char** argv)
+{
+	int rounds = argc > 1 ? atoi(argv[1]) : 20000;
+	if (rounds < 1)
+		rounds = 1;
+
+	static char const* const sets[][4] = {
+		{ "short", "vlc", "mpv", "wmplayer.exe" },
+		{ "long", "Microsoft.Media.Player.exe", "ApplicationFrameHost.exe", "foobar2000_portable_build.exe" },
+		{ "non-ascii", "Äudio-Spieler.exe", "Проигрыватель.exe", "lecteur_média.exe" },
+	};
+	unsigned long sink = 0;
+	printf("%-10s %12s %12s %12s\n", "names", "towlower", "iequal", "ihash");
+	for (unsigned int s = 0; s < sizeof(sets) / sizeof(*sets); ++s)
+	{
+		std::vector<std::string> a, b;
+		for (int i = 0; i < 64; ++i)
+		{
+			std::string name(sets[s][1 + i % 3]);
+			a.push_back(name);
+			b.push_back(i & 1 ? upper(name) : name);
+		}
+		double loop = ns_per_call(rounds, a, b, towlower_iequal, sink);
+		double iequal = ns_per_call(rounds, a, b, [](std::string const& x, std::string const& y) { return utf8_iequal(x, y); }, sink);
+		double ihash = ns_per_call(rounds, a, b, [](std::string const& x, std::string const&) { return utf8_ihash(x) & 1; }, sink);
+		printf("%-10s %9.1f ns %9.1f ns %9.1f ns\n", sets[s][0], loop, iequal, ihash);
+	}
+	// Keeps the calls from being optimized away
+	return sink == 0 ? 1 : 0;
+}
@@ -0,0 +1,94 @@
+// Cold session scan over a number of endpoints, serially and with
+//   parallel_scan. There is no audio stack to scan here, so an endpoint is
+//   simulated by its latencies: activating the session manager and, for
+//   every session, opening the process and reading its image name. Those
+//   are waits on the audio service and the kernel, not CPU work, which is
+//   what the workers get to overlap.
+#include "unicode.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "parallel_scan.hpp"
+
+struct FakeSession
+{
+	unsigned int endpoint;
+	std::string processName;
+};
+typedef std::vector<FakeSession> FakeIndex;
+
+static std::chrono::microseconds activateLatency(2000);
+static std::chrono::microseconds sessionLatency(150);
+static unsigned int sessionsPerEndpoint = 8;
+
+static void scan_endpoint(unsigned int endpoint, FakeIndex& out)
+{
+	std::this_thread::sleep_for(activateLatency);
+	for (unsigned int i = 0; i < sessionsPerEndpoint; ++i)
+	{
+		std::this_thread::sleep_for(sessionLatency);
+		// Every other session belongs to a player
+		if (i & 1)
+			out.push_back(FakeSession{ endpoint, "vlc" });
+	}
+}
+
+static void serial(unsigned int endpoints, FakeIndex& index)
+{
+	for (unsigned int i = 0; i < endpoints; ++i)
+		scan_endpoint(i, index);
+}
+static void parallel(unsigned int endpoints, FakeIndex& index)
+{
+	std::vector<FakeIndex> parts;
+	parallel_scan<NoApartment>(endpoints, parts, [](unsigned int i, FakeIndex& part)
+	{
+		scan_endpoint(i, part);
+	});
+	for (std::vector<FakeIndex>::iterator start = parts.begin(), end = parts.end(); start != end; ++start)
+		index.insert(index.end(), start->begin(), start->end());
+}
+
+// Milliseconds per scan
+template<typename Function>
+static double measure(Function f, unsigned int endpoints, int rounds, size_t& found)
+{
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	for (int i = 0; i < rounds; ++i)
+	{
+		FakeIndex index;
+		f(endpoints, index);
+		found = index.size();
+	}
+	std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+	return elapsed.count() / rounds;
+}
+
+int main(int argc, char** argv)
+{
+	int rounds = argc > 1 ? atoi(argv[1]) : 20;
+	if (rounds < 1)
+		rounds = 1;
+
+	printf("%-10s %12s %12s %8s\n", "endpoints", "serial", "parallel", "speedup");
+	static unsigned int const counts[] = { 1, 2, 4, 6, 8, 10 };
+	for (unsigned int const* count = counts; count != counts + sizeof(counts) / sizeof(*counts); ++count)
+	{
+		size_t serialFound, parallelFound;
+		double s = measure(serial, *count, rounds, serialFound);
+		double p = measure(parallel, *count, rounds, parallelFound);
+		if (serialFound != parallelFound)
+		{
+			fprintf(stderr, "index mismatch: %zu serial, %zu parallel\n", serialFound, parallelFound);
+			return 1;
+		}
+		printf("%-10u %9.3f ms %9.3f ms %7.2fx\n", *count, s, p, s / p);
+	}
+	return 0;
+}
@@ -0,0 +1,75 @@
+// Loading the volume snapshot at startup and looking players up in it, for
+//   snapshots far bigger than anyone's list of players. The snapshot is
+//   written to a temporary file first, loading then reads and decodes it
+//   into the index like volume_snapshot_start does.
+#include "unicode.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include "volume_snapshot.hpp"
+
+static std::string app_name(unsigned int i)
+{
+	char buffer[32];
+	snprintf(buffer, sizeof(buffer), "player%06u.exe", i);
+	return std::string(buffer);
+}
+
+int main(int argc, char** argv)
+{
+	int rounds = argc > 1 ? atoi(argv[1]) : 50;
+	if (rounds < 1)
+		rounds = 1;
+	std::basic_string<TCHAR> path(_T("snapshot_bench.bin"));
+
+	printf("%-8s %10s %12s %12s %12s\n", "entries", "bytes", "load", "per entry", "lookup");
+	static unsigned int const counts[] = { 16, 256, 1000, 4000, 16000, 64000 };
+	for (unsigned int const* count = counts; count != counts + sizeof(counts) / sizeof(*counts); ++count)
+	{
+		std::vector<VolumeSnapshotEntry> entries;
+		entries.reserve(*count);
+		for (unsigned int i = 0; i < *count; ++i)
+		{
+			VolumeSnapshotEntry entry = { app_name(i), (i % 100) / 100.f, (unsigned char)(VolumeSnapshotEntry::HAS_VOLUME | VolumeSnapshotEntry::HAS_MUTE | (i & 1)) };
+			entries.push_back(entry);
+		}
+		std::vector<unsigned char> data;
+		volume_snapshot_encode(entries, data);
+		FILE* f = fopen("snapshot_bench.bin", "wb");
+		if (!f || fwrite(data.data(), 1, data.size(), f) != data.size() || fclose(f) != 0)
+		{
+			fputs("couldn't write snapshot_bench.bin\n", stderr);
+			return 1;
+		}
+
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		for (int i = 0; i < rounds; ++i)
+			if (!volume_snapshot_load(path) || volume_snapshot_size() != *count)
+			{
+				fputs("snapshot didn't load back\n", stderr);
+				return 1;
+			}
+		std::chrono::duration<double, std::milli> load = std::chrono::steady_clock::now() - start;
+
+		// The lookup a session appearing costs, every other one a miss
+		unsigned int lookups = 100000, found = 0;
+		VolumeSnapshotEntry entry;
+		start = std::chrono::steady_clock::now();
+		for (unsigned int i = 0; i < lookups; ++i)
+			found += volume_snapshot_lookup(app_name((i * 7919u) % (*count * 2)), entry);
+		std::chrono::duration<double, std::nano> lookup = std::chrono::steady_clock::now() - start;
+		if (found == 0)
+			return 1;
+
+		double ms = load.count() / rounds;
+		printf("%-8u %10zu %9.3f ms %9.1f ns %9.1f ns\n", *count, data.size(), ms, ms * 1e6 / *count, lookup.count() / lookups);
+	}
+	remove("snapshot_bench.bin");
+	return 0;
+}
@@ -0,0 +1,171 @@
+// Time from starting mpVolCtrl to its first volume change, and to its exit.
+//   It is the real startup, with the dispatcher, the fade engine, the
+//   statistics, the command socket and the input devices, only the audio
+//   stack is a fake session. There may be no volume keys to press, so the
+//   first change is an "up" sent to the command socket as soon as it
+//   connects, and seen as the "bench: volume" line on the verbose output;
+//   the exit is timed from a SIGTERM sent then. The statistics of a run
+//   have the same phases as startup_*_us.
+#include "unicode.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <vector>
+
+// Where IpcServer::socket_path puts it
+static bool socket_address(struct sockaddr_un& addr)
+{
+	char const* dir = getenv("XDG_RUNTIME_DIR");
+	char buf[64];
+	snprintf(buf, sizeof buf, "/tmp/mpVolCtrl-%u.sock", (unsigned)getuid());
+	std::string path = dir && *dir ? std::string(dir) + "/mpVolCtrl.sock" : std::string(buf);
+	memset(&addr, 0, sizeof addr);
+	addr.sun_family = AF_UNIX;
+	if (path.length() >= sizeof addr.sun_path)
+		return false;
+	memcpy(addr.sun_path, path.c_str(), path.length() + 1);
+	return true;
+}
+
+// A connected socket, -1 if nothing listens there
+static int connect_socket()
+{
+	struct sockaddr_un addr;
+	int fd;
+	if (!socket_address(addr) || (fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) == -1)
+		return -1;
+	if (connect(fd, (struct sockaddr*)&addr, sizeof addr) == -1)
+	{
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+// Milliseconds to the first volume change and to the exit, false if it
+//   didn't get there
+static bool run_once(double& firstKey, double& exited)
+{
+	int fds[2];
+	if (pipe(fds) != 0)
+		return false;
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	pid_t pid = fork();
+	if (pid < 0)
+		return false;
+	if (pid == 0)
+	{
+		dup2(fds[1], STDOUT_FILENO);
+		close(fds[0]);
+		close(fds[1]);
+		execl(MPVC_BINARY, MPVC_BINARY, "--fake-session", "bench", "--verbose", (char*)NULL);
+		_exit(127);
+	}
+	close(fds[1]);
+
+	// The socket is bound before anything else starts, the command waits in
+	//   it until the loop runs
+	int fd;
+	int status;
+	struct timespec pause = { 0, 50000 };
+	while ((fd = connect_socket()) == -1)
+	{
+		if (waitpid(pid, &status, WNOHANG) == pid)
+		{
+			close(fds[0]);
+			return false;
+		}
+		nanosleep(&pause, NULL);
+	}
+	bool sent = send(fd, "up\n", 3, MSG_NOSIGNAL) == 3;
+
+	firstKey = -1.;
+	std::string output;
+	char buffer[512];
+	for (ssize_t n; (n = read(fds[0], buffer, sizeof(buffer))) != 0; )
+	{
+		if (n < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+		output.append(buffer, n);
+		if (firstKey < 0. && output.find("bench: volume") != std::string::npos)
+		{
+			firstKey = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+			start = std::chrono::steady_clock::now();
+			kill(pid, SIGTERM);
+		}
+	}
+	close(fds[0]);
+	close(fd);
+	waitpid(pid, &status, 0);
+	exited = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	return sent && firstKey >= 0. && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+static void print_row(char const* name, std::vector<double>& times)
+{
+	std::sort(times.begin(), times.end());
+	printf("%-12s %9.3f ms %9.3f ms %9.3f ms\n", name, times.front(), times[times.size() / 2], times.back());
+}
+
+int main(int argc, char** argv)
+{
+	int rounds = argc > 1 ? atoi(argv[1]) : 50;
+	if (rounds < 1)
+		rounds = 1;
+
+	// It would take the running one's socket and statistics
+	int running = connect_socket();
+	if (running != -1)
+	{
+		close(running);
+		fputs("mpVolCtrl is running, stop it first\n", stderr);
+		return 1;
+	}
+
+	// A config directory of its own, so no setting or snapshot of the user's
+	//   gets in
+	char dir[] = "/tmp/startup_bench.XXXXXX";
+	if (!mkdtemp(dir))
+	{
+		perror("mkdtemp");
+		return 1;
+	}
+	setenv("XDG_CONFIG_HOME", dir, 1);
+
+	std::vector<double> firstKeys, exits;
+	for (int i = 0; i < rounds; ++i)
+	{
+		double firstKey, exited;
+		if (!run_once(firstKey, exited))
+		{
+			fputs(MPVC_BINARY " didn't get to the volume change, it needs /dev/input to start\n", stderr);
+			return 1;
+		}
+		firstKeys.push_back(firstKey);
+		exits.push_back(exited);
+	}
+
+	printf("%-12s %12s %12s %12s\n", "", "min", "median", "max");
+	print_row("first key", firstKeys);
+	print_row("exit", exits);
+
+	std::string cleanup = std::string("rm -rf ") + dir;
+	return system(cleanup.c_str()) == 0 ? 0 : 1;
+}
@@ -0,0 +1,170 @@
+/* Sample provider plugin. It keeps the volume of made up sessions in
+ *   memory, one per player name in the config (just "sample" without
+ *   any), a starting point for a real backend and what mpvcplugin checks
+ *   the loader with. MPVC_SAMPLE_ABSENT in the environment has it report
+ *   its backend as missing.
+ */
+#include <stdlib.h>
+#include <string.h>
+
+#include "plugin_abi.h"
+
+#define MAX_SESSIONS 16
+#define MAX_NAME 64
+
+struct session
+{
+	char name[MAX_NAME];
+	size_t length;
+	float volume;
+	int muted;
+};
+
+struct sample
+{
+	struct mpvc_host const* host;
+	struct session sessions[MAX_SESSIONS];
+	unsigned int count;
+};
+
+static float clamp(float volume)
+{
+	return volume < 0.f ? 0.f : volume > 1.f ? 1.f : volume;
+}
+
+static int matches(struct session const* session, char const* target, size_t length)
+{
+	return length == 0 || (length == session->length && memcmp(session->name, target, length) == 0);
+}
+
+static void add_session(struct sample* sample, char const* name, size_t length)
+{
+	struct session* session;
+	if (sample->count == MAX_SESSIONS || length == 0 || length >= MAX_NAME)
+		return;
+	session = &sample->sessions[sample->count++];
+	memcpy(session->name, name, length);
+	session->name[length] = '\0';
+	session->length = length;
+	session->volume = 1.f;
+	session->muted = 0;
+	sample->host->session_added(sample->host->host_data, session->name, session->volume);
+}
+
+static int sample_present(void)
+{
+	/* A real backend looks for its audio service here */
+	return getenv("MPVC_SAMPLE_ABSENT") == NULL;
+}
+
+static void* sample_init(struct mpvc_host const* host)
+{
+	struct sample* sample = (struct sample*)calloc(1, sizeof(struct sample));
+	char const *p, *sep;
+	if (!sample)
+		return NULL;
+	sample->host = host;
+	for (p = host->process_names; p && *p; p = *sep ? sep + 1 : sep)
+	{
+		char const* end;
+		sep = strchr(p, ',');
+		if (!sep)
+			sep = p + strlen(p);
+		while (p != sep && *p == ' ')
+			++p;
+		for (end = sep; end != p && end[-1] == ' '; --end)
+			;
+		add_session(sample, p, (size_t)(end - p));
+	}
+	if (!sample->count)
+		add_session(sample, "sample", 6);
+	return sample;
+}
+
+static void sample_apply(void* instance, struct mpvc_command const* commands, size_t count, int* statuses)
+{
+	struct sample* sample = (struct sample*)instance;
+	unsigned int i;
+	size_t c;
+	for (c = 0; c < count; ++c)
+		statuses[c] = MPVC_STATUS_NOT_FOUND;
+	for (i = 0; i < sample->count; ++i)
+	{
+		struct session* session = &sample->sessions[i];
+		for (c = 0; c < count; ++c)
+		{
+			struct mpvc_command const* command = &commands[c];
+			if (!matches(session, command->target, command->target_length))
+				continue;
+			statuses[c] = MPVC_STATUS_FOUND;
+			switch (command->op)
+			{
+			case MPVC_OP_CHANGE:
+				session->volume = clamp(session->volume + command->value);
+				break;
+			case MPVC_OP_TOGGLE_MUTE:
+				session->muted = !session->muted;
+				break;
+			case MPVC_OP_SET_VOLUME:
+			case MPVC_OP_FADE:
+				/* No fades, the volume is set right away */
+				session->volume = clamp(command->value);
+				break;
+			case MPVC_OP_SET_MUTE:
+				session->muted = command->value != 0.f;
+				break;
+			default:
+				statuses[c] = MPVC_STATUS_ERROR;
+				break;
+			}
+		}
+	}
+}
+
+static int sample_get(void* instance, char const* target, size_t length, float* volume, int* muted)
+{
+	struct sample* sample = (struct sample*)instance;
+	unsigned int i;
+	for (i = 0; i < sample->count; ++i)
+		if (matches(&sample->sessions[i], target, length))
+		{
+			*volume = sample->sessions[i].volume;
+			*muted = sample->sessions[i].muted;
+			return MPVC_STATUS_FOUND;
+		}
+	return MPVC_STATUS_NOT_FOUND;
+}
+
+static void sample_list(void* instance, mpvc_list_callback callback, void* context)
+{
+	struct sample* sample = (struct sample*)instance;
+	unsigned int i;
+	for (i = 0; i < sample->count; ++i)
+		callback(context, sample->sessions[i].name, sample->sessions[i].volume, sample->sessions[i].muted);
+}
+
+static void sample_shutdown(void* instance)
+{
+	struct sample* sample = (struct sample*)instance;
+	unsigned int i;
+	for (i = 0; i < sample->count; ++i)
+		sample->host->session_removed(sample->host->host_data, sample->sessions[i].name);
+	free(sample);
+}
+
+static struct mpvc_plugin const samplePlugin = {
+	MPVC_PLUGIN_ABI_VERSION,
+	"sample",
+	0,
+	sample_present,
+	sample_init,
+	sample_apply,
+	sample_get,
+	sample_list,
+	sample_shutdown
+};
+
+MPVC_PLUGIN_EXPORT struct mpvc_plugin const* mpvc_plugin_entry(unsigned int host_abi_version)
+{
+	return host_abi_version >= MPVC_PLUGIN_ABI_VERSION ? &samplePlugin : NULL;
+}
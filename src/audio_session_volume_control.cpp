@@ -0,0 +1,1013 @@
+#include "unicode.h"
+#include <assert.h>
+
+#include <algorithm>
+#include <atomic>
+#include <string>
+#include <iterator>
+#include <unordered_set>
+#include <vector>
+
+#include <initguid.h>
+#include <Windows.h>
+#include <tchar.h>
+#include <mmdeviceapi.h>
+#include <audiopolicy.h>
+#include <endpointvolume.h>
+#include <Psapi.h>
+
+#include "audio_session_volume_control.hpp"
+#include "call_stats.hpp"
+#include "errors.hpp"
+#include "fade_engine.hpp"
+#include "foreground_window.hpp"
+#include "handles.hpp"
+#include "metrics.hpp"
+#include "parallel_scan.hpp"
+#include "timeline.hpp"
+#include "utf8.hpp"
+#include "volume_control.hpp"
+#include "volume_dispatch.hpp"
+#include "volume_snapshot.hpp"
+#include "volume_steps.hpp"
+
+#if _MSC_VER
+const CLSID CLSID_MMDeviceEnumerator = __uuidof(MMDeviceEnumerator);
+const IID IID_IMMDeviceEnumerator = __uuidof(IMMDeviceEnumerator);
+const IID IID_IAudioSessionManager2 = __uuidof(IAudioSessionManager2);
+const IID IID_ISimpleAudioVolume = __uuidof(ISimpleAudioVolume);
+const IID IID_IAudioSessionControl2 = __uuidof(IAudioSessionControl2);
+const IID IID_IMMNotificationClient = __uuidof(IMMNotificationClient);
+const IID IID_IAudioSessionNotification = __uuidof(IAudioSessionNotification);
+const IID IID_IAudioSessionEvents = __uuidof(IAudioSessionEvents);
+const IID IID_IAudioMeterInformation = __uuidof(IAudioMeterInformation);
+#endif
+
+// Failures are counted for the stats segment
+static inline bool com_succeeded(HRESULT hResult)
+{
+	if (SUCCEEDED(hResult))
+		return true;
+	mpvc_metrics.comErrors.fetch_add(1, std::memory_order_relaxed);
+	return false;
+}
+
+// Keeps a scan worker in the multithreaded apartment. The sessions it finds
+//   are used by the calling thread afterwards, which is why scans only go
+//   parallel when that one is in the MTA too.
+struct MtaApartment
+{
+	bool initialized;
+
+	MtaApartment() : initialized(SUCCEEDED(CoInitializeEx(NULL, COINIT_MULTITHREADED))) { }
+	~MtaApartment()
+	{
+		if (initialized)
+			CoUninitialize();
+	}
+};
+
+static bool in_mta()
+{
+	APTTYPE type;
+	APTTYPEQUALIFIER qualifier;
+	return SUCCEEDED(CoGetApartmentType(&type, &qualifier)) && type == APTTYPE_MTA;
+}
+
+// Reference counting and QueryInterface for the callback objects handed to
+//   the audio service. Those are called on its threads, so everything the
+//   callbacks touch is atomic.
+template<class Interface>
+class ComCallback : public Interface
+{
+private:
+	std::atomic<ULONG> refs;
+	IID const& iid;
+public:
+	ComCallback(IID const& iid) : refs(1), iid(iid) { }
+	virtual ~ComCallback() { }
+
+	ULONG STDMETHODCALLTYPE AddRef()
+	{
+		return refs.fetch_add(1) + 1;
+	}
+	ULONG STDMETHODCALLTYPE Release()
+	{
+		ULONG ret = refs.fetch_sub(1) - 1;
+		if (ret == 0)
+			delete this;
+		return ret;
+	}
+	HRESULT STDMETHODCALLTYPE QueryInterface(REFIID riid, void** out)
+	{
+		if (riid == IID_IUnknown || riid == iid)
+		{
+			AddRef();
+			*out = static_cast<Interface*>(this);
+			return S_OK;
+		}
+		*out = NULL;
+		return E_NOINTERFACE;
+	}
+};
+
+// Marks the provider's endpoint table stale when the devices or the default
+//   one change, the table itself is rebuilt by the next scan
+class EndpointNotificationClient : public ComCallback<IMMNotificationClient>
+{
+private:
+	std::atomic<bool>& stale;
+public:
+	EndpointNotificationClient(std::atomic<bool>& stale) : ComCallback<IMMNotificationClient>(IID_IMMNotificationClient), stale(stale) { }
+
+	HRESULT STDMETHODCALLTYPE OnDefaultDeviceChanged(EDataFlow flow, ERole role, LPCWSTR)
+	{
+		if (flow == eRender && role == eMultimedia)
+			stale.store(true, std::memory_order_release);
+		return S_OK;
+	}
+	HRESULT STDMETHODCALLTYPE OnDeviceStateChanged(LPCWSTR, DWORD)
+	{
+		stale.store(true, std::memory_order_release);
+		return S_OK;
+	}
+	HRESULT STDMETHODCALLTYPE OnDeviceAdded(LPCWSTR)
+	{
+		stale.store(true, std::memory_order_release);
+		return S_OK;
+	}
+	HRESULT STDMETHODCALLTYPE OnDeviceRemoved(LPCWSTR)
+	{
+		stale.store(true, std::memory_order_release);
+		return S_OK;
+	}
+	HRESULT STDMETHODCALLTYPE OnPropertyValueChanged(LPCWSTR, PROPERTYKEY const)
+	{
+		return S_OK;
+	}
+};
+
+// Marks an endpoint's sessions stale when a new one shows up, and has the
+//   provider scan them on its lane right away, so a player starting gets
+//   its remembered state back before the next key press
+class SessionNotificationClient : public ComCallback<IAudioSessionNotification>
+{
+private:
+	MediaPlayerVolumeControlProvider* provider;
+	// The provider's, a burst of new sessions is one scan
+	std::atomic<bool>& scanQueued;
+public:
+	std::atomic<bool> stale;
+
+	SessionNotificationClient(MediaPlayerVolumeControlProvider* provider, std::atomic<bool>& scanQueued) : ComCallback<IAudioSessionNotification>(IID_IAudioSessionNotification), provider(provider), scanQueued(scanQueued), stale(true) { }
+
+	HRESULT STDMETHODCALLTYPE OnSessionCreated(IAudioSessionControl*)
+	{
+		stale.store(true, std::memory_order_release);
+		if (!scanQueued.exchange(true, std::memory_order_acq_rel) && !volume_dispatch_warm_up(provider))
+			scanQueued.store(false, std::memory_order_release);
+		return S_OK;
+	}
+};
+
+// Follows the state of one session
+class SessionEventsClient : public ComCallback<IAudioSessionEvents>
+{
+public:
+	std::atomic<int> state;
+
+	SessionEventsClient() : ComCallback<IAudioSessionEvents>(IID_IAudioSessionEvents), state(AudioSessionStateInactive) { }
+
+	HRESULT STDMETHODCALLTYPE OnStateChanged(AudioSessionState newState)
+	{
+		state.store(newState, std::memory_order_relaxed);
+		return S_OK;
+	}
+	HRESULT STDMETHODCALLTYPE OnSessionDisconnected(AudioSessionDisconnectReason)
+	{
+		state.store(AudioSessionStateExpired, std::memory_order_relaxed);
+		return S_OK;
+	}
+	HRESULT STDMETHODCALLTYPE OnDisplayNameChanged(LPCWSTR, LPCGUID)
+	{
+		return S_OK;
+	}
+	HRESULT STDMETHODCALLTYPE OnIconPathChanged(LPCWSTR, LPCGUID)
+	{
+		return S_OK;
+	}
+	HRESULT STDMETHODCALLTYPE OnSimpleVolumeChanged(float, BOOL, LPCGUID)
+	{
+		return S_OK;
+	}
+	HRESULT STDMETHODCALLTYPE OnChannelVolumeChanged(DWORD, float*, DWORD, LPCGUID)
+	{
+		return S_OK;
+	}
+	HRESULT STDMETHODCALLTYPE OnGroupingParamChanged(LPCGUID, LPCGUID)
+	{
+		return S_OK;
+	}
+};
+
+class AudioSesionInterfaceVolumeControlProvider : public MediaPlayerVolumeControlProvider, private FadeSink
+{
+public:
+	enum ScanMode
+	{
+		SCAN_SERIAL,
+		// One endpoint per worker, on machines with lots of them (monitors,
+		//   headsets, virtual cables) that's most of a cold scan
+		SCAN_PARALLEL
+	};
+protected:
+	// A session of one of the registered processes, kept with its events
+	//   registered until it's gone from its endpoint
+	struct TrackedSession
+	{
+		std::wstring instanceId;
+		ComPtr<IAudioSessionControl2> control;
+		ComPtr<SessionEventsClient> events;
+		// NULL if the session has none, the fades' key otherwise
+		ComPtr<ISimpleAudioVolume> volume;
+		// Queried by the first SESSIONS_AUDIBLE key press
+		ComPtr<IAudioMeterInformation> meter;
+		// Set once a fade was started on volume
+		FadeSink* fader;
+		DWORD processId;
+		// UTF-8, converted once when the session is first tracked
+		std::string processName;
+
+		TrackedSession(std::wstring const& instanceId, ComPtr<IAudioSessionControl2>&& control, DWORD processId, std::string&& processName) : instanceId(instanceId), control(std::move(control)), events(), volume(), meter(), fader(), processId(processId), processName(std::move(processName)) { }
+		TrackedSession(TrackedSession&&) = default;
+		// Would leak the registration of the one assigned to
+		TrackedSession& operator=(TrackedSession&&) = delete;
+		~TrackedSession()
+		{
+			// The fade thread must be done with volume before it's released
+			if (fader && volume)
+				fade_cancel(fader, volume.get());
+			if (control && events)
+				control->UnregisterAudioSessionNotification(events.get());
+		}
+
+		AudioSessionState state() const
+		{
+			return events ? (AudioSessionState)events->state.load(std::memory_order_relaxed) : AudioSessionStateActive;
+		}
+	};
+
+	// An endpoint in scope, with its session manager activated by the first
+	//   scan that needs it and kept until the endpoints change. Its sessions
+	//   are only enumerated again once a new one was created.
+	struct Endpoint
+	{
+		std::wstring id;
+		ComPtr<IMMDevice> device;
+		ComPtr<IAudioSessionManager2> manager;
+		ComPtr<SessionNotificationClient> notification;
+		std::vector<TrackedSession> sessions;
+		// Instance ids of the sessions of other processes, so they aren't
+		//   looked up again
+		std::vector<std::wstring> ignored;
+		// The sessions new to a later enumeration are players starting
+		bool enumerated;
+
+		Endpoint(std::wstring&& id, ComPtr<IMMDevice>&& device) : id(std::move(id)), device(std::move(device)), manager(), notification(), sessions(), ignored(), enumerated() { }
+		Endpoint(Endpoint&&) = default;
+		Endpoint& operator=(Endpoint&&) = delete;
+		~Endpoint()
+		{
+			drop_manager();
+		}
+
+		bool sessions_stale() const
+		{
+			return !notification || notification->stale.load(std::memory_order_acquire);
+		}
+		void drop_manager()
+		{
+			// Sessions first, their events go with the manager
+			sessions.clear();
+			ignored.clear();
+			if (manager && notification)
+				manager->UnregisterSessionNotification(notification.get());
+			notification.reset();
+			manager.reset();
+			enumerated = false;
+		}
+	};
+
+	// File names are case-insensitive
+	std::unordered_set<std::string, Utf8IHash, Utf8IEqual> processNames;
+	ComPtr<IMMDeviceEnumerator> iMMDevEnum;
+	ScanMode scanMode;
+	SessionFilter sessionFilter;
+	SessionRouting sessionRouting;
+	EndpointScope endpointScope;
+	std::vector<std::wstring> endpointIds;
+	std::vector<Endpoint> endpoints;
+	std::atomic<bool> endpointsStale;
+	// A scan for new sessions is queued on the lane
+	std::atomic<bool> scanQueued;
+	ComPtr<EndpointNotificationClient> notificationClient;
+	// Bumped whenever a scan changed the tracked sessions
+	unsigned long sessionGeneration;
+	// The foreground process's sessions as of routedGeneration
+	DWORD routedProcessId;
+	unsigned long routedGeneration;
+	std::vector<TrackedSession*> routedSessions;
+	// The sessions apply_to_all and a batch's keyed commands work on, kept
+	//   for its capacity so a key press finding the sessions tracked
+	//   already doesn't allocate
+	std::vector<TrackedSession*> commandSessions;
+	// Every tracked session, for batches with commands for more than the
+	//   keys' sessions
+	std::vector<TrackedSession*> batchSessions;
+public:
+	AudioSesionInterfaceVolumeControlProvider() : processNames(), iMMDevEnum(), scanMode(SCAN_PARALLEL), sessionFilter(SESSIONS_ALL), sessionRouting(ROUTE_ALL), endpointScope(ENDPOINTS_ALL), endpointIds(), endpoints(), endpointsStale(true), scanQueued(), notificationClient(), sessionGeneration(), routedProcessId(), routedGeneration(), routedSessions(), commandSessions(), batchSessions() { }
+	virtual ~AudioSesionInterfaceVolumeControlProvider()
+	{
+		fade_cancel_all(this);
+		endpoints.clear();
+		if (iMMDevEnum && notificationClient)
+			iMMDevEnum->UnregisterEndpointNotificationCallback(notificationClient.get());
+	}
+
+	void register_process_name(std::string const& name)
+	{
+		processNames.insert(name);
+	}
+	void set_scan_mode(ScanMode mode)
+	{
+		scanMode = mode;
+	}
+	// Not synchronized with the scans, for before the dispatcher starts
+	void set_endpoints(EndpointScope scope, std::vector<std::wstring> const& ids)
+	{
+		endpointScope = scope;
+		endpointIds = ids;
+		endpointsStale.store(true, std::memory_order_relaxed);
+	}
+	void set_session_filter(SessionFilter filter)
+	{
+		sessionFilter = filter;
+	}
+	void set_session_routing(SessionRouting routing)
+	{
+		sessionRouting = routing;
+	}
+private:
+	// The sessions of the registered processes, in endpoint order. Points
+	//   into the endpoint table, valid until the next scan.
+	typedef std::vector<TrackedSession*> SessionIndex;
+
+	// Empty if the process can't be looked at
+	static std::string process_name(DWORD processId)
+	{
+		TCHAR processPath[MAX_PATH + 1];
+		DWORD len;
+		{
+			UniqueWin32Handle hProcess(WIN32_CALL(CALL_OPEN_PROCESS, OpenProcess(PROCESS_QUERY_INFORMATION | PROCESS_VM_READ, FALSE, processId)));
+			if (!hProcess)
+				return std::string();
+			len = WIN32_CALL(CALL_GET_PROCESS_IMAGE_FILE_NAME, GetProcessImageFileName(hProcess.get(), processPath, MAX_PATH + 1));
+		}
+		TCHAR* lastDirSep = std::find(std::make_reverse_iterator(&processPath[len]), std::make_reverse_iterator(&processPath[0]), _T('\\')).base();
+		return utf8_from_tstring(std::basic_string_view<TCHAR>(lastDirSep, &processPath[len] - lastDirSep));
+	}
+
+	// Enumerates the sessions of an endpoint again. Sessions tracked already
+	//   are taken over, only new ones are looked up.
+	void enumerate_sessions(Endpoint& endpoint)
+	{
+		HRESULT hResult;
+
+		if (!endpoint.manager)
+		{
+			hResult = COM_CALL(CALL_ACTIVATE, endpoint.device->Activate(IID_IAudioSessionManager2, CLSCTX_ALL, NULL, endpoint.manager.put_void()));
+			if (!com_succeeded(hResult))
+				return;
+		}
+
+		// Cleared before enumerating, a session created meanwhile sets it again
+		if (endpoint.notification)
+			endpoint.notification->stale.store(false, std::memory_order_relaxed);
+
+		ComPtr<IAudioSessionEnumerator> iAudioSessEnum;
+		hResult = COM_CALL(CALL_GET_SESSION_ENUMERATOR, endpoint.manager->GetSessionEnumerator(iAudioSessEnum.put()));
+		if (!com_succeeded(hResult))
+		{
+			// Most likely AUDCLNT_E_DEVICE_INVALIDATED, look again next time
+			endpoint.drop_manager();
+			endpointsStale.store(true, std::memory_order_relaxed);
+			return;
+		}
+
+		// Notifications only start after the first enumeration. They're
+		//   delivered to the MTA, without them the sessions are enumerated
+		//   on every scan.
+		if (!endpoint.notification && in_mta())
+		{
+			// Starts out stale, so the next scan catches the sessions created
+			//   before it was registered
+			ComPtr<SessionNotificationClient> client(new SessionNotificationClient(this, scanQueued));
+			if (com_succeeded(endpoint.manager->RegisterSessionNotification(client.get())))
+				endpoint.notification = std::move(client);
+		}
+
+		int sessionCount;
+		// Really, don't EVER trust ANYTHING!
+		hResult = iAudioSessEnum->GetCount(&sessionCount);
+		if (!com_succeeded(hResult))
+			return;
+		std::vector<TrackedSession> old;
+		old.swap(endpoint.sessions);
+		std::vector<std::wstring> oldIgnored;
+		oldIgnored.swap(endpoint.ignored);
+		for (int j = 0; j < sessionCount; ++j)
+		{
+			ComPtr<IAudioSessionControl> iAudioSessCtrl;
+			hResult = COM_CALL(CALL_GET_SESSION, iAudioSessEnum->GetSession(j, iAudioSessCtrl.put()));
+			if (!com_succeeded(hResult))
+				continue;
+
+			ComPtr<IAudioSessionControl2> iAudioSessCtrl2;
+			hResult = iAudioSessCtrl.query(IID_IAudioSessionControl2, iAudioSessCtrl2);
+			if (!com_succeeded(hResult))
+				continue;
+
+			UniqueCoTaskMemString instanceIdString;
+			hResult = COM_CALL(CALL_GET_INSTANCE_ID, iAudioSessCtrl2->GetSessionInstanceIdentifier(instanceIdString.put()));
+			if (!com_succeeded(hResult))
+				continue;
+			std::wstring instanceId(instanceIdString.get());
+
+			std::vector<TrackedSession>::iterator tracked = std::find_if(old.begin(), old.end(), [&instanceId](TrackedSession const& session) { return session.instanceId == instanceId; });
+			if (tracked != old.end())
+			{
+				endpoint.sessions.push_back(std::move(*tracked));
+				continue;
+			}
+			if (std::find(oldIgnored.begin(), oldIgnored.end(), instanceId) != oldIgnored.end())
+			{
+				endpoint.ignored.push_back(std::move(instanceId));
+				continue;
+			}
+
+			DWORD processId;
+			hResult = COM_CALL(CALL_GET_PROCESS_ID, iAudioSessCtrl2->GetProcessId(&processId));
+			if (!com_succeeded(hResult))
+				continue;
+
+			// A process that can't be opened, like the system sounds' or an
+			//   elevated one, won't be opened on the next scan either
+			std::string processName(process_name(processId));
+			if (processName.empty() || processNames.find(processName) == processNames.end())
+			{
+				endpoint.ignored.push_back(std::move(instanceId));
+				continue;
+			}
+
+			TrackedSession session(instanceId, std::move(iAudioSessCtrl2), processId, std::move(processName));
+			if (com_succeeded(session.control.query(IID_ISimpleAudioVolume, session.volume)) && endpoint.enumerated)
+				restore(session);
+			if (timeline_recording())
+			{
+				float volume = 0.f;
+				if (session.volume)
+					COM_CALL(CALL_GET_MASTER_VOLUME, session.volume->GetMasterVolume(&volume));
+				timeline_session_added(session.processName, volume);
+			}
+			// Registered before asking for the state, so no change gets lost
+			//   in between
+			ComPtr<SessionEventsClient> events(new SessionEventsClient());
+			if (com_succeeded(COM_CALL(CALL_REGISTER_SESSION_EVENTS, session.control->RegisterAudioSessionNotification(events.get()))))
+			{
+				AudioSessionState state;
+				if (SUCCEEDED(session.control->GetState(&state)))
+					events->state.store(state, std::memory_order_relaxed);
+				session.events = std::move(events);
+			}
+			endpoint.sessions.push_back(std::move(session));
+		}
+		endpoint.enumerated = true;
+		// The ones taken over were moved out
+		if (timeline_recording())
+			for (std::vector<TrackedSession>::const_iterator start = old.begin(), end = old.end(); start != end; ++start)
+				if (start->control)
+					timeline_session_removed(start->processName);
+	}
+
+	// Gives a player that started again the state it was last set to
+	static void restore(TrackedSession& session)
+	{
+		VolumeSnapshotEntry entry;
+		if (!volume_snapshot_lookup(session.processName, entry))
+			return;
+		if (entry.flags & VolumeSnapshotEntry::HAS_VOLUME)
+			com_succeeded(COM_CALL(CALL_SET_MASTER_VOLUME, session.volume->SetMasterVolume(entry.volume, NULL)));
+		if (entry.flags & VolumeSnapshotEntry::HAS_MUTE)
+			com_succeeded(COM_CALL(CALL_SET_MUTE, session.volume->SetMute((entry.flags & VolumeSnapshotEntry::MUTED) != 0, NULL)));
+	}
+
+	// Runs on the scan workers as well, nothing shared but the endpoint
+	//   (which belongs to one worker) and the stale flag may be written here
+	void scan_endpoint(Endpoint& endpoint, SessionIndex& out)
+	{
+		if (endpoint.sessions_stale())
+			enumerate_sessions(endpoint);
+		for (std::vector<TrackedSession>::iterator start = endpoint.sessions.begin(), end = endpoint.sessions.end(); start != end; ++start)
+			if (start->state() != AudioSessionStateExpired)
+				out.push_back(&*start);
+	}
+
+	// Adds an endpoint to the new table, taking the session manager and the
+	//   tracked sessions over from the old one if it was there already
+	static void keep_endpoint(std::vector<Endpoint>& table, std::vector<Endpoint>& old, ComPtr<IMMDevice>&& device)
+	{
+		UniqueCoTaskMemString idString;
+		if (!com_succeeded(device->GetId(idString.put())))
+			return;
+		std::wstring id(idString.get());
+		for (std::vector<Endpoint>::iterator start = old.begin(), end = old.end(); start != end; ++start)
+			if (start->id == id && start->device)
+			{
+				start->device = std::move(device);
+				table.push_back(std::move(*start));
+				return;
+			}
+		table.push_back(Endpoint(std::move(id), std::move(device)));
+	}
+
+	// Resolves the endpoints in scope
+	bool update_endpoints()
+	{
+		HRESULT hResult;
+
+		if (!iMMDevEnum)
+		{
+			hResult = COM_CALL(CALL_CREATE_DEVICE_ENUMERATOR, CoCreateInstance(CLSID_MMDeviceEnumerator, NULL, CLSCTX_ALL, IID_IMMDeviceEnumerator, iMMDevEnum.put_void()));
+			if (!com_succeeded(hResult))
+			{
+				ShowErrorMessage(hResult, _T("CoCreateInstance[IMMDeviceEnumerator] error"));
+				return false;
+			}
+			// Without notifications the table is resolved again on every scan
+			ComPtr<EndpointNotificationClient> client(new EndpointNotificationClient(endpointsStale));
+			if (com_succeeded(iMMDevEnum->RegisterEndpointNotificationCallback(client.get())))
+				notificationClient = std::move(client);
+		}
+
+		// Cleared first, a notification coming in while resolving leaves it set
+		endpointsStale.store(!notificationClient, std::memory_order_relaxed);
+		std::vector<Endpoint> old;
+		old.swap(endpoints);
+
+		switch (endpointScope)
+		{
+		case ENDPOINTS_DEFAULT:
+			{
+				ComPtr<IMMDevice> iMMDevice;
+				hResult = COM_CALL(CALL_GET_DEFAULT_ENDPOINT, iMMDevEnum->GetDefaultAudioEndpoint(eRender, eMultimedia, iMMDevice.put()));
+				// No render device at all isn't an error
+				if (hResult == HRESULT_FROM_WIN32(ERROR_NOT_FOUND))
+					break;
+				if (!com_succeeded(hResult))
+				{
+					ShowErrorMessage(hResult, _T("IMMDeviceEnumerator::GetDefaultAudioEndpoint error"));
+					endpointsStale.store(true, std::memory_order_relaxed);
+					return false;
+				}
+				keep_endpoint(endpoints, old, std::move(iMMDevice));
+			}
+			break;
+		case ENDPOINTS_LIST:
+			// Configured devices that are gone or disabled are skipped
+			for (std::vector<std::wstring>::const_iterator start = endpointIds.begin(), end = endpointIds.end(); start != end; ++start)
+			{
+				ComPtr<IMMDevice> iMMDevice;
+				DWORD state;
+				if (SUCCEEDED(COM_CALL(CALL_GET_DEVICE, iMMDevEnum->GetDevice(start->c_str(), iMMDevice.put()))) && SUCCEEDED(iMMDevice->GetState(&state)) && state == DEVICE_STATE_ACTIVE)
+					keep_endpoint(endpoints, old, std::move(iMMDevice));
+			}
+			break;
+		case ENDPOINTS_ALL:
+		default:
+			{
+				ComPtr<IMMDeviceCollection> iMMDevColl;
+				hResult = COM_CALL(CALL_ENUM_ENDPOINTS, iMMDevEnum->EnumAudioEndpoints(eRender, DEVICE_STATE_ACTIVE, iMMDevColl.put()));
+				if (!com_succeeded(hResult))
+				{
+					ShowErrorMessage(hResult, _T("IMMDeviceEnumerator::EnumAudioEndpoints error"));
+					endpointsStale.store(true, std::memory_order_relaxed);
+					return false;
+				}
+
+				UINT deviceCount;
+				// Never trust anything
+				hResult = iMMDevColl->GetCount(&deviceCount);
+				if (!com_succeeded(hResult))
+				{
+					ShowErrorMessage(hResult, _T("IMMDeviceCollection::GetCount error"));
+					endpointsStale.store(true, std::memory_order_relaxed);
+					return false;
+				}
+				endpoints.reserve(deviceCount);
+				for (UINT i = 0; i < deviceCount; ++i)
+				{
+					ComPtr<IMMDevice> iMMDevice;
+					if (com_succeeded(iMMDevColl->Item(i, iMMDevice.put())))
+						keep_endpoint(endpoints, old, std::move(iMMDevice));
+				}
+			}
+			break;
+		}
+		timeline_devices_changed((unsigned int)endpoints.size());
+		return true;
+	}
+
+	bool scan_sessions(SessionIndex& index)
+	{
+		if (endpointsStale.load(std::memory_order_acquire))
+		{
+			++sessionGeneration;
+			if (!update_endpoints())
+				return false;
+		}
+
+		// Threads are only worth it for enumerating, tracked sessions are
+		//   just collected
+		size_t staleEndpoints = std::count_if(endpoints.begin(), endpoints.end(), [](Endpoint const& endpoint) { return endpoint.sessions_stale(); });
+		if (staleEndpoints != 0)
+			++sessionGeneration;
+		if (scanMode == SCAN_PARALLEL && staleEndpoints > 1 && in_mta())
+		{
+			std::vector<SessionIndex> parts;
+			parallel_scan<MtaApartment>((unsigned int)endpoints.size(), parts, [this](unsigned int i, SessionIndex& part)
+			{
+				scan_endpoint(endpoints[i], part);
+			});
+			for (std::vector<SessionIndex>::iterator start = parts.begin(), end = parts.end(); start != end; ++start)
+				std::move(start->begin(), start->end(), std::back_inserter(index));
+		}
+		else
+			for (std::vector<Endpoint>::iterator start = endpoints.begin(), end = endpoints.end(); start != end; ++start)
+				scan_endpoint(*start, index);
+		return true;
+	}
+
+	// Whether a scan would only collect what's tracked already
+	bool sessions_current() const
+	{
+		return !endpointsStale.load(std::memory_order_acquire) && std::none_of(endpoints.begin(), endpoints.end(), [](Endpoint const& endpoint) { return endpoint.sessions_stale(); });
+	}
+
+	// The foreground process's sessions that haven't expired. Which those are
+	//   is only looked up again once the foreground or the sessions changed.
+	bool route_to_foreground(DWORD processId, SessionIndex& index)
+	{
+		if (processId != routedProcessId || routedGeneration != sessionGeneration)
+		{
+			routedSessions.clear();
+			for (std::vector<Endpoint>::iterator endpoint = endpoints.begin(), endpointsEnd = endpoints.end(); endpoint != endpointsEnd; ++endpoint)
+				for (std::vector<TrackedSession>::iterator start = endpoint->sessions.begin(), end = endpoint->sessions.end(); start != end; ++start)
+					if (start->processId == processId)
+						routedSessions.push_back(&*start);
+			routedProcessId = processId;
+			routedGeneration = sessionGeneration;
+		}
+		index.clear();
+		for (std::vector<TrackedSession*>::const_iterator start = routedSessions.begin(), end = routedSessions.end(); start != end; ++start)
+			if ((*start)->state() != AudioSessionStateExpired)
+				index.push_back(*start);
+		return !index.empty();
+	}
+
+	// Asks the session's meter, only done for the sessions that are active
+	static bool audible(TrackedSession* session)
+	{
+		float peak;
+		if (!session->meter && !com_succeeded(session->control.query(IID_IAudioMeterInformation, session->meter)))
+			return false;
+		return com_succeeded(COM_CALL(CALL_GET_PEAK_VALUE, session->meter->GetPeakValue(&peak))) && peak > 0.f;
+	}
+
+	static bool active(TrackedSession* session)
+	{
+		return session->state() == AudioSessionStateActive;
+	}
+
+	// Moves the sessions passing pred to the front, in order, and returns
+	//   their end. Unlike std::stable_partition it never takes a buffer; the
+	//   order of the rest is lost, it's either dropped or left untouched.
+	template<typename Predicate>
+	static SessionIndex::iterator keep_front(SessionIndex::iterator first, SessionIndex::iterator last, Predicate pred)
+	{
+		SessionIndex::iterator keep = first;
+		for (; first != last; ++first)
+			if (pred(*first))
+				std::iter_swap(keep++, first);
+		return keep;
+	}
+
+	// Keeps the sessions passing the filter, or the ones passing the next
+	//   looser one if none do. A key pressed while the player is paused
+	//   still has to do something.
+	static void narrow_sessions(SessionIndex& index, SessionFilter filter)
+	{
+		SessionIndex::iterator keep = keep_front(index.begin(), index.end(), active);
+		if (keep == index.begin())
+			return;
+		if (filter == SESSIONS_AUDIBLE)
+		{
+			SessionIndex::iterator audibleEnd = keep_front(index.begin(), keep, audible);
+			if (audibleEnd != index.begin())
+				keep = audibleEnd;
+		}
+		index.erase(keep, index.end());
+	}
+
+	// With ROUTE_FOREGROUND only the sessions of the foreground process if
+	//   it has any, without a scan if nothing changed since the last one.
+	//   scanned is a scan just done to take instead, another one could move
+	//   the sessions it points to.
+	bool collect_sessions(SessionIndex& index, SessionFilter filter, SessionRouting routing, SessionIndex const* scanned = NULL)
+	{
+		index.clear();
+		DWORD foreground = routing == ROUTE_FOREGROUND ? foreground_process_id() : 0;
+		if (!(foreground && (scanned || sessions_current()) && route_to_foreground(foreground, index)))
+		{
+			if (scanned)
+				index.assign(scanned->begin(), scanned->end());
+			else if (!scan_sessions(index))
+				return false;
+			SessionIndex routed;
+			if (foreground && route_to_foreground(foreground, routed))
+				index.swap(routed);
+		}
+		if (filter != SESSIONS_ALL)
+			narrow_sessions(index, filter);
+		return true;
+	}
+
+	template<typename UnaryFunction>
+	bool apply_to_all(UnaryFunction f, SessionFilter filter = SESSIONS_ALL, SessionRouting routing = ROUTE_ALL)
+	{
+		if (!collect_sessions(commandSessions, filter, routing))
+			return false;
+		for (SessionIndex::iterator start = commandSessions.begin(), end = commandSessions.end(); start != end; ++start)
+			f(**start);
+		return true;
+	}
+
+	// The fade thread writes the volume interfaces from the MTA, they can
+	//   only be handed to it when they were made there
+	FadeSink* fader()
+	{
+		return in_mta() ? this : NULL;
+	}
+
+	virtual void fade_write(FadeWrite const* writes, unsigned int count)
+	{
+		for (FadeWrite const* end = writes + count; writes != end; ++writes)
+			com_succeeded(COM_CALL(CALL_SET_MASTER_VOLUME, static_cast<ISimpleAudioVolume*>(writes->key)->SetMasterVolume(writes->volume, NULL)));
+	}
+
+	// Starts or retargets the session's fade, false if the caller has to
+	//   write the volume itself
+	static bool fade_session(FadeSink* fader, TrackedSession& session, float from, float to, unsigned int durationMs)
+	{
+		if (!fader || !fade_to(fader, session.volume.get(), from, to, durationMs))
+			return false;
+		session.fader = fader;
+		return true;
+	}
+
+	// Runs a batch's commands on each session it's called with
+	class ApplyBatch
+	{
+	private:
+		VolumeCommand const* commands;
+		size_t count;
+		VOLUME_CHANGE_STATUS* statuses;
+		// Sorted, the sessions the keyed commands go to
+		SessionIndex const& keySessions;
+		// NULL for jumping to the new volume
+		FadeSink* fader;
+		unsigned int stepDurationMs;
+
+		bool matches(TrackedSession& session, VolumeCommand const& command) const
+		{
+			if (command.keyed())
+				return std::binary_search(keySessions.begin(), keySessions.end(), &session);
+			return command.target.empty() || utf8_iequal(command.target, session.processName);
+		}
+
+		void change_volume(TrackedSession& session, float delta, unsigned int presses)
+		{
+			// Presses during a fade move its target, so they add up
+			float target;
+			if (fader && stepDurationMs && fade_add(fader, session.volume.get(), delta, stepDurationMs, &target, SCALE_AMPLITUDE, presses))
+			{
+				volume_snapshot_record_volume(session.processName, target);
+				return;
+			}
+			float volume;
+			if (!com_succeeded(COM_CALL(CALL_GET_MASTER_VOLUME, session.volume->GetMasterVolume(&volume))))
+				return;
+			target = volume_step_target(volume, delta, SCALE_AMPLITUDE, presses);
+			if (!(stepDurationMs && fade_session(fader, session, volume, target, stepDurationMs)))
+				com_succeeded(COM_CALL(CALL_SET_MASTER_VOLUME, session.volume->SetMasterVolume(target, NULL)));
+			volume_snapshot_record_volume(session.processName, target);
+		}
+		static void set_mute(TrackedSession& session, bool mute)
+		{
+			if (com_succeeded(COM_CALL(CALL_SET_MUTE, session.volume->SetMute(mute, NULL))))
+				volume_snapshot_record_mute(session.processName, mute);
+		}
+	public:
+		ApplyBatch(VolumeCommand const* commands, size_t count, VOLUME_CHANGE_STATUS* statuses, SessionIndex const& keySessions, FadeSink* fader) : commands(commands), count(count), statuses(statuses), keySessions(keySessions), fader(fader), stepDurationMs(fade_step_duration()) { }
+
+		void operator()(TrackedSession& session)
+		{
+			for (size_t i = 0; i < count; ++i)
+			{
+				VolumeCommand const& command = commands[i];
+				if (!matches(session, command))
+					continue;
+				statuses[i] = STATUS_FOUND;
+				if (!session.volume)
+					continue;
+				float volume = std::min<float>(std::max<float>(command.value, 0.f), 1.f);
+				BOOL mute;
+				switch (command.op)
+				{
+				case VolumeCommand::CHANGE:
+					change_volume(session, command.value, command.presses);
+					break;
+				case VolumeCommand::TOGGLE_MUTE:
+					if (com_succeeded(COM_CALL(CALL_GET_MUTE, session.volume->GetMute(&mute))))
+						set_mute(session, !mute);
+					break;
+				case VolumeCommand::FADE:
+					{
+						float from;
+						if (com_succeeded(COM_CALL(CALL_GET_MASTER_VOLUME, session.volume->GetMasterVolume(&from))) && fade_session(fader, session, from, volume, command.duration))
+						{
+							volume_snapshot_record_volume(session.processName, volume);
+							break;
+						}
+					}
+					// Fall through - jumping there instead
+				case VolumeCommand::SET_VOLUME:
+					// Or the fade would carry on from here
+					if (session.fader)
+						fade_cancel(session.fader, session.volume.get());
+					if (com_succeeded(COM_CALL(CALL_SET_MASTER_VOLUME, session.volume->SetMasterVolume(volume, NULL))))
+						volume_snapshot_record_volume(session.processName, volume);
+					break;
+				case VolumeCommand::SET_MUTE:
+					set_mute(session, command.value != 0.f);
+					break;
+				}
+			}
+		}
+	};
+
+	// The keyed commands' sessions are looked up like a key press does, the
+	//   other commands' in every tracked session, each session is then
+	//   visited once
+	virtual void apply_batch(VolumeCommand const* commands, size_t count, VOLUME_CHANGE_STATUS* statuses)
+	{
+		bool keyed = false, targeted = false;
+		for (size_t i = 0; i < count; ++i)
+			(commands[i].keyed() ? keyed : targeted) = true;
+		commandSessions.clear();
+		batchSessions.clear();
+		if ((targeted && !scan_sessions(batchSessions)) || (keyed && !collect_sessions(commandSessions, sessionFilter, sessionRouting, targeted ? &batchSessions : NULL)))
+		{
+			std::fill(statuses, statuses + count, STATUS_ERROR);
+			return;
+		}
+		std::fill(statuses, statuses + count, STATUS_NOT_FOUND);
+		std::sort(commandSessions.begin(), commandSessions.end());
+		ApplyBatch batch(commands, count, statuses, commandSessions, fader());
+		SessionIndex& index = targeted ? batchSessions : commandSessions;
+		for (SessionIndex::iterator start = index.begin(), end = index.end(); start != end; ++start)
+			batch(**start);
+	}
+
+	class GetVolume
+	{
+	private:
+		target_type const& target;
+	public:
+		float volume;
+		bool mute;
+		MediaPlayerVolumeControlProvider::VOLUME_CHANGE_STATUS status;
+
+		GetVolume(target_type const& target) : target(target), volume(), mute(), status(STATUS_NOT_FOUND) { }
+
+		void operator()(TrackedSession& session)
+		{
+			if ((!target.empty() && !utf8_iequal(target, session.processName)) || status == STATUS_FOUND)
+				return;
+			status = STATUS_FOUND;
+			if (!session.volume)
+				return;
+			BOOL b = FALSE;
+			COM_CALL(CALL_GET_MASTER_VOLUME, session.volume->GetMasterVolume(&volume));
+			COM_CALL(CALL_GET_MUTE, session.volume->GetMute(&b));
+			mute = !!b;
+		}
+	};
+
+	virtual VOLUME_CHANGE_STATUS get_target_volume(target_type const& target, float& volume, bool& muted)
+	{
+		GetVolume gv(target);
+		if (!apply_to_all<GetVolume&>(gv))
+			return STATUS_ERROR;
+		volume = gv.volume;
+		muted = gv.mute;
+		return gv.status;
+	}
+
+	class ListTargets
+	{
+	private:
+		std::vector<TargetState>& out;
+	public:
+		ListTargets(std::vector<TargetState>& out) : out(out) { }
+
+		void operator()(TrackedSession& session)
+		{
+			ComPtr<ISimpleAudioVolume> const& iAudioVolume = session.volume;
+			if (!iAudioVolume)
+				return;
+			TargetState state = { session.processName, 0.f, false };
+			BOOL b = FALSE;
+			COM_CALL(CALL_GET_MASTER_VOLUME, iAudioVolume->GetMasterVolume(&state.volume));
+			COM_CALL(CALL_GET_MUTE, iAudioVolume->GetMute(&b));
+			state.muted = !!b;
+			out.push_back(state);
+		}
+	};
+
+	virtual void list_targets(std::vector<TargetState>& out)
+	{
+		ListTargets lt(out);
+		apply_to_all<ListTargets&>(lt);
+	}
+
+	// Creates the device enumerator and tracks the sessions there are, so
+	//   the first key press only collects them
+	virtual void prepare()
+	{
+		// A session created from here on queues another scan
+		scanQueued.store(false, std::memory_order_release);
+		commandSessions.clear();
+		scan_sessions(commandSessions);
+		commandSessions.reserve(16);
+	}
+};
+
+static AudioSesionInterfaceVolumeControlProvider* audioSessionProvider = NULL;
+
+void audio_session_add_provider(std::vector<std::string> const& processNames)
+{
+	audioSessionProvider = new AudioSesionInterfaceVolumeControlProvider();
+	for (std::vector<std::string>::const_iterator start = processNames.begin(), end = processNames.end(); start != end; ++start)
+		audioSessionProvider->register_process_name(*start);
+	add_volume_control(audioSessionProvider);
+}
+
+void audio_session_set_endpoints(EndpointScope scope, std::string const& ids)
+{
+	if (!audioSessionProvider)
+		return;
+	// Converted here once, the scans compare them with IMMDevice::GetId
+	std::vector<std::wstring> list;
+	std::string::size_type pos = 0, sep;
+	do {
+		sep = ids.find(',', pos);
+		std::string_view item(std::string_view(ids).substr(pos, sep == std::string::npos ? std::string::npos : sep - pos));
+		std::string_view::size_type first = item.find_first_not_of(' '), last = item.find_last_not_of(' ');
+		if (first != std::string_view::npos)
+			list.push_back(utf8_to_wide(item.substr(first, last - first + 1)));
+		pos = sep + 1;
+	} while (sep != std::string::npos);
+	audioSessionProvider->set_endpoints(scope, list);
+}
+
+void audio_session_set_session_filter(SessionFilter filter)
+{
+	if (audioSessionProvider)
+		audioSessionProvider->set_session_filter(filter);
+}
+
+void audio_session_set_routing(SessionRouting routing)
+{
+	if (audioSessionProvider)
+		audioSessionProvider->set_session_routing(routing);
+}
@@ -0,0 +1,57 @@
+#pragma once
+#ifndef __AUDIO_SESSION_VOLUME_CONTROL_HPP__
+#define __AUDIO_SESSION_VOLUME_CONTROL_HPP__
+
+#include "unicode.h"
+
+#include <tchar.h>
+
+#include <string>
+#include <vector>
+
+// Which render endpoints the audio session provider looks for sessions on
+enum EndpointScope
+{
+	// The default multimedia device, followed when it changes
+	ENDPOINTS_DEFAULT = 0,
+	// The devices in the configured list that are active
+	ENDPOINTS_LIST = 1,
+	// Every active device
+	ENDPOINTS_ALL = 2
+};
+
+// Which of the sessions the volume keys act on. If none pass, the next
+//   looser filter is used.
+enum SessionFilter
+{
+	SESSIONS_ALL = 0,
+	// Sessions that are playing, not paused, stopped or expired
+	SESSIONS_ACTIVE = 1,
+	// Active sessions whose peak meter isn't at zero
+	SESSIONS_AUDIBLE = 2
+};
+
+// Which player the volume keys go to
+enum SessionRouting
+{
+	// Every registered player
+	ROUTE_ALL = 0,
+	// The player in the foreground window if it has a session, every
+	//   registered player otherwise. Needs foreground_tracking_start.
+	ROUTE_FOREGROUND = 1
+};
+
+// Creates the provider for the sessions of the processNames (executable file
+//   names like wmplayer.exe) and adds it to the volume controls. The
+//   functions below do nothing without it.
+void audio_session_add_provider(std::vector<std::string> const& processNames);
+
+// ids is a comma separated list of endpoint ids (IMMDevice::GetId, e.g.
+//   {0.0.0.00000000}.{...}), only used with ENDPOINTS_LIST. Has to be called
+//   before the dispatcher starts.
+void audio_session_set_endpoints(EndpointScope scope, std::string const& ids);
+// Has to be called before the dispatcher starts as well
+void audio_session_set_session_filter(SessionFilter filter);
+void audio_session_set_routing(SessionRouting routing);
+
+#endif // __AUDIO_SESSION_VOLUME_CONTROL_HPP__
@@ -15,7 +15,8 @@
 #include <vector>
 
 #include "resource.h"
-#include "auto_cleanup.hpp"
+#include "handles.hpp"
+#include "call_stats.hpp"
 #include "errors.hpp"
 #include "autorun_task.hpp"
 
@@ -24,10 +25,9 @@ static BSTR cachedUserName = NULL;
 
 BSTR get_user_name_bstr()
 {
-	static BSTR cached_username = NULL;
-	static AutoDeleter<BSTR&, void (STDAPICALLTYPE *)(BSTR)> cached_username_deleter(cached_username, SysFreeString);
-	if (cached_username != NULL)
-		return cached_username;
+	static UniqueBstr cached_username;
+	if (cached_username)
+		return cached_username.get();
 
 	ULONG len = 64;
 	std::vector<OLECHAR> username_vect(len);
@@ -45,15 +45,15 @@ BSTR get_user_name_bstr()
 			return NULL;
 		} while (false);
 
-	return cached_username = SysAllocStringLen(&username_vect[0], len);
+	cached_username.reset(SysAllocStringLen(&username_vect[0], len));
+	return cached_username.get();
 }
 
 BSTR get_exe_file_name_bstr()
 {
-	static BSTR cached_filename = NULL;
-	static AutoDeleter<BSTR&, void (STDAPICALLTYPE *)(BSTR)> cached_filename_deleter(cached_filename, SysFreeString);
-	if (cached_filename != NULL)
-		return cached_filename;
+	static UniqueBstr cached_filename;
+	if (cached_filename)
+		return cached_filename.get();
 
 	std::vector<WCHAR> filename_vect(MAX_PATH + 1);
 	DWORD len = GetModuleFileNameW(NULL, &filename_vect[0], MAX_PATH + 1);
@@ -63,31 +63,32 @@ BSTR get_exe_file_name_bstr()
 	else if (len == MAX_PATH + 1 && GetLastError() == ERROR_INSUFFICIENT_BUFFER)
 		ShowErrorMessage(ERROR_INSUFFICIENT_BUFFER, _T("GetModuleFileNameW error"));
 	else
-		return cached_filename = SysAllocStringLen(&filename_vect[0], len);
+	{
+		cached_filename.reset(SysAllocStringLen(&filename_vect[0], len));
+		return cached_filename.get();
+	}
 	return NULL;
 }
 
-bool create_logon_task(ITaskService* iTaskScheduler, ITaskFolder* iTaskFolder, IRegisteredTask*& out)
+bool create_logon_task(ITaskService* iTaskScheduler, ITaskFolder* iTaskFolder, ComPtr<IRegisteredTask>& out)
 {
-	ITaskDefinition* iAutorunTaskDefinition;
-	HRESULT hResult = iTaskScheduler->NewTask(0, &iAutorunTaskDefinition);
+	ComPtr<ITaskDefinition> iAutorunTaskDefinition;
+	HRESULT hResult = COM_CALL(CALL_TASK_NEW_TASK, iTaskScheduler->NewTask(0, iAutorunTaskDefinition.put()));
 	if (!SUCCEEDED(hResult))
 	{
 		ShowErrorMessage(hResult, _T("ITaskService::NewTask error"));
 		return false;
 	}
-	AutoReleaser<ITaskDefinition> iAutorunTaskDefinitionReleaser(iAutorunTaskDefinition);
 
 	BSTR tmp;
 	{
-		IRegistrationInfo* iAutorunRegistrationInfo;
-		hResult = iAutorunTaskDefinition->get_RegistrationInfo(&iAutorunRegistrationInfo);
+		ComPtr<IRegistrationInfo> iAutorunRegistrationInfo;
+		hResult = iAutorunTaskDefinition->get_RegistrationInfo(iAutorunRegistrationInfo.put());
 		if (!SUCCEEDED(hResult))
 		{
 			ShowErrorMessage(hResult, _T("IRegistrationInfo::get_RegistrationInfo error"));
 			return false;
 		}
-		AutoReleaser<IRegistrationInfo> iAutorunRegistrationInfoReleaser(iAutorunRegistrationInfo);
 
 		tmp = SysAllocString(OLESTR("Torge Matthies"));
 		iAutorunRegistrationInfo->put_Author(tmp);
@@ -108,36 +109,33 @@ bool create_logon_task(ITaskService* iTaskScheduler, ITaskFolder* iTaskFolder, I
 
 	VARIANT username;
 	{
-		ITriggerCollection* iTriggers;
-		hResult = iAutorunTaskDefinition->get_Triggers(&iTriggers);
+		ComPtr<ITriggerCollection> iTriggers;
+		hResult = iAutorunTaskDefinition->get_Triggers(iTriggers.put());
 		if (!SUCCEEDED(hResult))
 		{
 			ShowErrorMessage(hResult, _T("ITaskDefinition::get_Triggers error"));
 			return false;
 		}
-		AutoReleaser<ITriggerCollection> iAutorunTriggersReleaser(iTriggers);
 
-		ITrigger* iAutorunTrigger;
-		hResult = iTriggers->Create(TASK_TRIGGER_LOGON, &iAutorunTrigger);
+		ComPtr<ITrigger> iAutorunTrigger;
+		hResult = iTriggers->Create(TASK_TRIGGER_LOGON, iAutorunTrigger.put());
 		if (!SUCCEEDED(hResult))
 		{
 			ShowErrorMessage(hResult, _T("ITriggerCollection::Create error"));
 			return false;
 		}
-		AutoReleaser<ITrigger> iAutorunTriggerReleaser(iAutorunTrigger);
 
 		tmp = SysAllocString(OLESTR("Logon"));
 		iAutorunTrigger->put_Id(tmp);
 		SysFreeString(tmp);
 
-		ILogonTrigger* iLogonTrigger;
-		iAutorunTrigger->QueryInterface(IID_ILogonTrigger, (void**)&iLogonTrigger);
+		ComPtr<ILogonTrigger> iLogonTrigger;
+		hResult = iAutorunTrigger.query(IID_ILogonTrigger, iLogonTrigger);
 		if (!SUCCEEDED(hResult))
 		{
 			ShowErrorMessage(hResult, _T("ITrigger::QueryInterface[ILogonTrigger] error"));
 			return false;
 		}
-		AutoReleaser<ILogonTrigger> iLogonTriggerReleaser(iLogonTrigger);
 
 		if (!(username.bstrVal = get_user_name_bstr()))
 			return false;
@@ -146,36 +144,33 @@ bool create_logon_task(ITaskService* iTaskScheduler, ITaskFolder* iTaskFolder, I
 	}
 
 	{
-		IActionCollection* iActions;
-		hResult = iAutorunTaskDefinition->get_Actions(&iActions);
+		ComPtr<IActionCollection> iActions;
+		hResult = iAutorunTaskDefinition->get_Actions(iActions.put());
 		if (!SUCCEEDED(hResult))
 		{
 			ShowErrorMessage(hResult, _T("ITaskDefinition::get_Actions error"));
 			return false;
 		}
-		AutoReleaser<IActionCollection> iActionsReleaser(iActions);
 
-		IAction* iAction;
-		hResult = iActions->Create(TASK_ACTION_EXEC, &iAction);
+		ComPtr<IAction> iAction;
+		hResult = iActions->Create(TASK_ACTION_EXEC, iAction.put());
 		if (!SUCCEEDED(hResult))
 		{
 			ShowErrorMessage(hResult, _T("IActionCollection::Create error"));
 			return false;
 		}
-		AutoReleaser<IAction> iActionReleaser(iAction);
 
 		tmp = SysAllocString(OLESTR("Start mpVolCtrl"));
 		iAction->put_Id(tmp);
 		SysFreeString(tmp);
 
-		IExecAction* iExecAction;
-		hResult = iAction->QueryInterface(IID_IExecAction, (void**)&iExecAction);
+		ComPtr<IExecAction> iExecAction;
+		hResult = iAction.query(IID_IExecAction, iExecAction);
 		if (!SUCCEEDED(hResult))
 		{
 			ShowErrorMessage(hResult, _T("IAction::QueryInterface[IID_IExecAction] error"));
 			return false;
 		}
-		AutoReleaser<IExecAction> iExecActionReleaser(iExecAction);
 
 		if (!(tmp = get_exe_file_name_bstr()))
 			return false;
@@ -188,14 +183,13 @@ bool create_logon_task(ITaskService* iTaskScheduler, ITaskFolder* iTaskFolder, I
 	}
 
 	{
-		ITaskSettings* iSettings;
-		hResult = iAutorunTaskDefinition->get_Settings(&iSettings);
+		ComPtr<ITaskSettings> iSettings;
+		hResult = iAutorunTaskDefinition->get_Settings(iSettings.put());
 		if (!SUCCEEDED(hResult))
 		{
 			ShowErrorMessage(hResult, _T("ITaskDefinition::get_Settings error"));
 			return false;
 		}
-		AutoReleaser<ITaskSettings> iSettingsReleaser(iSettings);
 
 		hResult = iSettings->put_DisallowStartIfOnBatteries(VARIANT_FALSE);
 		if (!SUCCEEDED(hResult))
@@ -226,7 +220,7 @@ bool create_logon_task(ITaskService* iTaskScheduler, ITaskFolder* iTaskFolder, I
 	}
 
 	tmp = SysAllocString(AUTORUN_TASK_NAME);
-	hResult = iTaskFolder->RegisterTaskDefinition(tmp, iAutorunTaskDefinition, TASK_CREATE, username, _variant_t(), TASK_LOGON_INTERACTIVE_TOKEN, _variant_t(OLESTR("")), &out);
+	hResult = COM_CALL(CALL_TASK_REGISTER, iTaskFolder->RegisterTaskDefinition(tmp, iAutorunTaskDefinition.get(), TASK_CREATE, username, _variant_t(), TASK_LOGON_INTERACTIVE_TOKEN, _variant_t(OLESTR("")), out.put()));
 	SysFreeString(tmp);
 	if (SUCCEEDED(hResult))
 		return true;
@@ -236,23 +230,21 @@ bool create_logon_task(ITaskService* iTaskScheduler, ITaskFolder* iTaskFolder, I
 
 bool validate_autorun_task(ITaskFolder* iTaskFolder, IRegisteredTask* iAutorunTask)
 {
-	ITaskDefinition* iAutorunTaskDefinition;
-	HRESULT hResult = iAutorunTask->get_Definition(&iAutorunTaskDefinition);
+	ComPtr<ITaskDefinition> iAutorunTaskDefinition;
+	HRESULT hResult = iAutorunTask->get_Definition(iAutorunTaskDefinition.put());
 	if (!SUCCEEDED(hResult))
 	{
 		ShowErrorMessage(hResult, _T("ITaskDefinition::get_Definition error"));
 		return false;
 	}
-	AutoReleaser<ITaskDefinition> iAutorunTaskDefinitionReleaser(iAutorunTaskDefinition);
 
-	IActionCollection* iActions;
-	hResult = iAutorunTaskDefinition->get_Actions(&iActions);
+	ComPtr<IActionCollection> iActions;
+	hResult = iAutorunTaskDefinition->get_Actions(iActions.put());
 	if (!SUCCEEDED(hResult))
 	{
 		ShowErrorMessage(hResult, _T("ITaskDefinition::get_Actions error"));
 		return false;
 	}
-	AutoReleaser<IActionCollection> iActionsReleaser(iActions);
 
 	long count;
 	hResult = iActions->get_Count(&count);
@@ -263,14 +255,13 @@ bool validate_autorun_task(ITaskFolder* iTaskFolder, IRegisteredTask* iAutorunTa
 	}
 	for (long i = 1; i <= count; ++i)
 	{
-		IAction* iAction;
-		hResult = iActions->get_Item(i, &iAction);
+		ComPtr<IAction> iAction;
+		hResult = iActions->get_Item(i, iAction.put());
 		if (!SUCCEEDED(hResult))
 		{
 			ShowErrorMessage(hResult, _T("IActionCollection::get_Item error"));
 			return false;
 		}
-		AutoReleaser<IAction> iActionReleaser(iAction);
 
 		BSTR tmp;
 		hResult = iAction->get_Id(&tmp);
@@ -292,14 +283,13 @@ bool validate_autorun_task(ITaskFolder* iTaskFolder, IRegisteredTask* iAutorunTa
 		if (type != TASK_ACTION_EXEC)
 			continue;
 
-		IExecAction* iExecAction;
-		hResult = iAction->QueryInterface(IID_IExecAction, (void**)&iExecAction);
+		ComPtr<IExecAction> iExecAction;
+		hResult = iAction.query(IID_IExecAction, iExecAction);
 		if (!SUCCEEDED(hResult))
 		{
 			ShowErrorMessage(hResult, _T("IAction::QueryInterface error"));
 			return false;
 		}
-		AutoReleaser<IExecAction> iExecActionReleaser(iExecAction);
 
 		hResult = iExecAction->get_Path(&tmp);
 		if (!SUCCEEDED(hResult))
@@ -316,7 +306,7 @@ bool validate_autorun_task(ITaskFolder* iTaskFolder, IRegisteredTask* iAutorunTa
 			ShowErrorMessage(hResult, _T("IExecAction::put_Path error"));
 			return false;
 		}
-		hResult = iAutorunTaskDefinition->put_Actions(iActions);
+		hResult = iAutorunTaskDefinition->put_Actions(iActions.get());
 		if (!SUCCEEDED(hResult))
 		{
 			ShowErrorMessage(hResult, _T("ITaskDefinition::put_Actions error"));
@@ -326,7 +316,9 @@ bool validate_autorun_task(ITaskFolder* iTaskFolder, IRegisteredTask* iAutorunTa
 		VARIANT username;
 		username.vt = VT_BSTR;
 		username.bstrVal = get_user_name_bstr();
-		hResult = iTaskFolder->RegisterTaskDefinition(tmp, iAutorunTaskDefinition, TASK_UPDATE, username, _variant_t(), TASK_LOGON_INTERACTIVE_TOKEN, _variant_t(OLESTR("")), &iAutorunTask);
+		// The updated registration isn't needed, only the call's success
+		ComPtr<IRegisteredTask> iUpdatedTask;
+		hResult = COM_CALL(CALL_TASK_REGISTER, iTaskFolder->RegisterTaskDefinition(tmp, iAutorunTaskDefinition.get(), TASK_UPDATE, username, _variant_t(), TASK_LOGON_INTERACTIVE_TOKEN, _variant_t(OLESTR("")), iUpdatedTask.put()));
 		SysFreeString(tmp);
 		if (!SUCCEEDED(hResult))
 		{
@@ -339,16 +331,15 @@ bool validate_autorun_task(ITaskFolder* iTaskFolder, IRegisteredTask* iAutorunTa
 
 bool set_autorun_state(bool enabled)
 {
-	ITaskService* iTaskScheduler;
-	HRESULT hResult = CoCreateInstance(CLSID_TaskScheduler, NULL, CLSCTX_ALL, IID_ITaskService, (LPVOID*)&iTaskScheduler);
+	ComPtr<ITaskService> iTaskScheduler;
+	HRESULT hResult = COM_CALL(CALL_CREATE_TASK_SERVICE, CoCreateInstance(CLSID_TaskScheduler, NULL, CLSCTX_ALL, IID_ITaskService, iTaskScheduler.put_void()));
 	if (!SUCCEEDED(hResult))
 	{
 		ShowErrorMessage(hResult, _T("CoCreateInstance[ITaskService] error"));
 		return false;
 	}
-	AutoReleaser<ITaskService> iTaskSchedulerReleaser(iTaskScheduler);
 
-	hResult = iTaskScheduler->Connect(VARIANT(), VARIANT(), VARIANT(), VARIANT());
+	hResult = COM_CALL(CALL_TASK_CONNECT, iTaskScheduler->Connect(VARIANT(), VARIANT(), VARIANT(), VARIANT()));
 	if (!SUCCEEDED(hResult))
 	{
 		ShowErrorMessage(hResult, _T("ITaskService::Connect error"));
@@ -356,30 +347,31 @@ bool set_autorun_state(bool enabled)
 	}
 
 	BSTR tmp = SysAllocString(OLESTR("\\"));
-	ITaskFolder* iRootTaskFolder;
-	hResult = iTaskScheduler->GetFolder(tmp, &iRootTaskFolder);
+	ComPtr<ITaskFolder> iRootTaskFolder;
+	hResult = COM_CALL(CALL_TASK_GET_FOLDER, iTaskScheduler->GetFolder(tmp, iRootTaskFolder.put()));
 	SysFreeString(tmp);
 	if (!SUCCEEDED(hResult))
 	{
 		ShowErrorMessage(hResult, _T("ITaskService::GetFolder error"));
 		return false;
 	}
-	AutoReleaser<ITaskFolder> iRootTaskFolderReleaser(iRootTaskFolder);
 
-	IRegisteredTask* iAutorunTask;
+	ComPtr<IRegisteredTask> iAutorunTask;
 	tmp = SysAllocString((std::basic_string<OLECHAR>(OLESTR("\\")) += AUTORUN_TASK_NAME).c_str());
-	hResult = iRootTaskFolder->GetTask(tmp, &iAutorunTask);
-	AutoReleaser<IRegisteredTask> iAutorunTaskReleaser(iAutorunTask, !SUCCEEDED(hResult));
+	hResult = COM_CALL(CALL_TASK_GET_TASK, iRootTaskFolder->GetTask(tmp, iAutorunTask.put()));
 	SysFreeString(tmp);
-	if (iAutorunTaskReleaser)
-		validate_autorun_task(iRootTaskFolder, iAutorunTask);
+	if (!SUCCEEDED(hResult))
+		// Only a task that was actually returned counts
+		iAutorunTask.release();
+	if (iAutorunTask)
+		validate_autorun_task(iRootTaskFolder.get(), iAutorunTask.get());
 	else
-		if (!create_logon_task(iTaskScheduler, iRootTaskFolder, iAutorunTask))
+		if (!create_logon_task(iTaskScheduler.get(), iRootTaskFolder.get(), iAutorunTask))
 			return false;
 		else if (enabled)
 			return true;
 
-	hResult = iAutorunTask->put_Enabled(enabled ? VARIANT_TRUE : VARIANT_FALSE);
+	hResult = COM_CALL(CALL_TASK_ENABLED, iAutorunTask->put_Enabled(enabled ? VARIANT_TRUE : VARIANT_FALSE));
 	if (!SUCCEEDED(hResult))
 	{
 		ShowErrorMessage(hResult, _T("IRegisteredTask::put_Enabled error"));
@@ -390,16 +382,15 @@ bool set_autorun_state(bool enabled)
 
 bool get_autorun_state(bool& enabled)
 {
-	ITaskService* iTaskScheduler;
-	HRESULT hResult = CoCreateInstance(CLSID_TaskScheduler, NULL, CLSCTX_ALL, IID_ITaskService, (LPVOID*)&iTaskScheduler);
+	ComPtr<ITaskService> iTaskScheduler;
+	HRESULT hResult = COM_CALL(CALL_CREATE_TASK_SERVICE, CoCreateInstance(CLSID_TaskScheduler, NULL, CLSCTX_ALL, IID_ITaskService, iTaskScheduler.put_void()));
 	if (!SUCCEEDED(hResult))
 	{
 		ShowErrorMessage(hResult, _T("CoCreateInstance[ITaskService] error"));
 		return false;
 	}
-	AutoReleaser<ITaskService> iTaskSchedulerReleaser(iTaskScheduler);
 
-	hResult = iTaskScheduler->Connect(VARIANT(), VARIANT(), VARIANT(), VARIANT());
+	hResult = COM_CALL(CALL_TASK_CONNECT, iTaskScheduler->Connect(VARIANT(), VARIANT(), VARIANT(), VARIANT()));
 	if (!SUCCEEDED(hResult))
 	{
 		ShowErrorMessage(hResult, _T("ITaskService::Connect error"));
@@ -407,27 +398,27 @@ bool get_autorun_state(bool& enabled)
 	}
 
 	BSTR tmp = SysAllocString(OLESTR("\\"));
-	ITaskFolder* iRootTaskFolder;
-	hResult = iTaskScheduler->GetFolder(tmp, &iRootTaskFolder);
+	ComPtr<ITaskFolder> iRootTaskFolder;
+	hResult = COM_CALL(CALL_TASK_GET_FOLDER, iTaskScheduler->GetFolder(tmp, iRootTaskFolder.put()));
 	SysFreeString(tmp);
 	if (!SUCCEEDED(hResult))
 	{
 		ShowErrorMessage(hResult, _T("ITaskService::GetFolder error"));
 		return false;
 	}
-	AutoReleaser<ITaskFolder> iRootTaskFolderReleaser(iRootTaskFolder);
 
-	IRegisteredTask* iAutorunTask;
+	ComPtr<IRegisteredTask> iAutorunTask;
 	tmp = SysAllocString((std::basic_string<OLECHAR>(OLESTR("\\")) += AUTORUN_TASK_NAME).c_str());
-	hResult = iRootTaskFolder->GetTask(tmp, &iAutorunTask);
-	AutoReleaser<IRegisteredTask> iAutorunTaskReleaser(iAutorunTask, !SUCCEEDED(hResult));
+	hResult = COM_CALL(CALL_TASK_GET_TASK, iRootTaskFolder->GetTask(tmp, iAutorunTask.put()));
 	SysFreeString(tmp);
-	if (iAutorunTaskReleaser)
+	if (!SUCCEEDED(hResult))
+		iAutorunTask.release();
+	if (iAutorunTask)
 	{
-		if (!validate_autorun_task(iRootTaskFolder, iAutorunTask))
+		if (!validate_autorun_task(iRootTaskFolder.get(), iAutorunTask.get()))
 			return false;
 		VARIANT_BOOL b;
-		iAutorunTask->get_Enabled(&b);
+		COM_CALL(CALL_TASK_ENABLED, iAutorunTask->get_Enabled(&b));
 		enabled = !!b;
 	}
 	else
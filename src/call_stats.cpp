@@ -0,0 +1,94 @@
+#include "unicode.h"
+
+#include <stdio.h>
+
+#include "call_stats.hpp"
+#include "timeline.hpp"
+
+static char const* const callSiteNames[CALL_SITES] = {
+	"create_device_enumerator", "get_default_endpoint", "get_device", "enum_endpoints", "activate",
+	"get_session_enumerator", "get_session", "get_instance_id", "get_process_id", "open_process",
+	"get_process_image_file_name", "register_session_events", "get_master_volume", "set_master_volume",
+	"get_mute", "set_mute", "get_peak_value",
+	"create_task_service", "task_connect", "task_get_folder", "task_get_task", "task_new_task",
+	"task_register", "task_enabled"
+};
+
+char const* call_site_name(unsigned int site)
+{
+	return site < CALL_SITES ? callSiteNames[site] : NULL;
+}
+
+#if MPVC_CALL_STATS
+
+CallSiteStats mpvc_call_stats[CALL_SITES];
+
+void call_stats_record(CallSite site, uint64_t ns, int32_t error)
+{
+	timeline_call(site, ns, error);
+	CallSiteStats& stats = mpvc_call_stats[site];
+	stats.calls.fetch_add(1, std::memory_order_relaxed);
+	stats.totalNs.fetch_add(ns, std::memory_order_relaxed);
+	uint64_t max = stats.maxNs.load(std::memory_order_relaxed);
+	while (ns > max && !stats.maxNs.compare_exchange_weak(max, ns, std::memory_order_relaxed))
+		;
+	if (!error)
+		return;
+
+	stats.failures.fetch_add(1, std::memory_order_relaxed);
+	for (int i = 0; i < CALL_STATS_ERRORS; ++i)
+	{
+		int32_t slot = stats.errors[i].load(std::memory_order_relaxed);
+		if (slot == 0)
+		{
+			int32_t expected = 0;
+			// Taken by another thread meanwhile, maybe for the same error
+			if (!stats.errors[i].compare_exchange_strong(expected, error, std::memory_order_relaxed))
+				slot = expected;
+			else
+				slot = error;
+		}
+		if (slot == error)
+		{
+			stats.errorCounts[i].fetch_add(1, std::memory_order_relaxed);
+			return;
+		}
+	}
+	stats.otherErrors.fetch_add(1, std::memory_order_relaxed);
+}
+
+static void append_value(std::string& out, char const* site, char const* name, uint64_t value)
+{
+	char buf[128];
+	snprintf(buf, sizeof(buf), " %s_%s=%llu", site, name, (unsigned long long)value);
+	out.append(buf);
+}
+
+void call_stats_format(std::string& out)
+{
+	for (int i = 0; i < CALL_SITES; ++i)
+	{
+		CallSiteStats const& stats = mpvc_call_stats[i];
+		uint64_t calls = stats.calls.load(std::memory_order_relaxed);
+		if (!calls)
+			continue;
+		append_value(out, callSiteNames[i], "calls", calls);
+		append_value(out, callSiteNames[i], "failures", stats.failures.load(std::memory_order_relaxed));
+		append_value(out, callSiteNames[i], "us", stats.totalNs.load(std::memory_order_relaxed) / 1000);
+		append_value(out, callSiteNames[i], "max_us", stats.maxNs.load(std::memory_order_relaxed) / 1000);
+		for (int j = 0; j < CALL_STATS_ERRORS; ++j)
+		{
+			int32_t error = stats.errors[j].load(std::memory_order_relaxed);
+			if (!error)
+				break;
+			char name[32];
+			snprintf(name, sizeof(name), "error_%08lx", (unsigned long)(uint32_t)error);
+			append_value(out, callSiteNames[i], name, stats.errorCounts[j].load(std::memory_order_relaxed));
+		}
+		uint64_t other = stats.otherErrors.load(std::memory_order_relaxed);
+		if (other)
+			append_value(out, callSiteNames[i], "error_other", other);
+	}
+}
+
+#endif // MPVC_CALL_STATS
@@ -0,0 +1,128 @@
+#pragma once
+#ifndef __CALL_STATS_HPP__
+#define __CALL_STATS_HPP__
+
+#include "unicode.h"
+
+#include <stdint.h>
+
+#include <atomic>
+#include <chrono>
+#include <string>
+
+#ifdef _WIN32
+#include <Windows.h>
+#endif
+
+// Accounting of the COM and Win32 calls the session provider and the autorun
+//   task make, per call site: calls, failures by error code and the time
+//   spent in them. Reported by the IPC "stats" command, so a field report
+//   shows which call of the audio stack is the slow one.
+//
+// Only built in with MPVC_CALL_STATS (the CMake option of the same name).
+//   Without it COM_CALL and WIN32_CALL are the bare call. With it, every
+//   call also goes into the timeline while one is recorded (timeline.hpp).
+
+enum CallSite
+{
+	// Audio sessions
+	CALL_CREATE_DEVICE_ENUMERATOR,
+	CALL_GET_DEFAULT_ENDPOINT,
+	CALL_GET_DEVICE,
+	CALL_ENUM_ENDPOINTS,
+	CALL_ACTIVATE,
+	CALL_GET_SESSION_ENUMERATOR,
+	CALL_GET_SESSION,
+	CALL_GET_INSTANCE_ID,
+	CALL_GET_PROCESS_ID,
+	CALL_OPEN_PROCESS,
+	CALL_GET_PROCESS_IMAGE_FILE_NAME,
+	CALL_REGISTER_SESSION_EVENTS,
+	CALL_GET_MASTER_VOLUME,
+	CALL_SET_MASTER_VOLUME,
+	CALL_GET_MUTE,
+	CALL_SET_MUTE,
+	CALL_GET_PEAK_VALUE,
+	// Autorun task
+	CALL_CREATE_TASK_SERVICE,
+	CALL_TASK_CONNECT,
+	CALL_TASK_GET_FOLDER,
+	CALL_TASK_GET_TASK,
+	CALL_TASK_NEW_TASK,
+	CALL_TASK_REGISTER,
+	CALL_TASK_ENABLED,
+	CALL_SITES
+};
+
+// "set_master_volume" and so on, NULL past CALL_SITES
+char const* call_site_name(unsigned int site);
+
+#if MPVC_CALL_STATS
+
+// Distinct error codes kept per call site, the rest are only counted
+#define CALL_STATS_ERRORS 4
+
+struct CallSiteStats
+{
+	std::atomic<uint64_t> calls;
+	std::atomic<uint64_t> failures;
+	std::atomic<uint64_t> totalNs;
+	std::atomic<uint64_t> maxNs;
+	// HRESULTs, the Win32 errors as HRESULT_FROM_WIN32. 0 for a free slot.
+	std::atomic<int32_t> errors[CALL_STATS_ERRORS];
+	std::atomic<uint64_t> errorCounts[CALL_STATS_ERRORS];
+	std::atomic<uint64_t> otherErrors;
+};
+
+extern CallSiteStats mpvc_call_stats[CALL_SITES];
+
+// error is 0 for a call that succeeded
+void call_stats_record(CallSite site, uint64_t ns, int32_t error);
+// Appends " name_calls=..." for every site called at least once
+void call_stats_format(std::string& out);
+
+#ifdef _WIN32
+// Started right before the call is made, see COM_CALL
+class CallTimer
+{
+private:
+	CallSite site;
+	std::chrono::steady_clock::time_point start;
+
+	uint64_t elapsed() const
+	{
+		return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+	}
+public:
+	explicit CallTimer(CallSite site) : site(site), start(std::chrono::steady_clock::now()) { }
+
+	HRESULT com_done(HRESULT hResult)
+	{
+		call_stats_record(site, elapsed(), FAILED(hResult) ? (int32_t)hResult : 0);
+		return hResult;
+	}
+	// For the calls returning 0 or NULL on failure, with the error in
+	//   GetLastError
+	template<typename T>
+	T win32_done(T result)
+	{
+		int32_t error = 0;
+		if (!result && !(error = (int32_t)HRESULT_FROM_WIN32(GetLastError())))
+			error = (int32_t)E_FAIL;
+		call_stats_record(site, elapsed(), error);
+		return result;
+	}
+};
+
+#define COM_CALL(site, ...) ([&]() { CallTimer __call_timer(site); return __call_timer.com_done(__VA_ARGS__); }())
+#define WIN32_CALL(site, ...) ([&]() { CallTimer __call_timer(site); return __call_timer.win32_done(__VA_ARGS__); }())
+#endif
+
+#else
+
+#define COM_CALL(site, ...) (__VA_ARGS__)
+#define WIN32_CALL(site, ...) (__VA_ARGS__)
+
+#endif // MPVC_CALL_STATS
+
+#endif // __CALL_STATS_HPP__
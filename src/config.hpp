@@ -4,20 +4,26 @@
 
 #include <assert.h>
 
+#include <errno.h>
 #include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
+#include <wctype.h>
 
 #include <iterator>
-#include <istream>
 #include <utility>
-#include <sstream>
 #include <string>
+#include <string_view>
 #include <limits>
 #include <memory>
 #include <map>
+#include <type_traits>
+#include <unordered_map>
+
+#include "utf8.hpp"
 
-#include <iostream>
 namespace config
 {
 	namespace config_internal
@@ -168,7 +174,7 @@ namespace config
 			line_iterator& operator+=(difference_type n)
 			{
 				if (n-- <= 0)
-					return;
+					return *this;
 				if (!line_valid)
 					skip_line();
 				if (n != 0 && current != end)
@@ -282,14 +288,7 @@ namespace config
 			template<>
 			bool string_iequal(char const* str1, char const* str2)
 			{
-#if 0
-				return stricmp(str1, str2) == 0;
-#else
-				for (; *str1 != '\0'; ++str1, ++str2)
-					if (tolower(*str1) != tolower(*str2))
-						return false;
-				return *str2 == '\0';
-#endif
+				return utf8_iequal(str1, str2);
 			}
 			template<>
 			bool string_iequal(wchar_t const* str1, wchar_t const* str2)
@@ -331,17 +330,75 @@ namespace config
 			{
 				return string_iequal(str1.c_str(), str2.c_str());
 			}
+
+			// Case-insensitive hash and equality of option names, UTF-8 for
+			//   char
+			template<typename _CharT>
+			struct option_hash
+			{
+				size_t operator()(std::basic_string_view<_CharT> str) const
+				{
+					size_t hash = 2166136261u;
+					for (typename std::basic_string_view<_CharT>::const_iterator start = str.begin(), end = str.end(); start != end; ++start)
+						hash = (hash ^ (size_t)towlower(*start)) * 16777619u;
+					return hash;
+				}
+			};
+			template<>
+			struct option_hash<char> : public Utf8IHash { };
+			template<typename _CharT>
+			struct option_equal
+			{
+				bool operator()(std::basic_string_view<_CharT> str1, std::basic_string_view<_CharT> str2) const
+				{
+					if (str1.length() != str2.length())
+						return false;
+					for (typename std::basic_string_view<_CharT>::size_type i = 0; i != str1.length(); ++i)
+						if (towlower(str1[i]) != towlower(str2[i]))
+							return false;
+					return true;
+				}
+			};
+			template<>
+			struct option_equal<char> : public Utf8IEqual { };
 		}
 
+		// Integers in decimal with leading blanks, what follows them is
+		//   ignored. Out of range values are clamped and flagged.
 		template<typename T, typename _CharT>
 		T parse_number(std::basic_string<_CharT> const& str, bool& fail, bool& overflow, bool& underflow)
 		{
-			std::basic_istringstream<_CharT> iss(str);
-			T ret;
-			iss >> ret;
-			fail = iss.fail();
-			overflow = iss.fail();
-			underflow = iss.fail();
+			static_assert(std::is_integral<T>::value, "only integers are parsed");
+			// Digits are ASCII whatever the character type
+			char buffer[64];
+			size_t length = 0;
+			for (typename std::basic_string<_CharT>::const_iterator start = str.begin(), end = str.end(); start != end && length + 1 < sizeof buffer; ++start)
+				buffer[length++] = (unsigned long)*start < 0x80 ? (char)*start : '?';
+			buffer[length] = '\0';
+
+			char const* p = buffer;
+			while (*p == ' ' || *p == '\t')
+				++p;
+			char* end;
+			T ret = T();
+			errno = 0;
+			overflow = underflow = false;
+			if (std::is_signed<T>::value)
+			{
+				long long value = strtoll(p, &end, 10);
+				fail = end == p;
+				overflow = (errno == ERANGE && value > 0) || value > (long long)(std::numeric_limits<T>::max)();
+				underflow = (errno == ERANGE && value < 0) || value < (long long)(std::numeric_limits<T>::min)();
+				ret = overflow ? (std::numeric_limits<T>::max)() : underflow ? (std::numeric_limits<T>::min)() : (T)value;
+			}
+			else
+			{
+				// strtoull takes negative numbers and wraps them around
+				unsigned long long value = *p == '-' ? 0 : strtoull(p, &end, 10);
+				fail = *p == '-' || end == p;
+				overflow = !fail && (errno == ERANGE || value > (unsigned long long)(std::numeric_limits<T>::max)());
+				ret = overflow ? (std::numeric_limits<T>::max)() : (T)value;
+			}
 			return ret;
 		}
 		template<typename T, typename _CharT>
@@ -378,23 +435,14 @@ namespace config
 		template<typename Iterator, typename T>
 		inline void write_number(Iterator& out, T value)
 		{
-			std::ostringstream oss;
-			oss << value;
-			write_string(out, oss.str());
-		}
-
-		template<class _KeyCharT, class VT, typename Pr, class Alloc, typename _CharT>
-		inline typename std::map<std::basic_string<_KeyCharT>, VT, Pr, Alloc>::iterator find_map_str(std::map<std::basic_string<_KeyCharT>, VT, Pr, Alloc>& map, std::basic_string<_CharT> const& key)
-		{
-			std::basic_string<_KeyCharT> k;
-			k.reserve(key.length());
-			std::copy(key.begin(), key.end(), std::back_inserter(k));
-			return map.find(k);
-		}
-		template<class _KeyCharT, class VT, typename Pr, class Alloc>
-		inline typename std::map<std::basic_string<_KeyCharT>, VT, Pr, Alloc>::iterator find_map_str(std::map<std::basic_string<_KeyCharT>, VT, Pr, Alloc>& map, std::basic_string<_KeyCharT> const& key)
-		{
-			return map.find(key);
+			char buffer[64];
+			if (std::is_floating_point<T>::value)
+				snprintf(buffer, sizeof buffer, "%Lg", (long double)value);
+			else if (std::is_signed<T>::value)
+				snprintf(buffer, sizeof buffer, "%lld", (long long)value);
+			else
+				snprintf(buffer, sizeof buffer, "%llu", (unsigned long long)value);
+			write_string(out, (char const*)buffer);
 		}
 	}
 
@@ -421,15 +469,41 @@ namespace config
 			ConfigValueBinding(ConfigValueType type, void* ptr, std::basic_string<_CharT> const& desc) : type(type), pointer(ptr), description(desc) { }
 			ConfigValueBinding(ConfigValueType type, void* ptr) : type(type), pointer(ptr) { }
 		};
+		// Sorted for writing the config out
 		typedef std::map<ConfigOptionName, ConfigValueBinding> ConfigOptions;
+		// For reading it, names are matched regardless of case
+		typedef std::unordered_map<std::basic_string_view<_CharT>, typename ConfigOptions::iterator, config_internal::string_compare::option_hash<_CharT>, config_internal::string_compare::option_equal<_CharT>> OptionIndex;
 
 		ConfigOptions options;
+		// Views of the names in options
+		OptionIndex index;
 
 		bool add_option_internal(ConfigOptionName const& name, std::basic_string<_CharT> const& description, ConfigValueType type, void* pointer)
 		{
-			return options.insert(typename ConfigOptions::value_type(name, ConfigValueBinding(type, pointer, description))).second;
+			if (index.find(name) != index.end())
+				return false;
+			typename ConfigOptions::iterator it = options.insert(typename ConfigOptions::value_type(name, ConfigValueBinding(type, pointer, description))).first;
+			index.insert(typename OptionIndex::value_type((*it).first, it));
+			return true;
+		}
+
+		typename ConfigOptions::iterator find_option(std::basic_string_view<_CharT> name)
+		{
+			typename OptionIndex::iterator it = index.find(name);
+			return it == index.end() ? options.end() : (*it).second;
+		}
+		template<typename _CharT2>
+		typename ConfigOptions::iterator find_option(std::basic_string_view<_CharT2> name)
+		{
+			ConfigOptionName converted(name.begin(), name.end());
+			return find_option(std::basic_string_view<_CharT>(converted));
 		}
 	public:
+		ConfigIO() : options(), index() { }
+		// index points into options
+		ConfigIO(ConfigIO const&) = delete;
+		ConfigIO& operator=(ConfigIO const&) = delete;
+
 		bool add_option(ConfigOptionName const& name, std::basic_string<_CharT> const& description, bool& binding) { return add_option_internal(name, description, Bool, (void*)&binding); }
 		bool add_option(ConfigOptionName const& name, std::basic_string<_CharT> const& description, char& binding) { return add_option_internal(name, description, Char, (void*)&binding); }
 		bool add_option(ConfigOptionName const& name, std::basic_string<_CharT> const& description, signed char& binding) { return add_option_internal(name, description, SChar, (void*)&binding); }
@@ -626,7 +700,7 @@ namespace config
 
 				if (sep1 != string_type::npos)
 				{
-					typename ConfigOptions::iterator end = options.end(), iter = find_map_str(options, line.substr(pos0, sep0 - pos0));
+					typename ConfigOptions::iterator end = options.end(), iter = find_option(std::basic_string_view<typename string_type::value_type>(line).substr(pos0, sep0 - pos0));
 					if (iter != end)
 						parse_value(line.substr(sep1, pos1 - sep1 + 1), (*iter).second);
 				}
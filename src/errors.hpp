@@ -4,6 +4,7 @@
 
 #include "unicode.h"
 
+#ifdef _WIN32
 #include <Windows.h>
 #include <tchar.h>
 
@@ -65,4 +66,14 @@ inline void ShowErrorMessage(HRESULT hResult, LPCTSTR title)
 	MessageBox(NULL, GetErrorMessage(hResult), title, MB_OK);
 }
 
+#else
+#include <stdio.h>
+#include <string.h>
+
+inline void ShowErrorMessage(int error, char const* title)
+{
+	fprintf(stderr, "%s: %s\n", title, strerror(error));
+}
+#endif
+
 #endif // __ERRORS_HPP__
@@ -0,0 +1,232 @@
+#include "evdev_input.hpp"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/epoll.h>
+#include <sys/inotify.h>
+#include <sys/ioctl.h>
+#include <linux/input.h>
+
+#include <algorithm>
+
+#include "errors.hpp"
+#include "metrics.hpp"
+#include "timeline.hpp"
+
+static const char inputDir[] = "/dev/input";
+
+enum {
+	MODKEY_LEFTSHIFT = 1 << 0, MODKEY_RIGHTSHIFT = 1 << 1,
+	MODKEY_LEFTCTRL = 1 << 2, MODKEY_RIGHTCTRL = 1 << 3,
+	MODKEY_LEFTALT = 1 << 4, MODKEY_RIGHTALT = 1 << 5
+};
+
+static bool test_bit(unsigned char const* bits, unsigned int bit)
+{
+	return (bits[bit / 8] >> (bit % 8)) & 1;
+}
+
+EvdevInput::Device::~Device()
+{
+	if (fd != -1)
+	{
+		if (grabbed)
+			ioctl(fd, EVIOCGRAB, 0);
+		close(fd);
+	}
+}
+
+void EvdevInput::Device::on_event(uint32_t events)
+{
+	struct input_event buf[32];
+	for (;;)
+	{
+		ssize_t len = read(fd, buf, sizeof buf);
+		if (len > 0)
+		{
+			for (size_t i = 0, n = (size_t)len / sizeof *buf; i < n; ++i)
+				owner.process_event(buf[i]);
+			continue;
+		}
+		if (len == -1 && (errno == EAGAIN || errno == EINTR))
+		{
+			if (errno == EINTR)
+				continue;
+			if (!(events & (EPOLLHUP | EPOLLERR)))
+				break;
+		}
+		// ENODEV after unplugging, or EOF
+		owner.listener.on_batch_end();
+		owner.close_device(this);
+		return;
+	}
+	owner.listener.on_batch_end();
+}
+
+EvdevInput::Hotplug::~Hotplug()
+{
+	if (fd != -1)
+		close(fd);
+}
+
+void EvdevInput::Hotplug::on_event(uint32_t)
+{
+	alignas(struct inotify_event) char buf[4096];
+	ssize_t len;
+	while ((len = read(fd, buf, sizeof buf)) > 0)
+		for (char* p = buf; p < buf + len; p += sizeof(struct inotify_event) + ((struct inotify_event*)p)->len)
+		{
+			struct inotify_event const* ev = (struct inotify_event*)p;
+			// udev creates the node first and fixes the permissions afterwards,
+			//   so retry on IN_ATTRIB too. Removal is noticed by the device itself.
+			if (ev->len == 0 || strncmp(ev->name, "event", 5) != 0)
+				continue;
+			size_t count = owner.devices.size();
+			if (owner.open_device(std::string(inputDir) + '/' + ev->name) && owner.devices.size() > count)
+				mpvc_metrics.hookReinstalls.fetch_add(1, std::memory_order_relaxed);
+		}
+}
+
+EvdevInput::~EvdevInput()
+{
+	for (std::vector<Device*>::iterator start = devices.begin(), end = devices.end(); start != end; ++start)
+		delete *start;
+}
+
+bool EvdevInput::open_device(std::string const& path)
+{
+	for (std::vector<Device*>::iterator start = devices.begin(), end = devices.end(); start != end; ++start)
+		if ((*start)->path == path)
+			return true;
+
+	int fd = open(path.c_str(), O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+	if (fd == -1)
+		return false;
+
+	unsigned char keyBits[KEY_MAX / 8 + 1];
+	memset(keyBits, 0, sizeof keyBits);
+	if (ioctl(fd, EVIOCGBIT(EV_KEY, sizeof keyBits), keyBits) == -1
+		|| !(test_bit(keyBits, KEY_VOLUMEUP) || test_bit(keyBits, KEY_VOLUMEDOWN) || test_bit(keyBits, KEY_MUTE)
+			|| test_bit(keyBits, KEY_LEFTCTRL) || test_bit(keyBits, KEY_LEFTSHIFT) || test_bit(keyBits, KEY_LEFTALT)))
+	{
+		close(fd);
+		return false;
+	}
+
+	bool grabbed = false;
+	if (grab && (test_bit(keyBits, KEY_VOLUMEUP) || test_bit(keyBits, KEY_VOLUMEDOWN) || test_bit(keyBits, KEY_MUTE)) && !test_bit(keyBits, KEY_A))
+		grabbed = ioctl(fd, EVIOCGRAB, 1) == 0;
+
+	Device* device = new Device(*this, path, fd, grabbed);
+	if (!loop.add(fd, EPOLLIN, device))
+	{
+		delete device;
+		return false;
+	}
+	devices.push_back(device);
+	timeline_devices_changed((unsigned int)devices.size());
+	return true;
+}
+
+bool EvdevInput::open_all(bool watchHotplug)
+{
+	if (watchHotplug && hotplug.fd == -1)
+	{
+		if ((hotplug.fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC)) == -1)
+			ShowErrorMessage(errno, "inotify_init1 error");
+		else if (inotify_add_watch(hotplug.fd, inputDir, IN_CREATE | IN_ATTRIB) == -1 || !loop.add(hotplug.fd, EPOLLIN, &hotplug))
+		{
+			ShowErrorMessage(errno, "inotify_add_watch error");
+			close(hotplug.fd);
+			hotplug.fd = -1;
+		}
+	}
+
+	DIR* dir = opendir(inputDir);
+	if (!dir)
+	{
+		ShowErrorMessage(errno, "opendir error");
+		return false;
+	}
+	struct dirent* entry;
+	while ((entry = readdir(dir)))
+		if (strncmp(entry->d_name, "event", 5) == 0)
+			open_device(std::string(inputDir) + '/' + entry->d_name);
+	closedir(dir);
+	return !devices.empty() || hotplug.fd != -1;
+}
+
+bool EvdevInput::replay(char const* path)
+{
+	FILE* f = fopen(path, "rb");
+	if (!f)
+	{
+		ShowErrorMessage(errno, "fopen error");
+		return false;
+	}
+	struct input_event ev;
+	// No batching, every press is applied on its own like it was recorded
+	while (fread(&ev, sizeof ev, 1, f) == 1)
+	{
+		process_event(ev);
+		listener.on_batch_end();
+	}
+	fclose(f);
+	return true;
+}
+
+unsigned int EvdevInput::modifier_mask(unsigned int modifierKeys)
+{
+	return ((modifierKeys & (MODKEY_LEFTSHIFT | MODKEY_RIGHTSHIFT)) ? MODIFIER_SHIFT : MODIFIER_NONE)
+		| ((modifierKeys & (MODKEY_LEFTCTRL | MODKEY_RIGHTCTRL)) ? MODIFIER_CONTROL : MODIFIER_NONE)
+		| ((modifierKeys & (MODKEY_LEFTALT | MODKEY_RIGHTALT)) ? MODIFIER_ALT : MODIFIER_NONE);
+}
+
+void EvdevInput::process_event(struct input_event const& ev)
+{
+	if (ev.type != EV_KEY)
+		return;
+
+	unsigned int modKey = 0;
+	MediaKey key;
+	switch (ev.code)
+	{
+	case KEY_LEFTSHIFT: modKey = MODKEY_LEFTSHIFT; break;
+	case KEY_RIGHTSHIFT: modKey = MODKEY_RIGHTSHIFT; break;
+	case KEY_LEFTCTRL: modKey = MODKEY_LEFTCTRL; break;
+	case KEY_RIGHTCTRL: modKey = MODKEY_RIGHTCTRL; break;
+	case KEY_LEFTALT: modKey = MODKEY_LEFTALT; break;
+	case KEY_RIGHTALT: modKey = MODKEY_RIGHTALT; break;
+	case KEY_VOLUMEUP: key = MEDIAKEY_VOLUME_UP; break;
+	case KEY_VOLUMEDOWN: key = MEDIAKEY_VOLUME_DOWN; break;
+	case KEY_MUTE: key = MEDIAKEY_VOLUME_MUTE; break;
+	default:
+		return;
+	}
+	if (modKey)
+	{
+		if (ev.value)
+			modifierKeys |= modKey;
+		else
+			modifierKeys &= ~modKey;
+		return;
+	}
+
+	// value is 0 for release, 1 for press and 2 for autorepeat
+	timeline_key(key, ev.value != 0, modifier_mask(modifierKeys));
+	KeyAction action = ev.value ? keyStateMachine.key_down(key, modifier_mask(modifierKeys), disabled) : keyStateMachine.key_up(key);
+	if (action.type != KeyAction::ACTION_PASS && action.type != KeyAction::ACTION_SWALLOW)
+		listener.on_key_action(action);
+}
+
+void EvdevInput::close_device(Device* device)
+{
+	loop.remove(device->fd);
+	devices.erase(std::remove(devices.begin(), devices.end(), device), devices.end());
+	delete device;
+	timeline_devices_changed((unsigned int)devices.size());
+}
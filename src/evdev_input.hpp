@@ -0,0 +1,87 @@
+#pragma once
+#ifndef __EVDEV_INPUT_HPP__
+#define __EVDEV_INPUT_HPP__
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+#include "event_loop.hpp"
+#include "key_actions.hpp"
+
+struct input_event;
+
+// Reads the volume keys from /dev/input/event* for the portable build and
+//   feeds them through the KeyStateMachine.
+class EvdevInput
+{
+public:
+	class Listener
+	{
+	public:
+		virtual ~Listener() { }
+		virtual void on_key_action(KeyAction const& action) = 0;
+		// After all events of one read, pending changes can be applied
+		//   together from here
+		virtual void on_batch_end() { }
+	};
+private:
+	class Device : public EventLoop::Handler
+	{
+	public:
+		EvdevInput& owner;
+		std::string path;
+		int fd;
+		bool grabbed;
+
+		Device(EvdevInput& owner, std::string const& path, int fd, bool grabbed) : owner(owner), path(path), fd(fd), grabbed(grabbed) { }
+		~Device();
+
+		virtual void on_event(uint32_t events);
+	};
+	class Hotplug : public EventLoop::Handler
+	{
+	public:
+		EvdevInput& owner;
+		int fd;
+
+		Hotplug(EvdevInput& owner) : owner(owner), fd(-1) { }
+		~Hotplug();
+
+		virtual void on_event(uint32_t events);
+	};
+
+	EventLoop& loop;
+	Listener& listener;
+	bool const& disabled;
+	bool grab;
+
+	KeyStateMachine keyStateMachine;
+	unsigned int modifierKeys;
+
+	std::vector<Device*> devices;
+	Hotplug hotplug;
+public:
+	// disabled is read on every key press, it's the redirection toggle.
+	EvdevInput(EventLoop& loop, Listener& listener, bool const& disabled) : loop(loop), listener(listener), disabled(disabled), grab(), modifierKeys(), devices(), hotplug(*this) { }
+	~EvdevInput();
+
+	// EVIOCGRAB is all or nothing, so only devices without alphanumeric keys
+	//   (media remotes, the volume buttons of a kiosk) are grabbed.
+	void set_grab(bool enable) { grab = enable; }
+
+	bool open_device(std::string const& path);
+	bool open_all(bool watchHotplug = true);
+
+	// Feeds a raw evdev capture (e.g. `cat /dev/input/event3 > keys.bin`)
+	//   through the state machine, without any timing.
+	bool replay(char const* path);
+
+	void process_event(struct input_event const& ev);
+private:
+	void close_device(Device* device);
+	static unsigned int modifier_mask(unsigned int modifierKeys);
+};
+
+#endif // __EVDEV_INPUT_HPP__
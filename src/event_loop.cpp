@@ -0,0 +1,166 @@
+#include "event_loop.hpp"
+
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+
+#include "errors.hpp"
+
+bool EventLoop::init()
+{
+	epollFd.reset(epoll_create1(EPOLL_CLOEXEC));
+	if (!epollFd)
+	{
+		ShowErrorMessage(errno, "epoll_create1 error");
+		return false;
+	}
+	return true;
+}
+
+bool EventLoop::add(int fd, uint32_t events, Handler* handler)
+{
+	struct epoll_event ev;
+	ev.events = events;
+	ev.data.ptr = handler;
+	if (epoll_ctl(epollFd.get(), EPOLL_CTL_ADD, fd, &ev) == -1)
+	{
+		ShowErrorMessage(errno, "epoll_ctl error");
+		return false;
+	}
+	return true;
+}
+
+bool EventLoop::modify(int fd, uint32_t events, Handler* handler)
+{
+	struct epoll_event ev;
+	ev.events = events;
+	ev.data.ptr = handler;
+	return epoll_ctl(epollFd.get(), EPOLL_CTL_MOD, fd, &ev) == 0;
+}
+
+bool EventLoop::remove(int fd)
+{
+	return epoll_ctl(epollFd.get(), EPOLL_CTL_DEL, fd, NULL) == 0;
+}
+
+int EventLoop::run()
+{
+	struct epoll_event events[16];
+	running = true;
+	while (running)
+	{
+		int n = epoll_wait(epollFd.get(), events, sizeof events / sizeof *events, -1);
+		if (n == -1)
+		{
+			if (errno == EINTR)
+				continue;
+			ShowErrorMessage(errno, "epoll_wait error");
+			return 1;
+		}
+		for (int i = 0; i < n && running; ++i)
+			static_cast<Handler*>(events[i].data.ptr)->on_event(events[i].events);
+	}
+	return exitCode;
+}
+
+PeriodicTimer::~PeriodicTimer()
+{
+	stop();
+}
+
+bool PeriodicTimer::start(EventLoop& loop, unsigned int intervalMs)
+{
+	stop();
+	if ((fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC)) == -1)
+	{
+		ShowErrorMessage(errno, "timerfd_create error");
+		return false;
+	}
+	struct itimerspec spec;
+	spec.it_interval.tv_sec = intervalMs / 1000;
+	spec.it_interval.tv_nsec = (long)(intervalMs % 1000) * 1000000;
+	spec.it_value = spec.it_interval;
+	if (timerfd_settime(fd, 0, &spec, NULL) == -1 || !loop.add(fd, EPOLLIN, this))
+	{
+		ShowErrorMessage(errno, "timerfd_settime error");
+		close(fd);
+		fd = -1;
+		return false;
+	}
+	this->loop = &loop;
+	return true;
+}
+
+void PeriodicTimer::stop()
+{
+	if (fd == -1)
+		return;
+	loop->remove(fd);
+	close(fd);
+	fd = -1;
+}
+
+void PeriodicTimer::on_event(uint32_t)
+{
+	// Expirations missed while busy are collapsed into one call
+	uint64_t expirations;
+	if (read(fd, &expirations, sizeof expirations) == sizeof expirations)
+		on_timer();
+}
+
+static void quit_signal_set(sigset_t* set)
+{
+	sigemptyset(set);
+	sigaddset(set, SIGINT);
+	sigaddset(set, SIGTERM);
+}
+
+QuitSignals::~QuitSignals()
+{
+	if (fd == -1)
+		return;
+	loop->remove(fd);
+	close(fd);
+}
+
+bool QuitSignals::block()
+{
+	sigset_t set;
+	quit_signal_set(&set);
+	int error = pthread_sigmask(SIG_BLOCK, &set, NULL);
+	if (error != 0)
+	{
+		ShowErrorMessage(error, "pthread_sigmask error");
+		return false;
+	}
+	return true;
+}
+
+bool QuitSignals::start(EventLoop& loop)
+{
+	sigset_t set;
+	quit_signal_set(&set);
+	if ((fd = signalfd(-1, &set, SFD_NONBLOCK | SFD_CLOEXEC)) == -1)
+	{
+		ShowErrorMessage(errno, "signalfd error");
+		return false;
+	}
+	if (!loop.add(fd, EPOLLIN, this))
+	{
+		close(fd);
+		fd = -1;
+		return false;
+	}
+	this->loop = &loop;
+	return true;
+}
+
+void QuitSignals::on_event(uint32_t)
+{
+	struct signalfd_siginfo info;
+	if (read(fd, &info, sizeof info) == sizeof info)
+		loop->quit(0);
+}
@@ -0,0 +1,77 @@
+#pragma once
+#ifndef __EVENT_LOOP_HPP__
+#define __EVENT_LOOP_HPP__
+
+#include <stdint.h>
+
+#include "handles.hpp"
+
+// epoll based main loop of the portable build, the counterpart of the
+//   GetMessage loop in main.cpp.
+class EventLoop
+{
+public:
+	// One handler per registered fd, the pointer is stored in the epoll data
+	class Handler
+	{
+	public:
+		virtual ~Handler() { }
+		virtual void on_event(uint32_t events) = 0;
+	};
+private:
+	UniqueFd epollFd;
+	bool running;
+	int exitCode;
+public:
+	EventLoop() : epollFd(), running(), exitCode() { }
+
+	bool init();
+
+	bool add(int fd, uint32_t events, Handler* handler);
+	bool modify(int fd, uint32_t events, Handler* handler);
+	bool remove(int fd);
+
+	int run();
+	void quit(int code)
+	{
+		exitCode = code;
+		running = false;
+	}
+};
+
+// timerfd firing every interval, the counterpart of SetTimer
+class PeriodicTimer : public EventLoop::Handler
+{
+private:
+	EventLoop* loop;
+	int fd;
+public:
+	PeriodicTimer() : loop(), fd(-1) { }
+	virtual ~PeriodicTimer();
+
+	bool start(EventLoop& loop, unsigned int intervalMs);
+	void stop();
+
+	virtual void on_timer() = 0;
+	virtual void on_event(uint32_t events);
+};
+
+// SIGINT and SIGTERM through a signalfd, so they quit the loop from within it
+//   and not from a signal handler. block() has to come before any thread is
+//   started, the threads inherit the mask and leave the signals to the fd.
+class QuitSignals : public EventLoop::Handler
+{
+private:
+	EventLoop* loop;
+	int fd;
+public:
+	QuitSignals() : loop(), fd(-1) { }
+	virtual ~QuitSignals();
+
+	static bool block();
+	bool start(EventLoop& loop);
+
+	virtual void on_event(uint32_t events);
+};
+
+#endif // __EVENT_LOOP_HPP__
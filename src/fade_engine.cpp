@@ -0,0 +1,295 @@
+#include "unicode.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <utility>
+
+#ifdef _WIN32
+#include <Windows.h>
+#include <objbase.h>
+#else
+#include <errno.h>
+#include <time.h>
+#endif
+
+#include "fade_engine.hpp"
+#ifdef _WIN32
+#include "handles.hpp"
+#endif
+
+typedef std::chrono::steady_clock fade_clock;
+
+namespace
+{
+	struct Fade
+	{
+		FadeSink* sink;
+		void* key;
+		float from;
+		float to;
+		fade_clock::time_point start;
+		fade_clock::duration duration;
+	};
+}
+
+static std::mutex fadeMutex;
+// Signalled for new fades, for stopping and when a batch was written
+static std::condition_variable fadeChanged;
+static Fade fades[FADE_MAX];
+static unsigned int fadeCount = 0;
+// The tick being written while writing is set. Two arrays, so every sink
+//   gets its writes as one contiguous run.
+static FadeSink* batchSinks[FADE_MAX];
+static FadeWrite batchWrites[FADE_MAX];
+static unsigned int batchCount = 0;
+static bool writing = false;
+static bool stopping = false;
+static bool running = false;
+static std::thread fadeThread;
+static std::atomic<unsigned int> stepDuration(0);
+
+static float fade_value(Fade const& fade, fade_clock::time_point now)
+{
+	if (now >= fade.start + fade.duration)
+		return fade.to;
+	float t = std::chrono::duration<float>(now - fade.start).count() / std::chrono::duration<float>(fade.duration).count();
+	return fade.from + (fade.to - fade.from) * t;
+}
+
+static Fade* find_fade(FadeSink* sink, void* key)
+{
+	for (unsigned int i = 0; i < fadeCount; ++i)
+		if (fades[i].sink == sink && fades[i].key == key)
+			return &fades[i];
+	return NULL;
+}
+
+static bool in_batch(FadeSink* sink, void* key, bool anyKey)
+{
+	for (unsigned int i = 0; i < batchCount; ++i)
+		if (batchSinks[i] == sink && (anyKey || batchWrites[i].key == key))
+			return true;
+	return false;
+}
+
+// Called with the lock held
+static void build_batch(fade_clock::time_point now)
+{
+	batchCount = 0;
+	for (unsigned int i = 0; i < fadeCount; )
+	{
+		Fade& fade = fades[i];
+		batchSinks[batchCount] = fade.sink;
+		batchWrites[batchCount].key = fade.key;
+		batchWrites[batchCount].volume = fade_value(fade, now);
+		++batchCount;
+		// Done with its last write
+		if (now >= fade.start + fade.duration)
+			fade = fades[--fadeCount];
+		else
+			++i;
+	}
+	// Insertion sort by sink, there are few and they come mostly sorted
+	for (unsigned int i = 1; i < batchCount; ++i)
+		for (unsigned int j = i; j > 0 && std::less<FadeSink*>()(batchSinks[j], batchSinks[j - 1]); --j)
+		{
+			std::swap(batchSinks[j - 1], batchSinks[j]);
+			std::swap(batchWrites[j - 1], batchWrites[j]);
+		}
+}
+
+static void write_batch()
+{
+	for (unsigned int start = 0, end; start < batchCount; start = end)
+	{
+		for (end = start + 1; end < batchCount && batchSinks[end] == batchSinks[start]; ++end)
+			;
+		batchSinks[start]->fade_write(&batchWrites[start], end - start);
+	}
+}
+
+#ifdef _WIN32
+// The high resolution kind needs Windows 10 1803, the plain one is rounded
+//   to the system timer resolution
+static HANDLE create_tick_timer()
+{
+#ifdef CREATE_WAITABLE_TIMER_HIGH_RESOLUTION
+	HANDLE timer = CreateWaitableTimerExW(NULL, NULL, CREATE_WAITABLE_TIMER_HIGH_RESOLUTION, TIMER_ALL_ACCESS);
+	if (timer)
+		return timer;
+#endif
+	return CreateWaitableTimer(NULL, FALSE, NULL);
+}
+#endif
+
+static void fade_main()
+{
+#ifdef _WIN32
+	// The sessions' volume interfaces are free threaded in the MTA
+	HRESULT hResult = CoInitializeEx(NULL, COINIT_MULTITHREADED);
+	UniqueWin32Handle timer(create_tick_timer());
+#else
+	struct timespec next;
+	clock_gettime(CLOCK_MONOTONIC, &next);
+#endif
+	std::unique_lock<std::mutex> lock(fadeMutex);
+	for (;;)
+	{
+		if (!fadeCount && !stopping)
+		{
+			fadeChanged.wait(lock);
+#ifndef _WIN32
+			clock_gettime(CLOCK_MONOTONIC, &next);
+#endif
+			continue;
+		}
+		if (stopping)
+			break;
+
+		build_batch(fade_clock::now());
+		writing = true;
+		lock.unlock();
+		write_batch();
+		lock.lock();
+		writing = false;
+		batchCount = 0;
+		fadeChanged.notify_all();
+		if (!fadeCount || stopping)
+			continue;
+
+		lock.unlock();
+#ifdef _WIN32
+		// Relative, in 100ns units
+		LARGE_INTEGER due;
+		due.QuadPart = -(LONGLONG)FADE_TICK_MS * 10000;
+		if (timer && SetWaitableTimer(timer.get(), &due, 0, NULL, NULL, FALSE))
+			WaitForSingleObject(timer.get(), INFINITE);
+		else
+			Sleep(FADE_TICK_MS);
+#else
+		// Absolute, so the ticks don't drift by the time spent writing
+		next.tv_nsec += FADE_TICK_MS * 1000000L;
+		if (next.tv_nsec >= 1000000000L)
+		{
+			next.tv_nsec -= 1000000000L;
+			++next.tv_sec;
+		}
+		while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL) == EINTR)
+			;
+#endif
+		lock.lock();
+	}
+	lock.unlock();
+#ifdef _WIN32
+	if (SUCCEEDED(hResult))
+		CoUninitialize();
+#endif
+}
+
+bool fade_engine_start(unsigned int stepDurationMs)
+{
+	std::lock_guard<std::mutex> lock(fadeMutex);
+	stepDuration.store(stepDurationMs, std::memory_order_relaxed);
+	if (running)
+		return true;
+	stopping = false;
+	fadeThread = std::thread(fade_main);
+	running = true;
+	return true;
+}
+
+void fade_engine_stop()
+{
+	{
+		std::lock_guard<std::mutex> lock(fadeMutex);
+		if (!running)
+			return;
+		running = false;
+		stopping = true;
+		fadeCount = 0;
+		stepDuration.store(0, std::memory_order_relaxed);
+		fadeChanged.notify_all();
+	}
+	fadeThread.join();
+}
+
+unsigned int fade_step_duration()
+{
+	return stepDuration.load(std::memory_order_relaxed);
+}
+
+bool fade_to(FadeSink* sink, void* key, float from, float to, unsigned int durationMs)
+{
+	std::lock_guard<std::mutex> lock(fadeMutex);
+	if (!running)
+		return false;
+	fade_clock::time_point now = fade_clock::now();
+	Fade* fade = find_fade(sink, key);
+	if (fade)
+		from = fade_value(*fade, now);
+	else if (fadeCount == FADE_MAX)
+		return false;
+	else
+	{
+		fade = &fades[fadeCount++];
+		fade->sink = sink;
+		fade->key = key;
+	}
+	fade->from = from;
+	fade->to = to < 0.f ? 0.f : (to > 1.f ? 1.f : to);
+	fade->start = now;
+	fade->duration = std::chrono::milliseconds(durationMs);
+	fadeChanged.notify_all();
+	return true;
+}
+
+bool fade_add(FadeSink* sink, void* key, float delta, unsigned int durationMs, float* target, VolumeScale scale, unsigned int presses)
+{
+	std::lock_guard<std::mutex> lock(fadeMutex);
+	Fade* fade = find_fade(sink, key);
+	if (!running || !fade)
+		return false;
+	fade_clock::time_point now = fade_clock::now();
+	fade->from = fade_value(*fade, now);
+	fade->to = volume_step_target(fade->to, delta, scale, presses);
+	fade->start = now;
+	fade->duration = std::chrono::milliseconds(durationMs);
+	if (target)
+		*target = fade->to;
+	return true;
+}
+
+void fade_cancel(FadeSink* sink, void* key, bool wait)
+{
+	std::unique_lock<std::mutex> lock(fadeMutex);
+	Fade* fade = find_fade(sink, key);
+	if (fade)
+		*fade = fades[--fadeCount];
+	while (wait && writing && in_batch(sink, key, false))
+		fadeChanged.wait(lock);
+}
+
+void fade_cancel_all(FadeSink* sink)
+{
+	std::unique_lock<std::mutex> lock(fadeMutex);
+	for (unsigned int i = 0; i < fadeCount; )
+		if (fades[i].sink == sink)
+			fades[i] = fades[--fadeCount];
+		else
+			++i;
+	while (writing && in_batch(sink, NULL, true))
+		fadeChanged.wait(lock);
+}
+
+// The thread must not outlive its std::thread object, for exits that skip
+//   fade_engine_stop
+struct __fade_engine_cleanup {
+	~__fade_engine_cleanup()
+	{
+		fade_engine_stop();
+	}
+} __fade_engine_cleanup_inst;
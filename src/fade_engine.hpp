@@ -0,0 +1,66 @@
+#pragma once
+#ifndef __FADE_ENGINE_HPP__
+#define __FADE_ENGINE_HPP__
+
+#include "unicode.h"
+
+#include <stddef.h>
+
+#include "volume_steps.hpp"
+
+// Volume fades, driven by a single thread on a high resolution timer. Each
+//   tick computes every fade in flight and hands a provider all of its
+//   fades in one batch, so a tick costs one set of volume writes no matter
+//   how the fades were started.
+//
+// The fades live in a fixed table, nothing is allocated per tick or per
+//   fade. A fade is identified by its sink (the provider) and a key of the
+//   provider's choosing (a session interface, a stream index); starting a
+//   fade for a key that already has one continues from where that one is.
+
+#define FADE_MAX 64
+// Milliseconds between two writes of a fade
+#define FADE_TICK_MS 10
+// For fades asked for without a duration
+#define FADE_DEFAULT_DURATION 200
+
+struct FadeWrite
+{
+	void* key;
+	float volume;
+};
+
+class FadeSink
+{
+public:
+	virtual ~FadeSink() { }
+	// Called on the fade thread with every fade of this sink once per tick.
+	//   A fade cancelled without waiting can still show up once more.
+	virtual void fade_write(FadeWrite const* writes, unsigned int count) = 0;
+};
+
+// stepDurationMs is what the volume keys' steps are ramped over, 0 for
+//   jumping right to the new volume
+bool fade_engine_start(unsigned int stepDurationMs);
+// Drops the fades in flight where they are
+void fade_engine_stop();
+// 0 while the engine isn't running
+unsigned int fade_step_duration();
+
+// Returns false if the engine isn't running or the table is full, the
+//   caller writes the volume itself then. from is ignored if the key is
+//   fading already.
+bool fade_to(FadeSink* sink, void* key, float from, float to, unsigned int durationMs);
+// Moves the target of the key's fade a step of delta on (volume_step_target
+//   in the sink's scale, delta being presses key presses) and restarts it
+//   from where it is, the new target goes to target if given. Returns false
+//   if the key isn't fading.
+bool fade_add(FadeSink* sink, void* key, float delta, unsigned int durationMs, float* target = NULL, VolumeScale scale = SCALE_AMPLITUDE, unsigned int presses = 1);
+// With wait, also waits for a write of the fade in flight, so the key may
+//   be freed or written directly afterwards. Waiting must not be done
+//   holding a lock fade_write takes.
+void fade_cancel(FadeSink* sink, void* key, bool wait = true);
+// Every fade of a sink, for a provider going away
+void fade_cancel_all(FadeSink* sink);
+
+#endif // __FADE_ENGINE_HPP__
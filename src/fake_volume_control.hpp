@@ -0,0 +1,217 @@
+#pragma once
+#ifndef __FAKE_VOLUME_CONTROL_HPP__
+#define __FAKE_VOLUME_CONTROL_HPP__
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "fade_engine.hpp"
+#include "timeline.hpp"
+#include "volume_control.hpp"
+#include "volume_snapshot.hpp"
+#include "volume_steps.hpp"
+
+// In-memory provider standing in for a real audio stack, so recorded input
+//   can be run on machines without sound hardware. Fades are keyed by the
+//   session's index; the lock is only there for the fade thread's writes.
+class FakeVolumeControlProvider : public MediaPlayerVolumeControlProvider, private FadeSink
+{
+public:
+	struct Session
+	{
+		std::string processName;
+		float volume;
+		bool muted;
+
+		Session(std::string const& processName, float volume) : processName(processName), volume(volume), muted() { }
+	};
+private:
+	std::vector<Session> sessions;
+	bool verbose;
+	// Microseconds each write to a session takes, the audio service's
+	//   round trip for replays
+	unsigned int writeLatency;
+	std::atomic<unsigned long> writes;
+	std::mutex mutex;
+public:
+	FakeVolumeControlProvider(bool verbose = false) : sessions(), verbose(verbose), writeLatency(), writes(0), mutex() { }
+	~FakeVolumeControlProvider()
+	{
+		fade_cancel_all(this);
+	}
+
+	// Stands in for a player starting, so it gets its remembered state
+	void add_session(std::string const& processName, float volume = 1.f)
+	{
+		timeline_session_added(processName, volume);
+		std::lock_guard<std::mutex> lock(mutex);
+		sessions.push_back(Session(processName, volume));
+		VolumeSnapshotEntry entry;
+		if (!volume_snapshot_lookup(processName, entry))
+			return;
+		if (entry.flags & VolumeSnapshotEntry::HAS_VOLUME)
+			sessions.back().volume = entry.volume;
+		if (entry.flags & VolumeSnapshotEntry::HAS_MUTE)
+			sessions.back().muted = (entry.flags & VolumeSnapshotEntry::MUTED) != 0;
+	}
+	// The first session of the process. Fades are keyed by index, so all of
+	//   them end where they are.
+	void remove_session(std::string const& processName)
+	{
+		timeline_session_removed(processName);
+		fade_cancel_all(this);
+		std::lock_guard<std::mutex> lock(mutex);
+		for (std::vector<Session>::iterator start = sessions.begin(), end = sessions.end(); start != end; ++start)
+			if ((*start).processName == processName)
+			{
+				sessions.erase(start);
+				return;
+			}
+	}
+	// Not synchronized with the commands, for before the dispatcher starts
+	//   or between commands
+	std::vector<Session> const& get_sessions() const
+	{
+		return sessions;
+	}
+	void set_write_latency(unsigned int us)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		writeLatency = us;
+	}
+	// Session volumes and mute states written, fade steps included
+	unsigned long get_writes() const
+	{
+		return writes.load(std::memory_order_relaxed);
+	}
+private:
+	// Called with the lock held, like the audio service would hold up the
+	//   provider
+	void wrote()
+	{
+		writes.fetch_add(1, std::memory_order_relaxed);
+		if (writeLatency)
+			std::this_thread::sleep_for(std::chrono::microseconds(writeLatency));
+	}
+
+	static void* fade_key(size_t i)
+	{
+		return (void*)(uintptr_t)i;
+	}
+	virtual void fade_write(FadeWrite const* writes, unsigned int count)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		for (FadeWrite const* end = writes + count; writes != end; ++writes)
+		{
+			sessions[(uintptr_t)writes->key].volume = writes->volume;
+			wrote();
+		}
+	}
+
+	static bool matches(Session const& session, VolumeCommand const& command)
+	{
+		return command.target.empty() || session.processName == command.target;
+	}
+	// Called with the lock held
+	void change_volume(size_t i, float delta, unsigned int presses, unsigned int durationMs)
+	{
+		Session& session = sessions[i];
+		float volume = volume_step_target(session.volume, delta, SCALE_AMPLITUDE, presses);
+		if (verbose)
+			printf("%s: volume %.2f\n", session.processName.c_str(), volume);
+		// A fade in flight has its own target
+		if (!(durationMs && (fade_add(this, fade_key(i), delta, durationMs, &volume, SCALE_AMPLITUDE, presses) || fade_to(this, fade_key(i), session.volume, volume, durationMs))))
+		{
+			session.volume = volume;
+			wrote();
+		}
+		volume_snapshot_record_volume(session.processName, volume);
+	}
+	void set_mute(Session& session, bool mute)
+	{
+		session.muted = mute;
+		wrote();
+		volume_snapshot_record_mute(session.processName, mute);
+		if (verbose)
+			printf("%s: %s\n", session.processName.c_str(), mute ? "muted" : "unmuted");
+	}
+	virtual void apply_batch(VolumeCommand const* commands, size_t count, VOLUME_CHANGE_STATUS* statuses)
+	{
+		std::fill(statuses, statuses + count, STATUS_NOT_FOUND);
+		// Waits for the fades' writes in flight, so not under the lock
+		for (size_t c = 0; c < count; ++c)
+			if (commands[c].op == VolumeCommand::SET_VOLUME)
+				for (size_t i = 0; i < sessions.size(); ++i)
+					if (matches(sessions[i], commands[c]))
+						fade_cancel(this, fade_key(i));
+		unsigned int stepDurationMs = fade_step_duration();
+		std::lock_guard<std::mutex> lock(mutex);
+		for (size_t i = 0; i < sessions.size(); ++i)
+			for (size_t c = 0; c < count; ++c)
+			{
+				VolumeCommand const& command = commands[c];
+				Session& session = sessions[i];
+				if (!matches(session, command))
+					continue;
+				statuses[c] = STATUS_FOUND;
+				float volume = std::min<float>(std::max<float>(command.value, 0.f), 1.f);
+				switch (command.op)
+				{
+				case VolumeCommand::CHANGE:
+					change_volume(i, command.value, command.presses, stepDurationMs);
+					break;
+				case VolumeCommand::TOGGLE_MUTE:
+					set_mute(session, !session.muted);
+					break;
+				case VolumeCommand::FADE:
+					if (fade_to(this, fade_key(i), session.volume, volume, command.duration))
+					{
+						volume_snapshot_record_volume(session.processName, volume);
+						break;
+					}
+					// Fall through - jumping there instead
+				case VolumeCommand::SET_VOLUME:
+					// A fade an earlier command of the batch started
+					fade_cancel(this, fade_key(i), false);
+					session.volume = volume;
+					wrote();
+					volume_snapshot_record_volume(session.processName, volume);
+					break;
+				case VolumeCommand::SET_MUTE:
+					set_mute(session, command.value != 0.f);
+					break;
+				}
+			}
+	}
+	virtual VOLUME_CHANGE_STATUS get_target_volume(target_type const& target, float& volume, bool& muted)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		for (std::vector<Session>::iterator start = sessions.begin(), end = sessions.end(); start != end; ++start)
+			if (target.empty() || (*start).processName == target)
+			{
+				volume = (*start).volume;
+				muted = (*start).muted;
+				return STATUS_FOUND;
+			}
+		return STATUS_NOT_FOUND;
+	}
+	virtual void list_targets(std::vector<TargetState>& out)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		for (std::vector<Session>::iterator start = sessions.begin(), end = sessions.end(); start != end; ++start)
+		{
+			TargetState state = { (*start).processName, (*start).volume, (*start).muted };
+			out.push_back(state);
+		}
+	}
+};
+
+#endif // __FAKE_VOLUME_CONTROL_HPP__
@@ -0,0 +1,109 @@
+#include "unicode.h"
+
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include "file_io.hpp"
+
+#ifdef _WIN32
+bool FileReader::open(std::basic_string<TCHAR> const& path)
+{
+	file.reset(CreateFile(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL));
+	pos = size = 0;
+	return (bool)file;
+}
+
+bool FileReader::fill()
+{
+	DWORD read = 0;
+	if (!file || !ReadFile(file.get(), buffer, sizeof buffer, &read, NULL))
+		read = 0;
+	pos = 0;
+	size = read;
+	return size != 0;
+}
+
+bool FileWriter::open(std::basic_string<TCHAR> const& path)
+{
+	file.reset(CreateFile(path.c_str(), GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL));
+	size = 0;
+	failed = false;
+	return (bool)file;
+}
+
+void FileWriter::flush()
+{
+	DWORD written = 0;
+	if (size && (!WriteFile(file.get(), buffer, (DWORD)size, &written, NULL) || written != size))
+		failed = true;
+	size = 0;
+}
+
+bool FileWriter::close()
+{
+	if (!file)
+		return false;
+	flush();
+	if (!CloseHandle(file.release()))
+		failed = true;
+	return !failed;
+}
+#else
+bool FileReader::open(std::basic_string<TCHAR> const& path)
+{
+	file.reset(::open(path.c_str(), O_RDONLY | O_CLOEXEC));
+	pos = size = 0;
+	return (bool)file;
+}
+
+bool FileReader::fill()
+{
+	ssize_t read = -1;
+	if (file)
+		while ((read = ::read(file.get(), buffer, sizeof buffer)) < 0 && errno == EINTR)
+			;
+	pos = 0;
+	size = read > 0 ? (size_t)read : 0;
+	return size != 0;
+}
+
+bool FileWriter::open(std::basic_string<TCHAR> const& path)
+{
+	file.reset(::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666));
+	size = 0;
+	failed = false;
+	return (bool)file;
+}
+
+void FileWriter::flush()
+{
+	for (size_t done = 0; done < size;)
+	{
+		ssize_t written = ::write(file.get(), buffer + done, size - done);
+		if (written < 0 && errno == EINTR)
+			continue;
+		if (written <= 0)
+		{
+			failed = true;
+			break;
+		}
+		done += (size_t)written;
+	}
+	size = 0;
+}
+
+bool FileWriter::close()
+{
+	if (!file)
+		return false;
+	flush();
+	if (::close(file.release()) != 0)
+		failed = true;
+	return !failed;
+}
+#endif
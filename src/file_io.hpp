@@ -0,0 +1,203 @@
+#pragma once
+#ifndef __FILE_IO_HPP__
+#define __FILE_IO_HPP__
+
+#include "unicode.h"
+
+#ifdef _WIN32
+#include <tchar.h>
+#endif
+
+#include <stddef.h>
+
+#include <iterator>
+#include <string>
+
+#include "handles.hpp"
+
+// Buffered reading and writing of small text files straight on CreateFile
+//   and open, so the config doesn't pull in iostreams with their locales
+//   and static initialization. Lines end in \n inside and in \r\n in the
+//   files on Windows, like a text mode stream; a \r read is dropped.
+
+#define FILE_IO_BUFFER 4096
+
+class FileReader
+{
+private:
+#ifdef _WIN32
+	UniqueFileHandle file;
+#else
+	UniqueFd file;
+#endif
+	char buffer[FILE_IO_BUFFER];
+	size_t pos, size;
+
+	bool fill();
+public:
+	// Like istreambuf_iterator: copies share the reader's position and two
+	//   compare equal if both or neither are at the end
+	class iterator
+	{
+	private:
+		FileReader* reader;
+
+		bool at_end() const
+		{
+			return !reader || reader->peek() < 0;
+		}
+	public:
+		typedef std::input_iterator_tag iterator_category;
+		typedef char value_type;
+		typedef ptrdiff_t difference_type;
+		typedef char const* pointer;
+		typedef char reference;
+
+		iterator() : reader() { }
+		explicit iterator(FileReader* reader) : reader(reader) { }
+
+		char operator*() const
+		{
+			return (char)reader->peek();
+		}
+		iterator& operator++()
+		{
+			reader->skip();
+			return *this;
+		}
+		iterator operator++(int)
+		{
+			iterator ret = *this;
+			reader->skip();
+			return ret;
+		}
+		bool operator==(iterator const& other) const
+		{
+			return at_end() == other.at_end();
+		}
+		bool operator!=(iterator const& other) const
+		{
+			return at_end() != other.at_end();
+		}
+	};
+
+	FileReader() : file(), pos(), size() { }
+	FileReader(FileReader const&) = delete;
+	FileReader& operator=(FileReader const&) = delete;
+
+	bool open(std::basic_string<TCHAR> const& path);
+
+	// The next character without taking it, -1 at the end or on errors
+	int peek()
+	{
+		for (;; ++pos)
+		{
+			if (pos == size && !fill())
+				return -1;
+			if (buffer[pos] != '\r')
+				return (unsigned char)buffer[pos];
+		}
+	}
+	void skip()
+	{
+		if (peek() >= 0)
+			++pos;
+	}
+
+	iterator begin()
+	{
+		return iterator(this);
+	}
+	iterator end()
+	{
+		return iterator();
+	}
+};
+
+class FileWriter
+{
+private:
+#ifdef _WIN32
+	UniqueFileHandle file;
+#else
+	UniqueFd file;
+#endif
+	char buffer[FILE_IO_BUFFER];
+	size_t size;
+	bool failed;
+
+	void flush();
+	void put_raw(char c)
+	{
+		if (size == FILE_IO_BUFFER)
+			flush();
+		buffer[size++] = c;
+	}
+public:
+	// Like ostreambuf_iterator
+	class iterator
+	{
+	private:
+		FileWriter* writer;
+	public:
+		typedef std::output_iterator_tag iterator_category;
+		typedef void value_type;
+		typedef ptrdiff_t difference_type;
+		typedef void pointer;
+		typedef void reference;
+
+		explicit iterator(FileWriter* writer) : writer(writer) { }
+
+		iterator& operator*()
+		{
+			return *this;
+		}
+		iterator& operator=(char c)
+		{
+			writer->put(c);
+			return *this;
+		}
+		iterator& operator++()
+		{
+			return *this;
+		}
+		iterator& operator++(int)
+		{
+			return *this;
+		}
+	};
+
+	FileWriter() : file(), size(), failed() { }
+	FileWriter(FileWriter const&) = delete;
+	FileWriter& operator=(FileWriter const&) = delete;
+	~FileWriter()
+	{
+		close();
+	}
+
+	// Creates the file or truncates it
+	bool open(std::basic_string<TCHAR> const& path);
+	// False if a write failed since open
+	bool close();
+
+	void put(char c)
+	{
+#ifdef _WIN32
+		if (c == '\n')
+			put_raw('\r');
+#endif
+		put_raw(c);
+	}
+	void write(char const* str)
+	{
+		for (; *str != '\0'; ++str)
+			put(*str);
+	}
+
+	iterator out()
+	{
+		return iterator(this);
+	}
+};
+
+#endif // __FILE_IO_HPP__
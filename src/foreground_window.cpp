@@ -0,0 +1,48 @@
+#include "unicode.h"
+
+#include <atomic>
+
+#include <Windows.h>
+
+#include "foreground_window.hpp"
+#include "handles.hpp"
+
+static std::atomic<DWORD> foregroundProcessId(0);
+static UniqueWinEventHook foregroundHook;
+
+// Only called when the foreground changes, which is what makes the process
+//   id worth caching: the key presses in between just load it.
+static void CALLBACK foreground_changed(HWINEVENTHOOK, DWORD, HWND hwnd, LONG idObject, LONG, DWORD, DWORD)
+{
+	if (idObject != OBJID_WINDOW || !hwnd)
+		return;
+	DWORD processId = 0;
+	GetWindowThreadProcessId(hwnd, &processId);
+	foregroundProcessId.store(processId, std::memory_order_relaxed);
+}
+
+bool foreground_tracking_start()
+{
+	if (foregroundHook)
+		return true;
+	// Out of context, so nothing gets injected anywhere. Our own windows
+	//   (the tray menu) don't count as foreground, the player behind them does.
+	foregroundHook.reset(SetWinEventHook(EVENT_SYSTEM_FOREGROUND, EVENT_SYSTEM_FOREGROUND, NULL, foreground_changed, 0, 0, WINEVENT_OUTOFCONTEXT | WINEVENT_SKIPOWNPROCESS));
+	if (!foregroundHook)
+		return false;
+	HWND hwnd = GetForegroundWindow();
+	if (hwnd)
+		foreground_changed(NULL, EVENT_SYSTEM_FOREGROUND, hwnd, OBJID_WINDOW, CHILDID_SELF, 0, 0);
+	return true;
+}
+
+void foreground_tracking_stop()
+{
+	foregroundHook.reset();
+	foregroundProcessId.store(0, std::memory_order_relaxed);
+}
+
+DWORD foreground_process_id()
+{
+	return foregroundProcessId.load(std::memory_order_relaxed);
+}
@@ -0,0 +1,18 @@
+#pragma once
+#ifndef __FOREGROUND_WINDOW_HPP__
+#define __FOREGROUND_WINDOW_HPP__
+
+#include "unicode.h"
+
+#include <Windows.h>
+
+// Follows the foreground window, so the volume keys can go to the player the
+//   user is looking at. The hook is called on the thread that installed it,
+//   from its message loop; the process id can be read from any thread.
+bool foreground_tracking_start();
+void foreground_tracking_stop();
+
+// Process of the foreground window, 0 if unknown or not tracking
+DWORD foreground_process_id();
+
+#endif // __FOREGROUND_WINDOW_HPP__
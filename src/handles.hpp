@@ -0,0 +1,243 @@
+#pragma once
+#ifndef __HANDLES_HPP__
+#define __HANDLES_HPP__
+
+#include "unicode.h"
+
+#include <utility>
+
+#ifdef _WIN32
+#include <Windows.h>
+#include <Unknwn.h>
+#include <OleAuto.h>
+#else
+#include <unistd.h>
+#endif
+
+// Move-only owner of a handle.
+//
+// Deleter is a stateless function object that also provides the invalid
+//   value of the handle type:
+//
+//   struct Deleter
+//   {
+//       static T invalid() noexcept;
+//       void operator()(T value) const noexcept;
+//   };
+//
+// It is inherited from instead of stored, so a UniqueHandle is exactly as
+//   big as the handle and the call to the deleter is a direct one.
+template<typename T, typename Deleter>
+class UniqueHandle : private Deleter
+{
+private:
+	T value;
+public:
+	UniqueHandle() noexcept : Deleter(), value(Deleter::invalid()) { }
+	explicit UniqueHandle(T value) noexcept : Deleter(), value(value) { }
+
+	UniqueHandle(UniqueHandle&& other) noexcept : Deleter(), value(std::exchange(other.value, Deleter::invalid())) { }
+	UniqueHandle& operator=(UniqueHandle&& other) noexcept
+	{
+		reset(std::exchange(other.value, Deleter::invalid()));
+		return *this;
+	}
+	UniqueHandle(UniqueHandle const&) = delete;
+	UniqueHandle& operator=(UniqueHandle const&) = delete;
+
+	~UniqueHandle()
+	{
+		if (value != Deleter::invalid())
+			deleter()(value);
+	}
+
+	T get() const noexcept
+	{
+		return value;
+	}
+	explicit operator bool() const noexcept
+	{
+		return value != Deleter::invalid();
+	}
+
+	// Gives up ownership without closing
+	T release() noexcept
+	{
+		return std::exchange(value, Deleter::invalid());
+	}
+	void reset(T newValue = Deleter::invalid()) noexcept
+	{
+		T old = std::exchange(value, newValue);
+		if (old != Deleter::invalid())
+			deleter()(old);
+	}
+	// Out-parameter for functions returning a new handle through a pointer,
+	//   the current one is closed first
+	T* put() noexcept
+	{
+		reset();
+		return &value;
+	}
+
+	friend void swap(UniqueHandle& first, UniqueHandle& second) noexcept
+	{
+		std::swap(first.value, second.value);
+	}
+private:
+	Deleter const& deleter() const noexcept
+	{
+		return *this;
+	}
+};
+
+// Deleter calling a free function, for handles that are invalid when zero
+template<typename T, auto Close>
+struct FunctionDeleter
+{
+	static T invalid() noexcept
+	{
+		return T();
+	}
+	void operator()(T value) const noexcept
+	{
+		Close(value);
+	}
+};
+
+// Runs a function at the end of the scope unless dismissed
+template<typename Function>
+class ScopeGuard
+{
+private:
+	Function f;
+	bool active;
+public:
+	explicit ScopeGuard(Function f, bool active = true) : f(std::move(f)), active(active) { }
+
+	ScopeGuard(ScopeGuard&& other) : f(std::move(other.f)), active(std::exchange(other.active, false)) { }
+	ScopeGuard& operator=(ScopeGuard&&) = delete;
+	ScopeGuard(ScopeGuard const&) = delete;
+	ScopeGuard& operator=(ScopeGuard const&) = delete;
+
+	~ScopeGuard()
+	{
+		if (active)
+			f();
+	}
+
+	void arm(bool enable = true)
+	{
+		active = enable;
+	}
+	void dismiss()
+	{
+		active = false;
+	}
+	bool armed() const
+	{
+		return active;
+	}
+};
+
+template<class Interface>
+struct ComReleaser
+{
+	static Interface* invalid() noexcept
+	{
+		return nullptr;
+	}
+	void operator()(Interface* p) const noexcept
+	{
+		p->Release();
+	}
+};
+
+// Owning COM interface pointer. Move-only like the other handles, a second
+//   reference has to be asked for with copy().
+template<class Interface>
+class ComPtr : public UniqueHandle<Interface*, ComReleaser<Interface>>
+{
+private:
+	typedef UniqueHandle<Interface*, ComReleaser<Interface>> base_type;
+public:
+	ComPtr() noexcept : base_type() { }
+	// Takes over the reference
+	explicit ComPtr(Interface* p) noexcept : base_type(p) { }
+	ComPtr(ComPtr&&) noexcept = default;
+	ComPtr& operator=(ComPtr&&) noexcept = default;
+
+	Interface* operator->() const noexcept
+	{
+		return this->get();
+	}
+
+	ComPtr copy() const noexcept
+	{
+		if (this->get())
+			this->get()->AddRef();
+		return ComPtr(this->get());
+	}
+
+	// For CoCreateInstance, Activate and friends
+	void** put_void() noexcept
+	{
+		return reinterpret_cast<void**>(this->put());
+	}
+
+#ifdef _WIN32
+	// QueryInterface straight into a typed pointer
+	template<class Other>
+	HRESULT query(REFIID iid, ComPtr<Other>& out) const noexcept
+	{
+		return this->get()->QueryInterface(iid, out.put_void());
+	}
+#endif
+};
+
+#ifdef _WIN32
+typedef UniqueHandle<HANDLE, FunctionDeleter<HANDLE, CloseHandle>> UniqueWin32Handle;
+struct FileHandleDeleter
+{
+	static HANDLE invalid() noexcept
+	{
+		return INVALID_HANDLE_VALUE;
+	}
+	void operator()(HANDLE h) const noexcept
+	{
+		CloseHandle(h);
+	}
+};
+// CreateFile and CreateNamedPipe return INVALID_HANDLE_VALUE instead of NULL
+typedef UniqueHandle<HANDLE, FileHandleDeleter> UniqueFileHandle;
+typedef UniqueHandle<HWND, FunctionDeleter<HWND, DestroyWindow>> UniqueHwnd;
+typedef UniqueHandle<HMENU, FunctionDeleter<HMENU, DestroyMenu>> UniqueHmenu;
+typedef UniqueHandle<HLOCAL, FunctionDeleter<HLOCAL, LocalFree>> UniqueHlocal;
+typedef UniqueHandle<HWINEVENTHOOK, FunctionDeleter<HWINEVENTHOOK, UnhookWinEvent>> UniqueWinEventHook;
+typedef UniqueHandle<BSTR, FunctionDeleter<BSTR, SysFreeString>> UniqueBstr;
+// Strings COM hands out, like IMMDevice::GetId
+typedef UniqueHandle<LPWSTR, FunctionDeleter<LPWSTR, CoTaskMemFree>> UniqueCoTaskMemString;
+#else
+struct FdDeleter
+{
+	static int invalid() noexcept
+	{
+		return -1;
+	}
+	void operator()(int fd) const noexcept
+	{
+		close(fd);
+	}
+};
+typedef UniqueHandle<int, FdDeleter> UniqueFd;
+#endif
+
+// The point of all of the above
+static_assert(sizeof(ComPtr<struct IncompleteInterface>) == sizeof(void*), "ComPtr must be pointer sized");
+#ifdef _WIN32
+static_assert(sizeof(UniqueWin32Handle) == sizeof(HANDLE), "UniqueHandle must be handle sized");
+static_assert(sizeof(UniqueBstr) == sizeof(BSTR), "UniqueHandle must be handle sized");
+#else
+static_assert(sizeof(UniqueFd) == sizeof(int), "UniqueHandle must be handle sized");
+#endif
+
+#endif // __HANDLES_HPP__
@@ -0,0 +1,90 @@
+#pragma once
+#ifndef __IPC_HPP__
+#define __IPC_HPP__
+
+#include "unicode.h"
+
+#include <string>
+#include <vector>
+
+#include "ipc_protocol.hpp"
+
+// Local command endpoint of the running instance (see ipc_protocol.hpp),
+//   a named pipe on Windows and a Unix domain socket in the portable build.
+
+// Client mode of the same binary: sends all commands in one write and
+//   prints the responses. Returns 0 if every command succeeded.
+int ipc_client(std::vector<std::string> const& commands);
+
+#ifdef _WIN32
+#include <Windows.h>
+
+// The commands run on the window's thread, the COM objects of the providers
+//   live in its apartment. The window must hand the IpcBatch in lParam of
+//   executeMessage to ipc_execute_batch.
+struct IpcBatch
+{
+	std::string* input;
+	std::string* output;
+};
+inline void ipc_execute_batch(IpcBatch* batch)
+{
+	batch->input->erase(0, ipc_process_input(batch->input->data(), batch->input->size(), *batch->output));
+}
+
+bool ipc_server_start(HWND hWnd, UINT executeMessage);
+// Has to be called on the window's thread, while the window is still there,
+//   it runs the batch the server may be waiting on.
+void ipc_server_stop();
+#else
+#include <sys/epoll.h>
+
+#include "event_loop.hpp"
+#include "handles.hpp"
+
+// Responses held for a client that doesn't read them, past it the server
+//   stops reading from the client until they are sent
+#define IPC_OUTPUT_MAX 65536
+
+class IpcServer : public EventLoop::Handler
+{
+private:
+	class Connection : public EventLoop::Handler
+	{
+	public:
+		IpcServer& owner;
+		int fd;
+		std::string input;
+		std::string output;
+		// What the connection is registered for with the loop
+		uint32_t events;
+
+		Connection(IpcServer& owner, int fd) : owner(owner), fd(fd), input(), output(), events(EPOLLIN) { }
+		~Connection();
+
+		virtual void on_event(uint32_t events);
+		bool flush();
+	};
+
+	EventLoop& loop;
+	UniqueFd listenFd;
+	std::string path;
+	std::vector<Connection*> connections;
+	void (*executed)();
+public:
+	// executed is called after every batch of commands
+	IpcServer(EventLoop& loop, void (*executed)() = NULL) : loop(loop), listenFd(), path(), connections(), executed(executed) { }
+	~IpcServer();
+
+	static std::string socket_path();
+
+	// Fails with EADDRINUSE if another instance is listening already
+	bool listen();
+
+	virtual void on_event(uint32_t events);
+private:
+	void close_connection(Connection* connection);
+};
+#endif
+
+#endif // __IPC_HPP__
@@ -0,0 +1,242 @@
+#include "ipc.hpp"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include <algorithm>
+
+#include "errors.hpp"
+
+static bool make_address(std::string const& path, struct sockaddr_un& addr)
+{
+	memset(&addr, 0, sizeof addr);
+	addr.sun_family = AF_UNIX;
+	if (path.length() >= sizeof addr.sun_path)
+		return false;
+	memcpy(addr.sun_path, path.c_str(), path.length() + 1);
+	return true;
+}
+
+std::string IpcServer::socket_path()
+{
+	char const* dir = getenv("XDG_RUNTIME_DIR");
+	if (dir && *dir)
+		return std::string(dir) + "/mpVolCtrl.sock";
+	char buf[64];
+	snprintf(buf, sizeof buf, "/tmp/mpVolCtrl-%u.sock", (unsigned)getuid());
+	return buf;
+}
+
+IpcServer::Connection::~Connection()
+{
+	close(fd);
+}
+
+bool IpcServer::Connection::flush()
+{
+	while (!output.empty())
+	{
+		ssize_t len = send(fd, output.data(), output.size(), MSG_NOSIGNAL);
+		if (len < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			if (errno != EAGAIN)
+				return false;
+			break;
+		}
+		output.erase(0, (size_t)len);
+	}
+
+	// Only wait for EPOLLOUT while something is stuck in the buffer, and
+	//   leave the client's commands in the socket while too much is
+	uint32_t wanted = (output.size() > IPC_OUTPUT_MAX ? 0u : (uint32_t)EPOLLIN) | (output.empty() ? 0u : (uint32_t)EPOLLOUT);
+	if (wanted == events)
+		return true;
+	events = wanted;
+	return owner.loop.modify(fd, events, this);
+}
+
+void IpcServer::Connection::on_event(uint32_t events)
+{
+	if (events & EPOLLIN)
+	{
+		char buf[4096];
+		ssize_t len;
+		bool eof = false, executed = false;
+		while ((len = recv(fd, buf, sizeof buf, 0)) != 0)
+		{
+			if (len < 0)
+			{
+				if (errno == EINTR)
+					continue;
+				eof = errno != EAGAIN;
+				break;
+			}
+			// Lines run as they complete, what is held is the one still
+			//   coming, and that one only up to IPC_LINE_MAX
+			input.append(buf, (size_t)len);
+			size_t consumed = ipc_process_input(input.data(), input.size(), output);
+			input.erase(0, consumed);
+			executed = executed || consumed;
+			if (input.size() > IPC_LINE_MAX || output.size() > IPC_OUTPUT_MAX)
+				break;
+		}
+		if (len == 0)
+			eof = true;
+
+		// Everything that arrived in this wakeup is answered with one send
+		if (executed && owner.executed)
+			owner.executed();
+		if (input.size() > IPC_LINE_MAX || !flush() || (eof && output.empty()))
+		{
+			owner.close_connection(this);
+			return;
+		}
+	}
+	else if ((events & EPOLLOUT) && !flush())
+	{
+		owner.close_connection(this);
+		return;
+	}
+	if (events & (EPOLLHUP | EPOLLERR))
+		owner.close_connection(this);
+}
+
+IpcServer::~IpcServer()
+{
+	for (std::vector<Connection*>::iterator start = connections.begin(), end = connections.end(); start != end; ++start)
+		delete *start;
+	if (listenFd)
+		unlink(path.c_str());
+}
+
+bool IpcServer::listen()
+{
+	path = socket_path();
+	struct sockaddr_un addr;
+	if (!make_address(path, addr))
+	{
+		ShowErrorMessage(ENAMETOOLONG, "IPC socket path error");
+		return false;
+	}
+	listenFd.reset(socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0));
+	if (!listenFd)
+	{
+		ShowErrorMessage(errno, "socket error");
+		return false;
+	}
+
+	if (bind(listenFd.get(), (struct sockaddr*)&addr, sizeof addr) == -1)
+	{
+		int error = errno;
+		if (error == EADDRINUSE)
+		{
+			// Left over from a crashed instance if nobody answers
+			UniqueFd probe(socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0));
+			bool alive = probe && ::connect(probe.get(), (struct sockaddr*)&addr, sizeof addr) == 0;
+			if (!alive && unlink(path.c_str()) == 0 && bind(listenFd.get(), (struct sockaddr*)&addr, sizeof addr) == 0)
+				error = 0;
+		}
+		if (error)
+		{
+			if (error != EADDRINUSE)
+				ShowErrorMessage(error, "bind error");
+			listenFd.reset();
+			errno = error;
+			return false;
+		}
+	}
+	if (::listen(listenFd.get(), 8) == -1 || !loop.add(listenFd.get(), EPOLLIN, this))
+	{
+		ShowErrorMessage(errno, "listen error");
+		listenFd.reset();
+		unlink(path.c_str());
+		return false;
+	}
+	return true;
+}
+
+void IpcServer::on_event(uint32_t)
+{
+	int fd;
+	while ((fd = accept4(listenFd.get(), NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) != -1)
+	{
+		Connection* connection = new Connection(*this, fd);
+		if (!loop.add(fd, EPOLLIN, connection))
+		{
+			delete connection;
+			continue;
+		}
+		connections.push_back(connection);
+	}
+}
+
+void IpcServer::close_connection(Connection* connection)
+{
+	loop.remove(connection->fd);
+	connections.erase(std::remove(connections.begin(), connections.end(), connection), connections.end());
+	delete connection;
+}
+
+int ipc_client(std::vector<std::string> const& commands)
+{
+	struct sockaddr_un addr;
+	int fd;
+	if (!make_address(IpcServer::socket_path(), addr) || (fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) == -1)
+		return 2;
+	if (connect(fd, (struct sockaddr*)&addr, sizeof addr) == -1)
+	{
+		ShowErrorMessage(errno, "Couldn't connect to the running instance");
+		close(fd);
+		return 2;
+	}
+
+	std::string request;
+	for (std::vector<std::string>::const_iterator start = commands.begin(), end = commands.end(); start != end; ++start)
+		request.append(*start).push_back('\n');
+	for (size_t off = 0; off < request.size();)
+	{
+		ssize_t len = send(fd, request.data() + off, request.size() - off, MSG_NOSIGNAL);
+		if (len < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			close(fd);
+			return 2;
+		}
+		off += (size_t)len;
+	}
+	shutdown(fd, SHUT_WR);
+
+	int ret = 0;
+	bool lineStart = true;
+	char buf[4096];
+	ssize_t len;
+	while ((len = recv(fd, buf, sizeof buf, 0)) != 0)
+	{
+		if (len < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			ret = 2;
+			break;
+		}
+		for (ssize_t i = 0; i < len; ++i)
+		{
+			if (lineStart && buf[i] == 'E')
+				ret = 1;
+			lineStart = buf[i] == '\n';
+		}
+		fwrite(buf, 1, (size_t)len, stdout);
+	}
+	close(fd);
+	return ret;
+}
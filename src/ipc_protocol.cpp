@@ -0,0 +1,257 @@
+#include "unicode.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <vector>
+
+#include "fade_engine.hpp"
+#include "ipc_protocol.hpp"
+#include "metrics.hpp"
+#include "volume_control.hpp"
+
+static const size_t maxArgs = 4;
+
+static bool (*reloadHandler)(std::string& error) = NULL;
+
+void ipc_set_reload_handler(bool (*handler)(std::string& error))
+{
+	reloadHandler = handler;
+}
+
+// Returns maxArgs + 1 if there are more words than args takes
+static size_t split_args(char const* line, size_t len, std::string (&args)[maxArgs])
+{
+	size_t n = 0;
+	char const *p = line, *end = line + len;
+	while (p != end)
+	{
+		while (p != end && (*p == ' ' || *p == '\t' || *p == '\r'))
+			++p;
+		char const* start = p;
+		while (p != end && *p != ' ' && *p != '\t' && *p != '\r')
+			++p;
+		if (p == start)
+			continue;
+		if (n == maxArgs)
+			return maxArgs + 1;
+		args[n++].assign(start, p);
+	}
+	return n;
+}
+
+// Words a command takes, with its name. batch takes the rest of the line,
+//   and an unknown command is answered as such whatever follows.
+static size_t command_args(std::string const& name)
+{
+	if (name == "ping" || name == "stats" || name == "reload")
+		return 1;
+	if (name == "up" || name == "down" || name == "get")
+		return 2;
+	if (name == "mute" || name == "set")
+		return 3;
+	if (name == "fade")
+		return 4;
+	return (size_t)-1;
+}
+
+static bool parse_float(std::string const& str, float& out)
+{
+	char* end;
+	out = strtof(str.c_str(), &end);
+	return !str.empty() && *end == '\0';
+}
+
+// Milliseconds, up to a minute
+static bool parse_duration(std::string const& str, unsigned int& out)
+{
+	char* end;
+	unsigned long value = strtoul(str.c_str(), &end, 10);
+	out = (unsigned int)value;
+	return !str.empty() && *end == '\0' && value <= 60000;
+}
+
+static MediaPlayerVolumeControlProvider::target_type to_target(std::string const& arg)
+{
+	return arg == "*" ? MediaPlayerVolumeControlProvider::target_type() : arg;
+}
+
+static void append_status(std::string& response, MediaPlayerVolumeControlProvider::VOLUME_CHANGE_STATUS status)
+{
+	switch (status)
+	{
+	case MediaPlayerVolumeControlProvider::STATUS_FOUND:
+		response.append("OK");
+		break;
+	case MediaPlayerVolumeControlProvider::STATUS_NOT_FOUND:
+		response.append("ERR not found");
+		break;
+	default:
+		response.append("ERR provider error");
+		break;
+	}
+}
+
+// One command of a batch line, false if it isn't one
+static bool parse_batch_command(char const* text, size_t len, MediaPlayerVolumeControlProvider::VolumeCommand& out)
+{
+	typedef MediaPlayerVolumeControlProvider::VolumeCommand VolumeCommand;
+	std::string args[maxArgs];
+	size_t n = split_args(text, len, args);
+	if (n < 2 || n > maxArgs)
+		return false;
+	out.target = to_target(args[1]);
+	out.duration = 0;
+	if (args[0] == "change")
+	{
+		out.op = VolumeCommand::CHANGE;
+		return n == 3 && parse_float(args[2], out.value);
+	}
+	if (args[0] == "mute")
+	{
+		out.op = n == 2 ? VolumeCommand::TOGGLE_MUTE : VolumeCommand::SET_MUTE;
+		out.value = n == 3 && args[2] == "1" ? 1.f : 0.f;
+		return n == 2 || (n == 3 && (args[2] == "0" || args[2] == "1"));
+	}
+	if (args[0] == "set")
+	{
+		out.op = VolumeCommand::SET_VOLUME;
+		return n == 3 && parse_float(args[2], out.value);
+	}
+	if (args[0] == "fade")
+	{
+		out.op = VolumeCommand::FADE;
+		out.duration = FADE_DEFAULT_DURATION;
+		return n >= 3 && parse_float(args[2], out.value) && (n == 3 || parse_duration(args[3], out.duration));
+	}
+	return false;
+}
+
+// The commands go to the providers together, one pass over their sessions
+static void execute_batch(char const* p, char const* end, std::string& response)
+{
+	std::vector<MediaPlayerVolumeControlProvider::VolumeCommand> commands;
+	for (;;)
+	{
+		char const* sep = (char const*)memchr(p, ';', end - p);
+		commands.push_back(MediaPlayerVolumeControlProvider::VolumeCommand(MediaPlayerVolumeControlProvider::VolumeCommand::CHANGE));
+		if (!parse_batch_command(p, (sep ? sep : end) - p, commands.back()))
+		{
+			char buf[32];
+			snprintf(buf, sizeof buf, "ERR bad command %u", (unsigned int)commands.size());
+			response.append(buf);
+			return;
+		}
+		if (!sep)
+			break;
+		p = sep + 1;
+	}
+	std::vector<MediaPlayerVolumeControlProvider::VOLUME_CHANGE_STATUS> statuses(commands.size());
+	volume_batch(commands.data(), commands.size(), statuses.data());
+	response.append("OK");
+	for (std::vector<MediaPlayerVolumeControlProvider::VOLUME_CHANGE_STATUS>::const_iterator start = statuses.begin(), end = statuses.end(); start != end; ++start)
+		response.append(*start == MediaPlayerVolumeControlProvider::STATUS_FOUND ? " ok" : *start == MediaPlayerVolumeControlProvider::STATUS_NOT_FOUND ? " notfound" : " error");
+}
+
+void ipc_execute(char const* line, size_t len, std::string& response)
+{
+	mpvc_metrics.ipcCommands.fetch_add(1, std::memory_order_relaxed);
+
+	std::string args[maxArgs];
+	size_t n = split_args(line, len, args);
+	float value;
+	if (n == 0)
+		response.append("ERR empty command");
+	else if (n > command_args(args[0]))
+		response.append("ERR too many arguments");
+	else if (args[0] == "ping")
+		response.append("OK pong");
+	else if (args[0] == "up" || args[0] == "down")
+	{
+		value = .05f;
+		if (n > 1 && (!parse_float(args[1], value) || value < 0.f))
+			response.append("ERR bad amount");
+		else
+			append_status(response, args[0] == "up" ? volume_up(value) : volume_down(value));
+	}
+	else if (args[0] == "mute")
+	{
+		if (n == 1)
+			append_status(response, volume_mute());
+		else if (n == 3 && (args[2] == "0" || args[2] == "1"))
+			append_status(response, volume_set_mute(to_target(args[1]), args[2] == "1"));
+		else
+			response.append("ERR usage: mute [<app> <0|1>]");
+	}
+	else if (args[0] == "set")
+	{
+		if (n == 3 && parse_float(args[2], value))
+			append_status(response, volume_set(to_target(args[1]), value));
+		else
+			response.append("ERR usage: set <app> <volume>");
+	}
+	else if (args[0] == "fade")
+	{
+		unsigned int duration = FADE_DEFAULT_DURATION;
+		if (n >= 3 && parse_float(args[2], value) && (n == 3 || parse_duration(args[3], duration)))
+			append_status(response, volume_fade(to_target(args[1]), value, duration));
+		else
+			response.append("ERR usage: fade <app> <volume> [ms]");
+	}
+	else if (args[0] == "get")
+	{
+		bool muted = false;
+		MediaPlayerVolumeControlProvider::VOLUME_CHANGE_STATUS status = volume_get(n > 1 ? to_target(args[1]) : MediaPlayerVolumeControlProvider::target_type(), value, muted);
+		if (status == MediaPlayerVolumeControlProvider::STATUS_FOUND)
+		{
+			char buf[32];
+			snprintf(buf, sizeof buf, "OK %.4f %d", value, muted ? 1 : 0);
+			response.append(buf);
+		}
+		else
+			append_status(response, status);
+	}
+	else if (args[0] == "batch")
+	{
+		// The rest of the line, past the word
+		char const* p = line, *end = line + len;
+		while (p != end && (*p == ' ' || *p == '\t'))
+			++p;
+		p += 5;
+		if (n < 3)
+			response.append("ERR usage: batch <command>[; <command>...]");
+		else
+			execute_batch(p, end, response);
+	}
+	else if (args[0] == "stats")
+	{
+		std::string stats;
+		mpvc_metrics.format(stats);
+		response.append("OK ").append(stats);
+	}
+	else if (args[0] == "reload")
+	{
+		std::string error;
+		if (!reloadHandler)
+			response.append("ERR not supported");
+		else if (!reloadHandler(error))
+			response.append("ERR ").append(error);
+		else
+			response.append("OK");
+	}
+	else
+		response.append("ERR unknown command");
+	response.push_back('\n');
+}
+
+size_t ipc_process_input(char const* data, size_t len, std::string& responses)
+{
+	char const *start = data, *end = data + len, *eol;
+	while ((eol = (char const*)memchr(start, '\n', end - start)))
+	{
+		ipc_execute(start, eol - start, responses);
+		start = eol + 1;
+	}
+	return start - data;
+}
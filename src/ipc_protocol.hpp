@@ -0,0 +1,47 @@
+#pragma once
+#ifndef __IPC_PROTOCOL_HPP__
+#define __IPC_PROTOCOL_HPP__
+
+#include <stddef.h>
+
+#include <string>
+
+// Line based command protocol of the local IPC endpoint. Every command is
+//   one line, every command gets exactly one response line, in order, so a
+//   client can pipeline as many commands as it likes in a single write.
+//
+//   ping                       OK pong
+//   up [amount]                OK | ERR not found
+//   down [amount]
+//   mute                       toggles the mute state of everything
+//   mute <app|*> <0|1>
+//   set <app|*> <volume>       volume in 0..1
+//   fade <app|*> <volume> [ms] over 200 ms by default
+//   get [app]                  OK <volume> <0|1>
+//   batch <cmd>[; <cmd>...]    OK <ok|notfound|error> per command
+//     change <app|*> <delta>   * is what the keys change
+//     mute <app|*> [0|1]       toggles without the state
+//     set <app|*> <volume>
+//     fade <app|*> <volume> [ms]
+//   stats                      OK name=value ...
+//   reload                     OK | ERR <reason>, reads KeyBindings from the
+//                              config again
+//
+// Responses start with "OK" or "ERR <reason>", a command with more
+//   arguments than it takes gets "ERR too many arguments".
+
+// Longest line the endpoints take, a client sending a longer one is
+//   disconnected
+#define IPC_LINE_MAX 4096
+
+// Executes every complete line in data and appends the responses. Returns
+//   the number of bytes consumed, an incomplete last line is left over.
+size_t ipc_process_input(char const* data, size_t len, std::string& responses);
+
+void ipc_execute(char const* line, size_t len, std::string& response);
+
+// Runs the reload command, false with the reason in error if it failed.
+//   reload isn't supported until one is set.
+void ipc_set_reload_handler(bool (*handler)(std::string& error));
+
+#endif // __IPC_PROTOCOL_HPP__
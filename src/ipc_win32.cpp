@@ -0,0 +1,230 @@
+#include "unicode.h"
+
+#include <Windows.h>
+#include <sddl.h>
+#include <tchar.h>
+
+#include <string>
+#include <vector>
+
+#include "handles.hpp"
+#include "errors.hpp"
+#include "ipc.hpp"
+
+#define PIPE_BUFFER 4096
+// One client being served and the next one waiting
+#define PIPE_INSTANCES 2
+
+static UniqueWin32Handle hServerThread;
+// Made on start, the thread takes it over
+static UniqueFileHandle hListeningPipe;
+static UniqueHlocal securityDescriptor;
+static std::wstring pipeName;
+static HWND hExecuteWindow;
+static UINT executeMessage;
+static volatile LONG stopping;
+
+static bool write_all(HANDLE hFile, char const* data, DWORD len)
+{
+	DWORD written;
+	while (len != 0)
+	{
+		if (!WriteFile(hFile, data, len, &written, NULL))
+			return false;
+		data += written;
+		len -= written;
+	}
+	return true;
+}
+
+// Pipe names are machine-wide, unlike the Local\ objects, so the name is
+//   \\.\pipe\mpVolCtrl_<session>_<user SID>. sid gets the user's SID.
+static bool pipe_name(std::wstring& name, std::wstring& sid)
+{
+	DWORD sessionId;
+	UniqueWin32Handle hToken;
+	if (!ProcessIdToSessionId(GetCurrentProcessId(), &sessionId) || !OpenProcessToken(GetCurrentProcess(), TOKEN_QUERY, hToken.put()))
+		return false;
+	union {
+		TOKEN_USER user;
+		BYTE buf[sizeof(TOKEN_USER) + SECURITY_MAX_SID_SIZE];
+	} tokenUser;
+	DWORD len;
+	LPWSTR sidString;
+	if (!GetTokenInformation(hToken.get(), TokenUser, &tokenUser, sizeof tokenUser, &len) || !ConvertSidToStringSidW(tokenUser.user.User.Sid, &sidString))
+		return false;
+	UniqueHlocal sidOwner(reinterpret_cast<HLOCAL>(sidString));
+	sid = sidString;
+	name = L"\\\\.\\pipe\\mpVolCtrl_" + std::to_wstring(sessionId) + L"_" + sid;
+	return true;
+}
+
+static HANDLE create_pipe_instance(DWORD flags)
+{
+	SECURITY_ATTRIBUTES sa = { sizeof sa, securityDescriptor.get(), FALSE };
+	return CreateNamedPipeW(pipeName.c_str(), PIPE_ACCESS_DUPLEX | flags, PIPE_TYPE_BYTE | PIPE_READMODE_BYTE | PIPE_WAIT | PIPE_REJECT_REMOTE_CLIENTS, PIPE_INSTANCES, PIPE_BUFFER, PIPE_BUFFER, 0, &sa);
+}
+
+static DWORD WINAPI ipc_server_thread(LPVOID)
+{
+	std::string input, output;
+	char buf[PIPE_BUFFER];
+	UniqueFileHandle hListening(std::move(hListeningPipe));
+	while (!stopping && hListening)
+	{
+		if (!ConnectNamedPipe(hListening.get(), NULL) && GetLastError() != ERROR_PIPE_CONNECTED)
+		{
+			// Cancelled, or the client was gone already
+			DisconnectNamedPipe(hListening.get());
+			continue;
+		}
+		// One client at a time, the commands are serialized through the
+		//   window's thread anyway. The next one finds an instance to wait
+		//   for meanwhile instead of none at all.
+		UniqueFileHandle hPipe(std::move(hListening));
+		hListening.reset(create_pipe_instance(0));
+
+		input.clear();
+		DWORD len;
+		while (!stopping && ReadFile(hPipe.get(), buf, sizeof buf, &len, NULL) && len != 0)
+		{
+			input.append(buf, len);
+			// The line still coming, a client sending one past IPC_LINE_MAX
+			//   is dropped
+			if (input.size() - (input.rfind('\n') + 1) > IPC_LINE_MAX)
+				break;
+			if (input.find('\n') == std::string::npos)
+				continue;
+
+			// Every complete line that arrived in this read is executed in one
+			//   round trip to the window and answered with one write. No
+			//   timeout, the window would still get the batch after one and
+			//   write to the strings here. ipc_server_stop takes the batch
+			//   meanwhile, it runs on the window's thread.
+			IpcBatch batch = { &input, &output };
+			SetLastError(ERROR_SUCCESS);
+			SendMessage(hExecuteWindow, executeMessage, 0, (LPARAM)&batch);
+			if (GetLastError() != ERROR_SUCCESS)
+				break;
+			if (!output.empty() && !write_all(hPipe.get(), output.data(), (DWORD)output.size()))
+				break;
+			output.clear();
+		}
+		FlushFileBuffers(hPipe.get());
+		DisconnectNamedPipe(hPipe.get());
+	}
+	return stopping ? 0 : 1;
+}
+
+bool ipc_server_start(HWND hWnd, UINT message)
+{
+	hExecuteWindow = hWnd;
+	executeMessage = message;
+	stopping = 0;
+
+	// Only the user may connect, and the first instance fails if someone
+	//   else holds the name already
+	std::wstring sid;
+	PSECURITY_DESCRIPTOR descriptor;
+	if (!pipe_name(pipeName, sid) || !ConvertStringSecurityDescriptorToSecurityDescriptorW((L"D:P(A;;GA;;;" + sid + L")").c_str(), SDDL_REVISION_1, &descriptor, NULL))
+	{
+		ShowErrorMessage(GetLastError(), _T("IPC security error"));
+		return false;
+	}
+	securityDescriptor.reset(reinterpret_cast<HLOCAL>(descriptor));
+	hListeningPipe.reset(create_pipe_instance(FILE_FLAG_FIRST_PIPE_INSTANCE));
+	if (!hListeningPipe)
+	{
+		ShowErrorMessage(GetLastError(), _T("CreateNamedPipe error"));
+		return false;
+	}
+
+	hServerThread.reset(CreateThread(NULL, 0, ipc_server_thread, NULL, 0, NULL));
+	if (!hServerThread)
+	{
+		ShowErrorMessage(GetLastError(), _T("CreateThread[IPC] error"));
+		return false;
+	}
+	return true;
+}
+
+void ipc_server_stop()
+{
+	if (!hServerThread)
+		return;
+	InterlockedExchange(&stopping, 1);
+	// Wakes up ConnectNamedPipe, ReadFile and WriteFile. A cancel that comes
+	//   before the thread is in one of them is lost, so it's repeated until
+	//   the thread is out. A batch it sends the window meanwhile is run here,
+	//   the window's thread would otherwise never take it.
+	HANDLE hThread = hServerThread.get();
+	for (;;)
+	{
+		CancelSynchronousIo(hThread);
+		if (MsgWaitForMultipleObjects(1, &hThread, FALSE, 50, QS_SENDMESSAGE) == WAIT_OBJECT_0)
+			break;
+		MSG msg;
+		PeekMessage(&msg, NULL, 0, 0, PM_NOREMOVE | PM_QS_SENDMESSAGE);
+	}
+	hServerThread.reset();
+	hListeningPipe.reset();
+}
+
+int ipc_client(std::vector<std::string> const& commands)
+{
+	std::wstring name, sid;
+	if (!pipe_name(name, sid))
+		return 2;
+	UniqueFileHandle hPipe;
+	for (;;)
+	{
+		hPipe.reset(CreateFileW(name.c_str(), GENERIC_READ | GENERIC_WRITE, 0, NULL, OPEN_EXISTING, FILE_FLAG_OVERLAPPED, NULL));
+		if (hPipe)
+			break;
+		if (GetLastError() != ERROR_PIPE_BUSY || !WaitNamedPipeW(name.c_str(), 2000))
+			return 2;
+	}
+
+	std::string request;
+	for (std::vector<std::string>::const_iterator start = commands.begin(), end = commands.end(); start != end; ++start)
+		request.append(*start).push_back('\n');
+	// The request goes out while the responses are read. The server answers
+	//   every read before reading on, so a long pipeline written in full
+	//   first would fill both pipe buffers with neither side reading.
+	UniqueWin32Handle hWriteEvent(CreateEventW(NULL, TRUE, FALSE, NULL)), hReadEvent(CreateEventW(NULL, TRUE, FALSE, NULL));
+	if (!hWriteEvent || !hReadEvent)
+		return 2;
+	OVERLAPPED writeOverlapped = {}, readOverlapped = {};
+	writeOverlapped.hEvent = hWriteEvent.get();
+	readOverlapped.hEvent = hReadEvent.get();
+	if (!WriteFile(hPipe.get(), request.data(), (DWORD)request.size(), NULL, &writeOverlapped) && GetLastError() != ERROR_IO_PENDING)
+		return 2;
+
+	// A pipe can't be half closed, so count the response lines instead
+	HANDLE hStdOut = GetStdHandle(STD_OUTPUT_HANDLE);
+	int ret = 0;
+	size_t lines = 0;
+	bool lineStart = true;
+	char buf[4096];
+	DWORD len;
+	while (lines < commands.size())
+	{
+		if (!ReadFile(hPipe.get(), buf, sizeof buf, NULL, &readOverlapped) && GetLastError() != ERROR_IO_PENDING)
+			break;
+		if (!GetOverlappedResult(hPipe.get(), &readOverlapped, &len, TRUE) || len == 0)
+			break;
+		for (DWORD i = 0; i < len; ++i)
+		{
+			if (lineStart && buf[i] == 'E')
+				ret = 1;
+			if ((lineStart = buf[i] == '\n'))
+				++lines;
+		}
+		if (hStdOut && hStdOut != INVALID_HANDLE_VALUE)
+			write_all(hStdOut, buf, len);
+	}
+	// The request has to stay until the write is done with it
+	CancelIo(hPipe.get());
+	GetOverlappedResult(hPipe.get(), &writeOverlapped, &len, TRUE);
+	return lines < commands.size() ? 2 : ret;
+}
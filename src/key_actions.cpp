@@ -0,0 +1,202 @@
+#include "key_actions.hpp"
+
+#include <stdlib.h>
+
+#include <atomic>
+
+#include "volume_steps.hpp"
+
+static constexpr KeyBinding make_binding(KeyAction::Type type, float amount = 0.f)
+{
+	return KeyBinding{ type, amount, 0, type == KeyAction::ACTION_QUIT || type == KeyAction::ACTION_TOGGLE_ICON || type == KeyAction::ACTION_TOGGLE_REDIRECTION };
+}
+
+// The fine, normal, coarse and large step of volumeStepAmounts
+static constexpr float volume_step(unsigned int modifiers)
+{
+	return volumeStepAmounts[(modifiers & MODIFIER_SHIFT) ? (modifiers & MODIFIER_CONTROL) ? 2 : 3 : (modifiers & MODIFIER_CONTROL) ? 0 : 1];
+}
+
+// Alt+Down quits, Alt+Up toggles the icon and Ctrl+Alt+Up the redirection,
+//   the volume keys step by their modifiers' amount otherwise
+static constexpr KeyBindingTable make_default_table()
+{
+	KeyBindingTable table = {};
+	for (unsigned int modifiers = 0; modifiers < KEY_MODIFIER_MASKS; ++modifiers)
+	{
+		if (modifiers & MODIFIER_ALT)
+		{
+			table.bindings[MEDIAKEY_VOLUME_UP][modifiers] = make_binding(modifiers & MODIFIER_CONTROL ? KeyAction::ACTION_TOGGLE_REDIRECTION : KeyAction::ACTION_TOGGLE_ICON);
+			table.bindings[MEDIAKEY_VOLUME_DOWN][modifiers] = make_binding(KeyAction::ACTION_QUIT);
+			table.bindings[MEDIAKEY_VOLUME_MUTE][modifiers] = make_binding(KeyAction::ACTION_PASS);
+			continue;
+		}
+		table.bindings[MEDIAKEY_VOLUME_UP][modifiers] = make_binding(KeyAction::ACTION_VOLUME_CHANGE, volume_step(modifiers));
+		table.bindings[MEDIAKEY_VOLUME_DOWN][modifiers] = make_binding(KeyAction::ACTION_VOLUME_CHANGE, -volume_step(modifiers));
+#ifdef _WIN32
+		// Left to the system unless it's bound
+		table.bindings[MEDIAKEY_VOLUME_MUTE][modifiers] = make_binding(KeyAction::ACTION_PASS);
+#else
+		table.bindings[MEDIAKEY_VOLUME_MUTE][modifiers] = make_binding(KeyAction::ACTION_MUTE);
+#endif
+	}
+	return table;
+}
+
+static constexpr KeyBindingTable defaultTable = make_default_table();
+static_assert(defaultTable.bindings[MEDIAKEY_VOLUME_DOWN][MODIFIER_CONTROL].amount == -.01f && defaultTable.bindings[MEDIAKEY_VOLUME_UP][MODIFIER_SHIFT].amount == .20f, "Ctrl is the fine step and Shift the large one");
+static_assert(defaultTable.bindings[MEDIAKEY_VOLUME_UP][MODIFIER_CONTROL | MODIFIER_ALT].whileDisabled, "the redirection can be enabled again");
+
+// Configured tables take turns, the one in use is never written
+static KeyBindingTable configuredTables[2];
+static unsigned int nextTable = 0;
+static std::atomic<KeyBindingTable const*> currentTable(&defaultTable);
+
+static std::string trim(std::string const& str)
+{
+	std::string::size_type first = str.find_first_not_of(' '), last = str.find_last_not_of(' ');
+	return first == std::string::npos ? std::string() : str.substr(first, last - first + 1);
+}
+
+static bool parse_key(std::string const& str, MediaKey& key, unsigned int& modifiers)
+{
+	modifiers = MODIFIER_NONE;
+	std::string::size_type pos = 0, plus;
+	while ((plus = str.find('+', pos)) != std::string::npos)
+	{
+		std::string modifier = trim(str.substr(pos, plus - pos));
+		if (modifier == "Shift")
+			modifiers |= MODIFIER_SHIFT;
+		else if (modifier == "Ctrl")
+			modifiers |= MODIFIER_CONTROL;
+		else if (modifier == "Alt")
+			modifiers |= MODIFIER_ALT;
+		else
+			return false;
+		pos = plus + 1;
+	}
+	std::string name = trim(str.substr(pos));
+	if (name == "VolumeUp")
+		key = MEDIAKEY_VOLUME_UP;
+	else if (name == "VolumeDown")
+		key = MEDIAKEY_VOLUME_DOWN;
+	else if (name == "Mute")
+		key = MEDIAKEY_VOLUME_MUTE;
+	else
+		return false;
+	return true;
+}
+
+// A volume or step in 0..1
+static bool parse_volume(std::string const& str, float& out)
+{
+	char* end;
+	out = strtof(str.c_str(), &end);
+	return !str.empty() && *end == '\0' && out >= 0.f && out <= 1.f;
+}
+
+// names[0] is the empty name of "target *", used counts the ones after it
+static bool parse_action(std::string const& str, KeyBindingTable& table, size_t& used, KeyBinding& out)
+{
+	std::string::size_type space = str.find(' ');
+	std::string name = str.substr(0, space), arg = space == std::string::npos ? std::string() : trim(str.substr(space));
+	if (name == "up" || name == "down")
+	{
+		float amount = volumeStepAmounts[1];
+		if (!arg.empty() && (!parse_volume(arg, amount) || amount == 0.f))
+			return false;
+		out = make_binding(KeyAction::ACTION_VOLUME_CHANGE, name == "up" ? amount : -amount);
+		return true;
+	}
+	if (name == "set")
+	{
+		float volume;
+		if (!parse_volume(arg, volume))
+			return false;
+		out = make_binding(KeyAction::ACTION_SET_VOLUME, volume);
+		return true;
+	}
+	if (name == "target")
+	{
+		out = make_binding(KeyAction::ACTION_SELECT_TARGET);
+		if (arg == "*")
+			return true;
+		if (arg.empty() || arg.size() >= KEY_TARGET_NAME || used + arg.size() + 1 > KEY_BINDING_NAMES)
+			return false;
+		out.target = (unsigned short)used;
+		arg.copy(table.names + used, arg.size());
+		table.names[used + arg.size()] = '\0';
+		used += arg.size() + 1;
+		return true;
+	}
+	if (!arg.empty())
+		return false;
+	if (name == "pass")
+		out = make_binding(KeyAction::ACTION_PASS);
+	else if (name == "mute")
+		out = make_binding(KeyAction::ACTION_MUTE);
+	else if (name == "toggle")
+		out = make_binding(KeyAction::ACTION_TOGGLE_REDIRECTION);
+	else if (name == "icon")
+		out = make_binding(KeyAction::ACTION_TOGGLE_ICON);
+	else if (name == "quit")
+		out = make_binding(KeyAction::ACTION_QUIT);
+	else
+		return false;
+	return true;
+}
+
+bool key_bindings_configure(std::string const& bindings, std::string& error)
+{
+	if (trim(bindings).empty())
+	{
+		currentTable.store(&defaultTable, std::memory_order_release);
+		return true;
+	}
+
+	KeyBindingTable& table = configuredTables[nextTable];
+	table = defaultTable;
+	size_t used = 1;
+	std::string::size_type pos = 0, sep;
+	do {
+		sep = bindings.find(';', pos);
+		std::string entry = trim(bindings.substr(pos, sep == std::string::npos ? std::string::npos : sep - pos));
+		pos = sep + 1;
+		if (entry.empty())
+			continue;
+		std::string::size_type equals = entry.find('=');
+		MediaKey key;
+		unsigned int modifiers;
+		KeyBinding binding;
+		if (equals == std::string::npos || !parse_key(entry.substr(0, equals), key, modifiers) || !parse_action(trim(entry.substr(equals + 1)), table, used, binding))
+		{
+			error = entry;
+			return false;
+		}
+		table.bindings[key][modifiers] = binding;
+	} while (sep != std::string::npos);
+
+	currentTable.store(&table, std::memory_order_release);
+	nextTable ^= 1;
+	return true;
+}
+
+KeyAction KeyStateMachine::key_down(MediaKey key, unsigned int modifiers, bool disabled)
+{
+	if (key >= MEDIAKEY_COUNT)
+		return KeyAction(KeyAction::ACTION_PASS);
+	KeyBindingTable const* table = currentTable.load(std::memory_order_acquire);
+	KeyBinding const& binding = table->bindings[key][modifiers & (KEY_MODIFIER_MASKS - 1)];
+	if (binding.type == KeyAction::ACTION_PASS || (disabled && !binding.whileDisabled))
+		return KeyAction(KeyAction::ACTION_PASS);
+	keyStates[key] = true;
+	return KeyAction(binding.type, binding.amount, binding.type == KeyAction::ACTION_SELECT_TARGET ? table->names + binding.target : NULL);
+}
+
+KeyAction KeyStateMachine::key_up(MediaKey key)
+{
+	if (key >= MEDIAKEY_COUNT || !keyStates[key])
+		return KeyAction(KeyAction::ACTION_PASS);
+	keyStates[key] = false;
+	return KeyAction(KeyAction::ACTION_SWALLOW);
+}
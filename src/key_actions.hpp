@@ -0,0 +1,109 @@
+#pragma once
+#ifndef __KEY_ACTIONS_HPP__
+#define __KEY_ACTIONS_HPP__
+
+#include <string.h>
+
+#include <string>
+
+// Platform independent part of the media key handling. The input backends
+// (the low-level keyboard hook on Windows, evdev on Linux) translate their
+// events into MediaKey + modifier mask and act on the returned KeyAction.
+
+enum MediaKey { MEDIAKEY_VOLUME_UP, MEDIAKEY_VOLUME_DOWN, MEDIAKEY_VOLUME_MUTE, MEDIAKEY_COUNT };
+
+enum KeyModifier { MODIFIER_NONE = 0, MODIFIER_SHIFT = 1, MODIFIER_CONTROL = 2, MODIFIER_ALT = 4 };
+// Every combination of the modifiers above
+#define KEY_MODIFIER_MASKS 8
+// Room for a target name and its terminator
+#define KEY_TARGET_NAME 64
+
+struct KeyAction
+{
+	enum Type {
+		ACTION_PASS,                // Not ours, let the system handle the key
+		ACTION_SWALLOW,             // Eat the key, nothing else to do
+		ACTION_VOLUME_CHANGE,       // amount holds the signed delta
+		ACTION_MUTE,
+		ACTION_QUIT,
+		ACTION_TOGGLE_ICON,
+		ACTION_TOGGLE_REDIRECTION,
+		ACTION_SET_VOLUME,          // amount holds the volume
+		ACTION_SELECT_TARGET        // target holds the application the keys
+		                            //   change from now on, empty for all
+	};
+
+	Type type;
+	float amount;
+	// A copy, the binding table may be replaced once the action is returned
+	char target[KEY_TARGET_NAME];
+
+	KeyAction(Type type, float amount = 0.f, char const* target = NULL) : type(type), amount(amount), target()
+	{
+		if (target)
+			strncpy(this->target, target, KEY_TARGET_NAME - 1);
+	}
+
+	bool swallow() const { return type != ACTION_PASS; }
+};
+
+// What a key does, compiled from the KeyBindings option into one entry
+//   for every key and modifier mask
+struct KeyBinding
+{
+	KeyAction::Type type;
+	float amount;
+	// Offset of the name in KeyBindingTable::names, ACTION_SELECT_TARGET
+	unsigned short target;
+	// The actions that control the program keep working while the
+	//   redirection is disabled, otherwise there would be no way to turn it
+	//   back on
+	bool whileDisabled;
+};
+
+#define KEY_BINDING_NAMES 512
+
+struct KeyBindingTable
+{
+	KeyBinding bindings[MEDIAKEY_COUNT][KEY_MODIFIER_MASKS];
+	// The target names, each one terminated
+	char names[KEY_BINDING_NAMES];
+};
+
+// Compiles bindings on top of the default ones and publishes the table for
+//   the next key press. bindings is a semicolon separated list of
+//   "[Shift+][Ctrl+][Alt+]<VolumeUp|VolumeDown|Mute>=<action>" with the
+//   actions
+//     pass             leave the key to the system
+//     up|down [amount] change by amount, the plain step if none
+//     set <volume>     set to volume in 0..1
+//     mute             toggle the mute state
+//     toggle           disable or enable the redirection
+//     icon             hide or show the notification area icon
+//     quit
+//     target <app|*>   change only app with the keys from now on, * for
+//                      all of them again
+// Returns false and describes the first entry that doesn't parse in error,
+//   the table in use stays then. Calls have to come from the thread of the
+//   key presses: the window's on Windows, where the hook runs and the
+//   command pipe's reload is sent to, and the event loop's on Linux. A key
+//   press is done with the table before the next call then.
+bool key_bindings_configure(std::string const& bindings, std::string& error);
+
+class KeyStateMachine
+{
+private:
+	bool keyStates[MEDIAKEY_COUNT];
+public:
+	KeyStateMachine() : keyStates() { }
+
+	// Seed the state of a key that was already held when the backend started,
+	//   so its release doesn't leak through to the system.
+	void reset(MediaKey key, bool down) { keyStates[key] = down; }
+
+	// Autorepeat is delivered as repeated key_down calls.
+	KeyAction key_down(MediaKey key, unsigned int modifiers, bool disabled);
+	KeyAction key_up(MediaKey key);
+};
+
+#endif // __KEY_ACTIONS_HPP__
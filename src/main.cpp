@@ -2,26 +2,50 @@
 
 #include <Windows.h>
 #include <tchar.h>
+#include <string.h>
 #include <wchar.h>
 #include <CommCtrl.h>
 #include <Shlobj.h>
+#include <shellapi.h>
+#include <WtsApi32.h>
 
-#include <fstream>
+#include <algorithm>
 #include <memory>
 #include <string>
+#include <vector>
 
 #include "resource.h"
-#include "auto_cleanup.hpp"
+#include "handles.hpp"
 #include "errors.hpp"
+#include "key_actions.hpp"
 #include "volume_control.hpp"
+#include "volume_dispatch.hpp"
+#include "fade_engine.hpp"
+#include "volume_snapshot.hpp"
 #include "mpvc_config.hpp"
 #include "autorun_task.hpp"
+#include "plugin_loader.hpp"
+#include "audio_session_volume_control.hpp"
+#include "foreground_window.hpp"
+#include "ipc.hpp"
+#include "memory_usage.hpp"
+#include "metrics.hpp"
+#include "stats_segment.hpp"
+#include "timeline.hpp"
+#include "utf8.hpp"
+#include "volume_steps.hpp"
 
 #define APPWM_VOLUMEUP (WM_APP+1)
 #define APPWM_VOLUMEDOWN (WM_APP+2)
 #define APPWM_TRAYICON (WM_APP+3)
 #define APPWM_TOGGLENICON (WM_APP+4)
 #define APPWM_TOGGLEMEDIAKEYS (WM_APP+5)
+#define APPWM_IPCBATCH (WM_APP+6)
+#define APPWM_STARTUP (WM_APP+7)
+#define APPWM_MUTE (WM_APP+8)
+#define APPWM_SETVOLUME (WM_APP+9)
+
+#define MEMORY_LOG_TIMER_ID 2
 
 static const TCHAR mainWindowName[] = _T("mpVolCtrl Message Window");
 
@@ -34,88 +58,362 @@ NOTIFYICONDATA notifyIconData = { 0 };
 
 MPVCConfig mpvc_config;
 
-static bool volKeyStates[2];
+static KeyStateMachine keyStateMachine;
+static StatsSegment statsSegment;
+// The application a target binding selected, empty for the usual ones.
+//   The hook runs on the window's thread, like everything else using it.
+static MediaPlayerVolumeControlProvider::target_type keyTarget;
+
+// What finish_startup got to, stop_deferred undoes just that. Until the
+//   providers are up the hook leaves the keys to the system, a press would
+//   find nothing to change yet.
+static bool volumeSnapshot, recording, comInitialized, providersStarted;
+
+enum StartupStep
+{
+	STARTUP_STEP_SNAPSHOT,
+	STARTUP_STEP_PROVIDERS,
+	STARTUP_STEP_SERVICES
+};
+
+static bool get_media_key(DWORD vkCode, MediaKey& key)
+{
+	// VK_VOLUME_MUTE is left to the system unless it's bound
+	switch (vkCode)
+	{
+	case VK_VOLUME_UP:
+		key = MEDIAKEY_VOLUME_UP;
+		return true;
+	case VK_VOLUME_DOWN:
+		key = MEDIAKEY_VOLUME_DOWN;
+		return true;
+	case VK_VOLUME_MUTE:
+		key = MEDIAKEY_VOLUME_MUTE;
+		return true;
+	}
+	return false;
+}
+
+// The hook posts a binding's amount as the bits of the float
+static WPARAM amount_to_wparam(float amount)
+{
+	UINT32 bits;
+	memcpy(&bits, &amount, sizeof bits);
+	return bits;
+}
+
+static float amount_from_wparam(WPARAM wParam)
+{
+	UINT32 bits = (UINT32)wParam;
+	float amount;
+	memcpy(&amount, &bits, sizeof amount);
+	return amount;
+}
+
+static unsigned int get_key_modifiers()
+{
+	return (GetAsyncKeyState(VK_SHIFT) < 0 ? MODIFIER_SHIFT : MODIFIER_NONE) | (GetAsyncKeyState(VK_CONTROL) < 0 ? MODIFIER_CONTROL : MODIFIER_NONE);
+}
+
 LRESULT CALLBACK LowLevelKeyboardProc(int code, WPARAM wParam, LPARAM lParam)
 {
-	if (code == HC_ACTION)
+	MediaKey key;
+	if (code == HC_ACTION && providersStarted && get_media_key(((KBDLLHOOKSTRUCT*)lParam)->vkCode, key))
+	{
+		unsigned int modifiers = MODIFIER_NONE;
+		KeyAction action(KeyAction::ACTION_PASS);
 		switch (wParam)
 		{
 		case WM_KEYDOWN:
-			if (mpvc_config.disabled)
-				break;
-			if (((KBDLLHOOKSTRUCT*)lParam)->vkCode == VK_VOLUME_DOWN)
-			{
-				volKeyStates[1] = true;
-				PostMessage(hMainWindow, APPWM_VOLUMEDOWN, 0, 0);
-			}
-			else if (((KBDLLHOOKSTRUCT*)lParam)->vkCode == VK_VOLUME_UP)
-			{
-				volKeyStates[0] = true;
-				PostMessage(hMainWindow, APPWM_VOLUMEUP, 0, 0);
-			}
-			else
-				break;
-			return 1;
+			modifiers = get_key_modifiers();
+			timeline_key(key, true, modifiers);
+			action = keyStateMachine.key_down(key, modifiers, mpvc_config.disabled);
+			break;
 		case WM_SYSKEYDOWN:
-			if (((KBDLLHOOKSTRUCT*)lParam)->vkCode == VK_VOLUME_DOWN)
-			{
-				volKeyStates[1] = true;
-				PostQuitMessage(0);
-			}
-			else if (((KBDLLHOOKSTRUCT*)lParam)->vkCode == VK_VOLUME_UP)
-			{
-				volKeyStates[0] = true;
-				if (GetAsyncKeyState(VK_CONTROL) < 0)
-					PostMessage(hMainWindow, APPWM_TOGGLEMEDIAKEYS, 0, 0);
-				else
-					PostMessage(hMainWindow, APPWM_TOGGLENICON, 0, 0);
-			}
-			else
-				break;
-			return 1;
+			modifiers = get_key_modifiers() | MODIFIER_ALT;
+			timeline_key(key, true, modifiers);
+			action = keyStateMachine.key_down(key, modifiers, mpvc_config.disabled);
+			break;
 		case WM_KEYUP:
 		case WM_SYSKEYUP:
-			if (volKeyStates[1] && ((KBDLLHOOKSTRUCT*)lParam)->vkCode == VK_VOLUME_DOWN)
-				volKeyStates[1] = false;
-			else if (volKeyStates[0] && ((KBDLLHOOKSTRUCT*)lParam)->vkCode == VK_VOLUME_UP)
-				volKeyStates[0] = false;
-			else
-				break;
-			return 1;
+			timeline_key(key, false, MODIFIER_NONE);
+			action = keyStateMachine.key_up(key);
+			break;
+		}
+
+		switch (action.type)
+		{
+		case KeyAction::ACTION_VOLUME_CHANGE:
+			PostMessage(hMainWindow, action.amount < 0 ? APPWM_VOLUMEDOWN : APPWM_VOLUMEUP, amount_to_wparam(action.amount), 0);
+			break;
+		case KeyAction::ACTION_MUTE:
+			PostMessage(hMainWindow, APPWM_MUTE, 0, 0);
+			break;
+		case KeyAction::ACTION_SET_VOLUME:
+			PostMessage(hMainWindow, APPWM_SETVOLUME, amount_to_wparam(action.amount), 0);
+			break;
+		case KeyAction::ACTION_SELECT_TARGET:
+			keyTarget = action.target;
+			break;
+		case KeyAction::ACTION_QUIT:
+			PostQuitMessage(0);
+			break;
+		case KeyAction::ACTION_TOGGLE_ICON:
+			PostMessage(hMainWindow, APPWM_TOGGLENICON, 0, 0);
+			break;
+		case KeyAction::ACTION_TOGGLE_REDIRECTION:
+			PostMessage(hMainWindow, APPWM_TOGGLEMEDIAKEYS, 0, 0);
+			break;
+		default:
+			break;
 		}
+		if (action.swallow())
+			return 1;
+	}
 	return CallNextHookEx(hKeyboardHook, code, wParam, lParam);
 }
 
-AutoCleanup<void(*)()>* notifyIconDeleter;
+// The hook didn't see the keys for a while, they may have changed meanwhile
+static void sync_key_states()
+{
+	keyStateMachine.reset(MEDIAKEY_VOLUME_UP, GetAsyncKeyState(VK_VOLUME_UP) < 0);
+	keyStateMachine.reset(MEDIAKEY_VOLUME_DOWN, GetAsyncKeyState(VK_VOLUME_DOWN) < 0);
+	keyStateMachine.reset(MEDIAKEY_VOLUME_MUTE, GetAsyncKeyState(VK_VOLUME_MUTE) < 0);
+}
+
+static bool install_keyboard_hook()
+{
+	HHOOK hNewHook = SetWindowsHookEx(WH_KEYBOARD_LL, LowLevelKeyboardProc, (HMODULE)hInstance, 0);
+	if (hNewHook == NULL)
+		return false;
+	if (hKeyboardHook)
+		UnhookWindowsHookEx(hKeyboardHook);
+	hKeyboardHook = hNewHook;
+	sync_key_states();
+	return true;
+}
+
+static void uninstall_keyboard_hook()
+{
+	if (hKeyboardHook)
+		UnhookWindowsHookEx(hKeyboardHook);
+	hKeyboardHook = NULL;
+}
+
+// Key presses that queued up while the previous one was being applied are
+//   summed into a single change
+static void handle_volume_message(WPARAM amount)
+{
+	// Queued presses of the same step go along as a count, a different step
+	//   waits for its own message
+	float step = amount_from_wparam(amount);
+	unsigned int keypresses = 1;
+	MSG msg;
+	while (PeekMessage(&msg, hMainWindow, APPWM_VOLUMEUP, APPWM_VOLUMEDOWN, PM_NOREMOVE) && amount_from_wparam(msg.wParam) == step)
+	{
+		PeekMessage(&msg, hMainWindow, msg.message, msg.message, PM_REMOVE);
+		++keypresses;
+	}
+	mpvc_metrics.keypressesHandled.fetch_add(keypresses, std::memory_order_relaxed);
+	mpvc_metrics.coalescedEvents.fetch_add(keypresses - 1, std::memory_order_relaxed);
+	volume_change(keyTarget, step * keypresses, keypresses);
+	mpvc_metrics.startup_phase_done(STARTUP_FIRST_KEY);
+	statsSegment.publish();
+}
+
+// Read into a config of its own, the running one keeps its state
+static bool reload_key_bindings(std::string& error)
+{
+	MPVCConfig config;
+	config.read_config(false);
+	if (key_bindings_configure(config.keyBindings, error))
+		return true;
+	error = "bad KeyBindings entry " + error;
+	return false;
+}
+
+// Only loaded once the icon is clicked, most runs never show it
+static HMENU tray_menu()
+{
+	if (!hMenu && !(hMenu = LoadMenu(hInstance, MAKEINTRESOURCE(IDR_TRAY_POPUPMENU))))
+		ShowErrorMessage(GetLastError(), _T("LoadMenu error"));
+	return hMenu;
+}
+
+static void destroy_tray_menu()
+{
+	if (hMenu)
+		DestroyMenu(hMenu);
+	hMenu = NULL;
+}
+
+ScopeGuard<void (*)()>* notifyIconDeleter;
 
 void addNotifyIcon()
 {
 	mpvc_config.invisible = false;
-	*notifyIconDeleter = true;
+	notifyIconDeleter->arm();
 	Shell_NotifyIcon(NIM_ADD, &notifyIconData);
 }
 
 void deleteNotifyIcon()
 {
 	Shell_NotifyIcon(NIM_DELETE, &notifyIconData);
-	*notifyIconDeleter = false;
+	notifyIconDeleter->dismiss();
 	mpvc_config.invisible = true;
 }
 
+static std::vector<std::string> split_list(std::string const& list)
+{
+	std::vector<std::string> ret;
+	std::string::size_type pos = 0, sep;
+	do {
+		sep = list.find(',', pos);
+		std::string item(list, pos, sep == std::string::npos ? std::string::npos : sep - pos);
+		std::string::size_type first = item.find_first_not_of(' '), last = item.find_last_not_of(' ');
+		if (first != std::string::npos)
+			ret.push_back(item.substr(first, last - first + 1));
+		pos = sep + 1;
+	} while (sep != std::string::npos);
+	return ret;
+}
+
+static void start_providers()
+{
+	std::vector<std::string> providers = split_list(mpvc_config.providers);
+	if (std::find(providers.begin(), providers.end(), "sessions") != providers.end())
+		audio_session_add_provider(split_list(mpvc_config.processNames));
+	audio_session_set_endpoints((EndpointScope)mpvc_config.endpointScope, mpvc_config.endpointIds);
+	audio_session_set_session_filter((SessionFilter)mpvc_config.sessionFilter);
+	audio_session_set_routing((SessionRouting)mpvc_config.routing);
+	std::vector<std::string> failedPlugins;
+	load_plugins(mpvc_config.configDir, mpvc_config.plugins, mpvc_config.processNames, failedPlugins);
+	for (std::vector<std::string>::iterator start = failedPlugins.begin(), end = failedPlugins.end(); start != end; ++start)
+		MessageBox(NULL, tstring_from_utf8("Plugin " + *start).c_str(), _T("Config error"), MB_OK);
+	volume_dispatch_start((DispatchPolicy)mpvc_config.dispatchPolicy, mpvc_config.providerBudget);
+	fade_engine_start(mpvc_config.fadeTime);
+	providersStarted = true;
+	sync_key_states();
+	// The device enumerator and the first session scan, on the lanes
+	volume_dispatch_warm_up();
+	mpvc_metrics.startup_phase_done(STARTUP_PROVIDERS);
+}
+
+static void shutdown_volume_controls()
+{
+	// A provider stuck in a lane can't be deleted under it
+	bool stopped = volume_dispatch_stop(1000);
+	// Nor under a fade write
+	fade_engine_stop();
+	if (stopped)
+		delete_volume_controls();
+}
+
+// The parts of starting up the hook doesn't need, one step per message of
+//   the running loop, so the hook is serviced in between
+static void finish_startup(WPARAM step)
+{
+	switch (step)
+	{
+	case STARTUP_STEP_SNAPSHOT:
+		// Before the providers, they restore from it as they find the
+		//   sessions, and stopped after them, so their last changes get
+		//   written
+		volumeSnapshot = mpvc_config.rememberVolumes && volume_snapshot_start(mpvc_config.configDir + VOLUME_SNAPSHOT_FILE);
+		// Before the providers, so it has the sessions there already are
+		recording = !mpvc_config.recordTimeline.empty() && timeline_record_start(mpvc_config.configDir + tstring_from_utf8(mpvc_config.recordTimeline));
+		break;
+	case STARTUP_STEP_PROVIDERS:
+	{
+		HRESULT hResult = CoInitializeEx(NULL, COINIT_APARTMENTTHREADED | COINIT_DISABLE_OLE1DDE | COINIT_SPEED_OVER_MEMORY);
+		if (!SUCCEEDED(hResult))
+		{
+			ShowErrorMessage(hResult, _T("CoInitializeEx error"));
+			PostQuitMessage(1);
+			return;
+		}
+		comInitialized = true;
+		start_providers();
+		break;
+	}
+	case STARTUP_STEP_SERVICES:
+		// Not fatal, only monitoring reads it
+		if (statsSegment.open())
+			statsSegment.start_refresh();
+		// A line at the start, then one every interval
+		if (mpvc_config.memoryLogInterval && memory_log_append(mpvc_config.configDir + MEMORY_LOG_FILE))
+			SetTimer(hMainWindow, MEMORY_LOG_TIMER_ID, memory_log_interval_ms(mpvc_config.memoryLogInterval), NULL);
+
+		// Not fatal either, the keys work without it
+		ipc_set_reload_handler(reload_key_bindings);
+		ipc_server_start(hMainWindow, APPWM_IPCBATCH);
+
+		// Hidden meanwhile by another instance starting
+		if (!mpvc_config.invisible)
+			addNotifyIcon();
+		mpvc_metrics.startup_phase_done(STARTUP_DEFERRED);
+		return;
+	}
+	PostMessage(hMainWindow, APPWM_STARTUP, step + 1, 0);
+}
+
+// Undoes the steps of finish_startup it got to, in reverse
+static void stop_deferred()
+{
+	// It lists the targets through the providers
+	statsSegment.stop_refresh();
+	if (providersStarted)
+		shutdown_volume_controls();
+	providersStarted = false;
+	if (comInitialized)
+		CoUninitialize();
+	if (recording)
+		timeline_record_stop();
+	if (volumeSnapshot)
+		volume_snapshot_stop();
+}
+
 LRESULT CALLBACK WindowProc(HWND hWnd, UINT uMsg, WPARAM wParam, LPARAM lParam)
 {
 	switch (uMsg)
 	{
 	case APPWM_VOLUMEUP:
+	case APPWM_VOLUMEDOWN:
+		// wParam holds the signed amount of the key's binding
+		handle_volume_message(wParam);
+		return 0;
+	case APPWM_MUTE:
+	case APPWM_SETVOLUME:
+		mpvc_metrics.keypressesHandled.fetch_add(1, std::memory_order_relaxed);
+		if (uMsg == APPWM_MUTE)
+			volume_mute(keyTarget);
+		else
+			volume_set(keyTarget, amount_from_wparam(wParam));
+		mpvc_metrics.startup_phase_done(STARTUP_FIRST_KEY);
+		statsSegment.publish();
+		return 0;
+	case APPWM_STARTUP:
+		finish_startup(wParam);
+		return 0;
+	case APPWM_IPCBATCH:
+		ipc_execute_batch((IpcBatch*)lParam);
+		// The targets they set show up with the next refresh
+		statsSegment.publish();
+		return 0;
+	case WM_TIMER:
+		if (wParam == MEMORY_LOG_TIMER_ID)
 		{
-			bool cntrl = GetAsyncKeyState(VK_CONTROL) < 0;
-			volume_up(GetAsyncKeyState(VK_SHIFT) < 0 ? cntrl ? .10f : .20f : cntrl ? .01f : .05f);
+			memory_log_append(mpvc_config.configDir + MEMORY_LOG_FILE);
+			return 0;
 		}
-		return 0;
-	case APPWM_VOLUMEDOWN:
+		break;
+	case WM_WTSSESSION_CHANGE:
+		// Windows silently drops low level hooks that time out, which tends
+		//   to happen around sleep and the lock screen
+		if ((wParam == WTS_SESSION_UNLOCK || wParam == WTS_CONSOLE_CONNECT) && install_keyboard_hook())
 		{
-			bool cntrl = GetAsyncKeyState(VK_CONTROL) < 0;
-			volume_down(GetAsyncKeyState(VK_SHIFT) < 0 ? cntrl ? .10f : .20f : cntrl ? .01f : .05f);
+			mpvc_metrics.hookReinstalls.fetch_add(1, std::memory_order_relaxed);
+			statsSegment.publish();
 		}
 		return 0;
 	case APPWM_TOGGLENICON:
@@ -143,6 +441,8 @@ LRESULT CALLBACK WindowProc(HWND hWnd, UINT uMsg, WPARAM wParam, LPARAM lParam)
 		switch (LOWORD(lParam))
 		{
 		case WM_RBUTTONUP:
+			if (!tray_menu())
+				return 0;
 			POINT cursorPos;
 			GetCursorPos(&cursorPos);
 
@@ -218,12 +518,41 @@ void unsubclassMainWindow()
 	SetWindowLongPtr(hMainWindow, GWLP_WNDPROC, prevWndProc);
 }
 
+// "mpVolCtrl -c <command>..." talks to the running instance instead of
+//   starting a new one
+static bool get_client_commands(std::vector<std::string>& commands)
+{
+	int argc;
+	LPWSTR* argv = CommandLineToArgvW(GetCommandLineW(), &argc);
+	if (!argv)
+		return false;
+	UniqueHlocal argvDeleter((HLOCAL)argv);
+	if (argc < 2 || (wcscmp(argv[1], L"-c") != 0 && wcscmp(argv[1], L"--command") != 0))
+		return false;
+	for (int i = 2; i < argc; ++i)
+	{
+		int len = WideCharToMultiByte(CP_UTF8, 0, argv[i], -1, NULL, 0, NULL, NULL);
+		std::string command(len > 0 ? len - 1 : 0, '\0');
+		if (len > 1)
+			WideCharToMultiByte(CP_UTF8, 0, argv[i], -1, &command[0], len, NULL, NULL);
+		commands.push_back(command);
+	}
+	return true;
+}
+
 int CALLBACK _tWinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPTSTR lpCmdLine, int nCmdShow)
 {
 	::hInstance = hInstance;
 
-	HANDLE hSingleInstanceLockEvent = CreateEvent(NULL, FALSE, FALSE, _T("Local\\mpVolCtrl_lock"));
-	AutoDeleter<HANDLE, BOOL(WINAPI *)(HANDLE)> hSingleInstanceLockEventDeleter(hSingleInstanceLockEvent, CloseHandle, hSingleInstanceLockEvent != NULL);
+	std::vector<std::string> clientCommands;
+	if (get_client_commands(clientCommands))
+	{
+		// A GUI subsystem process has no console of its own
+		AttachConsole(ATTACH_PARENT_PROCESS);
+		return ipc_client(clientCommands);
+	}
+
+	UniqueWin32Handle hSingleInstanceLockEvent(CreateEvent(NULL, FALSE, FALSE, _T("Local\\mpVolCtrl_lock")));
 	if (GetLastError() == ERROR_ALREADY_EXISTS)
 	{
 		if ((hMainWindow = FindWindow(WC_STATIC, mainWindowName)))
@@ -239,60 +568,64 @@ int CALLBACK _tWinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPTSTR lpCm
 	struct __config_write {
 		~__config_write() { mpvc_config.write_config(); }
 	} __config_write_inst;
+	if (!volume_steps_configure((StepCurve)mpvc_config.stepCurve, mpvc_config.stepDecibels))
+		MessageBox(NULL, _T("StepDecibels needs four step sizes from 0.5 to 60, the default ones are used"), _T("Config error"), MB_OK);
+	std::string bindingError;
+	if (!key_bindings_configure(mpvc_config.keyBindings, bindingError))
+		MessageBox(NULL, tstring_from_utf8("KeyBindings entry " + bindingError + " doesn't parse, the default bindings are used").c_str(), _T("Config error"), MB_OK);
+	mpvc_metrics.startup_phase_done(STARTUP_CONFIG);
+	// The snapshot, the timeline and the providers are started from the
+	//   running loop by finish_startup, and stopped once the window is gone
+	ScopeGuard<void (*)()> deferredCleanup(stop_deferred);
 
-	HRESULT hResult = CoInitializeEx(NULL, COINIT_APARTMENTTHREADED | COINIT_DISABLE_OLE1DDE | COINIT_SPEED_OVER_MEMORY);
-	if (!SUCCEEDED(hResult))
-	{
-		ShowErrorMessage(hResult, _T("CoInitializeEx error"));
-		return 1;
-	}
-	AutoCleanup<void (WINAPI *)()> comCleanup(CoUninitialize);
-
-	hMainWindow = CreateWindow(WC_STATIC, mainWindowName, 0x00, 0, 0, 0, 0, HWND_MESSAGE, NULL, hInstance, NULL);
-	if (hMainWindow == NULL)
+	UniqueHwnd mainWindow(CreateWindow(WC_STATIC, mainWindowName, 0x00, 0, 0, 0, 0, HWND_MESSAGE, NULL, hInstance, NULL));
+	if (!mainWindow)
 	{
 		ShowErrorMessage(GetLastError(), _T("CreateWindow error"));
 		return 2;
 	}
-	AutoDeleter<HWND, BOOL (WINAPI *)(HWND)> hMainWindowDeleter(hMainWindow, DestroyWindow);
+	hMainWindow = mainWindow.get();
 	subclassMainWindow();
-	AutoCleanup<void (*)()> subclassCleanup(unsubclassMainWindow);
-
-	hMenu = LoadMenu(hInstance, MAKEINTRESOURCE(IDR_TRAY_POPUPMENU));
-	if (hMenu == NULL)
-	{
-		ShowErrorMessage(GetLastError(), _T("LoadMenu error"));
-		return 3;
-	}
-	AutoDeleter<HMENU, BOOL (WINAPI *)(HMENU)> hMenuDeleter(hMenu, DestroyMenu);
+	ScopeGuard<void (*)()> subclassCleanup(unsubclassMainWindow);
 
-	volKeyStates[0] = GetAsyncKeyState(VK_VOLUME_UP) < 0;
-	volKeyStates[1] = GetAsyncKeyState(VK_VOLUME_DOWN) < 0;
+	ScopeGuard<void (*)()> menuCleanup(destroy_tray_menu);
 
-	hKeyboardHook = SetWindowsHookEx(WH_KEYBOARD_LL, LowLevelKeyboardProc, (HMODULE)hInstance, 0);
-	if (hKeyboardHook == NULL)
+	// The hook is only serviced by the message loop, so anything slow is
+	//   left to finish_startup, a step at a time
+	if (!install_keyboard_hook())
 	{
 		ShowErrorMessage(GetLastError(), _T("SetWindowsHookEx error"));
 		return 4;
 	}
-	AutoDeleter<HHOOK, BOOL (WINAPI *)(HHOOK)> hKeyboardHookDeleter(hKeyboardHook, UnhookWindowsHookEx);
+	ScopeGuard<void (*)()> keyboardHookCleanup(uninstall_keyboard_hook);
+	// Not fatal, the keys go to every player without it
+	bool foregroundTracking = mpvc_config.routing == ROUTE_FOREGROUND && foreground_tracking_start();
+	ScopeGuard<void (*)()> foregroundTrackingCleanup(foreground_tracking_stop, foregroundTracking);
+	WTSRegisterSessionNotification(hMainWindow, NOTIFY_FOR_THIS_SESSION);
+	mpvc_metrics.startup_phase_done(STARTUP_INPUT);
 
+	// Does nothing if finish_startup didn't get to start it, and runs before
+	//   the providers are stopped, a command may still be using them
+	ScopeGuard<void (*)()> ipcCleanup(ipc_server_stop);
+
+	// Filled in here, another instance starting may toggle the icon before
+	//   finish_startup adds it
 	notifyIconData.cbSize = sizeof(NOTIFYICONDATA);
 	notifyIconData.hWnd = hMainWindow;
 	notifyIconData.uFlags = NIF_MESSAGE | NIF_ICON;
 	notifyIconData.uCallbackMessage = APPWM_TRAYICON;
 	notifyIconData.hIcon = LoadIcon(hInstance, MAKEINTRESOURCE(IDI_ICON));
 	notifyIconData.uVersion = NOTIFYICON_VERSION;
-	if (!mpvc_config.invisible)
-		Shell_NotifyIcon(NIM_ADD, &notifyIconData);
 	struct __delete_notifyicon {
 		// So invisible doesn't get set to false before the config is written
 		//   note: I learned about that the hard way.
 		static void del() { Shell_NotifyIcon(NIM_DELETE, &notifyIconData); }
 	};
-	AutoCleanup<void(*)()> notifyIconDeleter(__delete_notifyicon::del, mpvc_config.invisible);
+	ScopeGuard<void (*)()> notifyIconDeleter(__delete_notifyicon::del, false);
 	::notifyIconDeleter = &notifyIconDeleter;
 
+	PostMessage(hMainWindow, APPWM_STARTUP, STARTUP_STEP_SNAPSHOT, 0);
+	mpvc_metrics.startup_phase_done(STARTUP_LOOP);
 	MSG msg;
 	BOOL bRet;
 	while ((bRet = GetMessage(&msg, NULL, 0, 0)))
@@ -303,7 +636,5 @@ int CALLBACK _tWinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPTSTR lpCm
 		DispatchMessage(&msg);
 	}
 
-	delete_volume_controls();
-
 	return bRet ? (int)bRet : (int)msg.wParam;
 }
@@ -0,0 +1,386 @@
+#include "unicode.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "resource.h"
+#include "errors.hpp"
+#include "event_loop.hpp"
+#include "evdev_input.hpp"
+#include "key_actions.hpp"
+#include "volume_control.hpp"
+#include "volume_dispatch.hpp"
+#include "fade_engine.hpp"
+#include "volume_snapshot.hpp"
+#include "fake_volume_control.hpp"
+#include "ipc.hpp"
+#include "memory_usage.hpp"
+#include "metrics.hpp"
+#include "stats_segment.hpp"
+#include "timeline.hpp"
+#include "mpvc_config.hpp"
+#include "plugin_loader.hpp"
+#include "volume_steps.hpp"
+#if MPVC_HAVE_PULSE
+#include "pulse_volume_control.hpp"
+#endif
+#if MPVC_HAVE_DBUS
+#include "mpris_volume_control.hpp"
+#endif
+
+MPVCConfig mpvc_config;
+
+static EventLoop* mainLoop;
+static StatsSegment statsSegment;
+
+// Volume changes of one batch of input events are applied together as a
+//   count of presses of one step, so a backlog of autorepeat doesn't turn
+//   into a backlog of writes to the audio system. A press of another step
+//   goes in a change of its own.
+class KeyActionDispatcher : public EvdevInput::Listener
+{
+private:
+	bool verbose;
+	float pendingAmount;
+	unsigned int pendingPresses;
+	// The application a target binding selected, empty for the usual ones
+	MediaPlayerVolumeControlProvider::target_type target;
+public:
+	KeyActionDispatcher(bool verbose) : verbose(verbose), pendingAmount(), pendingPresses(), target() { }
+
+	virtual void on_key_action(KeyAction const& action)
+	{
+		if (action.type == KeyAction::ACTION_VOLUME_CHANGE)
+		{
+			if (pendingPresses && action.amount != pendingAmount)
+				flush();
+			pendingAmount = action.amount;
+			++pendingPresses;
+			return;
+		}
+		flush();
+		switch (action.type)
+		{
+		case KeyAction::ACTION_MUTE:
+		case KeyAction::ACTION_SET_VOLUME:
+			mpvc_metrics.keypressesHandled.fetch_add(1, std::memory_order_relaxed);
+			if (action.type == KeyAction::ACTION_MUTE)
+				volume_mute(target);
+			else
+				volume_set(target, action.amount);
+			mpvc_metrics.startup_phase_done(STARTUP_FIRST_KEY);
+			statsSegment.publish();
+			break;
+		case KeyAction::ACTION_SELECT_TARGET:
+			target = action.target;
+			if (verbose)
+				printf("keys change %s\n", target.empty() ? "every player" : target.c_str());
+			break;
+		case KeyAction::ACTION_QUIT:
+			if (mainLoop)
+				mainLoop->quit(0);
+			break;
+		case KeyAction::ACTION_TOGGLE_REDIRECTION:
+			mpvc_config.disabled = !mpvc_config.disabled;
+			if (verbose)
+				printf("redirection %s\n", mpvc_config.disabled ? "disabled" : "enabled");
+			break;
+		default:
+			// There is no notification area icon to toggle
+			break;
+		}
+	}
+	virtual void on_batch_end()
+	{
+		flush();
+	}
+private:
+	void flush()
+	{
+		if (!pendingPresses)
+			return;
+		mpvc_metrics.keypressesHandled.fetch_add(pendingPresses, std::memory_order_relaxed);
+		mpvc_metrics.coalescedEvents.fetch_add(pendingPresses - 1, std::memory_order_relaxed);
+		volume_change(target, pendingAmount * pendingPresses, pendingPresses);
+		mpvc_metrics.startup_phase_done(STARTUP_FIRST_KEY);
+		pendingAmount = 0.f;
+		pendingPresses = 0;
+		statsSegment.publish();
+	}
+};
+
+class MemoryLogTimer : public PeriodicTimer
+{
+public:
+	virtual void on_timer()
+	{
+		memory_log_append(mpvc_config.configDir + MEMORY_LOG_FILE);
+	}
+};
+
+// The targets they set show up with the next refresh
+static void on_ipc_executed()
+{
+	statsSegment.publish();
+}
+
+// Read into a config of its own, the running one keeps its state
+static bool reload_key_bindings(std::string& error)
+{
+	MPVCConfig config;
+	config.read_config(false);
+	if (key_bindings_configure(config.keyBindings, error))
+		return true;
+	error = "bad KeyBindings entry " + error;
+	return false;
+}
+
+static std::vector<std::string> split_list(std::string const& list)
+{
+	std::vector<std::string> ret;
+	std::string::size_type pos = 0, sep;
+	do {
+		sep = list.find(',', pos);
+		std::string item(list, pos, sep == std::string::npos ? std::string::npos : sep - pos);
+		std::string::size_type first = item.find_first_not_of(' '), last = item.find_last_not_of(' ');
+		if (first != std::string::npos)
+			ret.push_back(item.substr(first, last - first + 1));
+		pos = sep + 1;
+	} while (sep != std::string::npos);
+	return ret;
+}
+
+static void print_usage(char const* argv0)
+{
+	fprintf(stderr,
+		"Usage: %s [options]\n"
+		"       %s -c [COMMAND...]  send commands to the running instance (stdin if none)\n"
+		"  --grab                 grab the volume key devices (not full keyboards)\n"
+		"  --device PATH          only use PATH instead of all /dev/input/event* devices\n"
+		"  --no-hotplug           don't watch /dev/input for new devices\n"
+		"  --replay FILE          feed a raw evdev capture instead of live input\n"
+		"  --record FILE          record a timeline for mpvcreplay (see RecordTimeline)\n"
+		"  --fake-session NAME    control an in-memory session instead of the audio system\n"
+		"  --verbose              print every volume change\n", argv0, argv0);
+}
+
+static int run_client(int argc, char* argv[])
+{
+	std::vector<std::string> commands(argv, argv + argc);
+	if (commands.empty())
+	{
+		char line[1024];
+		while (fgets(line, sizeof line, stdin))
+		{
+			size_t len = strcspn(line, "\r\n");
+			if (len != 0)
+				commands.push_back(std::string(line, len));
+		}
+	}
+	int ret = ipc_client(commands);
+	if (ret == 2)
+		fprintf(stderr, "Couldn't reach the running instance at %s\n", IpcServer::socket_path().c_str());
+	return ret;
+}
+
+int main(int argc, char* argv[])
+{
+	if (argc > 1 && (strcmp(argv[1], "-c") == 0 || strcmp(argv[1], "--command") == 0))
+		return run_client(argc - 2, argv + 2);
+
+	bool grab = false, hotplug = true, verbose = false;
+	char const* replayFile = NULL;
+	char const* recordFile = NULL;
+	std::vector<std::string> devicePaths, fakeSessions;
+	for (int i = 1; i < argc; ++i)
+	{
+		if (strcmp(argv[i], "--grab") == 0)
+			grab = true;
+		else if (strcmp(argv[i], "--no-hotplug") == 0)
+			hotplug = false;
+		else if (strcmp(argv[i], "--verbose") == 0)
+			verbose = true;
+		else if (strcmp(argv[i], "--device") == 0 && i + 1 < argc)
+			devicePaths.push_back(argv[++i]);
+		else if (strcmp(argv[i], "--replay") == 0 && i + 1 < argc)
+			replayFile = argv[++i];
+		else if (strcmp(argv[i], "--record") == 0 && i + 1 < argc)
+			recordFile = argv[++i];
+		else if (strcmp(argv[i], "--fake-session") == 0 && i + 1 < argc)
+			fakeSessions.push_back(argv[++i]);
+		else if (strcmp(argv[i], "--version") == 0)
+		{
+			puts(PRODUCT_NAME " " VERSION_STRING);
+			return 0;
+		}
+		else
+		{
+			print_usage(argv[0]);
+			return 1;
+		}
+	}
+
+	// Before the providers and the dispatcher start their threads. A replay
+	//   doesn't run the loop, the signals end it like any program.
+	if (!replayFile && !QuitSignals::block())
+		return 1;
+	EventLoop loop;
+	if (!loop.init())
+		return 1;
+	// The socket doubles as the single instance lock, so it comes first, a
+	//   second instance leaves without touching the config, the volumes or
+	//   the audio system. Anything else is not fatal, the keys work without
+	//   it. Replays don't serve commands and run next to an instance.
+	IpcServer ipcServer(loop, on_ipc_executed);
+	if (!replayFile && !ipcServer.listen() && errno == EADDRINUSE)
+	{
+		fputs("Already running\n", stderr);
+		return 0;
+	}
+
+	if (!mpvc_config.read_config())
+	{
+		fputs("Couldn't read config.txt\n", stderr);
+		return 5;
+	}
+	// A replay leaves the config as it found it, like the volume snapshot
+	struct __config_write {
+		bool enabled;
+		~__config_write() { if (enabled) mpvc_config.write_config(); }
+	} __config_write_inst = { !replayFile };
+	if (!volume_steps_configure((StepCurve)mpvc_config.stepCurve, mpvc_config.stepDecibels))
+		fputs("StepDecibels needs four step sizes from 0.5 to 60, the default ones are used\n", stderr);
+	std::string bindingError;
+	if (!key_bindings_configure(mpvc_config.keyBindings, bindingError))
+		fprintf(stderr, "KeyBindings entry %s doesn't parse, the default bindings are used\n", bindingError.c_str());
+	// Whatever reads --verbose output gets every line as it happens
+	if (verbose)
+		setvbuf(stdout, NULL, _IOLBF, 0);
+	// Before the providers, they restore from it as they find the players,
+	//   and stopped after them. Without it nothing is remembered or restored,
+	//   so replays don't depend on earlier runs or on their own order.
+	if (mpvc_config.rememberVolumes && !replayFile)
+		volume_snapshot_start(mpvc_config.configDir + VOLUME_SNAPSHOT_FILE);
+	struct __volume_snapshot_stop {
+		~__volume_snapshot_stop() { volume_snapshot_stop(); }
+	} __volume_snapshot_stop_inst;
+	// Before the providers, so it has the sessions there already are
+	std::string recordPath(recordFile ? recordFile : "");
+	if (!recordFile && !mpvc_config.recordTimeline.empty())
+		recordPath = mpvc_config.configDir + mpvc_config.recordTimeline;
+	if (!recordPath.empty() && !timeline_record_start(recordPath))
+		ShowErrorMessage(errno, "timeline_record_start error");
+	struct __timeline_stop {
+		~__timeline_stop() { timeline_record_stop(); }
+	} __timeline_stop_inst;
+	mpvc_metrics.startup_phase_done(STARTUP_CONFIG);
+
+	if (!fakeSessions.empty())
+	{
+		FakeVolumeControlProvider* fakeProvider = new FakeVolumeControlProvider(verbose);
+		for (std::vector<std::string>::iterator start = fakeSessions.begin(), end = fakeSessions.end(); start != end; ++start)
+			fakeProvider->add_session(*start, .5f);
+		add_volume_control(fakeProvider);
+	}
+	else
+	{
+		std::vector<std::string> processNames = split_list(mpvc_config.processNames), providers = split_list(mpvc_config.providers);
+#if MPVC_HAVE_PULSE
+		if (std::find(providers.begin(), providers.end(), "pulse") != providers.end())
+		{
+			PulseAudioVolumeControlProvider* pulseProvider = new PulseAudioVolumeControlProvider();
+			for (std::vector<std::string>::iterator start = processNames.begin(), end = processNames.end(); start != end; ++start)
+				pulseProvider->register_process_name(*start);
+			if (pulseProvider->connect())
+				add_volume_control(pulseProvider);
+			else
+				delete pulseProvider;
+		}
+#endif
+#if MPVC_HAVE_DBUS
+		if (std::find(providers.begin(), providers.end(), "mpris") != providers.end())
+		{
+			MprisVolumeControlProvider* mprisProvider = new MprisVolumeControlProvider();
+			for (std::vector<std::string>::iterator start = processNames.begin(), end = processNames.end(); start != end; ++start)
+				mprisProvider->register_player_name(*start);
+			if (mprisProvider->connect())
+				add_volume_control(mprisProvider);
+			else
+				delete mprisProvider;
+		}
+#endif
+	}
+	std::vector<std::string> failedPlugins;
+	load_plugins(mpvc_config.configDir, mpvc_config.plugins, mpvc_config.processNames, failedPlugins);
+	for (std::vector<std::string>::iterator start = failedPlugins.begin(), end = failedPlugins.end(); start != end; ++start)
+		fprintf(stderr, "Plugin %s\n", start->c_str());
+	struct __delete_volume_controls {
+		// A provider stuck in a lane can't be deleted under it, nor under a
+		//   fade write
+		~__delete_volume_controls()
+		{
+			bool stopped = volume_dispatch_stop(1000);
+			fade_engine_stop();
+			if (stopped)
+				delete_volume_controls();
+		}
+	} __delete_volume_controls_inst;
+	mpvc_metrics.startup_phase_done(STARTUP_PROVIDERS);
+
+	KeyActionDispatcher dispatcher(verbose);
+	EvdevInput input(loop, dispatcher, mpvc_config.disabled);
+	input.set_grab(grab);
+
+	// Replays stay serial and deterministic
+	if (replayFile)
+		return input.replay(replayFile) ? 0 : 2;
+	volume_dispatch_start((DispatchPolicy)mpvc_config.dispatchPolicy, mpvc_config.providerBudget);
+	fade_engine_start(mpvc_config.fadeTime);
+	// The providers' first scan, on the lanes
+	volume_dispatch_warm_up();
+
+	ipc_set_reload_handler(reload_key_bindings);
+
+	// Not fatal either, only monitoring reads it. Stopped before the
+	//   providers, it lists the targets through them.
+	if (statsSegment.open())
+		statsSegment.start_refresh();
+	struct __stats_refresh_stop {
+		~__stats_refresh_stop() { statsSegment.stop_refresh(); }
+	} __stats_refresh_stop_inst;
+	// A line at the start, then one every interval
+	MemoryLogTimer memoryLogTimer;
+	if (mpvc_config.memoryLogInterval && memory_log_append(mpvc_config.configDir + MEMORY_LOG_FILE))
+		memoryLogTimer.start(loop, memory_log_interval_ms(mpvc_config.memoryLogInterval));
+
+	if (devicePaths.empty())
+	{
+		if (!input.open_all(hotplug))
+		{
+			fputs("No input devices with volume keys found\n", stderr);
+			return 4;
+		}
+	}
+	else
+		for (std::vector<std::string>::iterator start = devicePaths.begin(), end = devicePaths.end(); start != end; ++start)
+			if (!input.open_device(*start))
+			{
+				ShowErrorMessage(errno, "open_device error");
+				return 4;
+			}
+	mpvc_metrics.startup_phase_done(STARTUP_INPUT);
+
+	mainLoop = &loop;
+	QuitSignals quitSignals;
+	if (!quitSignals.start(loop))
+		return 1;
+	mpvc_metrics.startup_phase_done(STARTUP_LOOP);
+	int ret = loop.run();
+	mainLoop = NULL;
+	return ret;
+}
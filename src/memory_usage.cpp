@@ -0,0 +1,125 @@
+#include "unicode.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#ifdef _WIN32
+#include <Windows.h>
+#include <Psapi.h>
+#else
+#include <dirent.h>
+#include <malloc.h>
+#endif
+
+#include "memory_usage.hpp"
+
+#ifdef _WIN32
+bool memory_usage_read(MemoryUsage& out)
+{
+	PROCESS_MEMORY_COUNTERS_EX counters;
+	if (!GetProcessMemoryInfo(GetCurrentProcess(), (PROCESS_MEMORY_COUNTERS*)&counters, sizeof counters))
+		return false;
+	out.residentBytes = counters.WorkingSetSize;
+	out.peakResidentBytes = counters.PeakWorkingSetSize;
+	out.privateBytes = counters.PrivateUsage;
+	// Walking the heaps takes their locks, the commit charge shows the same
+	out.heapBytes = 0;
+	DWORD handles = 0;
+	GetProcessHandleCount(GetCurrentProcess(), &handles);
+	out.handles = handles;
+	return true;
+}
+#else
+// The kB values of the named lines of a /proc file
+static bool read_proc_kb(char const* path, char const* const* names, uint64_t* const* values, unsigned int count)
+{
+	FILE* f = fopen(path, "r");
+	if (!f)
+		return false;
+	char line[256];
+	while (fgets(line, sizeof line, f))
+		for (unsigned int i = 0; i < count; ++i)
+		{
+			size_t length = strlen(names[i]);
+			unsigned long long kb;
+			if (strncmp(line, names[i], length) == 0 && sscanf(line + length, " %llu", &kb) == 1)
+				*values[i] += kb * 1024;
+		}
+	fclose(f);
+	return true;
+}
+
+static uint64_t count_fds()
+{
+	DIR* dir = opendir("/proc/self/fd");
+	if (!dir)
+		return 0;
+	uint64_t count = 0;
+	while (struct dirent* entry = readdir(dir))
+		if (entry->d_name[0] != '.')
+			++count;
+	closedir(dir);
+	// The one of the listing
+	return count ? count - 1 : 0;
+}
+
+bool memory_usage_read(MemoryUsage& out)
+{
+	out = MemoryUsage();
+	static char const* const statusNames[] = { "VmRSS:", "VmHWM:" };
+	uint64_t* const statusValues[] = { &out.residentBytes, &out.peakResidentBytes };
+	if (!read_proc_kb("/proc/self/status", statusNames, statusValues, 2))
+		return false;
+	// Linux 4.14 and later, left at 0 before
+	static char const* const privateNames[] = { "Private_Clean:", "Private_Dirty:" };
+	uint64_t* const privateValues[] = { &out.privateBytes, &out.privateBytes };
+	read_proc_kb("/proc/self/smaps_rollup", privateNames, privateValues, 2);
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33))
+	struct mallinfo2 info = mallinfo2();
+	out.heapBytes = info.uordblks + info.hblkhd;
+#elif defined(__GLIBC__)
+	// Wraps around at 4 GB
+	struct mallinfo info = mallinfo();
+	out.heapBytes = (unsigned int)info.uordblks + (unsigned int)info.hblkhd;
+#endif
+	out.handles = count_fds();
+	return true;
+}
+#endif
+
+void memory_usage_format(MemoryUsage const& usage, std::string& out)
+{
+	char buf[160];
+	int len = snprintf(buf, sizeof buf, "resident_kb=%llu peak_resident_kb=%llu private_kb=%llu heap_kb=%llu handles=%llu",
+		(unsigned long long)(usage.residentBytes / 1024), (unsigned long long)(usage.peakResidentBytes / 1024), (unsigned long long)(usage.privateBytes / 1024),
+		(unsigned long long)(usage.heapBytes / 1024), (unsigned long long)usage.handles);
+	if (len > 0)
+		out.append(buf, (size_t)len < sizeof buf ? (size_t)len : sizeof buf - 1);
+}
+
+bool memory_log_append(std::basic_string<TCHAR> const& path)
+{
+	MemoryUsage usage;
+	if (!memory_usage_read(usage))
+		return false;
+	time_t now = time(NULL);
+	struct tm local;
+#ifdef _WIN32
+	bool haveTime = localtime_s(&local, &now) == 0;
+	FILE* f = _tfopen(path.c_str(), _T("a"));
+#else
+	bool haveTime = localtime_r(&now, &local) != NULL;
+	FILE* f = fopen(path.c_str(), "a");
+#endif
+	if (!f)
+		return false;
+	char stamp[32] = "";
+	if (haveTime)
+		strftime(stamp, sizeof stamp, "%Y-%m-%d %H:%M:%S ", &local);
+	std::string line(stamp);
+	memory_usage_format(usage, line);
+	line.append("\n");
+	bool ret = fwrite(line.data(), 1, line.size(), f) == line.size();
+	return fclose(f) == 0 && ret;
+}
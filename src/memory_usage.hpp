@@ -0,0 +1,50 @@
+#pragma once
+#ifndef __MEMORY_USAGE_HPP__
+#define __MEMORY_USAGE_HPP__
+
+#include "unicode.h"
+
+#ifdef _WIN32
+#include <tchar.h>
+#endif
+
+#include <stdint.h>
+
+#include <string>
+
+// File in the config folder MemoryLogInterval appends to
+#define MEMORY_LOG_FILE _T("memory.log")
+// Minutes, about 20 days keep the timers' milliseconds within 31 bits
+#define MEMORY_LOG_MAX_INTERVAL 30000
+
+// What the process holds, for telling a slow leak from a steady state over
+//   a long run
+struct MemoryUsage
+{
+	// Working set on Windows, RSS elsewhere
+	uint64_t residentBytes;
+	uint64_t peakResidentBytes;
+	// Commit charge on Windows, private pages (clean and dirty) elsewhere
+	uint64_t privateBytes;
+	// In use on the C heap, 0 where the allocator doesn't tell
+	uint64_t heapBytes;
+	// Kernel handles on Windows, file descriptors elsewhere
+	uint64_t handles;
+
+	MemoryUsage() : residentBytes(), peakResidentBytes(), privateBytes(), heapBytes(), handles() { }
+};
+
+bool memory_usage_read(MemoryUsage& out);
+
+// "name=value" pairs separated by spaces, sizes in kB
+void memory_usage_format(MemoryUsage const& usage, std::string& out);
+
+// Appends the local time and the usage as a line to the file
+bool memory_log_append(std::basic_string<TCHAR> const& path);
+
+inline unsigned int memory_log_interval_ms(unsigned int minutes)
+{
+	return (minutes < MEMORY_LOG_MAX_INTERVAL ? minutes : MEMORY_LOG_MAX_INTERVAL) * 60000;
+}
+
+#endif // __MEMORY_USAGE_HPP__
@@ -0,0 +1,106 @@
+#include "unicode.h"
+
+#include "metrics.hpp"
+
+#include <stdio.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <time.h>
+#include <unistd.h>
+#endif
+
+#include <chrono>
+
+#include "call_stats.hpp"
+
+Metrics mpvc_metrics;
+
+#ifdef _WIN32
+// How long ago the kernel created the process, the loader and the static
+//   initialization before this are part of the startup too
+static std::chrono::microseconds process_age()
+{
+	FILETIME creation, exited, kernel, user, now;
+	if (!GetProcessTimes(GetCurrentProcess(), &creation, &exited, &kernel, &user))
+		return std::chrono::microseconds(0);
+	GetSystemTimeAsFileTime(&now);
+	ULARGE_INTEGER start, current;
+	start.LowPart = creation.dwLowDateTime;
+	start.HighPart = creation.dwHighDateTime;
+	current.LowPart = now.dwLowDateTime;
+	current.HighPart = now.dwHighDateTime;
+	// In 100 ns units
+	return current.QuadPart > start.QuadPart ? std::chrono::microseconds((current.QuadPart - start.QuadPart) / 10) : std::chrono::microseconds(0);
+}
+#else
+// How long ago the process started, from the start time in /proc/self/stat.
+//   That is in clock ticks since boot, 10 ms usually, so the phases may be
+//   late by up to one tick; the exec is in it, unlike in a clock read here.
+static std::chrono::microseconds process_age()
+{
+	FILE* f = fopen("/proc/self/stat", "r");
+	if (!f)
+		return std::chrono::microseconds(0);
+	char line[1024];
+	bool read = fgets(line, sizeof line, f) != NULL;
+	fclose(f);
+	// The command name may have spaces and parentheses, the fields after
+	//   the last ')' don't. The start time is the 22nd field, the 20th after
+	//   the name.
+	char const* fields = read ? strrchr(line, ')') : NULL;
+	unsigned long long startTicks;
+	if (!fields || sscanf(fields + 1, " %*s %*s %*s %*s %*s %*s %*s %*s %*s %*s %*s %*s %*s %*s %*s %*s %*s %*s %*s %llu", &startTicks) != 1)
+		return std::chrono::microseconds(0);
+	long ticksPerSecond = sysconf(_SC_CLK_TCK);
+	struct timespec now;
+	if (ticksPerSecond <= 0 || clock_gettime(CLOCK_BOOTTIME, &now) != 0)
+		return std::chrono::microseconds(0);
+	long long nowUs = (long long)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+	long long startUs = (long long)(startTicks / ticksPerSecond) * 1000000 + (long long)(startTicks % ticksPerSecond) * 1000000 / ticksPerSecond;
+	return std::chrono::microseconds(nowUs > startUs ? nowUs - startUs : 0);
+}
+#endif
+
+// Back from the first clock read by the age of the process, the phases are
+//   from the process start and not from this file's static initialization
+static std::chrono::steady_clock::time_point const processStart = std::chrono::steady_clock::now() - process_age();
+
+static char const* const startupPhaseNames[STARTUP_PHASES] = { "startup_config_us", "startup_providers_us", "startup_input_us", "startup_loop_us", "startup_deferred_us", "startup_warm_up_us", "startup_first_key_us" };
+
+static void append_counter(std::string& out, char const* name, uint64_t value)
+{
+	char buf[64];
+	int len = snprintf(buf, sizeof buf, "%s%s=%llu", out.empty() ? "" : " ", name, (unsigned long long)value);
+	if (len > 0)
+		out.append(buf, (size_t)len < sizeof buf ? (size_t)len : sizeof buf - 1);
+}
+
+void Metrics::format(std::string& out) const
+{
+	append_counter(out, "keypresses_handled", keypressesHandled.load(std::memory_order_relaxed));
+	append_counter(out, "coalesced_events", coalescedEvents.load(std::memory_order_relaxed));
+	append_counter(out, "sessions_cached", sessionsCached.load(std::memory_order_relaxed));
+	append_counter(out, "provider_errors", providerErrors.load(std::memory_order_relaxed));
+	append_counter(out, "com_errors", comErrors.load(std::memory_order_relaxed));
+	append_counter(out, "hook_reinstalls", hookReinstalls.load(std::memory_order_relaxed));
+	append_counter(out, "ipc_commands", ipcCommands.load(std::memory_order_relaxed));
+	append_counter(out, "late_results", lateResults.load(std::memory_order_relaxed));
+	for (int i = 0; i < STARTUP_PHASES; ++i)
+		append_counter(out, startupPhaseNames[i], startupPhases[i].load(std::memory_order_relaxed));
+#if MPVC_CALL_STATS
+	call_stats_format(out);
+#endif
+}
+
+void Metrics::startup_phase_done(StartupPhase phase)
+{
+	if (startupPhases[phase].load(std::memory_order_relaxed))
+		return;
+	uint64_t us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - processStart).count();
+	uint64_t expected = 0;
+	// Never 0, that's for not reached
+	startupPhases[phase].compare_exchange_strong(expected, us ? us : 1, std::memory_order_relaxed);
+}
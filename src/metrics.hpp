@@ -0,0 +1,65 @@
+#pragma once
+#ifndef __METRICS_HPP__
+#define __METRICS_HPP__
+
+#include <stdint.h>
+
+#include <atomic>
+#include <string>
+
+// Steps of starting up, in the order they finish on Windows
+enum StartupPhase
+{
+	// Config read
+	STARTUP_CONFIG,
+	// Providers set up and the dispatcher started
+	STARTUP_PROVIDERS,
+	// Keyboard hook installed or input devices opened, keys are caught
+	STARTUP_INPUT,
+	// Entering the message or event loop
+	STARTUP_LOOP,
+	// What was left for the loop to do (notification icon, IPC, stats)
+	STARTUP_DEFERRED,
+	// A provider's first scan, run on its lane in the background
+	STARTUP_WARM_UP,
+	STARTUP_FIRST_KEY,
+	STARTUP_PHASES
+};
+
+// Process wide counters, readable through the IPC "stats" command and the
+//   shared memory segment (stats_segment.hpp).
+struct Metrics
+{
+	std::atomic<uint64_t> keypressesHandled;
+	// Key presses folded into an earlier pending one instead of being
+	//   applied on their own
+	std::atomic<uint64_t> coalescedEvents;
+	// Sessions found at the last refresh of the stats segment
+	std::atomic<uint64_t> sessionsCached;
+	// Failed calls into the audio stack (libpulse, D-Bus, plugins) and
+	//   calls the dispatcher couldn't hand to a provider
+	std::atomic<uint64_t> providerErrors;
+	// Failed COM calls of the Windows session provider
+	std::atomic<uint64_t> comErrors;
+	// Keyboard hook reinstalled after unlocking, or input device picked up
+	//   through hotplug
+	std::atomic<uint64_t> hookReinstalls;
+	std::atomic<uint64_t> ipcCommands;
+	// Provider results that came in after their latency budget, see
+	//   volume_dispatch.hpp
+	std::atomic<uint64_t> lateResults;
+	// Microseconds from the start of the process to the end of each phase, 0 for phases not reached yet
+	std::atomic<uint64_t> startupPhases[STARTUP_PHASES];
+
+	Metrics() : keypressesHandled(), coalescedEvents(), sessionsCached(), providerErrors(), comErrors(), hookReinstalls(), ipcCommands(), lateResults(), startupPhases() { }
+
+	// Only the first time a phase finishes counts
+	void startup_phase_done(StartupPhase phase);
+
+	// "name=value" pairs separated by spaces
+	void format(std::string& out) const;
+};
+
+extern Metrics mpvc_metrics;
+
+#endif // __METRICS_HPP__
@@ -0,0 +1,432 @@
+#include "mpris_volume_control.hpp"
+
+#include <poll.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+#include <algorithm>
+
+#include "metrics.hpp"
+#include "volume_snapshot.hpp"
+#include "volume_steps.hpp"
+
+static const char mprisPrefix[] = "org.mpris.MediaPlayer2.";
+static const char mprisPath[] = "/org/mpris/MediaPlayer2";
+static const char mprisPlayerInterface[] = "org.mpris.MediaPlayer2.Player";
+static const char propertiesInterface[] = "org.freedesktop.DBus.Properties";
+
+MprisVolumeControlProvider::~MprisVolumeControlProvider()
+{
+	running = false;
+	if (dispatchThread.joinable())
+	{
+		uint64_t one = 1;
+		if (write(wakeupFd, &one, sizeof one) != sizeof one)
+			perror("eventfd write error");
+		dispatchThread.join();
+	}
+	if (wakeupFd != -1)
+		close(wakeupFd);
+	if (connection)
+	{
+		dbus_connection_flush(connection);
+		dbus_connection_remove_filter(connection, message_filter, this);
+		dbus_connection_close(connection);
+		dbus_connection_unref(connection);
+	}
+}
+
+bool MprisVolumeControlProvider::connect()
+{
+	DBusError error;
+	dbus_error_init(&error);
+	dbus_threads_init_default();
+	if (!(connection = dbus_bus_get_private(DBUS_BUS_SESSION, &error)))
+	{
+		fprintf(stderr, "dbus_bus_get_private error: %s\n", error.message);
+		dbus_error_free(&error);
+		return false;
+	}
+	dbus_connection_set_exit_on_disconnect(connection, FALSE);
+
+	dbus_bus_add_match(connection, "type='signal',sender='org.freedesktop.DBus',interface='org.freedesktop.DBus',member='NameOwnerChanged',arg0namespace='org.mpris.MediaPlayer2'", &error);
+	if (!dbus_error_is_set(&error))
+		dbus_bus_add_match(connection, "type='signal',interface='org.freedesktop.DBus.Properties',member='PropertiesChanged',path='/org/mpris/MediaPlayer2',arg0='org.mpris.MediaPlayer2.Player'", &error);
+	if (dbus_error_is_set(&error))
+	{
+		fprintf(stderr, "dbus_bus_add_match error: %s\n", error.message);
+		dbus_error_free(&error);
+		return false;
+	}
+	dbus_connection_add_filter(connection, message_filter, this, NULL);
+
+	// The only blocking calls: list the players that are already running.
+	//   Everything after this comes from the signals.
+	DBusMessage* call = dbus_message_new_method_call("org.freedesktop.DBus", "/org/freedesktop/DBus", "org.freedesktop.DBus", "ListNames");
+	DBusMessage* reply = call ? dbus_connection_send_with_reply_and_block(connection, call, 1000, &error) : NULL;
+	if (call)
+		dbus_message_unref(call);
+	if (reply)
+	{
+		DBusMessageIter iter, names;
+		if (dbus_message_iter_init(reply, &iter) && dbus_message_iter_get_arg_type(&iter) == DBUS_TYPE_ARRAY)
+			for (dbus_message_iter_recurse(&iter, &names); dbus_message_iter_get_arg_type(&names) == DBUS_TYPE_STRING; dbus_message_iter_next(&names))
+			{
+				char const* name;
+				dbus_message_iter_get_basic(&names, &name);
+				if (strncmp(name, mprisPrefix, sizeof mprisPrefix - 1) != 0 || !matches(name))
+					continue;
+
+				DBusMessage* ownerCall = dbus_message_new_method_call("org.freedesktop.DBus", "/org/freedesktop/DBus", "org.freedesktop.DBus", "GetNameOwner");
+				dbus_message_append_args(ownerCall, DBUS_TYPE_STRING, &name, DBUS_TYPE_INVALID);
+				DBusMessage* ownerReply = dbus_connection_send_with_reply_and_block(connection, ownerCall, 1000, NULL);
+				dbus_message_unref(ownerCall);
+				char const* owner;
+				if (ownerReply && dbus_message_get_args(ownerReply, NULL, DBUS_TYPE_STRING, &owner, DBUS_TYPE_INVALID))
+					add_player(name, owner, false);
+				if (ownerReply)
+					dbus_message_unref(ownerReply);
+			}
+		dbus_message_unref(reply);
+	}
+	else if (dbus_error_is_set(&error))
+	{
+		fprintf(stderr, "ListNames error: %s\n", error.message);
+		dbus_error_free(&error);
+	}
+
+	if ((wakeupFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK)) == -1)
+	{
+		perror("eventfd error");
+		return false;
+	}
+	running = true;
+	dispatchThread = std::thread(&MprisVolumeControlProvider::dispatch_thread, this);
+	return true;
+}
+
+std::string MprisVolumeControlProvider::player_name(std::string const& busName)
+{
+	std::string::size_type end = busName.find('.', sizeof mprisPrefix - 1);
+	return std::string(busName, sizeof mprisPrefix - 1, end == std::string::npos ? std::string::npos : end - (sizeof mprisPrefix - 1));
+}
+
+bool MprisVolumeControlProvider::matches(std::string const& busName) const
+{
+	if (busName.compare(0, sizeof mprisPrefix - 1, mprisPrefix) != 0)
+		return false;
+	return std::find(playerNames.begin(), playerNames.end(), player_name(busName)) != playerNames.end();
+}
+
+bool MprisVolumeControlProvider::matches_target(std::string const& busName, target_type const& target)
+{
+	if (target.empty())
+		return true;
+	return busName.compare(sizeof mprisPrefix - 1, target.length(), target) == 0
+		&& (busName.length() == sizeof mprisPrefix - 1 + target.length() || busName[sizeof mprisPrefix - 1 + target.length()] == '.');
+}
+
+void MprisVolumeControlProvider::add_player(std::string const& busName, std::string const& uniqueName, bool restore)
+{
+	Player player;
+	player.busName = busName;
+	player.name = player_name(busName);
+	player.uniqueName = uniqueName;
+	player.volume = 1.;
+	player.unmutedVolume = 1.;
+	player.volumeKnown = false;
+	player.pendingSerial = 0;
+	query_volume(player);
+	if (restore)
+		restore_volume(player);
+
+	std::lock_guard<std::mutex> lock(playersMutex);
+	for (std::vector<Player>::iterator start = players.begin(), end = players.end(); start != end; ++start)
+		if ((*start).busName == busName)
+		{
+			*start = player;
+			return;
+		}
+	players.push_back(player);
+}
+
+void MprisVolumeControlProvider::query_volume(Player& player)
+{
+	// Once per player appearing, not per key press
+	DBusMessage* call = dbus_message_new_method_call(player.busName.c_str(), mprisPath, propertiesInterface, "Get");
+	if (!call)
+		return;
+	char const* interfaceName = mprisPlayerInterface;
+	char const* propertyName = "Volume";
+	dbus_message_append_args(call, DBUS_TYPE_STRING, &interfaceName, DBUS_TYPE_STRING, &propertyName, DBUS_TYPE_INVALID);
+	DBusMessage* reply = dbus_connection_send_with_reply_and_block(connection, call, 1000, NULL);
+	dbus_message_unref(call);
+	if (!reply)
+		return;
+	DBusMessageIter iter, variant;
+	if (dbus_message_iter_init(reply, &iter) && dbus_message_iter_get_arg_type(&iter) == DBUS_TYPE_VARIANT)
+	{
+		dbus_message_iter_recurse(&iter, &variant);
+		if (dbus_message_iter_get_arg_type(&variant) == DBUS_TYPE_DOUBLE)
+		{
+			dbus_message_iter_get_basic(&variant, &player.volume);
+			player.volumeKnown = true;
+		}
+	}
+	dbus_message_unref(reply);
+}
+
+// Gives a player that started again the state it was last set to, by the
+//   name it was registered with like the other providers' process names.
+//   MPRIS has no mute, a muted player is set to 0 like the keys do.
+void MprisVolumeControlProvider::restore_volume(Player& player)
+{
+	VolumeSnapshotEntry entry;
+	if (!volume_snapshot_lookup(player.name, entry) || !(entry.flags & (VolumeSnapshotEntry::HAS_VOLUME | VolumeSnapshotEntry::HAS_MUTE)))
+		return;
+	if (entry.flags & VolumeSnapshotEntry::HAS_VOLUME)
+		player.volume = player.unmutedVolume = entry.volume;
+	if ((entry.flags & VolumeSnapshotEntry::HAS_MUTE) && (entry.flags & VolumeSnapshotEntry::MUTED) && player.volume > 0.)
+	{
+		player.unmutedVolume = player.volume;
+		player.volume = 0.;
+	}
+	player.volumeKnown = true;
+	if (send_volume(player, player.volume))
+		dbus_connection_flush(connection);
+}
+
+void MprisVolumeControlProvider::dispatch_thread()
+{
+	// dbus_connection_read_write_dispatch would hold the connection's I/O path
+	//   for the whole poll, making every Set from the key press path wait for
+	//   it. Poll ourselves and only enter libdbus for non-blocking reads.
+	int fd;
+	if (!dbus_connection_get_unix_fd(connection, &fd))
+		return;
+	struct pollfd fds[2] = { { fd, POLLIN, 0 }, { wakeupFd, POLLIN, 0 } };
+	while (running)
+	{
+		if (poll(fds, 2, -1) == -1)
+			continue;
+		if (!dbus_connection_read_write(connection, 0))
+			break;
+		while (dbus_connection_dispatch(connection) == DBUS_DISPATCH_DATA_REMAINS)
+			;
+	}
+}
+
+DBusHandlerResult MprisVolumeControlProvider::message_filter(DBusConnection*, DBusMessage* message, void* userdata)
+{
+	MprisVolumeControlProvider* self = static_cast<MprisVolumeControlProvider*>(userdata);
+	if (dbus_message_is_signal(message, "org.freedesktop.DBus", "NameOwnerChanged"))
+		self->on_name_owner_changed(message);
+	else if (dbus_message_is_signal(message, propertiesInterface, "PropertiesChanged"))
+		self->on_properties_changed(message);
+	return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+}
+
+void MprisVolumeControlProvider::on_name_owner_changed(DBusMessage* message)
+{
+	char const *name, *oldOwner, *newOwner;
+	if (!dbus_message_get_args(message, NULL, DBUS_TYPE_STRING, &name, DBUS_TYPE_STRING, &oldOwner, DBUS_TYPE_STRING, &newOwner, DBUS_TYPE_INVALID) || !matches(name))
+		return;
+	if (*newOwner)
+	{
+		// query_volume blocks, but this is the dispatch thread and not the
+		//   key press path
+		add_player(name, newOwner, true);
+		return;
+	}
+	std::lock_guard<std::mutex> lock(playersMutex);
+	for (std::vector<Player>::iterator start = players.begin(), end = players.end(); start != end; ++start)
+		if ((*start).busName == name)
+		{
+			players.erase(start);
+			break;
+		}
+}
+
+void MprisVolumeControlProvider::on_properties_changed(DBusMessage* message)
+{
+	char const* sender = dbus_message_get_sender(message);
+	DBusMessageIter iter, dict, entry, variant;
+	if (!sender || !dbus_message_iter_init(message, &iter) || !dbus_message_iter_next(&iter) || dbus_message_iter_get_arg_type(&iter) != DBUS_TYPE_ARRAY)
+		return;
+
+	// a{sv}, only Volume is of interest
+	for (dbus_message_iter_recurse(&iter, &dict); dbus_message_iter_get_arg_type(&dict) == DBUS_TYPE_DICT_ENTRY; dbus_message_iter_next(&dict))
+	{
+		dbus_message_iter_recurse(&dict, &entry);
+		char const* key;
+		dbus_message_iter_get_basic(&entry, &key);
+		if (strcmp(key, "Volume") != 0 || !dbus_message_iter_next(&entry))
+			continue;
+		dbus_message_iter_recurse(&entry, &variant);
+		if (dbus_message_iter_get_arg_type(&variant) != DBUS_TYPE_DOUBLE)
+			continue;
+		double volume;
+		dbus_message_iter_get_basic(&variant, &volume);
+
+		std::lock_guard<std::mutex> lock(playersMutex);
+		for (std::vector<Player>::iterator start = players.begin(), end = players.end(); start != end; ++start)
+			if ((*start).uniqueName == sender && !(*start).pendingSerial)
+			{
+				(*start).volume = volume;
+				(*start).volumeKnown = true;
+			}
+	}
+}
+
+// Runs on the dispatch thread, also for a timeout or a disconnect
+void MprisVolumeControlProvider::on_set_reply(DBusPendingCall* pending, void* userdata)
+{
+	MprisVolumeControlProvider* self = static_cast<MprisVolumeControlProvider*>(userdata);
+	DBusMessage* reply = dbus_pending_call_steal_reply(pending);
+	if (!reply)
+		return;
+	if (dbus_message_get_type(reply) == DBUS_MESSAGE_TYPE_ERROR)
+		mpvc_metrics.providerErrors.fetch_add(1, std::memory_order_relaxed);
+	dbus_uint32_t serial = dbus_message_get_reply_serial(reply);
+	dbus_message_unref(reply);
+
+	std::lock_guard<std::mutex> lock(self->playersMutex);
+	for (std::vector<Player>::iterator start = self->players.begin(), end = self->players.end(); start != end; ++start)
+		if ((*start).pendingSerial == serial)
+			(*start).pendingSerial = 0;
+}
+
+bool MprisVolumeControlProvider::send_volume(Player& player, double volume)
+{
+	DBusMessage* call = dbus_message_new_method_call(player.busName.c_str(), mprisPath, propertiesInterface, "Set");
+	if (!call)
+		return false;
+
+	char const* interfaceName = mprisPlayerInterface;
+	char const* propertyName = "Volume";
+	DBusMessageIter iter, variant;
+	dbus_message_iter_init_append(call, &iter);
+	bool ret = dbus_message_iter_append_basic(&iter, DBUS_TYPE_STRING, &interfaceName)
+		&& dbus_message_iter_append_basic(&iter, DBUS_TYPE_STRING, &propertyName)
+		&& dbus_message_iter_open_container(&iter, DBUS_TYPE_VARIANT, DBUS_TYPE_DOUBLE_AS_STRING, &variant);
+	if (ret)
+	{
+		ret = dbus_message_iter_append_basic(&variant, DBUS_TYPE_DOUBLE, &volume);
+		ret = dbus_message_iter_close_container(&iter, &variant) && ret;
+	}
+	// The reply is only waited for by on_set_reply, never on this path
+	DBusPendingCall* pending = NULL;
+	if (ret)
+		ret = dbus_connection_send_with_reply(connection, call, &pending, DBUS_TIMEOUT_USE_DEFAULT) && pending;
+	if (ret)
+	{
+		player.pendingSerial = dbus_message_get_serial(call);
+		dbus_pending_call_set_notify(pending, on_set_reply, this, NULL);
+		// Answered before the notify was set, it won't be called for it then
+		if (dbus_pending_call_get_completed(pending))
+			player.pendingSerial = 0;
+		dbus_pending_call_unref(pending);
+	}
+	dbus_message_unref(call);
+	if (!ret)
+		mpvc_metrics.providerErrors.fetch_add(1, std::memory_order_relaxed);
+	return ret;
+}
+
+// The commands are applied to the cached volume, a player gets one Set
+//   call with where they leave it
+void MprisVolumeControlProvider::apply_batch(VolumeCommand const* commands, size_t count, VOLUME_CHANGE_STATUS* statuses)
+{
+	if (!connection)
+	{
+		std::fill(statuses, statuses + count, STATUS_ERROR);
+		return;
+	}
+	std::fill(statuses, statuses + count, STATUS_NOT_FOUND);
+	{
+		std::lock_guard<std::mutex> lock(playersMutex);
+		for (std::vector<Player>::iterator start = players.begin(), end = players.end(); start != end; ++start)
+		{
+			bool write = false;
+			for (size_t i = 0; i < count; ++i)
+			{
+				VolumeCommand const& command = commands[i];
+				if (!matches_target((*start).busName, command.target))
+					continue;
+				// Until the player's volume is known only an absolute one can be
+				//   set, a step or a mute would start from a made up 1.0
+				if (!(*start).volumeKnown && command.op != VolumeCommand::SET_VOLUME && command.op != VolumeCommand::FADE)
+					continue;
+				statuses[i] = STATUS_FOUND;
+				bool mute;
+				switch (command.op)
+				{
+				case VolumeCommand::CHANGE:
+					// Players may allow more than 100%, the keys stay within 0..1
+					//   like the session volume does
+					(*start).volume = volume_step_target((float)(*start).volume, command.value, SCALE_AMPLITUDE, command.presses);
+					volume_snapshot_record_volume((*start).name, (float)(*start).volume);
+					write = true;
+					break;
+				case VolumeCommand::SET_VOLUME:
+				case VolumeCommand::FADE:
+					(*start).volume = std::min<double>(std::max<double>(command.value, 0.), 1.);
+					(*start).volumeKnown = true;
+					volume_snapshot_record_volume((*start).name, (float)(*start).volume);
+					write = true;
+					break;
+				case VolumeCommand::TOGGLE_MUTE:
+				case VolumeCommand::SET_MUTE:
+					// MPRIS has no mute, remember the volume instead
+					mute = command.op == VolumeCommand::TOGGLE_MUTE ? (*start).volume > 0. : command.value != 0.f;
+					if (mute == ((*start).volume <= 0.))
+						break;
+					if (mute)
+					{
+						(*start).unmutedVolume = (*start).volume;
+						(*start).volume = 0.;
+					}
+					else
+						(*start).volume = (*start).unmutedVolume;
+					volume_snapshot_record_mute((*start).name, mute);
+					write = true;
+					break;
+				}
+			}
+			if (!write || send_volume(*start, (*start).volume))
+				continue;
+			for (size_t i = 0; i < count; ++i)
+				if (matches_target((*start).busName, commands[i].target))
+					statuses[i] = STATUS_ERROR;
+		}
+	}
+	// All Set calls leave in one write
+	dbus_connection_flush(connection);
+}
+
+MediaPlayerVolumeControlProvider::VOLUME_CHANGE_STATUS MprisVolumeControlProvider::get_target_volume(target_type const& target, float& volume, bool& muted)
+{
+	std::lock_guard<std::mutex> lock(playersMutex);
+	for (std::vector<Player>::iterator start = players.begin(), end = players.end(); start != end; ++start)
+		if ((*start).volumeKnown && matches_target((*start).busName, target))
+		{
+			volume = (float)(*start).volume;
+			muted = (*start).volume <= 0.;
+			return STATUS_FOUND;
+		}
+	return STATUS_NOT_FOUND;
+}
+
+void MprisVolumeControlProvider::list_targets(std::vector<TargetState>& out)
+{
+	std::lock_guard<std::mutex> lock(playersMutex);
+	for (std::vector<Player>::iterator start = players.begin(), end = players.end(); start != end; ++start)
+		if ((*start).volumeKnown)
+		{
+			TargetState state = { (*start).busName.substr(sizeof mprisPrefix - 1), (float)(*start).volume, (*start).volume <= 0. };
+			out.push_back(state);
+		}
+}
@@ -0,0 +1,89 @@
+#pragma once
+#ifndef __MPRIS_VOLUME_CONTROL_HPP__
+#define __MPRIS_VOLUME_CONTROL_HPP__
+
+#include <atomic>
+#include <string>
+#include <vector>
+#include <mutex>
+#include <thread>
+
+#include <dbus/dbus.h>
+
+#include "volume_control.hpp"
+
+// Drives the volume of players that manage it themselves (VLC, mpv with
+//   mpv-mpris, ...) through org.mpris.MediaPlayer2.Player.Volume.
+//
+// The players present on the bus and their Volume are cached from
+//   NameOwnerChanged and PropertiesChanged signals. A key press only queues
+//   one Properties.Set call per player, nothing is introspected or waited for
+//   on that path, the replies come in on the dispatch thread.
+//
+// A PropertiesChanged signal can still carry the volume of an earlier Set when
+//   it comes in, so it is only taken while no Set to the player is waiting
+//   for its reply. The player answers in order, so the reply to the last one
+//   is enough to know.
+class MprisVolumeControlProvider : public MediaPlayerVolumeControlProvider
+{
+private:
+	struct Player
+	{
+		std::string busName;
+		// The registered name, which the volume snapshot goes by
+		std::string name;
+		std::string uniqueName;
+		double volume;
+		double unmutedVolume;
+		bool volumeKnown;
+		// Serial of the last Set call until its reply comes in, 0 after it
+		dbus_uint32_t pendingSerial;
+	};
+
+	std::vector<std::string> playerNames;
+
+	DBusConnection* connection;
+	std::thread dispatchThread;
+	std::atomic<bool> running;
+	int wakeupFd;
+
+	std::mutex playersMutex;
+	std::vector<Player> players;
+public:
+	MprisVolumeControlProvider() : playerNames(), connection(), dispatchThread(), running(), wakeupFd(-1), playersMutex(), players() { }
+	~MprisVolumeControlProvider();
+
+	// The part of the bus name after org.mpris.MediaPlayer2., without the
+	//   .instanceN suffix some players append (e.g. "vlc")
+	void register_player_name(std::string const& name)
+	{
+		playerNames.push_back(name);
+	}
+
+	bool connect();
+private:
+	// The registered name of a player, like vlc for
+	//   org.mpris.MediaPlayer2.vlc.instance42
+	static std::string player_name(std::string const& busName);
+	bool matches(std::string const& busName) const;
+	static bool matches_target(std::string const& busName, target_type const& target);
+	// Only players appearing once the provider runs get their remembered
+	//   state back, like the sessions of the other providers
+	void add_player(std::string const& busName, std::string const& uniqueName, bool restore);
+	void query_volume(Player& player);
+	void restore_volume(Player& player);
+
+	void dispatch_thread();
+	static DBusHandlerResult message_filter(DBusConnection* connection, DBusMessage* message, void* userdata);
+	void on_name_owner_changed(DBusMessage* message);
+	void on_properties_changed(DBusMessage* message);
+	static void on_set_reply(DBusPendingCall* pending, void* userdata);
+
+	bool send_volume(Player& player, double volume);
+
+	virtual void apply_batch(VolumeCommand const* commands, size_t count, VOLUME_CHANGE_STATUS* statuses);
+	virtual VOLUME_CHANGE_STATUS get_target_volume(target_type const& target, float& volume, bool& muted);
+	virtual void list_targets(std::vector<TargetState>& out);
+};
+
+#endif // __MPRIS_VOLUME_CONTROL_HPP__
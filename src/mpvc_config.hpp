@@ -5,35 +5,96 @@
 #include "unicode.h"
 
 #include <stdlib.h>
+#ifdef _WIN32
 #include <tchar.h>
+#else
+#include <stdio.h>
+#include <sys/stat.h>
+#endif
 
-#include <fstream>
 #include <string>
 
 #include "config.hpp"
+#include "file_io.hpp"
+#include "volume_steps.hpp"
 
-class MPVCConfig : public config::ConfigIO<_TCHAR>
+// The file is UTF-8, so are the strings read from it
+class MPVCConfig : public config::ConfigIO<char>
 {
 private:
-#if defined(_MSC_VER) || !UNICODE
-	typedef std::basic_string<TCHAR> path_type;
-#else
-	typedef std::string path_type;
-#endif
-	path_type configPath;
+	std::basic_string<_TCHAR> configPath;
+
+	bool write_file()
+	{
+		FileWriter out;
+		if (!out.open(configPath))
+			return false;
+		out.write("# Media Player Volume Control config\n# Generated by Media Player Volume Control " VERSION_STRING "\n\n");
+		config::ConfigIO<char>::generate_config(out.out());
+		return out.close();
+	}
 public:
+	// Where the config and the other files of the program live, with the
+	//   trailing separator
+	std::basic_string<_TCHAR> configDir;
+
 	bool disabled;
 	bool invisible;
 
 	unsigned char startDisabled;
 	unsigned char startHidden;
+	unsigned char dispatchPolicy;
+	unsigned int providerBudget;
+	unsigned int fadeTime;
+	unsigned char rememberVolumes;
+	std::string recordTimeline;
+	unsigned char stepCurve;
+	std::string stepDecibels;
+	std::string plugins;
+	unsigned int memoryLogInterval;
+	std::string keyBindings;
+	std::string processNames;
+	std::string providers;
+#ifdef _WIN32
+	unsigned char endpointScope;
+	std::string endpointIds;
+	unsigned char sessionFilter;
+	unsigned char routing;
+#endif
 
-	MPVCConfig() : configPath(), disabled(), invisible(), startDisabled(2), startHidden(2)
+	MPVCConfig() : configPath(), configDir(), disabled(), invisible(), startDisabled(2), startHidden(2), dispatchPolicy(0), providerBudget(250), fadeTime(0), rememberVolumes(1), recordTimeline(), stepCurve(0), stepDecibels(STEP_DEFAULT_DECIBELS), plugins(), memoryLogInterval(0), keyBindings()
+#ifdef _WIN32
+		, processNames("wmplayer.exe"), providers("sessions"), endpointScope(2), endpointIds(), sessionFilter(0), routing(0)
+#else
+		, processNames("vlc,mpv"), providers("pulse")
+#endif
 	{
-		config::ConfigIO<_TCHAR>::add_option(_T("StartDisabled"), _T("Whether the Media Keys redirection is disabled or enabled on start. 0 for enabled, 1 for disabled and 2 and 3 for enabled and disabled but remember the last state"), startDisabled);
-		config::ConfigIO<_TCHAR>::add_option(_T("StartHidden"), _T("Whether the Notification Area icon is shown or not. 0 for visible, 1 for hidden and 2 and 3 for visible and hidden but remember last state"), startHidden);
+		config::ConfigIO<char>::add_option("StartDisabled", "Whether the Media Keys redirection is disabled or enabled on start. 0 for enabled, 1 for disabled and 2 and 3 for enabled and disabled but remember the last state", startDisabled);
+		config::ConfigIO<char>::add_option("StartHidden", "Whether the Notification Area icon is shown or not. 0 for visible, 1 for hidden and 2 and 3 for visible and hidden but remember last state", startHidden);
+		config::ConfigIO<char>::add_option("DispatchPolicy", "When a volume key returns. 0 as soon as one backend found a player, 1 after every backend finished", dispatchPolicy);
+		config::ConfigIO<char>::add_option("ProviderBudget", "Milliseconds to wait for a backend before going on without it", providerBudget);
+		config::ConfigIO<char>::add_option("FadeTime", "Milliseconds a volume key's step is faded over, 0 for changing the volume right away", fadeTime);
+		config::ConfigIO<char>::add_option("RememberVolumes", "Whether a player gets the volume and mute state it was last set to back when it starts again. 0 for no, 1 for yes", rememberVolumes);
+		config::ConfigIO<char>::add_option("RecordTimeline", "File in the config folder to record the key presses, the players coming and going and the device changes to, for replaying them with mpvcreplay. Empty for not recording", recordTimeline);
+		config::ConfigIO<char>::add_option("StepCurve", "How a volume key's step is sized. 0 for a fixed amount of the volume, 1 for a fixed amount of decibels, which sounds the same at every volume", stepCurve);
+		config::ConfigIO<char>::add_option("StepDecibels", "Comma separated decibels of the Ctrl, plain, Ctrl+Shift and Shift steps for StepCurve: 1, each from 0.5 to 60", stepDecibels);
+		config::ConfigIO<char>::add_option("Plugins", "Comma separated names of the backend plugins to load from the plugins folder next to this file. Empty for loading none", plugins);
+		config::ConfigIO<char>::add_option("MemoryLogInterval", "Minutes between the lines of memory and handle usage appended to memory.log in the config folder, 0 for not logging", memoryLogInterval);
+		config::ConfigIO<char>::add_option("KeyBindings", "Semicolon separated bindings on top of the default ones, like Shift+VolumeUp=up 0.1; Alt+Mute=set 0.3; Ctrl+Alt+Mute=target vlc. The keys are VolumeUp, VolumeDown and Mute with Shift+, Ctrl+ and Alt+, the actions pass, up and down [amount], set <volume>, mute, toggle, icon, quit and target <app|*>", keyBindings);
+#ifdef _WIN32
+		config::ConfigIO<char>::add_option("ProcessNames", "Comma separated list of the player executables, like wmplayer.exe, whose audio sessions are controlled", processNames);
+		config::ConfigIO<char>::add_option("Providers", "Comma separated list of the volume backends to use. sessions for the players' audio sessions, empty for only the plugins", providers);
+		config::ConfigIO<char>::add_option("Endpoints", "Which playback devices to look for players on. 0 for the default device, 1 for the ones in EndpointIds and 2 for all of them", endpointScope);
+		config::ConfigIO<char>::add_option("EndpointIds", "Comma separated list of the endpoint ids of the playback devices for Endpoints: 1", endpointIds);
+		config::ConfigIO<char>::add_option("Sessions", "Which of a player's sessions the volume keys change. 0 for all of them, 1 for the ones playing and 2 for the ones playing and not silent, falling back to the looser ones if none are", sessionFilter);
+		config::ConfigIO<char>::add_option("Routing", "Which player the volume keys change. 0 for every player, 1 for the one in the foreground window if it is one, every player otherwise", routing);
+#else
+		config::ConfigIO<char>::add_option("ProcessNames", "Comma separated list of the player binaries whose streams are controlled", processNames);
+		config::ConfigIO<char>::add_option("Providers", "Comma separated list of the volume backends to use. pulse for the stream volume, mpris for the volume of the players themselves", providers);
+#endif
 	}
 
+#ifdef _WIN32
 	int get_config_path()
 	{
 		std::basic_string<TCHAR> tmp(MAX_PATH + 1, _T('\0'));
@@ -51,45 +112,50 @@ public:
 		tmp.resize(_tcslen(&tmp[0]));
 		tmp.append(_T("\\mpVolCtrl"));
 		CreateDirectory(tmp.c_str(), NULL);
-		tmp.append(_T("\\config.txt"));
+		tmp.append(_T("\\"));
+		configDir = tmp;
+		tmp.append(_T("config.txt"));
 
-#if defined(_MSC_VER) || !UNICODE
 		configPath = tmp;
+		return 1;
+	}
 #else
-		configPath.clear();
-		configPath.resize(wcstombs(0, tmp.c_str(), -1) + 1);
-		size_t nCharsConverted;
-		if ((nCharsConverted = wcstombs(&configPath[0], tmp.c_str(), tmp.length())) != (size_t)-1)
-			configPath.resize(nCharsConverted);
+	int get_config_path()
+	{
+		std::string tmp;
+		char const* dir = getenv("XDG_CONFIG_HOME");
+		if (dir && *dir)
+			tmp = dir;
+		else if ((dir = getenv("HOME")) && *dir)
+			(tmp = dir).append("/.config");
 		else
-			configPath.clear();
-#endif
+		{
+			fputs("Couldn't determine config folder\n", stderr);
+			return -1;
+		}
+
+		mkdir(tmp.c_str(), 0755);
+		tmp.append("/mpVolCtrl");
+		mkdir(tmp.c_str(), 0755);
+		tmp.append("/");
+		configDir = tmp;
+		tmp.append("config.txt");
+
+		configPath = tmp;
 		return 1;
 	}
+#endif
 
 	bool read_config(bool writeIfMissing = true)
 	{
 		if (configPath.empty())
 			get_config_path();
 
-		std::basic_fstream<_TCHAR> fs;
-		fs.open(configPath, std::basic_fstream<_TCHAR>::in);
-		if (fs.fail())
-		{
-			if (writeIfMissing)
-			{
-				fs.open(configPath, std::basic_fstream<_TCHAR>::out);
-				if (!fs.fail())
-				{
-					fs << std::noskipws << "# Media Player Volume Control config" << std::endl << "# Generated by Media Player Volume Control " VERSION_STRING << std::endl << std::endl;
-					config::ConfigIO<_TCHAR>::generate_config(std::ostreambuf_iterator<_TCHAR>(fs));
-				}
-			}
-		}
-		else
-			config::ConfigIO<_TCHAR>::parse_config(std::istreambuf_iterator<_TCHAR>(fs >> std::noskipws), std::istreambuf_iterator<_TCHAR>());
-		if (fs.is_open())
-			fs.close();
+		FileReader in;
+		if (in.open(configPath))
+			config::ConfigIO<char>::parse_config(in.begin(), in.end());
+		else if (writeIfMissing)
+			write_file();
 
 		disabled = (startDisabled & 1) != 0;
 		invisible = (startHidden & 1) != 0;
@@ -103,16 +169,7 @@ public:
 		if (startHidden & 2)
 			startHidden = invisible ? 3 : 2;
 
-		std::basic_fstream<_TCHAR> fs;
-		fs.open(configPath, std::basic_fstream<_TCHAR>::out);
-		if (!fs.fail())
-		{
-			fs << std::noskipws << "# Media Player Volume Control config" << std::endl << "# Generated by Media Player Volume Control " VERSION_STRING << std::endl << std::endl;
-			config::ConfigIO<_TCHAR>::generate_config(std::ostreambuf_iterator<_TCHAR>(fs));
-			fs.close();
-			return true;
-		}
-		return false;
+		return write_file();
 	}
 };
 
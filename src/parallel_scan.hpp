@@ -0,0 +1,58 @@
+#pragma once
+#ifndef __PARALLEL_SCAN_HPP__
+#define __PARALLEL_SCAN_HPP__
+
+#include "unicode.h"
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+// More endpoints than this are shared between the workers
+#define PARALLEL_SCAN_MAX_THREADS 8
+
+// Apartment for the workers that don't need one
+struct NoApartment
+{
+};
+
+// Runs scan(i, parts[i]) for every i below count. The calling thread takes
+//   part of the work, the rest is spread over up to maxThreads - 1 worker
+//   threads that each live in an Apartment (constructed on the worker, so
+//   its constructor can e.g. enter COM's multithreaded apartment) for as
+//   long as they scan. parts is resized to count and each part is written
+//   by exactly one thread, merging them in index order afterwards gives
+//   the same result as a serial scan.
+//
+// scan must not touch shared state without synchronizing.
+template<typename Apartment, typename Part, typename Scan>
+void parallel_scan(unsigned int count, std::vector<Part>& parts, Scan scan, unsigned int maxThreads = PARALLEL_SCAN_MAX_THREADS)
+{
+	parts.clear();
+	parts.resize(count);
+	if (count == 0)
+		return;
+
+	std::atomic<unsigned int> next(0);
+	auto work = [&]()
+	{
+		for (unsigned int i; (i = next.fetch_add(1, std::memory_order_relaxed)) < count; )
+			scan(i, parts[i]);
+	};
+
+	unsigned int threads = count < maxThreads ? count : maxThreads;
+	std::vector<std::thread> workers;
+	workers.reserve(threads - 1);
+	for (unsigned int i = 1; i < threads; ++i)
+		workers.emplace_back([&work]()
+		{
+			Apartment apartment;
+			(void)apartment;
+			work();
+		});
+	work();
+	for (std::vector<std::thread>::iterator start = workers.begin(), end = workers.end(); start != end; ++start)
+		start->join();
+}
+
+#endif // __PARALLEL_SCAN_HPP__
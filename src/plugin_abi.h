@@ -0,0 +1,108 @@
+#pragma once
+#ifndef __PLUGIN_ABI_H__
+#define __PLUGIN_ABI_H__
+
+/* The C interface of provider plugins, modules loaded at start from the
+ *   plugins folder next to config.txt when they're named in Plugins.
+ *
+ * A plugin exports mpvc_plugin_entry, which returns its function table.
+ *   The host checks abi_version and only ever calls a plugin instance
+ *   from one thread at a time. Strings are UTF-8 and only valid for the
+ *   call they are passed to. The layout of these structs only grows at
+ *   the end, along with MPVC_PLUGIN_ABI_VERSION.
+ */
+
+#include <stddef.h>
+
+#define MPVC_PLUGIN_ABI_VERSION 1
+
+#ifdef _WIN32
+#define MPVC_PLUGIN_EXPORT __declspec(dllexport)
+#else
+#define MPVC_PLUGIN_EXPORT __attribute__((visibility("default")))
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* The values of MediaPlayerVolumeControlProvider::VOLUME_CHANGE_STATUS */
+enum mpvc_status
+{
+	MPVC_STATUS_ERROR = -1,
+	MPVC_STATUS_FOUND = 0,
+	MPVC_STATUS_NOT_FOUND = 1
+};
+
+enum mpvc_op
+{
+	/* value is the delta, what a volume key does */
+	MPVC_OP_CHANGE = 0,
+	MPVC_OP_TOGGLE_MUTE = 1,
+	/* value is the volume, 0..1 */
+	MPVC_OP_SET_VOLUME = 2,
+	/* Like MPVC_OP_SET_VOLUME, over duration_ms if the backend can fade */
+	MPVC_OP_FADE = 3,
+	/* value is 1 for muting and 0 for unmuting */
+	MPVC_OP_SET_MUTE = 4
+};
+
+struct mpvc_command
+{
+	int op;
+	/* Process name, empty for every session the plugin controls */
+	char const* target;
+	size_t target_length;
+	float value;
+	unsigned int duration_ms;
+};
+
+/* What a plugin can tell the host, from any of its threads until
+ *   shutdown returns */
+struct mpvc_host
+{
+	unsigned int abi_version;
+	void* host_data;
+	/* Comma separated player names the user configured, may be empty */
+	char const* process_names;
+	void (*session_added)(void* host_data, char const* name, float volume);
+	void (*session_removed)(void* host_data, char const* name);
+	void (*devices_changed)(void* host_data, unsigned int count);
+};
+
+typedef void (*mpvc_list_callback)(void* context, char const* name, float volume, int muted);
+
+struct mpvc_plugin
+{
+	unsigned int abi_version;
+	/* Shown in messages */
+	char const* name;
+	/* Milliseconds the host waits for a command, 0 for the configured
+	 *   default */
+	unsigned int budget_ms;
+
+	/* Nonzero if the backend can work on this machine. Called before init;
+	 *   a plugin whose backend isn't there is unloaded again. */
+	int (*present)(void);
+	/* Returns the instance the other functions get, NULL on failure */
+	void* (*init)(struct mpvc_host const* host);
+	/* Runs the commands in order, setting an mpvc_status per command */
+	void (*apply)(void* instance, struct mpvc_command const* commands, size_t count, int* statuses);
+	/* The first matching session, returns an mpvc_status */
+	int (*get)(void* instance, char const* target, size_t target_length, float* volume, int* muted);
+	/* Calls back for every session it controls */
+	void (*list)(void* instance, mpvc_list_callback callback, void* context);
+	/* Stops the plugin's threads, no host callback may follow */
+	void (*shutdown)(void* instance);
+};
+
+/* The one export of a plugin. Returns NULL if it can't work with a host
+ *   of host_abi_version. */
+typedef struct mpvc_plugin const* (*mpvc_plugin_entry_function)(unsigned int host_abi_version);
+#define MPVC_PLUGIN_ENTRY "mpvc_plugin_entry"
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __PLUGIN_ABI_H__ */
@@ -0,0 +1,197 @@
+#include "unicode.h"
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <dlfcn.h>
+#endif
+
+#include "metrics.hpp"
+#include "plugin_abi.h"
+#include "plugin_loader.hpp"
+#include "timeline.hpp"
+#include "utf8.hpp"
+
+static_assert((int)MPVC_STATUS_ERROR == (int)MediaPlayerVolumeControlProvider::STATUS_ERROR && (int)MPVC_STATUS_FOUND == (int)MediaPlayerVolumeControlProvider::STATUS_FOUND && (int)MPVC_STATUS_NOT_FOUND == (int)MediaPlayerVolumeControlProvider::STATUS_NOT_FOUND, "the plugin statuses are the provider's");
+static_assert((int)MPVC_OP_CHANGE == (int)MediaPlayerVolumeControlProvider::VolumeCommand::CHANGE && (int)MPVC_OP_TOGGLE_MUTE == (int)MediaPlayerVolumeControlProvider::VolumeCommand::TOGGLE_MUTE && (int)MPVC_OP_SET_VOLUME == (int)MediaPlayerVolumeControlProvider::VolumeCommand::SET_VOLUME && (int)MPVC_OP_FADE == (int)MediaPlayerVolumeControlProvider::VolumeCommand::FADE && (int)MPVC_OP_SET_MUTE == (int)MediaPlayerVolumeControlProvider::VolumeCommand::SET_MUTE, "the plugin ops are the batch's");
+
+#ifdef _WIN32
+typedef HMODULE module_handle;
+
+static module_handle open_module(std::basic_string<TCHAR> const& path)
+{
+	// Dependencies next to the plugin are found before the ones elsewhere
+	return LoadLibraryEx(path.c_str(), NULL, LOAD_WITH_ALTERED_SEARCH_PATH);
+}
+static void* module_symbol(module_handle module, char const* name)
+{
+	return (void*)GetProcAddress(module, name);
+}
+static void close_module(module_handle module)
+{
+	FreeLibrary(module);
+}
+#else
+typedef void* module_handle;
+
+static module_handle open_module(std::basic_string<TCHAR> const& path)
+{
+	return dlopen(path.c_str(), RTLD_NOW | RTLD_LOCAL);
+}
+static void* module_symbol(module_handle module, char const* name)
+{
+	return dlsym(module, name);
+}
+static void close_module(module_handle module)
+{
+	dlclose(module);
+}
+#endif
+
+namespace
+{
+	// Callbacks of the plugins, from their threads
+	void host_session_added(void*, char const* name, float volume)
+	{
+		timeline_session_added(name, volume);
+	}
+	void host_session_removed(void*, char const* name)
+	{
+		timeline_session_removed(name);
+	}
+	void host_devices_changed(void*, unsigned int count)
+	{
+		timeline_devices_changed(count);
+	}
+
+	class PluginVolumeControlProvider : public MediaPlayerVolumeControlProvider
+	{
+	private:
+		module_handle module;
+		mpvc_plugin const* plugin;
+		// The plugin may keep pointers to both
+		std::string processNames;
+		mpvc_host host;
+		void* instance;
+		// Kept for their capacity, commands only come from the provider's lane
+		std::vector<mpvc_command> commands;
+		std::vector<int> statuses;
+	public:
+		PluginVolumeControlProvider(module_handle module, mpvc_plugin const* plugin, std::string const& processNames) : module(module), plugin(plugin), processNames(processNames), host(), instance(), commands(), statuses()
+		{
+			host.abi_version = MPVC_PLUGIN_ABI_VERSION;
+			host.host_data = this;
+			host.process_names = this->processNames.c_str();
+			host.session_added = host_session_added;
+			host.session_removed = host_session_removed;
+			host.devices_changed = host_devices_changed;
+		}
+		virtual ~PluginVolumeControlProvider()
+		{
+			if (instance)
+				plugin->shutdown(instance);
+			close_module(module);
+		}
+
+		bool init()
+		{
+			return (instance = plugin->init(&host)) != NULL;
+		}
+	private:
+		virtual void apply_batch(VolumeCommand const* batch, size_t count, VOLUME_CHANGE_STATUS* out)
+		{
+			commands.resize(count);
+			statuses.assign(count, MPVC_STATUS_NOT_FOUND);
+			for (size_t i = 0; i < count; ++i)
+			{
+				mpvc_command& command = commands[i];
+				command.op = (int)batch[i].op;
+				command.target = batch[i].target.c_str();
+				command.target_length = batch[i].target.length();
+				command.value = batch[i].value;
+				command.duration_ms = batch[i].duration;
+			}
+			plugin->apply(instance, commands.data(), count, statuses.data());
+			for (size_t i = 0; i < count; ++i)
+			{
+				out[i] = (VOLUME_CHANGE_STATUS)std::min(std::max(statuses[i], (int)MPVC_STATUS_ERROR), (int)MPVC_STATUS_NOT_FOUND);
+				if (out[i] == STATUS_ERROR)
+					mpvc_metrics.providerErrors.fetch_add(1, std::memory_order_relaxed);
+			}
+		}
+		virtual VOLUME_CHANGE_STATUS get_target_volume(target_type const& target, float& volume, bool& muted)
+		{
+			int m = 0;
+			int status = plugin->get(instance, target.c_str(), target.length(), &volume, &m);
+			muted = m != 0;
+			return status == MPVC_STATUS_FOUND ? STATUS_FOUND : status == MPVC_STATUS_ERROR ? STATUS_ERROR : STATUS_NOT_FOUND;
+		}
+		static void list_one(void* context, char const* name, float volume, int muted)
+		{
+			TargetState state = { name, volume, muted != 0 };
+			static_cast<std::vector<TargetState>*>(context)->push_back(state);
+		}
+		virtual void list_targets(std::vector<TargetState>& out)
+		{
+			plugin->list(instance, list_one, &out);
+		}
+		virtual unsigned int dispatch_budget()
+		{
+			return plugin->budget_ms;
+		}
+	};
+}
+
+PluginOpenResult plugin_open(std::basic_string<TCHAR> const& path, std::string const& processNames, MediaPlayerVolumeControlProvider*& provider)
+{
+	provider = NULL;
+	module_handle module = open_module(path);
+	if (!module)
+		return PLUGIN_LOAD_FAILED;
+	mpvc_plugin_entry_function entry = (mpvc_plugin_entry_function)module_symbol(module, MPVC_PLUGIN_ENTRY);
+	mpvc_plugin const* plugin = entry ? entry(MPVC_PLUGIN_ABI_VERSION) : NULL;
+	if (!plugin || plugin->abi_version != MPVC_PLUGIN_ABI_VERSION)
+	{
+		close_module(module);
+		return PLUGIN_INCOMPATIBLE;
+	}
+	if (!plugin->present())
+	{
+		close_module(module);
+		return PLUGIN_ABSENT;
+	}
+	// Closes the module if it fails
+	PluginVolumeControlProvider* pluginProvider = new PluginVolumeControlProvider(module, plugin, processNames);
+	if (!pluginProvider->init())
+	{
+		delete pluginProvider;
+		return PLUGIN_INIT_FAILED;
+	}
+	provider = pluginProvider;
+	return PLUGIN_OPENED;
+}
+
+void load_plugins(std::basic_string<TCHAR> const& dir, std::string const& names, std::string const& processNames, std::vector<std::string>& failed)
+{
+	static char const* const reasons[] = { "", "", "couldn't be loaded", "isn't a plugin of this version", "failed to start" };
+	std::string::size_type pos = 0, sep;
+	do {
+		sep = names.find(',', pos);
+		std::string name(names, pos, sep == std::string::npos ? std::string::npos : sep - pos);
+		std::string::size_type first = name.find_first_not_of(' '), last = name.find_last_not_of(' ');
+		pos = sep + 1;
+		if (first == std::string::npos)
+			continue;
+		name = name.substr(first, last - first + 1);
+		MediaPlayerVolumeControlProvider* provider;
+		PluginOpenResult result = plugin_open(dir + PLUGIN_DIR + tstring_from_utf8(name) + PLUGIN_SUFFIX, processNames, provider);
+		if (result == PLUGIN_OPENED)
+			add_volume_control(provider);
+		else if (result != PLUGIN_ABSENT)
+			failed.push_back(name + " " + reasons[result]);
+	} while (sep != std::string::npos);
+}
@@ -0,0 +1,50 @@
+#pragma once
+#ifndef __PLUGIN_LOADER_HPP__
+#define __PLUGIN_LOADER_HPP__
+
+#include "unicode.h"
+
+#ifdef _WIN32
+#include <tchar.h>
+#endif
+
+#include <string>
+#include <vector>
+
+#include "volume_control.hpp"
+
+// Providers in modules of the C ABI of plugin_abi.h. A module is only
+//   loaded when the config names it and stays loaded only if its backend
+//   is present, so nothing of the backends a machine doesn't use is
+//   resident. Its provider owns the module: deleting it shuts the plugin
+//   down and unloads it.
+
+#ifdef _WIN32
+#define PLUGIN_SUFFIX _T(".dll")
+#define PLUGIN_DIR _T("plugins\\")
+#else
+#define PLUGIN_SUFFIX ".so"
+#define PLUGIN_DIR "plugins/"
+#endif
+
+enum PluginOpenResult
+{
+	PLUGIN_OPENED,
+	// Loaded fine, but its backend isn't on this machine
+	PLUGIN_ABSENT,
+	PLUGIN_LOAD_FAILED,
+	// No entry point, or one for another ABI version
+	PLUGIN_INCOMPATIBLE,
+	PLUGIN_INIT_FAILED
+};
+
+// provider is only set for PLUGIN_OPENED. processNames is handed to the
+//   plugin's init.
+PluginOpenResult plugin_open(std::basic_string<TCHAR> const& path, std::string const& processNames, MediaPlayerVolumeControlProvider*& provider);
+
+// Opens the plugins of the comma separated names in dir and registers
+//   their providers. The names that couldn't be opened go to failed, with
+//   what went wrong.
+void load_plugins(std::basic_string<TCHAR> const& dir, std::string const& names, std::string const& processNames, std::vector<std::string>& failed);
+
+#endif // __PLUGIN_LOADER_HPP__
@@ -0,0 +1,389 @@
+#include "pulse_volume_control.hpp"
+
+#include <stdio.h>
+
+#include <algorithm>
+
+#include "metrics.hpp"
+#include "resource.h"
+#include "timeline.hpp"
+#include "volume_snapshot.hpp"
+#include "volume_steps.hpp"
+
+PulseAudioVolumeControlProvider::~PulseAudioVolumeControlProvider()
+{
+	// Before locking, a fade write in flight needs the lock
+	fade_cancel_all(this);
+	if (!mainloop)
+		return;
+	pa_threaded_mainloop_lock(mainloop);
+	// Let the writes of the last key presses reach the server before leaving
+	while (repliesReceived != requestsSent && is_ready_locked())
+		pa_threaded_mainloop_wait(mainloop);
+	disconnect_locked();
+	pa_threaded_mainloop_unlock(mainloop);
+	pa_threaded_mainloop_stop(mainloop);
+	pa_threaded_mainloop_free(mainloop);
+}
+
+bool PulseAudioVolumeControlProvider::connect()
+{
+	if (!mainloop)
+	{
+		if (!(mainloop = pa_threaded_mainloop_new()))
+			return false;
+		if (pa_threaded_mainloop_start(mainloop) < 0)
+		{
+			pa_threaded_mainloop_free(mainloop);
+			mainloop = NULL;
+			return false;
+		}
+	}
+	pa_threaded_mainloop_lock(mainloop);
+	bool ret = connect_locked();
+	pa_threaded_mainloop_unlock(mainloop);
+	return ret;
+}
+
+bool PulseAudioVolumeControlProvider::connect_locked()
+{
+	disconnect_locked();
+	pa_proplist* props = pa_proplist_new();
+	pa_proplist_sets(props, PA_PROP_APPLICATION_NAME, PRODUCT_NAME);
+	pa_proplist_sets(props, PA_PROP_APPLICATION_ID, "mpVolCtrl");
+	context = pa_context_new_with_proplist(pa_threaded_mainloop_get_api(mainloop), "mpVolCtrl", props);
+	pa_proplist_free(props);
+	if (!context)
+		return false;
+
+	pa_context_set_state_callback(context, context_state_cb, this);
+	pa_context_set_subscribe_callback(context, subscribe_cb, this);
+	if (pa_context_connect(context, NULL, PA_CONTEXT_NOFLAGS, NULL) < 0)
+	{
+		fprintf(stderr, "pa_context_connect error: %s\n", pa_strerror(pa_context_errno(context)));
+		disconnect_locked();
+		return false;
+	}
+
+	// Wait for the first listing, so the first key press already hits
+	for (;;)
+	{
+		pa_context_state_t state = pa_context_get_state(context);
+		if (state == PA_CONTEXT_READY)
+			break;
+		if (!PA_CONTEXT_IS_GOOD(state))
+		{
+			fprintf(stderr, "PulseAudio connection error: %s\n", pa_strerror(pa_context_errno(context)));
+			disconnect_locked();
+			return false;
+		}
+		pa_threaded_mainloop_wait(mainloop);
+	}
+	while (repliesReceived != requestsSent && is_ready_locked())
+		pa_threaded_mainloop_wait(mainloop);
+	listed = true;
+	return true;
+}
+
+void PulseAudioVolumeControlProvider::disconnect_locked()
+{
+	if (context)
+	{
+		pa_context_set_state_callback(context, NULL, NULL);
+		pa_context_set_subscribe_callback(context, NULL, NULL);
+		pa_context_disconnect(context);
+		pa_context_unref(context);
+		context = NULL;
+	}
+	sinkInputs.clear();
+	requestsSent = repliesReceived = 0;
+	listed = false;
+}
+
+bool PulseAudioVolumeControlProvider::is_ready_locked() const
+{
+	return context && pa_context_get_state(context) == PA_CONTEXT_READY;
+}
+
+// For the requests answered through success_cb or sink_input_info_cb
+bool PulseAudioVolumeControlProvider::track_locked(pa_operation* o)
+{
+	if (!o)
+		return false;
+	++requestsSent;
+	pa_operation_unref(o);
+	return true;
+}
+
+bool PulseAudioVolumeControlProvider::matches(SinkInput const& sinkInput) const
+{
+	return std::find(processNames.begin(), processNames.end(), sinkInput.processBinary) != processNames.end();
+}
+
+void PulseAudioVolumeControlProvider::update_sink_input(pa_sink_input_info const* info)
+{
+	char const* binary = pa_proplist_gets(info->proplist, PA_PROP_APPLICATION_PROCESS_BINARY);
+	std::vector<SinkInput>::iterator it = sinkInputs.begin(), end = sinkInputs.end();
+	for (; it != end; ++it)
+		if ((*it).index == info->index)
+			break;
+	bool added = it == end;
+	if (added)
+	{
+		sinkInputs.push_back(SinkInput());
+		it = sinkInputs.end() - 1;
+		(*it).index = info->index;
+	}
+	(*it).processBinary = binary ? binary : "";
+	// The replies before this one are all in, so a write still waiting for
+	//   its reply was sent after this request and the info predates it
+	if ((*it).lastWrite <= repliesReceived)
+	{
+		(*it).volume = info->volume;
+		(*it).muted = info->mute != 0;
+	}
+	if (!added || !matches(*it))
+		return;
+	timeline_session_added((*it).processBinary, (float)pa_cvolume_max(&(*it).volume) / PA_VOLUME_NORM);
+	if (listed)
+		restore_locked(*it);
+}
+
+void PulseAudioVolumeControlProvider::restore_locked(SinkInput& sinkInput)
+{
+	VolumeSnapshotEntry entry;
+	if (!volume_snapshot_lookup(sinkInput.processBinary, entry))
+		return;
+	if (entry.flags & VolumeSnapshotEntry::HAS_VOLUME)
+		write_volume_locked(sinkInput, entry.volume);
+	if ((entry.flags & VolumeSnapshotEntry::HAS_MUTE) && sinkInput.muted != ((entry.flags & VolumeSnapshotEntry::MUTED) != 0))
+		write_mute_locked(sinkInput, !sinkInput.muted);
+}
+
+void PulseAudioVolumeControlProvider::remove_sink_input(uint32_t index)
+{
+	for (std::vector<SinkInput>::iterator start = sinkInputs.begin(), end = sinkInputs.end(); start != end; ++start)
+		if ((*start).index == index)
+		{
+			if ((*start).fading)
+				fade_cancel(this, (void*)(uintptr_t)index, false);
+			if (matches(*start))
+				timeline_session_removed((*start).processBinary);
+			sinkInputs.erase(start);
+			return;
+		}
+}
+
+void PulseAudioVolumeControlProvider::context_state_cb(pa_context* c, void* userdata)
+{
+	PulseAudioVolumeControlProvider* self = static_cast<PulseAudioVolumeControlProvider*>(userdata);
+	switch (pa_context_get_state(c))
+	{
+	case PA_CONTEXT_READY:
+		{
+			pa_operation* o = pa_context_subscribe(c, PA_SUBSCRIPTION_MASK_SINK_INPUT, NULL, NULL);
+			if (o)
+				pa_operation_unref(o);
+			self->track_locked(pa_context_get_sink_input_info_list(c, sink_input_info_cb, self));
+		}
+		break;
+	case PA_CONTEXT_FAILED:
+	case PA_CONTEXT_TERMINATED:
+		self->sinkInputs.clear();
+		break;
+	default:
+		break;
+	}
+	pa_threaded_mainloop_signal(self->mainloop, 0);
+}
+
+void PulseAudioVolumeControlProvider::subscribe_cb(pa_context* c, pa_subscription_event_type_t t, uint32_t index, void* userdata)
+{
+	PulseAudioVolumeControlProvider* self = static_cast<PulseAudioVolumeControlProvider*>(userdata);
+	if ((t & PA_SUBSCRIPTION_EVENT_FACILITY_MASK) != PA_SUBSCRIPTION_EVENT_SINK_INPUT)
+		return;
+	if ((t & PA_SUBSCRIPTION_EVENT_TYPE_MASK) == PA_SUBSCRIPTION_EVENT_REMOVE)
+		self->remove_sink_input(index);
+	else
+	{
+		// Also refreshes the cached volume after our own writes and those of
+		//   other mixers
+		self->track_locked(pa_context_get_sink_input_info(c, index, sink_input_info_cb, self));
+	}
+}
+
+void PulseAudioVolumeControlProvider::sink_input_info_cb(pa_context*, pa_sink_input_info const* info, int eol, void* userdata)
+{
+	PulseAudioVolumeControlProvider* self = static_cast<PulseAudioVolumeControlProvider*>(userdata);
+	if (eol)
+	{
+		++self->repliesReceived;
+		pa_threaded_mainloop_signal(self->mainloop, 0);
+		return;
+	}
+	self->update_sink_input(info);
+}
+
+void PulseAudioVolumeControlProvider::success_cb(pa_context*, int success, void* userdata)
+{
+	PulseAudioVolumeControlProvider* self = static_cast<PulseAudioVolumeControlProvider*>(userdata);
+	if (!success)
+		mpvc_metrics.providerErrors.fetch_add(1, std::memory_order_relaxed);
+	++self->repliesReceived;
+	pa_threaded_mainloop_signal(self->mainloop, 0);
+}
+
+void PulseAudioVolumeControlProvider::write_volume_locked(SinkInput& sinkInput, float volume)
+{
+	// Same linear 0..1 scale as ISimpleAudioVolume, keeping the balance
+	volume = std::min<float>(std::max<float>(volume, 0.f), 1.f);
+	pa_cvolume_scale(&sinkInput.volume, (pa_volume_t)(volume * PA_VOLUME_NORM + .5f));
+	if (!pa_cvolume_valid(&sinkInput.volume))
+		return;
+
+	// Fire and forget, the replies are only counted so the destructor can
+	//   wait for them and older info replies are told apart. The cache is
+	//   updated right away so repeated presses build on each other without a
+	//   round trip.
+	if (track_locked(pa_context_set_sink_input_volume(context, sinkInput.index, &sinkInput.volume, success_cb, this)))
+		sinkInput.lastWrite = requestsSent;
+	else
+		mpvc_metrics.providerErrors.fetch_add(1, std::memory_order_relaxed);
+}
+
+void PulseAudioVolumeControlProvider::write_mute_locked(SinkInput& sinkInput, bool mute)
+{
+	sinkInput.muted = mute;
+	if (track_locked(pa_context_set_sink_input_mute(context, sinkInput.index, mute, success_cb, this)))
+		sinkInput.lastWrite = requestsSent;
+	else
+		mpvc_metrics.providerErrors.fetch_add(1, std::memory_order_relaxed);
+}
+
+// Jumps there if the fade can't be started
+void PulseAudioVolumeControlProvider::fade_locked(SinkInput& sinkInput, float volume, unsigned int durationMs)
+{
+	volume = std::min<float>(std::max<float>(volume, 0.f), 1.f);
+	volume_snapshot_record_volume(sinkInput.processBinary, volume);
+	if (durationMs && fade_to(this, (void*)(uintptr_t)sinkInput.index, (float)pa_cvolume_max(&sinkInput.volume) / PA_VOLUME_NORM, volume, durationMs))
+		sinkInput.fading = true;
+	else
+	{
+		sinkInput.fading = false;
+		write_volume_locked(sinkInput, volume);
+	}
+}
+
+void PulseAudioVolumeControlProvider::fade_write(FadeWrite const* writes, unsigned int count)
+{
+	// One lock section per tick, like a key press
+	pa_threaded_mainloop_lock(mainloop);
+	if (is_ready_locked())
+		for (FadeWrite const* end = writes + count; writes != end; ++writes)
+			for (std::vector<SinkInput>::iterator start = sinkInputs.begin(), inputsEnd = sinkInputs.end(); start != inputsEnd; ++start)
+				if ((*start).index == (uint32_t)(uintptr_t)writes->key)
+				{
+					if ((*start).fading)
+						write_volume_locked(*start, writes->volume);
+					break;
+				}
+	pa_threaded_mainloop_unlock(mainloop);
+}
+
+void PulseAudioVolumeControlProvider::change_volume_locked(SinkInput& sinkInput, float delta, unsigned int presses)
+{
+	// Presses during a fade move its target, so they add up
+	float target;
+	if (sinkInput.fading && fade_add(this, (void*)(uintptr_t)sinkInput.index, delta, fade_step_duration(), &target, SCALE_CUBIC, presses))
+	{
+		volume_snapshot_record_volume(sinkInput.processBinary, target);
+		return;
+	}
+	// Sink input volumes are on PulseAudio's cubic scale
+	fade_locked(sinkInput, volume_step_target((float)pa_cvolume_max(&sinkInput.volume) / PA_VOLUME_NORM, delta, SCALE_CUBIC, presses), fade_step_duration());
+}
+
+// Every write of the batch goes out in the one lock section
+void PulseAudioVolumeControlProvider::apply_batch(VolumeCommand const* commands, size_t count, VOLUME_CHANGE_STATUS* statuses)
+{
+	if (!mainloop)
+	{
+		std::fill(statuses, statuses + count, STATUS_ERROR);
+		return;
+	}
+	pa_threaded_mainloop_lock(mainloop);
+	if (!is_ready_locked() && !connect_locked())
+	{
+		pa_threaded_mainloop_unlock(mainloop);
+		std::fill(statuses, statuses + count, STATUS_ERROR);
+		return;
+	}
+
+	std::fill(statuses, statuses + count, STATUS_NOT_FOUND);
+	for (std::vector<SinkInput>::iterator start = sinkInputs.begin(), end = sinkInputs.end(); start != end; ++start)
+		for (size_t i = 0; i < count; ++i)
+		{
+			VolumeCommand const& command = commands[i];
+			if (!matches(*start, command.target))
+				continue;
+			statuses[i] = STATUS_FOUND;
+			switch (command.op)
+			{
+			case VolumeCommand::CHANGE:
+				change_volume_locked(*start, command.value, command.presses);
+				break;
+			case VolumeCommand::TOGGLE_MUTE:
+				write_mute_locked(*start, !(*start).muted);
+				volume_snapshot_record_mute((*start).processBinary, (*start).muted);
+				break;
+			case VolumeCommand::SET_VOLUME:
+				// The fade's next write is skipped, the engine drops it on its own
+				if ((*start).fading)
+					fade_cancel(this, (void*)(uintptr_t)(*start).index, false);
+				(*start).fading = false;
+				write_volume_locked(*start, command.value);
+				volume_snapshot_record_volume((*start).processBinary, std::min<float>(std::max<float>(command.value, 0.f), 1.f));
+				break;
+			case VolumeCommand::FADE:
+				fade_locked(*start, command.value, command.duration);
+				break;
+			case VolumeCommand::SET_MUTE:
+				write_mute_locked(*start, command.value != 0.f);
+				volume_snapshot_record_mute((*start).processBinary, (*start).muted);
+				break;
+			}
+		}
+	pa_threaded_mainloop_unlock(mainloop);
+}
+
+MediaPlayerVolumeControlProvider::VOLUME_CHANGE_STATUS PulseAudioVolumeControlProvider::get_target_volume(target_type const& target, float& volume, bool& muted)
+{
+	if (!mainloop)
+		return STATUS_ERROR;
+	pa_threaded_mainloop_lock(mainloop);
+	VOLUME_CHANGE_STATUS status = STATUS_NOT_FOUND;
+	for (std::vector<SinkInput>::iterator start = sinkInputs.begin(), end = sinkInputs.end(); start != end; ++start)
+		if (matches(*start, target))
+		{
+			status = STATUS_FOUND;
+			volume = (float)pa_cvolume_max(&(*start).volume) / PA_VOLUME_NORM;
+			muted = (*start).muted;
+			break;
+		}
+	pa_threaded_mainloop_unlock(mainloop);
+	return status;
+}
+
+void PulseAudioVolumeControlProvider::list_targets(std::vector<TargetState>& out)
+{
+	if (!mainloop)
+		return;
+	pa_threaded_mainloop_lock(mainloop);
+	for (std::vector<SinkInput>::iterator start = sinkInputs.begin(), end = sinkInputs.end(); start != end; ++start)
+		if (matches(*start))
+		{
+			TargetState state = { (*start).processBinary, (float)pa_cvolume_max(&(*start).volume) / PA_VOLUME_NORM, (*start).muted };
+			out.push_back(state);
+		}
+	pa_threaded_mainloop_unlock(mainloop);
+}
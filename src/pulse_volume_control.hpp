@@ -0,0 +1,97 @@
+#pragma once
+#ifndef __PULSE_VOLUME_CONTROL_HPP__
+#define __PULSE_VOLUME_CONTROL_HPP__
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+#include <pulse/pulseaudio.h>
+
+#include "fade_engine.hpp"
+#include "volume_control.hpp"
+
+// Per-application stream volume through PulseAudio (or pipewire-pulse), the
+//   portable equivalent of AudioSesionInterfaceVolumeControlProvider.
+//
+// One context is kept for the lifetime of the provider. The sink-inputs are
+//   listed once after connecting and kept up to date from subscription events,
+//   so a key press only issues the volume writes, all of them in a single lock
+//   section without waiting for the replies in between.
+//
+// Fades are keyed by the sink-input index. A write of the fade thread only
+//   goes out while its stream is still marked fading, so setting a volume
+//   can drop the fade without waiting for the fade thread under the lock.
+//
+// The server answers the requests of a context in the order they were sent,
+//   so with the requests and replies counted, an info reply to a request sent
+//   before the stream's last write is known to be stale and doesn't revert the
+//   cached volume. The change event of the write brings the written state.
+class PulseAudioVolumeControlProvider : public MediaPlayerVolumeControlProvider, private FadeSink
+{
+private:
+	struct SinkInput
+	{
+		uint32_t index;
+		std::string processBinary;
+		pa_cvolume volume;
+		bool muted;
+		bool fading;
+		// Number of the last volume or mute request sent for it
+		uint64_t lastWrite;
+	};
+
+	std::vector<std::string> processNames;
+
+	pa_threaded_mainloop* mainloop;
+	pa_context* context;
+	// Only touched with the mainloop lock held
+	std::vector<SinkInput> sinkInputs;
+	// The requests with a reply callback, the difference is the ones pending
+	uint64_t requestsSent;
+	uint64_t repliesReceived;
+	// Set once the first listing is in, the streams showing up after it
+	//   belong to players starting and get their remembered state
+	bool listed;
+public:
+	PulseAudioVolumeControlProvider() : processNames(), mainloop(), context(), sinkInputs(), requestsSent(), repliesReceived(), listed() { }
+	~PulseAudioVolumeControlProvider();
+
+	void register_process_name(std::string const& name)
+	{
+		processNames.push_back(name);
+	}
+
+	bool connect();
+private:
+	bool connect_locked();
+	void disconnect_locked();
+	bool is_ready_locked() const;
+	bool track_locked(pa_operation* o);
+	bool matches(SinkInput const& sinkInput) const;
+	bool matches(SinkInput const& sinkInput, target_type const& target) const
+	{
+		return target.empty() ? matches(sinkInput) : sinkInput.processBinary == target;
+	}
+	void write_volume_locked(SinkInput& sinkInput, float volume);
+	void write_mute_locked(SinkInput& sinkInput, bool mute);
+	void fade_locked(SinkInput& sinkInput, float volume, unsigned int durationMs);
+	void change_volume_locked(SinkInput& sinkInput, float delta, unsigned int presses);
+	void restore_locked(SinkInput& sinkInput);
+	virtual void fade_write(FadeWrite const* writes, unsigned int count);
+
+	void update_sink_input(pa_sink_input_info const* info);
+	void remove_sink_input(uint32_t index);
+
+	static void context_state_cb(pa_context* c, void* userdata);
+	static void subscribe_cb(pa_context* c, pa_subscription_event_type_t t, uint32_t index, void* userdata);
+	static void sink_input_info_cb(pa_context* c, pa_sink_input_info const* info, int eol, void* userdata);
+	static void success_cb(pa_context* c, int success, void* userdata);
+
+	virtual void apply_batch(VolumeCommand const* commands, size_t count, VOLUME_CHANGE_STATUS* statuses);
+	virtual VOLUME_CHANGE_STATUS get_target_volume(target_type const& target, float& volume, bool& muted);
+	virtual void list_targets(std::vector<TargetState>& out);
+};
+
+#endif // __PULSE_VOLUME_CONTROL_HPP__
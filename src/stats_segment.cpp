@@ -0,0 +1,178 @@
+#include "unicode.h"
+
+#include <string.h>
+
+#include <algorithm>
+#include <chrono>
+
+#ifdef _WIN32
+#include <Windows.h>
+#include <tchar.h>
+#else
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
+
+#include "errors.hpp"
+#include "handles.hpp"
+#include "metrics.hpp"
+#include "stats_segment.hpp"
+
+StatsSegment::~StatsSegment()
+{
+	stop_refresh();
+#ifdef _WIN32
+	if (layout)
+		UnmapViewOfFile(layout);
+	if (hMapping)
+		CloseHandle(hMapping);
+#else
+	if (layout)
+	{
+		munmap(layout, sizeof *layout);
+		shm_unlink(name.c_str());
+	}
+#endif
+}
+
+bool StatsSegment::open()
+{
+#ifdef _WIN32
+	hMapping = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, 0, sizeof *layout, stats_segment_name().c_str());
+	if (!hMapping)
+	{
+		ShowErrorMessage(GetLastError(), _T("CreateFileMapping error"));
+		return false;
+	}
+	if (!(layout = (StatsSegmentLayout*)MapViewOfFile(hMapping, FILE_MAP_WRITE, 0, 0, sizeof *layout)))
+	{
+		ShowErrorMessage(GetLastError(), _T("MapViewOfFile error"));
+		CloseHandle(hMapping);
+		hMapping = NULL;
+		return false;
+	}
+#else
+	name = stats_segment_name();
+	// Only one instance runs at a time (the IPC socket makes sure), so a
+	//   leftover of a crashed one is simply reused
+	UniqueFd fd(shm_open(name.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600));
+	if (!fd)
+	{
+		ShowErrorMessage(errno, "shm_open error");
+		return false;
+	}
+	void* p = MAP_FAILED;
+	if (ftruncate(fd.get(), sizeof *layout) == 0)
+		p = mmap(NULL, sizeof *layout, PROT_READ | PROT_WRITE, MAP_SHARED, fd.get(), 0);
+	int error = errno;
+	fd.reset();
+	if (p == MAP_FAILED)
+	{
+		ShowErrorMessage(error, "mmap error");
+		shm_unlink(name.c_str());
+		return false;
+	}
+	layout = (StatsSegmentLayout*)p;
+#endif
+
+	// Readers check the header last written, so zero the snapshot first
+	layout->magic = 0;
+	layout->sequence.store(0, std::memory_order_relaxed);
+	memset((void*)&layout->snapshot, 0, sizeof layout->snapshot);
+	layout->version = STATS_SEGMENT_VERSION;
+	layout->size = sizeof *layout;
+	std::atomic_thread_fence(std::memory_order_release);
+	layout->magic = STATS_SEGMENT_MAGIC;
+	return true;
+}
+
+static size_t copy_name(char* dest, size_t size, MediaPlayerVolumeControlProvider::target_type const& name)
+{
+	size_t len = std::min<size_t>(name.length(), size - 1);
+	// Cut at a character boundary
+	if (len < name.length())
+		while (len && (name[len] & 0xC0) == 0x80)
+			--len;
+	memcpy(dest, name.data(), len);
+	return len;
+}
+
+void StatsSegment::write(bool withTargets)
+{
+	uint32_t sequence = layout->sequence.load(std::memory_order_relaxed);
+	layout->sequence.store(sequence + 1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+
+	StatsSnapshot& snapshot = layout->snapshot;
+	snapshot.keypressesHandled = mpvc_metrics.keypressesHandled.load(std::memory_order_relaxed);
+	snapshot.coalescedEvents = mpvc_metrics.coalescedEvents.load(std::memory_order_relaxed);
+	snapshot.providerErrors = mpvc_metrics.providerErrors.load(std::memory_order_relaxed);
+	snapshot.comErrors = mpvc_metrics.comErrors.load(std::memory_order_relaxed);
+	snapshot.hookReinstalls = mpvc_metrics.hookReinstalls.load(std::memory_order_relaxed);
+	snapshot.ipcCommands = mpvc_metrics.ipcCommands.load(std::memory_order_relaxed);
+	if (withTargets)
+	{
+		uint32_t count = 0;
+		for (std::vector<MediaPlayerVolumeControlProvider::TargetState>::const_iterator start = targets.begin(), end = targets.end(); start != end && count < sizeof snapshot.targets / sizeof *snapshot.targets; ++start, ++count)
+		{
+			StatsTarget& target = snapshot.targets[count];
+			size_t len = copy_name(target.name, sizeof target.name, (*start).name);
+			memset(target.name + len, 0, sizeof target.name - len);
+			target.volume = (*start).volume;
+			target.muted = (*start).muted;
+		}
+		snapshot.targetCount = count;
+		snapshot.targetsUpdated = (uint64_t)std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+	}
+	snapshot.sessionsCached = mpvc_metrics.sessionsCached.load(std::memory_order_relaxed);
+
+	layout->sequence.store(sequence + 2, std::memory_order_release);
+}
+
+void StatsSegment::publish()
+{
+	if (!layout)
+		return;
+	std::lock_guard<std::mutex> lock(mutex);
+	write(false);
+}
+
+void StatsSegment::refresh_main()
+{
+	std::unique_lock<std::mutex> lock(mutex);
+	while (!stopping)
+	{
+		// Without the lock, the providers may take a while
+		lock.unlock();
+		targets.clear();
+		volume_list(targets);
+		mpvc_metrics.sessionsCached.store(targets.size(), std::memory_order_relaxed);
+		lock.lock();
+		if (stopping)
+			break;
+		write(true);
+		stopChanged.wait_for(lock, std::chrono::milliseconds(STATS_REFRESH_INTERVAL), [this] { return stopping; });
+	}
+}
+
+void StatsSegment::start_refresh()
+{
+	if (!layout || refreshThread.joinable())
+		return;
+	stopping = false;
+	refreshThread = std::thread(&StatsSegment::refresh_main, this);
+}
+
+void StatsSegment::stop_refresh()
+{
+	if (!refreshThread.joinable())
+		return;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+		stopChanged.notify_all();
+	}
+	refreshThread.join();
+}
@@ -0,0 +1,141 @@
+#pragma once
+#ifndef __STATS_SEGMENT_HPP__
+#define __STATS_SEGMENT_HPP__
+
+#include <stdint.h>
+#include <string.h>
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "volume_control.hpp"
+
+// Counters and per-target volumes published in shared memory, so monitoring
+//   can poll them without waking the application. The segment is a named file
+//   mapping ("Local\mpVolCtrl_stats") on Windows and a POSIX shared memory
+//   object ("/mpVolCtrl-<uid>.stats") elsewhere.
+//
+// The writers in the application take turns: the main loop publishing the
+//   counters and a thread of its own listing the targets. Readers never
+//   block them: the sequence is odd while an update is in progress and they
+//   retry until they copied the snapshot between two equal even values.
+
+#define STATS_SEGMENT_MAGIC 0x5356504DU // "MPVS"
+#define STATS_SEGMENT_VERSION 2
+
+// Volumes changed by other applications show up in the segment this late
+#define STATS_REFRESH_INTERVAL 5000
+
+struct StatsTarget
+{
+	// UTF-8, truncated
+	char name[56];
+	float volume;
+	uint32_t muted;
+};
+
+struct StatsSnapshot
+{
+	uint64_t keypressesHandled;
+	uint64_t coalescedEvents;
+	uint64_t sessionsCached;
+	uint64_t providerErrors;
+	uint64_t comErrors;
+	uint64_t hookReinstalls;
+	uint64_t ipcCommands;
+	// Milliseconds since the epoch of the last refresh of targets
+	uint64_t targetsUpdated;
+	uint32_t targetCount;
+	uint32_t reserved;
+	StatsTarget targets[32];
+};
+
+struct StatsSegmentLayout
+{
+	uint32_t magic;
+	uint32_t version;
+	// sizeof(StatsSegmentLayout) of the writer
+	uint32_t size;
+	std::atomic<uint32_t> sequence;
+	StatsSnapshot snapshot;
+};
+
+static_assert(std::atomic<uint32_t>::is_always_lock_free, "the sequence is shared between processes");
+
+// Copies a consistent snapshot, spinning while the writer is busy. Returns
+//   false if the segment isn't one this reader understands.
+inline bool stats_segment_read(StatsSegmentLayout const* layout, StatsSnapshot& out)
+{
+	if (layout->magic != STATS_SEGMENT_MAGIC || layout->version != STATS_SEGMENT_VERSION || layout->size < sizeof(StatsSegmentLayout))
+		return false;
+	for (;;)
+	{
+		uint32_t before = layout->sequence.load(std::memory_order_acquire);
+		if (before & 1)
+			continue;
+		memcpy(&out, (void const*)&layout->snapshot, sizeof out);
+		std::atomic_thread_fence(std::memory_order_acquire);
+		if (layout->sequence.load(std::memory_order_relaxed) == before)
+			return true;
+	}
+}
+
+// Name of the segment, shared with the reader
+inline std::string stats_segment_name()
+{
+#ifdef _WIN32
+	return "Local\\mpVolCtrl_stats";
+#else
+	return "/mpVolCtrl-" + std::to_string(getuid()) + ".stats";
+#endif
+}
+
+class StatsSegment
+{
+private:
+	StatsSegmentLayout* layout;
+	// The refresh thread's, filled without holding mutex
+	std::vector<MediaPlayerVolumeControlProvider::TargetState> targets;
+	// Taken for writing the segment and for stopping the refresh
+	std::mutex mutex;
+	std::condition_variable stopChanged;
+	std::thread refreshThread;
+	bool stopping;
+#ifdef _WIN32
+	void* hMapping;
+#else
+	std::string name;
+#endif
+public:
+	StatsSegment() : layout(), targets(), mutex(), stopChanged(), refreshThread(), stopping()
+#ifdef _WIN32
+		, hMapping()
+#else
+		, name()
+#endif
+	{ }
+	~StatsSegment();
+
+	bool open();
+
+	// Lists the targets every STATS_REFRESH_INTERVAL, starting now. Listing
+	//   asks every provider, so it's done on a thread of its own, which has
+	//   to be stopped before the providers are.
+	void start_refresh();
+	void stop_refresh();
+	// Refreshes the counters from mpvc_metrics
+	void publish();
+private:
+	void refresh_main();
+	// With mutex held
+	void write(bool withTargets);
+};
+
+#endif // __STATS_SEGMENT_HPP__
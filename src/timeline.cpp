@@ -0,0 +1,295 @@
+#include "unicode.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include <chrono>
+#include <mutex>
+
+#ifdef _WIN32
+#include <tchar.h>
+#endif
+
+#include "timeline.hpp"
+
+std::atomic<bool> timelineRecording(false);
+
+static std::mutex timelineMutex;
+static FILE* timelineFile = NULL;
+static std::chrono::steady_clock::time_point timelineStart;
+static uint64_t lastTime = 0;
+// Reused, so recording a key press doesn't allocate
+static std::vector<unsigned char> eventBuffer;
+
+static void put_varint(std::vector<unsigned char>& out, uint64_t value)
+{
+	for (; value >= 0x80; value >>= 7)
+		out.push_back((unsigned char)(value | 0x80));
+	out.push_back((unsigned char)value);
+}
+
+// False if it runs past end
+static bool get_varint(unsigned char const*& p, unsigned char const* end, uint64_t& value)
+{
+	value = 0;
+	for (unsigned int shift = 0; p != end && shift < 64; shift += 7)
+	{
+		unsigned char byte = *p++;
+		value |= (uint64_t)(byte & 0x7F) << shift;
+		if (!(byte & 0x80))
+			return true;
+	}
+	return false;
+}
+
+static void put_name(std::vector<unsigned char>& out, std::string const& name)
+{
+	// No process name gets there, it isn't worth a wider length
+	size_t len = name.length() > 255 ? 255 : name.length();
+	out.push_back((unsigned char)len);
+	out.insert(out.end(), name.begin(), name.begin() + len);
+}
+
+void timeline_encode(TimelineEvent const& event, uint64_t previousTime, std::vector<unsigned char>& out)
+{
+	out.push_back((unsigned char)event.type);
+	put_varint(out, event.time - previousTime);
+	switch (event.type)
+	{
+	case TimelineEvent::EVENT_KEY_DOWN:
+	case TimelineEvent::EVENT_KEY_UP:
+		out.push_back((unsigned char)event.key);
+		out.push_back((unsigned char)event.modifiers);
+		break;
+	case TimelineEvent::EVENT_SESSION_ADDED:
+		{
+			float volume = event.volume < 0.f ? 0.f : (event.volume > 1.f ? 1.f : event.volume);
+			unsigned int value = (unsigned int)(volume * 65535.f + .5f);
+			out.push_back((unsigned char)value);
+			out.push_back((unsigned char)(value >> 8));
+		}
+		put_name(out, event.name);
+		break;
+	case TimelineEvent::EVENT_SESSION_REMOVED:
+		put_name(out, event.name);
+		break;
+	case TimelineEvent::EVENT_DEVICES_CHANGED:
+		put_varint(out, event.value);
+		break;
+	case TimelineEvent::EVENT_CALL:
+		out.push_back((unsigned char)event.value);
+		put_varint(out, event.ns);
+		for (int i = 0; i < 4; ++i)
+			out.push_back((unsigned char)((uint32_t)event.error >> (8 * i)));
+		break;
+	}
+}
+
+// 0 if it runs past end, -1 if it makes no sense, the size otherwise
+static int decode_event(unsigned char const* p, unsigned char const* end, uint64_t previousTime, TimelineEvent& event)
+{
+	unsigned char const* start = p;
+	uint64_t delta;
+	if (p == end)
+		return 0;
+	unsigned char type = *p++;
+	if (type < TimelineEvent::EVENT_KEY_DOWN || type > TimelineEvent::EVENT_CALL)
+		return -1;
+	event.type = (TimelineEvent::Type)type;
+	if (!get_varint(p, end, delta))
+		return 0;
+	event.time = previousTime + delta;
+	switch (event.type)
+	{
+	case TimelineEvent::EVENT_KEY_DOWN:
+	case TimelineEvent::EVENT_KEY_UP:
+		if (end - p < 2)
+			return 0;
+		if (p[0] >= MEDIAKEY_COUNT)
+			return -1;
+		event.key = (MediaKey)p[0];
+		event.modifiers = p[1];
+		p += 2;
+		break;
+	case TimelineEvent::EVENT_SESSION_ADDED:
+		if (end - p < 2)
+			return 0;
+		event.volume = (p[0] | (p[1] << 8)) / 65535.f;
+		p += 2;
+		// Fall through - the name follows
+	case TimelineEvent::EVENT_SESSION_REMOVED:
+		if (p == end || end - p - 1 < *p)
+			return 0;
+		event.name.assign((char const*)p + 1, *p);
+		p += 1 + *p;
+		break;
+	case TimelineEvent::EVENT_DEVICES_CHANGED:
+		{
+			uint64_t count;
+			if (!get_varint(p, end, count))
+				return 0;
+			event.value = (unsigned int)count;
+		}
+		break;
+	case TimelineEvent::EVENT_CALL:
+		if (p == end)
+			return 0;
+		event.value = *p++;
+		if (!get_varint(p, end, event.ns))
+			return 0;
+		if (end - p < 4)
+			return 0;
+		event.error = (int32_t)(p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24));
+		p += 4;
+		break;
+	}
+	return (int)(p - start);
+}
+
+bool timeline_decode(unsigned char const* data, size_t size, std::vector<TimelineEvent>& out)
+{
+	out.clear();
+	if (size < 8 || memcmp(data, "MPVT", 4) != 0 || (data[4] | (data[5] << 8)) != TIMELINE_VERSION)
+		return false;
+	unsigned char const *p = data + 8, *end = data + size;
+	uint64_t time = 0;
+	while (p != end)
+	{
+		TimelineEvent event;
+		int len = decode_event(p, end, time, event);
+		if (len < 0)
+		{
+			out.clear();
+			return false;
+		}
+		if (len == 0)
+			break;
+		p += len;
+		time = event.time;
+		out.push_back(std::move(event));
+	}
+	return true;
+}
+
+bool timeline_read(char const* path, std::vector<TimelineEvent>& out)
+{
+	out.clear();
+	FILE* f = fopen(path, "rb");
+	if (!f)
+		return false;
+	std::vector<unsigned char> data;
+	unsigned char buffer[16384];
+	for (size_t n; (n = fread(buffer, 1, sizeof(buffer), f)) != 0; )
+		data.insert(data.end(), buffer, buffer + n);
+	bool ret = !ferror(f);
+	fclose(f);
+	return ret && timeline_decode(data.data(), data.size(), out);
+}
+
+bool timeline_record_start(std::basic_string<TCHAR> const& path)
+{
+	std::lock_guard<std::mutex> lock(timelineMutex);
+	if (timelineFile)
+		return true;
+#ifdef _WIN32
+	timelineFile = _tfopen(path.c_str(), _T("wb"));
+#else
+	timelineFile = fopen(path.c_str(), "wb");
+#endif
+	if (!timelineFile)
+		return false;
+	setvbuf(timelineFile, NULL, _IOFBF, 65536);
+	static unsigned char const header[8] = { 'M', 'P', 'V', 'T', TIMELINE_VERSION, 0, 0, 0 };
+	fwrite(header, 1, sizeof(header), timelineFile);
+	timelineStart = std::chrono::steady_clock::now();
+	lastTime = 0;
+	eventBuffer.reserve(300);
+	timelineRecording.store(true, std::memory_order_relaxed);
+	return true;
+}
+
+void timeline_record_stop()
+{
+	std::lock_guard<std::mutex> lock(timelineMutex);
+	timelineRecording.store(false, std::memory_order_relaxed);
+	if (!timelineFile)
+		return;
+	fclose(timelineFile);
+	timelineFile = NULL;
+}
+
+// The time is taken under the lock, so the events of different threads go
+//   out in order
+static void record(TimelineEvent& event)
+{
+	std::lock_guard<std::mutex> lock(timelineMutex);
+	if (!timelineFile)
+		return;
+	event.time = (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - timelineStart).count();
+	eventBuffer.clear();
+	timeline_encode(event, lastTime, eventBuffer);
+	fwrite(eventBuffer.data(), 1, eventBuffer.size(), timelineFile);
+	lastTime = event.time;
+}
+
+void timeline_key(MediaKey key, bool down, unsigned int modifiers)
+{
+	if (!timeline_recording())
+		return;
+	TimelineEvent event;
+	event.type = down ? TimelineEvent::EVENT_KEY_DOWN : TimelineEvent::EVENT_KEY_UP;
+	event.key = key;
+	event.modifiers = modifiers;
+	record(event);
+}
+
+void timeline_session_added(std::string const& name, float volume)
+{
+	if (!timeline_recording())
+		return;
+	TimelineEvent event;
+	event.type = TimelineEvent::EVENT_SESSION_ADDED;
+	event.name = name;
+	event.volume = volume;
+	record(event);
+}
+
+void timeline_session_removed(std::string const& name)
+{
+	if (!timeline_recording())
+		return;
+	TimelineEvent event;
+	event.type = TimelineEvent::EVENT_SESSION_REMOVED;
+	event.name = name;
+	record(event);
+}
+
+void timeline_devices_changed(unsigned int count)
+{
+	if (!timeline_recording())
+		return;
+	TimelineEvent event;
+	event.type = TimelineEvent::EVENT_DEVICES_CHANGED;
+	event.value = count;
+	record(event);
+}
+
+void timeline_call(unsigned int site, uint64_t ns, int32_t error)
+{
+	if (!timeline_recording())
+		return;
+	TimelineEvent event;
+	event.type = TimelineEvent::EVENT_CALL;
+	event.value = site;
+	event.ns = ns;
+	event.error = error;
+	record(event);
+}
+
+// Flushes what's buffered for exits that skip timeline_record_stop
+struct __timeline_cleanup {
+	~__timeline_cleanup()
+	{
+		timeline_record_stop();
+	}
+} __timeline_cleanup_inst;
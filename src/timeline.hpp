@@ -0,0 +1,88 @@
+#pragma once
+#ifndef __TIMELINE_HPP__
+#define __TIMELINE_HPP__
+
+#include "unicode.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+#include <string>
+#include <vector>
+
+#include "key_actions.hpp"
+
+// A recording of what a running instance went through: the volume keys as
+//   they reached the key state machine, players' sessions coming and going,
+//   the playback (or input) devices changing and, in builds with
+//   MPVC_CALL_STATS, every COM or Win32 call with its latency. mpvcreplay
+//   plays it back against the fake provider, so a field recording becomes a
+//   repeatable test.
+//
+// Events are written through a buffered file as they happen, from whichever
+//   thread they happen on. Nothing is recorded unless started.
+//
+// Timeline format, little endian:
+//   "MPVT", u16 version, u16 0
+//   per event: u8 type, varint microseconds since the previous event, then
+//     KEY_DOWN, KEY_UP: u8 MediaKey, u8 modifiers (KeyModifier's)
+//     SESSION_ADDED: u16 volume (0..65535 for 0..1), u8 name length, the
+//       UTF-8 process name
+//     SESSION_REMOVED: u8 name length, the name
+//     DEVICES_CHANGED: varint count of devices now
+//     CALL: u8 call site (call_stats.hpp's CallSite), varint nanoseconds,
+//       u32 error (0 for success)
+// Varints are 7 bits a byte, low bits first, the high bit set on all but
+//   the last byte.
+
+#define TIMELINE_VERSION 1
+
+struct TimelineEvent
+{
+	enum Type { EVENT_KEY_DOWN = 1, EVENT_KEY_UP, EVENT_SESSION_ADDED, EVENT_SESSION_REMOVED, EVENT_DEVICES_CHANGED, EVENT_CALL };
+
+	Type type;
+	// Microseconds since recording started
+	uint64_t time;
+	// KEY_DOWN, KEY_UP
+	MediaKey key;
+	unsigned int modifiers;
+	// SESSION_ADDED, SESSION_REMOVED
+	std::string name;
+	float volume;
+	// DEVICES_CHANGED: the device count, CALL: the call site
+	unsigned int value;
+	// CALL
+	uint64_t ns;
+	int32_t error;
+
+	TimelineEvent() : type(EVENT_KEY_DOWN), time(), key(MEDIAKEY_VOLUME_UP), modifiers(), name(), volume(), value(), ns(), error() { }
+};
+
+extern std::atomic<bool> timelineRecording;
+
+// Replaces the file at path
+bool timeline_record_start(std::basic_string<TCHAR> const& path);
+void timeline_record_stop();
+
+// For skipping the work of collecting what's recorded
+inline bool timeline_recording()
+{
+	return timelineRecording.load(std::memory_order_relaxed);
+}
+
+void timeline_key(MediaKey key, bool down, unsigned int modifiers);
+void timeline_session_added(std::string const& name, float volume);
+void timeline_session_removed(std::string const& name);
+void timeline_devices_changed(unsigned int count);
+void timeline_call(unsigned int site, uint64_t ns, int32_t error);
+
+// The file format, without the file. A truncated last event, from a
+//   recording cut short, is dropped; anything else that doesn't check out
+//   fails the decode.
+void timeline_encode(TimelineEvent const& event, uint64_t previousTime, std::vector<unsigned char>& out);
+bool timeline_decode(unsigned char const* data, size_t size, std::vector<TimelineEvent>& out);
+bool timeline_read(char const* path, std::vector<TimelineEvent>& out);
+
+#endif // __TIMELINE_HPP__
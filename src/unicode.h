@@ -10,3 +10,12 @@
 #define UNICODE 0
 #define _UNICODE 0
 #endif
+
+#ifndef _WIN32
+// The portable build has no tchar.h, everything is narrow there
+#ifndef _T
+typedef char TCHAR;
+typedef char _TCHAR;
+#define _T(x) x
+#endif
+#endif
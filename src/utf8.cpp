@@ -0,0 +1,231 @@
+#include "unicode.h"
+
+#include <string.h>
+#include <wctype.h>
+
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <locale.h>
+#endif
+
+#include "utf8.hpp"
+
+#define ONES 0x0101010101010101ULL
+#define HIGH_BITS 0x8080808080808080ULL
+
+#define FNV_OFFSET 2166136261u
+#define FNV_PRIME 16777619u
+
+// Bytes that aren't part of a valid sequence decode to this plus the byte,
+//   past every code point
+#define INVALID_BASE 0x110000u
+
+static inline uint64_t load8(char const* p)
+{
+	uint64_t word;
+	memcpy(&word, p, sizeof word);
+	return word;
+}
+
+// All 8 bytes below 0x80, none of the additions carries into the next byte
+static inline uint64_t ascii_lower8(uint64_t word)
+{
+	uint64_t upper = ((word + (0x80 - 'A') * ONES) ^ (word + (0x80 - 'Z' - 1) * ONES)) & HIGH_BITS;
+	return word | (upper >> 2);
+}
+
+static inline unsigned char ascii_lower(unsigned char c)
+{
+	return c >= 'A' && c <= 'Z' ? c | 0x20 : c;
+}
+
+static uint32_t decode(unsigned char const*& p, unsigned char const* end)
+{
+	unsigned char lead = *p++;
+	if (lead < 0x80)
+		return lead;
+	unsigned int count;
+	uint32_t cp;
+	unsigned char min = 0x80, max = 0xBF;
+	if (lead >= 0xC2 && lead <= 0xDF)
+		count = 1, cp = lead & 0x1F;
+	else if (lead >= 0xE0 && lead <= 0xEF)
+	{
+		count = 2, cp = lead & 0x0F;
+		// No overlong forms, no surrogates
+		if (lead == 0xE0)
+			min = 0xA0;
+		else if (lead == 0xED)
+			max = 0x9F;
+	}
+	else if (lead >= 0xF0 && lead <= 0xF4)
+	{
+		count = 3, cp = lead & 0x07;
+		if (lead == 0xF0)
+			min = 0x90;
+		else if (lead == 0xF4)
+			max = 0x8F;
+	}
+	else
+		return INVALID_BASE + lead;
+	if (end - p < (ptrdiff_t)count || p[0] < min || p[0] > max)
+		return INVALID_BASE + lead;
+	for (unsigned int i = 0; i < count; ++i)
+	{
+		if ((p[i] & 0xC0) != 0x80)
+			return INVALID_BASE + lead;
+		cp = (cp << 6) | (p[i] & 0x3F);
+	}
+	p += count;
+	return cp;
+}
+
+#ifndef _WIN32
+// towlower of the C locale, the one the program runs in, only knows ASCII
+static locale_t fold_locale()
+{
+	static locale_t const locale = []() {
+		static char const* const names[] = { "C.UTF-8", "C.utf8", "en_US.UTF-8", "" };
+		for (char const* name : names)
+			if (locale_t l = newlocale(LC_CTYPE_MASK, name, (locale_t)0))
+				return l;
+		return (locale_t)0;
+	}();
+	return locale;
+}
+#endif
+
+static uint32_t fold(uint32_t cp)
+{
+	if (cp < 0x80)
+		return ascii_lower((unsigned char)cp);
+	if (cp >= INVALID_BASE)
+		return cp;
+#ifdef _WIN32
+	// A value below 0x10000 is taken as a single character
+	return cp < 0x10000 ? (uint32_t)(ULONG_PTR)CharLowerW((LPWSTR)(ULONG_PTR)cp) & 0xFFFF : cp;
+#else
+	locale_t locale = fold_locale();
+	return locale ? (uint32_t)towlower_l((wint_t)cp, locale) : (uint32_t)towlower((wint_t)cp);
+#endif
+}
+
+static bool iequal_unicode(unsigned char const* a, unsigned char const* aEnd, unsigned char const* b, unsigned char const* bEnd)
+{
+	while (a != aEnd && b != bEnd)
+		if (fold(decode(a, aEnd)) != fold(decode(b, bEnd)))
+			return false;
+	return a == aEnd && b == bEnd;
+}
+
+bool utf8_iequal(std::string_view a, std::string_view b)
+{
+	size_t n = a.size() < b.size() ? a.size() : b.size(), i = 0;
+	for (; i + 8 <= n; i += 8)
+	{
+		uint64_t x = load8(a.data() + i), y = load8(b.data() + i);
+		if ((x | y) & HIGH_BITS)
+			break;
+		if (x != y && ascii_lower8(x) != ascii_lower8(y))
+			return false;
+	}
+	for (; i < n; ++i)
+	{
+		unsigned char x = (unsigned char)a[i], y = (unsigned char)b[i];
+		if ((x | y) & 0x80)
+			break;
+		if (ascii_lower(x) != ascii_lower(y))
+			return false;
+	}
+	// The shorter one ended on ASCII, the rest of the other can't match
+	if (i == n)
+		return a.size() == b.size();
+	unsigned char const* pa = (unsigned char const*)a.data();
+	unsigned char const* pb = (unsigned char const*)b.data();
+	return iequal_unicode(pa + i, pa + a.size(), pb + i, pb + b.size());
+}
+
+static inline uint32_t fnv1a_byte(uint32_t hash, unsigned char byte)
+{
+	return (hash ^ byte) * FNV_PRIME;
+}
+
+// FNV-1a over the lower case UTF-8 of the string
+uint32_t utf8_ihash(std::string_view str)
+{
+	uint32_t hash = FNV_OFFSET;
+	unsigned char const* p = (unsigned char const*)str.data();
+	unsigned char const* end = p + str.size();
+	while (p != end)
+	{
+		if (end - p >= 8)
+		{
+			uint64_t word = load8((char const*)p);
+			if (!(word & HIGH_BITS))
+			{
+				word = ascii_lower8(word);
+				for (int i = 0; i < 8; ++i)
+					hash = fnv1a_byte(hash, (unsigned char)(word >> (8 * i)));
+				p += 8;
+				continue;
+			}
+		}
+		if (*p < 0x80)
+		{
+			hash = fnv1a_byte(hash, ascii_lower(*p++));
+			continue;
+		}
+		uint32_t cp = fold(decode(p, end));
+		// The lower case of some is ASCII (the Kelvin sign)
+		if (cp >= INVALID_BASE)
+			hash = fnv1a_byte(hash, (unsigned char)(cp - INVALID_BASE));
+		else if (cp < 0x80)
+			hash = fnv1a_byte(hash, (unsigned char)cp);
+		else if (cp < 0x800)
+		{
+			hash = fnv1a_byte(hash, (unsigned char)(0xC0 | (cp >> 6)));
+			hash = fnv1a_byte(hash, (unsigned char)(0x80 | (cp & 0x3F)));
+		}
+		else if (cp < 0x10000)
+		{
+			hash = fnv1a_byte(hash, (unsigned char)(0xE0 | (cp >> 12)));
+			hash = fnv1a_byte(hash, (unsigned char)(0x80 | ((cp >> 6) & 0x3F)));
+			hash = fnv1a_byte(hash, (unsigned char)(0x80 | (cp & 0x3F)));
+		}
+		else
+		{
+			hash = fnv1a_byte(hash, (unsigned char)(0xF0 | (cp >> 18)));
+			hash = fnv1a_byte(hash, (unsigned char)(0x80 | ((cp >> 12) & 0x3F)));
+			hash = fnv1a_byte(hash, (unsigned char)(0x80 | ((cp >> 6) & 0x3F)));
+			hash = fnv1a_byte(hash, (unsigned char)(0x80 | (cp & 0x3F)));
+		}
+	}
+	return hash;
+}
+
+#ifdef _WIN32
+std::wstring utf8_to_wide(std::string_view str)
+{
+	std::wstring out;
+	int len = MultiByteToWideChar(CP_UTF8, 0, str.data(), (int)str.length(), NULL, 0);
+	if (len > 0)
+	{
+		out.resize(len);
+		MultiByteToWideChar(CP_UTF8, 0, str.data(), (int)str.length(), &out[0], len);
+	}
+	return out;
+}
+
+std::string utf8_from_wide(std::wstring_view str)
+{
+	std::string out;
+	int len = WideCharToMultiByte(CP_UTF8, 0, str.data(), (int)str.length(), NULL, 0, NULL, NULL);
+	if (len > 0)
+	{
+		out.resize(len);
+		WideCharToMultiByte(CP_UTF8, 0, str.data(), (int)str.length(), &out[0], len, NULL, NULL);
+	}
+	return out;
+}
+#endif
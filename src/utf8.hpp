@@ -0,0 +1,62 @@
+#pragma once
+#ifndef __UTF8_HPP__
+#define __UTF8_HPP__
+
+#include "unicode.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <string>
+#include <string_view>
+
+// Strings inside the program are UTF-8: process names, the config, the
+//   command protocol, the files it writes. Wide strings only appear at the
+//   Windows API and are converted right there, once per value where it is
+//   kept (a session's process name, the endpoint ids).
+
+// Case-insensitive comparison and hash, for option names and process names.
+//   ASCII goes through 8 bytes at a time; from the first byte that isn't
+//   ASCII on, code points are decoded and compared by their lower case
+//   (simple case mapping, not locale dependent). Invalid sequences only
+//   match themselves.
+bool utf8_iequal(std::string_view a, std::string_view b);
+// Equal for strings utf8_iequal finds equal
+uint32_t utf8_ihash(std::string_view str);
+
+struct Utf8IHash
+{
+	size_t operator()(std::string_view str) const { return utf8_ihash(str); }
+};
+struct Utf8IEqual
+{
+	bool operator()(std::string_view a, std::string_view b) const { return utf8_iequal(a, b); }
+};
+
+#ifdef _WIN32
+std::wstring utf8_to_wide(std::string_view str);
+std::string utf8_from_wide(std::wstring_view str);
+#endif
+
+// For TCHAR strings of the Windows API, the string itself elsewhere
+#if defined(_WIN32) && UNICODE
+inline std::basic_string<TCHAR> tstring_from_utf8(std::string_view str)
+{
+	return utf8_to_wide(str);
+}
+inline std::string utf8_from_tstring(std::basic_string_view<TCHAR> str)
+{
+	return utf8_from_wide(str);
+}
+#else
+inline std::basic_string<TCHAR> tstring_from_utf8(std::string_view str)
+{
+	return std::basic_string<TCHAR>(str);
+}
+inline std::string utf8_from_tstring(std::basic_string_view<TCHAR> str)
+{
+	return std::string(str);
+}
+#endif
+
+#endif // __UTF8_HPP__
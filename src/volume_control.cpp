@@ -2,224 +2,262 @@
 #include <assert.h>
 
 #include <algorithm>
+#include <atomic>
+#include <iterator>
+#include <vector>
 
-#include <initguid.h>
+#ifdef _WIN32
 #include <Windows.h>
-#include <tchar.h>
-#include <mmdeviceapi.h>
-#include <audiopolicy.h>
-#include <Psapi.h>
+#else
+#include <sched.h>
+#endif
 
-#include "auto_cleanup.hpp"
-#include "errors.hpp"
 #include "volume_control.hpp"
+#include "volume_dispatch.hpp"
+
+// All of the registry is constant initialized, the providers register
+//   themselves from static initializers in other translation units.
+static std::atomic<VolumeControlSnapshot::List*> currentList(nullptr);
+// Readers between pinning and releasing a snapshot, whichever one
+static std::atomic<long> activeReaders(0);
+static VolumeControlSnapshot::List* retiredLists = NULL;
+static std::atomic_flag writerLock = ATOMIC_FLAG_INIT;
 
-#if _MSC_VER
-const CLSID CLSID_MMDeviceEnumerator = __uuidof(MMDeviceEnumerator);
-const IID IID_IMMDeviceEnumerator = __uuidof(IMMDeviceEnumerator);
-const IID IID_IAudioSessionManager2 = __uuidof(IAudioSessionManager2);
-const IID IID_ISimpleAudioVolume = __uuidof(ISimpleAudioVolume);
-const IID IID_IAudioSessionControl2 = __uuidof(IAudioSessionControl2);
+VolumeControlSnapshot::VolumeControlSnapshot()
+{
+	// Sequentially consistent, so a writer that swapped the list before
+	//   this increment is seen by the load, and one that swaps it after sees
+	//   the increment when it checks for readers
+	activeReaders.fetch_add(1);
+	list = currentList.load();
+}
+VolumeControlSnapshot::~VolumeControlSnapshot()
+{
+	activeReaders.fetch_sub(1, std::memory_order_release);
+}
+
+static inline void yield_thread()
+{
+#ifdef _WIN32
+	SwitchToThread();
+#else
+	sched_yield();
 #endif
+}
 
-class AudioSesionInterfaceVolumeControlProvider : public MediaPlayerVolumeControlProvider
+class WriterLock
 {
-protected:
-	std::vector<std::basic_string<TCHAR>> processNames;
-	IMMDeviceEnumerator* iMMDevEnum;
 public:
-	~AudioSesionInterfaceVolumeControlProvider()
-	{
-		if (iMMDevEnum)
-			iMMDevEnum->Release();
-	}
-
-	void register_process_name(std::basic_string<TCHAR> const& name)
+	WriterLock()
 	{
-		processNames.push_back(name);
+		while (writerLock.test_and_set(std::memory_order_acquire))
+			yield_thread();
 	}
-private:
-	template<typename UnaryFunction>
-	bool apply_to_all(UnaryFunction f)
+	~WriterLock()
 	{
-		static TCHAR processPath[MAX_PATH + 1];
-		HRESULT hResult;
-
-		if (!iMMDevEnum)
-		{
-			hResult = CoCreateInstance(CLSID_MMDeviceEnumerator, NULL, CLSCTX_ALL, IID_IMMDeviceEnumerator, (LPVOID*)&iMMDevEnum);
-			if (!SUCCEEDED(hResult))
-			{
-				ShowErrorMessage(hResult, _T("CoCreateInstance[IMMDeviceEnumerator] error"));
-				return false;
-			}
-		}
-
-		IMMDeviceCollection* iMMDevColl;
-		hResult = iMMDevEnum->EnumAudioEndpoints(eRender, DEVICE_STATE_ACTIVE, &iMMDevColl);
-		if (!SUCCEEDED(hResult))
-		{
-			ShowErrorMessage(hResult, _T("IMMDeviceEnumerator::EnumAudioEndpoints error"));
-			return false;
-		}
-		AutoReleaser<IMMDeviceCollection> iMMDevCollReleaser(iMMDevColl);
-
-		UINT deviceCount;
-		// Never trust anything
-		hResult = iMMDevColl->GetCount(&deviceCount);
-		if (!SUCCEEDED(hResult))
-		{
-			ShowErrorMessage(hResult, _T("IMMDeviceCollection::GetCount error"));
-			return false;
-		}
-		for (UINT i = 0; i < deviceCount; ++i)
-		{
-			IMMDevice* iMMDevice;
-			hResult = iMMDevColl->Item(i, &iMMDevice);
-			if (!SUCCEEDED(hResult))
-				continue;
-			AutoReleaser<IMMDevice> iMMDeviceReleaser(iMMDevice);
-
-			IAudioSessionManager2* iAudioSessMgr;
-			hResult = iMMDevice->Activate(IID_IAudioSessionManager2, CLSCTX_ALL, NULL, (void**)&iAudioSessMgr);
-			if (!SUCCEEDED(hResult))
-				continue;
-			AutoReleaser<IAudioSessionManager2> iAudioSessMgrReleaser(iAudioSessMgr);
-
-			IAudioSessionEnumerator* iAudioSessEnum;
-			hResult = iAudioSessMgr->GetSessionEnumerator(&iAudioSessEnum);
-			if (!SUCCEEDED(hResult))
-				continue;
-			AutoReleaser<IAudioSessionEnumerator> iAudioSessEnumReleaser(iAudioSessEnum);
-
-			int sessionCount;
-			// Really, don't EVER trust ANYTHING!
-			hResult = iAudioSessEnum->GetCount(&sessionCount);
-			if (!SUCCEEDED(hResult))
-				continue;
-			for (int j = 0; j < sessionCount; ++j)
-			{
-				IAudioSessionControl* iAudioSessCtrl;
-				hResult = iAudioSessEnum->GetSession(j, &iAudioSessCtrl);
-				if (!SUCCEEDED(hResult))
-					continue;
-				AutoReleaser<IAudioSessionControl> iAudioSessCtrlReleaser(iAudioSessCtrl);
-
-				IAudioSessionControl2* iAudioSessCtrl2;
-				hResult = iAudioSessCtrl->QueryInterface(IID_IAudioSessionControl2, (void**)&iAudioSessCtrl2);
-				if (!SUCCEEDED(hResult))
-					continue;
-				AutoReleaser<IAudioSessionControl2> iAudioSessCtrl2Releaser(iAudioSessCtrl2);
-
-				DWORD processId;
-				hResult = iAudioSessCtrl2->GetProcessId(&processId);
-				if (!SUCCEEDED(hResult))
-					continue;
-
-				HANDLE hProcess = OpenProcess(PROCESS_QUERY_INFORMATION | PROCESS_VM_READ, FALSE, processId);
-				if (!hProcess)
-					continue;
-				DWORD len = GetProcessImageFileName(hProcess, processPath, MAX_PATH + 1);
-				CloseHandle(hProcess);
-				if (len == 0)
-					continue;
-				TCHAR* lastDirSep = std::find(std::make_reverse_iterator(&processPath[len]), std::make_reverse_iterator(&processPath[0]), _T('\\')).base();
-				std::basic_string<TCHAR> processName(lastDirSep, &processPath[len]);
-				if (std::find(processNames.begin(), processNames.end(), processName) != processNames.end())
-					f(iAudioSessCtrl2);
-			}
-		}
-
-		return true;
+		writerLock.clear(std::memory_order_release);
 	}
+};
 
-	class ChangeVolume
+// Frees the replaced lists if no reader can hold one. Readers that started
+//   after the last swap keep the count up too, that only defers it.
+static void reclaim_retired()
+{
+	if (!retiredLists || activeReaders.load() != 0)
+		return;
+	while (retiredLists)
 	{
-	private:
-		float delta;
-	public:
-		MediaPlayerVolumeControlProvider::VOLUME_CHANGE_STATUS status;
-
-		ChangeVolume(float delta) : delta(delta), status(STATUS_NOT_FOUND) { }
-
-		void operator()(IAudioSessionControl2* iAudioSessCtrl)
-		{
-			status = STATUS_FOUND;
-			ISimpleAudioVolume* iAudioVolume;
-			HRESULT hResult = iAudioSessCtrl->QueryInterface(IID_ISimpleAudioVolume, (void**)&iAudioVolume);
-			if (!SUCCEEDED(hResult))
-				return;
-			AutoReleaser<ISimpleAudioVolume> iAudioVolumeReleaser(iAudioVolume);
-			float volume;
-			iAudioVolume->GetMasterVolume(&volume);
-			iAudioVolume->SetMasterVolume(std::min<float>(std::max<float>(volume += delta, 0.f), 1.f), NULL);
-		}
-	};
+		VolumeControlSnapshot::List* next = retiredLists->retiredNext;
+		delete retiredLists;
+		retiredLists = next;
+	}
+}
 
-	virtual VOLUME_CHANGE_STATUS change_volume(float delta)
+// Called with the writer lock held
+static void publish(VolumeControlSnapshot::List* list)
+{
+	VolumeControlSnapshot::List* old = currentList.exchange(list);
+	if (old)
 	{
-		ChangeVolume cv(delta);
-		if (!apply_to_all<ChangeVolume&>(cv))
-			return STATUS_ERROR;
-		return cv.status;
+		old->retiredNext = retiredLists;
+		retiredLists = old;
 	}
-};
-
-/*
-class VLCMediaPlayerVolumeControlProvider;
-*/
-
-std::vector<MediaPlayerVolumeControlProvider*>* volumeControlProvidersPtr = NULL;
+	reclaim_retired();
+}
 
 bool add_volume_control(MediaPlayerVolumeControlProvider* vcp)
 {
-	if (!volumeControlProvidersPtr && !(volumeControlProvidersPtr = new std::vector<MediaPlayerVolumeControlProvider*>()))
-		return false;
-	volumeControlProvidersPtr->push_back(vcp);
+	WriterLock lock;
+	VolumeControlSnapshot::List const* current = currentList.load(std::memory_order_relaxed);
+	VolumeControlSnapshot::List* list = new VolumeControlSnapshot::List();
+	if (current)
+		list->providers = current->providers;
+	list->providers.push_back(vcp);
+	list->retiredNext = NULL;
+	publish(list);
 	return true;
 }
 bool remove_volume_control(MediaPlayerVolumeControlProvider* vcp)
 {
-	if (volumeControlProvidersPtr)
-	{
-		std::vector<MediaPlayerVolumeControlProvider*>::iterator end = volumeControlProvidersPtr->end(), new_end = std::remove(volumeControlProvidersPtr->begin(), end, vcp);
-		if (new_end != end)
-		{
-			volumeControlProvidersPtr->erase(new_end);
-			return true;
-		}
-	}
-	return false;
+	WriterLock lock;
+	VolumeControlSnapshot::List const* current = currentList.load(std::memory_order_relaxed);
+	if (!current || std::find(current->providers.begin(), current->providers.end(), vcp) == current->providers.end())
+		return false;
+	VolumeControlSnapshot::List* list = new VolumeControlSnapshot::List();
+	std::remove_copy(current->providers.begin(), current->providers.end(), std::back_inserter(list->providers), vcp);
+	list->retiredNext = NULL;
+	publish(list);
+	return true;
+}
+void synchronize_volume_controls()
+{
+	while (activeReaders.load() != 0)
+		yield_thread();
+	WriterLock lock;
+	reclaim_retired();
 }
 void delete_volume_controls()
 {
-	for (std::vector<MediaPlayerVolumeControlProvider*>::iterator start = volumeControlProvidersPtr->begin(), end = volumeControlProvidersPtr->end(); start != end; ++start)
+	VolumeControlSnapshot::List* old;
+	{
+		WriterLock lock;
+		if (!(old = currentList.exchange(nullptr)))
+			return;
+	}
+	synchronize_volume_controls();
+	for (std::vector<MediaPlayerVolumeControlProvider*>::iterator start = old->providers.begin(), end = old->providers.end(); start != end; ++start)
 		delete *start;
-	volumeControlProvidersPtr->clear();
+	delete old;
 }
 
-MediaPlayerVolumeControlProvider::VOLUME_CHANGE_STATUS volume_change(float amount)
+// Each of these goes through the dispatcher while it runs and calls the
+//   providers one after the other otherwise
+
+MediaPlayerVolumeControlProvider::VOLUME_CHANGE_STATUS volume_change(float amount, unsigned int presses)
 {
+	DispatchResult result;
+	if (volume_dispatch(DispatchCommand(DispatchCommand::CHANGE, amount, false, NULL, 0, presses), result))
+		return result.status;
 	MediaPlayerVolumeControlProvider::VOLUME_CHANGE_STATUS ret = MediaPlayerVolumeControlProvider::STATUS_NOT_FOUND;
-	for (std::vector<MediaPlayerVolumeControlProvider*>::iterator start = volumeControlProvidersPtr->begin(), end = volumeControlProvidersPtr->end(); start != end; ++start)
+	VolumeControlSnapshot providers;
+	for (VolumeControlSnapshot::const_iterator start = providers.begin(), end = providers.end(); start != end; ++start)
 	{
-		MediaPlayerVolumeControlProvider::VOLUME_CHANGE_STATUS tmp = (*start)->volume_change(amount);
+		MediaPlayerVolumeControlProvider::VOLUME_CHANGE_STATUS tmp = (*start)->volume_change(amount, presses);
 		if (tmp == MediaPlayerVolumeControlProvider::STATUS_FOUND)
 			ret = MediaPlayerVolumeControlProvider::STATUS_FOUND;
 	}
 	return ret;
 }
 
-struct __dummy {
-	__dummy()
+MediaPlayerVolumeControlProvider::VOLUME_CHANGE_STATUS volume_mute()
+{
+	DispatchResult result;
+	if (volume_dispatch(DispatchCommand(DispatchCommand::MUTE), result))
+		return result.status;
+	MediaPlayerVolumeControlProvider::VOLUME_CHANGE_STATUS ret = MediaPlayerVolumeControlProvider::STATUS_NOT_FOUND;
+	VolumeControlSnapshot providers;
+	for (VolumeControlSnapshot::const_iterator start = providers.begin(), end = providers.end(); start != end; ++start)
+		if ((*start)->volume_mute() == MediaPlayerVolumeControlProvider::STATUS_FOUND)
+			ret = MediaPlayerVolumeControlProvider::STATUS_FOUND;
+	return ret;
+}
+
+MediaPlayerVolumeControlProvider::VOLUME_CHANGE_STATUS volume_set(MediaPlayerVolumeControlProvider::target_type const& target, float volume)
+{
+	DispatchResult result;
+	if (volume_dispatch(DispatchCommand(DispatchCommand::SET_VOLUME, volume, false, &target), result))
+		return result.status;
+	MediaPlayerVolumeControlProvider::VOLUME_CHANGE_STATUS ret = MediaPlayerVolumeControlProvider::STATUS_NOT_FOUND;
+	VolumeControlSnapshot providers;
+	for (VolumeControlSnapshot::const_iterator start = providers.begin(), end = providers.end(); start != end; ++start)
+		if ((*start)->volume_set(target, volume) == MediaPlayerVolumeControlProvider::STATUS_FOUND)
+			ret = MediaPlayerVolumeControlProvider::STATUS_FOUND;
+	return ret;
+}
+
+MediaPlayerVolumeControlProvider::VOLUME_CHANGE_STATUS volume_fade(MediaPlayerVolumeControlProvider::target_type const& target, float volume, unsigned int durationMs)
+{
+	DispatchResult result;
+	if (volume_dispatch(DispatchCommand(DispatchCommand::FADE, volume, false, &target, durationMs), result))
+		return result.status;
+	MediaPlayerVolumeControlProvider::VOLUME_CHANGE_STATUS ret = MediaPlayerVolumeControlProvider::STATUS_NOT_FOUND;
+	VolumeControlSnapshot providers;
+	for (VolumeControlSnapshot::const_iterator start = providers.begin(), end = providers.end(); start != end; ++start)
+		if ((*start)->volume_fade(target, volume, durationMs) == MediaPlayerVolumeControlProvider::STATUS_FOUND)
+			ret = MediaPlayerVolumeControlProvider::STATUS_FOUND;
+	return ret;
+}
+
+MediaPlayerVolumeControlProvider::VOLUME_CHANGE_STATUS volume_set_mute(MediaPlayerVolumeControlProvider::target_type const& target, bool mute)
+{
+	DispatchResult result;
+	if (volume_dispatch(DispatchCommand(DispatchCommand::SET_MUTE, 0.f, mute, &target), result))
+		return result.status;
+	MediaPlayerVolumeControlProvider::VOLUME_CHANGE_STATUS ret = MediaPlayerVolumeControlProvider::STATUS_NOT_FOUND;
+	VolumeControlSnapshot providers;
+	for (VolumeControlSnapshot::const_iterator start = providers.begin(), end = providers.end(); start != end; ++start)
+		if ((*start)->mute_set(target, mute) == MediaPlayerVolumeControlProvider::STATUS_FOUND)
+			ret = MediaPlayerVolumeControlProvider::STATUS_FOUND;
+	return ret;
+}
+
+MediaPlayerVolumeControlProvider::VOLUME_CHANGE_STATUS volume_batch(MediaPlayerVolumeControlProvider::VolumeCommand const* commands, size_t count, MediaPlayerVolumeControlProvider::VOLUME_CHANGE_STATUS* statuses)
+{
+	DispatchResult result(statuses);
+	if (volume_dispatch(DispatchCommand(commands, count), result))
+		return result.status;
+	std::fill(statuses, statuses + count, MediaPlayerVolumeControlProvider::STATUS_NOT_FOUND);
+	MediaPlayerVolumeControlProvider::VOLUME_CHANGE_STATUS ret = MediaPlayerVolumeControlProvider::STATUS_NOT_FOUND;
+	std::vector<MediaPlayerVolumeControlProvider::VOLUME_CHANGE_STATUS> providerStatuses(count);
+	VolumeControlSnapshot providers;
+	for (VolumeControlSnapshot::const_iterator start = providers.begin(), end = providers.end(); start != end; ++start)
+	{
+		if ((*start)->volume_batch(commands, count, providerStatuses.data()) != MediaPlayerVolumeControlProvider::STATUS_FOUND)
+			continue;
+		ret = MediaPlayerVolumeControlProvider::STATUS_FOUND;
+		for (size_t i = 0; i < count; ++i)
+			if (providerStatuses[i] == MediaPlayerVolumeControlProvider::STATUS_FOUND)
+				statuses[i] = MediaPlayerVolumeControlProvider::STATUS_FOUND;
+	}
+	return ret;
+}
+
+MediaPlayerVolumeControlProvider::VOLUME_CHANGE_STATUS volume_get(MediaPlayerVolumeControlProvider::target_type const& target, float& volume, bool& muted)
+{
+	DispatchResult result;
+	if (volume_dispatch(DispatchCommand(DispatchCommand::GET, 0.f, false, &target), result))
 	{
-		AudioSesionInterfaceVolumeControlProvider* audioSessIfaceVolCtrlProvider(new AudioSesionInterfaceVolumeControlProvider());
-		audioSessIfaceVolCtrlProvider->register_process_name(std::basic_string<TCHAR>(_T("wmplayer.exe")));
-		add_volume_control(audioSessIfaceVolCtrlProvider);
+		if (result.status == MediaPlayerVolumeControlProvider::STATUS_FOUND)
+		{
+			volume = result.volume;
+			muted = result.muted;
+		}
+		return result.status;
 	}
-	~__dummy()
+	VolumeControlSnapshot providers;
+	for (VolumeControlSnapshot::const_iterator start = providers.begin(), end = providers.end(); start != end; ++start)
+		if ((*start)->volume_get(target, volume, muted) == MediaPlayerVolumeControlProvider::STATUS_FOUND)
+			return MediaPlayerVolumeControlProvider::STATUS_FOUND;
+	return MediaPlayerVolumeControlProvider::STATUS_NOT_FOUND;
+}
+
+void volume_list(std::vector<MediaPlayerVolumeControlProvider::TargetState>& out)
+{
+	DispatchResult result(&out);
+	if (volume_dispatch(DispatchCommand(DispatchCommand::LIST), result))
+		return;
+	VolumeControlSnapshot providers;
+	for (VolumeControlSnapshot::const_iterator start = providers.begin(), end = providers.end(); start != end; ++start)
+		(*start)->volume_list(out);
+}
+
+// Frees what delete_volume_controls left, the lists only, the providers
+//   are owned by whoever registered them until then.
+struct __volume_controls_cleanup {
+	~__volume_controls_cleanup()
 	{
-		assert(volumeControlProvidersPtr != NULL);
-		delete volumeControlProvidersPtr;
+		WriterLock lock;
+		delete currentList.exchange(nullptr);
+		reclaim_retired();
 	}
-} __dummy_inst;
+} __volume_controls_cleanup_inst;
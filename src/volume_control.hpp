@@ -6,6 +6,7 @@
 #include <assert.h>
 
 #include <cmath>
+#include <string>
 #include <vector>
 #include <memory>
 
@@ -13,50 +14,204 @@ class MediaPlayerVolumeControlProvider
 {
 public:
 	enum VOLUME_CHANGE_STATUS { STATUS_ERROR = -1, STATUS_FOUND = 0, STATUS_NOT_FOUND = 1 };
+	// UTF-8 process name of a single application out of the ones a
+	//   provider controls, empty for all of them
+	typedef std::string target_type;
+	struct TargetState
+	{
+		target_type name;
+		float volume;
+		bool muted;
+	};
+	// One command of a batch. An empty target is every session the provider
+	//   controls, for CHANGE and TOGGLE_MUTE the ones the keys would change.
+	struct VolumeCommand
+	{
+		enum Op { CHANGE, TOGGLE_MUTE, SET_VOLUME, FADE, SET_MUTE };
+
+		Op op;
+		target_type target;
+		// CHANGE the delta, SET_VOLUME and FADE the volume, SET_MUTE 1 for
+		//   muting and 0 for unmuting
+		float value;
+		// FADE, milliseconds
+		unsigned int duration;
+		// CHANGE, the key presses of the same step value adds up, so the
+		//   decibel curve can move one level per press
+		unsigned int presses;
+
+		explicit VolumeCommand(Op op, target_type const& target = target_type(), float value = 0.f, unsigned int duration = 0, unsigned int presses = 1) : op(op), target(target), value(value), duration(duration), presses(presses) { }
+
+		// Goes by the session filter and routing of the keys
+		bool keyed() const
+		{
+			return target.empty() && (op == CHANGE || op == TOGGLE_MUTE);
+		}
+	};
 
 	virtual ~MediaPlayerVolumeControlProvider() { }
-	VOLUME_CHANGE_STATUS volume_change(float delta)
+	// Runs the commands in one pass over the provider's sessions, a session
+	//   several commands match gets them in order. statuses gets one status
+	//   per command, the return value is their batch_status.
+	VOLUME_CHANGE_STATUS volume_batch(VolumeCommand const* commands, size_t count, VOLUME_CHANGE_STATUS* statuses)
+	{
+		apply_batch(commands, count, statuses);
+		return batch_status(statuses, count);
+	}
+	VOLUME_CHANGE_STATUS volume_change(float delta, unsigned int presses = 1)
 	{
-		return change_volume(delta);
+		return run_command(VolumeCommand(VolumeCommand::CHANGE, target_type(), delta, 0, presses));
 	}
 	VOLUME_CHANGE_STATUS volume_up(float amount)
 	{
 #if NDEBUG
-		return change_volume(amount);
+		return volume_change(amount);
 #else
-		return change_volume(std::abs(amount));
+		return volume_change(std::abs(amount));
 #endif
 	}
 	VOLUME_CHANGE_STATUS volume_down(float amount)
 	{
 #if NDEBUG
-		return change_volume(-amount);
+		return volume_change(-amount);
 #else
-		return change_volume(-std::abs(amount));
+		return volume_change(-std::abs(amount));
 #endif
 	}
+	VOLUME_CHANGE_STATUS volume_mute()
+	{
+		return run_command(VolumeCommand(VolumeCommand::TOGGLE_MUTE));
+	}
+	VOLUME_CHANGE_STATUS volume_set(target_type const& target, float volume)
+	{
+		return run_command(VolumeCommand(VolumeCommand::SET_VOLUME, target, volume));
+	}
+	// Providers that can't fade set the volume right away
+	VOLUME_CHANGE_STATUS volume_fade(target_type const& target, float volume, unsigned int durationMs)
+	{
+		return run_command(VolumeCommand(VolumeCommand::FADE, target, volume, durationMs));
+	}
+	VOLUME_CHANGE_STATUS mute_set(target_type const& target, bool mute)
+	{
+		return run_command(VolumeCommand(VolumeCommand::SET_MUTE, target, mute ? 1.f : 0.f));
+	}
+	// Reports the first matching session
+	VOLUME_CHANGE_STATUS volume_get(target_type const& target, float& volume, bool& muted)
+	{
+		return get_target_volume(target, volume, muted);
+	}
+	// Appends every session currently controlled
+	void volume_list(std::vector<TargetState>& out)
+	{
+		list_targets(out);
+	}
+	// Milliseconds the dispatcher waits for this provider, 0 for the
+	//   configured default
+	unsigned int latency_budget()
+	{
+		return dispatch_budget();
+	}
+	// Sets up what the first command would otherwise have to, ahead of it
+	void warm_up()
+	{
+		prepare();
+	}
+
+	// STATUS_FOUND if any is, STATUS_ERROR if any is and none found a
+	//   session
+	static VOLUME_CHANGE_STATUS batch_status(VOLUME_CHANGE_STATUS const* statuses, size_t count)
+	{
+		VOLUME_CHANGE_STATUS ret = STATUS_NOT_FOUND;
+		for (size_t i = 0; i < count; ++i)
+			if (statuses[i] == STATUS_FOUND)
+				return STATUS_FOUND;
+			else if (statuses[i] == STATUS_ERROR)
+				ret = STATUS_ERROR;
+		return ret;
+	}
+private:
+	VOLUME_CHANGE_STATUS run_command(VolumeCommand const& command)
+	{
+		VOLUME_CHANGE_STATUS status;
+		apply_batch(&command, 1, &status);
+		return status;
+	}
+
+	// Sets every status, STATUS_ERROR for all of them if the provider
+	//   can't run commands right now
+	virtual void apply_batch(VolumeCommand const* commands, size_t count, VOLUME_CHANGE_STATUS* statuses) = 0;
+	virtual VOLUME_CHANGE_STATUS get_target_volume(target_type const&, float&, bool&)
+	{
+		return STATUS_NOT_FOUND;
+	}
+	virtual void list_targets(std::vector<TargetState>&) { }
+	virtual unsigned int dispatch_budget()
+	{
+		return 0;
+	}
+	virtual void prepare() { }
+};
+
+// The registered providers are published as immutable snapshots through an
+//   atomic pointer. Readers pin the current one without locking or
+//   allocating; writers copy it, swap in the copy and free replaced
+//   snapshots once no reader is left. Writers are serialized among
+//   themselves and may run on any thread, also during static initialization.
+class VolumeControlSnapshot
+{
+public:
+	struct List
+	{
+		std::vector<MediaPlayerVolumeControlProvider*> providers;
+		// Next replaced snapshot waiting to be freed
+		List* retiredNext;
+	};
 private:
-	virtual VOLUME_CHANGE_STATUS change_volume(float delta) = 0;
-	virtual VOLUME_CHANGE_STATUS set_volume(float volume)
+	List const* list;
+public:
+	VolumeControlSnapshot();
+	~VolumeControlSnapshot();
+	VolumeControlSnapshot(VolumeControlSnapshot const&) = delete;
+	VolumeControlSnapshot& operator=(VolumeControlSnapshot const&) = delete;
+
+	// Nothing is registered while list is NULL
+	typedef MediaPlayerVolumeControlProvider* const* const_iterator;
+	const_iterator begin() const
+	{
+		return list ? list->providers.data() : NULL;
+	}
+	const_iterator end() const
 	{
-		VOLUME_CHANGE_STATUS ret;
-		if ((ret = change_volume(-1.f)) != STATUS_FOUND)
-			return ret;
-		return change_volume(volume);
+		return list ? list->providers.data() + list->providers.size() : NULL;
 	}
-	virtual VOLUME_CHANGE_STATUS set_mute(bool mute)
+	size_t size() const
 	{
-		if (mute)
-			return change_volume(-1.f);
-		return change_volume(1.f);
+		return list ? list->providers.size() : 0;
 	}
 };
 
 bool add_volume_control(MediaPlayerVolumeControlProvider*);
+// Doesn't delete the provider. A reader may still be using it until
+//   synchronize_volume_controls returns.
 bool remove_volume_control(MediaPlayerVolumeControlProvider*);
+// Waits until no reader is left, then frees the replaced snapshots. Must not
+//   be called while holding a VolumeControlSnapshot.
+void synchronize_volume_controls();
 void delete_volume_controls();
 
-MediaPlayerVolumeControlProvider::VOLUME_CHANGE_STATUS volume_change(float amount);
+// presses is the number of key presses of the same step amount sums up
+MediaPlayerVolumeControlProvider::VOLUME_CHANGE_STATUS volume_change(float amount, unsigned int presses = 1);
+MediaPlayerVolumeControlProvider::VOLUME_CHANGE_STATUS volume_mute();
+MediaPlayerVolumeControlProvider::VOLUME_CHANGE_STATUS volume_set(MediaPlayerVolumeControlProvider::target_type const& target, float volume);
+MediaPlayerVolumeControlProvider::VOLUME_CHANGE_STATUS volume_fade(MediaPlayerVolumeControlProvider::target_type const& target, float volume, unsigned int durationMs);
+MediaPlayerVolumeControlProvider::VOLUME_CHANGE_STATUS volume_set_mute(MediaPlayerVolumeControlProvider::target_type const& target, bool mute);
+// Runs the batch on every provider. statuses gets one status per command,
+//   STATUS_FOUND if some provider found its target. Waits for every
+//   provider whatever the dispatch policy, each one's part of the answer
+//   counts.
+MediaPlayerVolumeControlProvider::VOLUME_CHANGE_STATUS volume_batch(MediaPlayerVolumeControlProvider::VolumeCommand const* commands, size_t count, MediaPlayerVolumeControlProvider::VOLUME_CHANGE_STATUS* statuses);
+MediaPlayerVolumeControlProvider::VOLUME_CHANGE_STATUS volume_get(MediaPlayerVolumeControlProvider::target_type const& target, float& volume, bool& muted);
+void volume_list(std::vector<MediaPlayerVolumeControlProvider::TargetState>& out);
 
 inline MediaPlayerVolumeControlProvider::VOLUME_CHANGE_STATUS volume_up(float amount)
 {
@@ -77,4 +232,23 @@ inline MediaPlayerVolumeControlProvider::VOLUME_CHANGE_STATUS volume_down(float
 #endif
 }
 
+// What the keys do once they were bound to a single application, an empty
+//   target is the keys' usual sessions
+inline MediaPlayerVolumeControlProvider::VOLUME_CHANGE_STATUS volume_change(MediaPlayerVolumeControlProvider::target_type const& target, float amount, unsigned int presses = 1)
+{
+	if (target.empty())
+		return volume_change(amount, presses);
+	MediaPlayerVolumeControlProvider::VolumeCommand command(MediaPlayerVolumeControlProvider::VolumeCommand::CHANGE, target, amount, 0, presses);
+	MediaPlayerVolumeControlProvider::VOLUME_CHANGE_STATUS status;
+	return volume_batch(&command, 1, &status);
+}
+inline MediaPlayerVolumeControlProvider::VOLUME_CHANGE_STATUS volume_mute(MediaPlayerVolumeControlProvider::target_type const& target)
+{
+	if (target.empty())
+		return volume_mute();
+	MediaPlayerVolumeControlProvider::VolumeCommand command(MediaPlayerVolumeControlProvider::VolumeCommand::TOGGLE_MUTE, target);
+	MediaPlayerVolumeControlProvider::VOLUME_CHANGE_STATUS status;
+	return volume_batch(&command, 1, &status);
+}
+
 #endif // __VOLUME_CONTROL_HPP__
@@ -0,0 +1,557 @@
+#include "unicode.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#ifdef _WIN32
+#include <Windows.h>
+#include <objbase.h>
+#endif
+
+#include "metrics.hpp"
+#include "volume_dispatch.hpp"
+
+typedef std::chrono::steady_clock dispatch_clock;
+
+namespace
+{
+	struct LaneResult
+	{
+		bool queued;
+		bool finished;
+		// The caller stopped waiting for this lane
+		bool timedOut;
+		// The lane didn't take the call, only the caller writes it
+		bool refused;
+		MediaPlayerVolumeControlProvider::VOLUME_CHANGE_STATUS status;
+		float volume;
+		bool muted;
+		std::vector<MediaPlayerVolumeControlProvider::TargetState> targets;
+		// BATCH, kept for their capacity like the call's commands
+		std::vector<MediaPlayerVolumeControlProvider::VOLUME_CHANGE_STATUS> statuses;
+		dispatch_clock::time_point deadline;
+	};
+
+	// One command, shared by the caller and the lanes it was queued on. Free
+	//   while refs is 0.
+	struct Call
+	{
+		std::atomic<unsigned int> refs;
+		DispatchCommand::Op op;
+		float value;
+		bool mute;
+		MediaPlayerVolumeControlProvider::target_type target;
+		unsigned int duration;
+		unsigned int presses;
+		std::vector<MediaPlayerVolumeControlProvider::VolumeCommand> commands;
+
+		std::mutex mutex;
+		std::condition_variable done;
+		bool returned;
+		unsigned int found;
+		LaneResult results[DISPATCH_MAX_LANES];
+
+		Call() : refs(0), op(DispatchCommand::CHANGE), value(), mute(), target(), duration(), presses(1), commands(), mutex(), done(), returned(), found(), results() { }
+	};
+
+	struct Lane
+	{
+		std::atomic<MediaPlayerVolumeControlProvider*> provider;
+		std::thread thread;
+		std::mutex mutex;
+		// Signalled both for new work and for the lane going idle
+		std::condition_variable changed;
+		Call* queue[DISPATCH_SLOTS];
+		unsigned int head, count;
+		bool busy;
+		// When the provider was handed the call it's busy with
+		dispatch_clock::time_point busySince;
+		bool stopping;
+		bool exited;
+
+		Lane() : provider(nullptr), thread(), mutex(), changed(), queue(), head(), count(), busy(), busySince(), stopping(), exited() { }
+	};
+}
+
+static Lane lanes[DISPATCH_MAX_LANES];
+static Call calls[DISPATCH_SLOTS];
+// Creating and tearing down lanes, never taken by dispatching itself once
+//   the lanes exist
+static std::mutex lanesMutex;
+static std::atomic<bool> running(false);
+static DispatchPolicy policy = DISPATCH_FIRST_WINS;
+static unsigned int defaultBudget = DISPATCH_DEFAULT_BUDGET;
+
+static void release_call(Call* call)
+{
+	call->refs.fetch_sub(1, std::memory_order_acq_rel);
+}
+
+static void run_command(MediaPlayerVolumeControlProvider* provider, Call* call, LaneResult& result)
+{
+	switch (call->op)
+	{
+	case DispatchCommand::CHANGE:
+		result.status = provider->volume_change(call->value, call->presses);
+		break;
+	case DispatchCommand::MUTE:
+		result.status = provider->volume_mute();
+		break;
+	case DispatchCommand::SET_VOLUME:
+		result.status = provider->volume_set(call->target, call->value);
+		break;
+	case DispatchCommand::FADE:
+		result.status = provider->volume_fade(call->target, call->value, call->duration);
+		break;
+	case DispatchCommand::SET_MUTE:
+		result.status = provider->mute_set(call->target, call->mute);
+		break;
+	case DispatchCommand::GET:
+		result.status = provider->volume_get(call->target, result.volume, result.muted);
+		break;
+	case DispatchCommand::LIST:
+		result.targets.clear();
+		provider->volume_list(result.targets);
+		result.status = result.targets.empty() ? MediaPlayerVolumeControlProvider::STATUS_NOT_FOUND : MediaPlayerVolumeControlProvider::STATUS_FOUND;
+		break;
+	case DispatchCommand::BATCH:
+		result.statuses.resize(call->commands.size());
+		result.status = provider->volume_batch(call->commands.data(), call->commands.size(), result.statuses.data());
+		break;
+	case DispatchCommand::WARM_UP:
+		provider->warm_up();
+		mpvc_metrics.startup_phase_done(STARTUP_WARM_UP);
+		result.status = MediaPlayerVolumeControlProvider::STATUS_NOT_FOUND;
+		break;
+	}
+}
+
+static void lane_main(Lane* lane, unsigned int index)
+{
+#ifdef _WIN32
+	// The providers' COM objects are created here and don't need the window
+	//   thread's apartment
+	HRESULT hResult = CoInitializeEx(NULL, COINIT_MULTITHREADED);
+#endif
+	std::unique_lock<std::mutex> lock(lane->mutex);
+	for (;;)
+	{
+		while (!lane->count && !lane->stopping)
+			lane->changed.wait(lock);
+		if (lane->stopping)
+			break;
+		Call* call = lane->queue[lane->head];
+		lane->head = (lane->head + 1) % DISPATCH_SLOTS;
+		--lane->count;
+		lane->busy = true;
+		lane->busySince = dispatch_clock::now();
+		MediaPlayerVolumeControlProvider* provider = lane->provider.load(std::memory_order_acquire);
+		lock.unlock();
+
+		// The result slot is this lane's alone until finished is set. A
+		//   warm up queued by a provider's own event may find it unbound.
+		LaneResult& result = call->results[index];
+		if (provider)
+			run_command(provider, call, result);
+
+		{
+			std::lock_guard<std::mutex> callLock(call->mutex);
+			result.finished = true;
+			// Finishing after a first wins return is fine, running over the
+			//   budget isn't
+			if (result.timedOut || (call->returned && dispatch_clock::now() > result.deadline))
+				mpvc_metrics.lateResults.fetch_add(1, std::memory_order_relaxed);
+			else if (result.status == MediaPlayerVolumeControlProvider::STATUS_FOUND)
+				++call->found;
+			call->done.notify_all();
+		}
+		release_call(call);
+
+		lock.lock();
+		lane->busy = false;
+		lane->changed.notify_all();
+	}
+	// Queued calls nobody will run, the callers gave up on them already
+	while (lane->count)
+	{
+		release_call(lane->queue[lane->head]);
+		lane->head = (lane->head + 1) % DISPATCH_SLOTS;
+		--lane->count;
+	}
+	lane->exited = true;
+	lane->changed.notify_all();
+	lock.unlock();
+#ifdef _WIN32
+	if (SUCCEEDED(hResult))
+		CoUninitialize();
+#endif
+}
+
+// Returns the index of the provider's lane, starting one if it has none yet
+static int find_lane(MediaPlayerVolumeControlProvider* provider)
+{
+	for (unsigned int i = 0; i < DISPATCH_MAX_LANES; ++i)
+		if (lanes[i].provider.load(std::memory_order_acquire) == provider)
+			return (int)i;
+	return -1;
+}
+
+static int get_lane(MediaPlayerVolumeControlProvider* provider)
+{
+	int index = find_lane(provider);
+	if (index >= 0)
+		return index;
+
+	std::lock_guard<std::mutex> lock(lanesMutex);
+	int unused = -1;
+	for (unsigned int i = 0; i < DISPATCH_MAX_LANES; ++i)
+	{
+		MediaPlayerVolumeControlProvider* p = lanes[i].provider.load(std::memory_order_relaxed);
+		if (p == provider)
+			return (int)i;
+		if (!p && unused == -1)
+			unused = (int)i;
+	}
+	if (unused == -1)
+		return -1;
+	Lane& lane = lanes[unused];
+	lane.provider.store(provider, std::memory_order_release);
+	// A lane freed by volume_dispatch_stop starts over with a new thread
+	if (!lane.thread.joinable())
+	{
+		lane.stopping = false;
+		lane.exited = false;
+		lane.thread = std::thread(lane_main, &lane, (unsigned int)unused);
+	}
+	return unused;
+}
+
+static Call* acquire_call()
+{
+	for (unsigned int i = 0; i < DISPATCH_SLOTS; ++i)
+	{
+		unsigned int expected = 0;
+		if (calls[i].refs.compare_exchange_strong(expected, 1, std::memory_order_acq_rel))
+			return &calls[i];
+	}
+	return NULL;
+}
+
+// Refuses the call if the lane is stopping, has its backlog full, or is
+//   still busy with a call it started before stalledBefore. The calls
+//   queued behind a stalled one are dropped then, they would be late
+//   anyway, so a hung provider only holds on to the call it hangs in.
+static bool enqueue(Lane& lane, Call* call, dispatch_clock::time_point stalledBefore)
+{
+	Call* dropped[DISPATCH_SLOTS];
+	unsigned int droppedCount = 0;
+	{
+		std::lock_guard<std::mutex> lock(lane.mutex);
+		if (!lane.stopping && lane.count < DISPATCH_LANE_BACKLOG && !(lane.busy && lane.busySince < stalledBefore))
+		{
+			lane.queue[(lane.head + lane.count) % DISPATCH_SLOTS] = call;
+			++lane.count;
+			lane.changed.notify_one();
+			return true;
+		}
+		if (lane.busy && lane.busySince < stalledBefore)
+			for (; lane.count; --lane.count, lane.head = (lane.head + 1) % DISPATCH_SLOTS)
+				dropped[droppedCount++] = lane.queue[lane.head];
+	}
+	// Their callers find them neither queued nor finished, like a timeout
+	for (unsigned int i = 0; i < droppedCount; ++i)
+		release_call(dropped[i]);
+	mpvc_metrics.lateResults.fetch_add(droppedCount, std::memory_order_relaxed);
+	return false;
+}
+
+// Takes a call the lane hasn't started off its queue, false if it's not
+//   there anymore
+static bool unqueue(Lane& lane, Call* call)
+{
+	std::lock_guard<std::mutex> lock(lane.mutex);
+	for (unsigned int i = 0; i < lane.count; ++i)
+	{
+		if (lane.queue[(lane.head + i) % DISPATCH_SLOTS] != call)
+			continue;
+		for (; i + 1 < lane.count; ++i)
+			lane.queue[(lane.head + i) % DISPATCH_SLOTS] = lane.queue[(lane.head + i + 1) % DISPATCH_SLOTS];
+		--lane.count;
+		lane.changed.notify_all();
+		return true;
+	}
+	return false;
+}
+
+void volume_dispatch_start(DispatchPolicy newPolicy, unsigned int budget)
+{
+	policy = newPolicy;
+	defaultBudget = budget ? budget : DISPATCH_DEFAULT_BUDGET;
+	running.store(true, std::memory_order_release);
+}
+
+bool volume_dispatch_stop(unsigned int graceMs)
+{
+	if (!running.exchange(false))
+		return true;
+	std::lock_guard<std::mutex> lanesLock(lanesMutex);
+	dispatch_clock::time_point deadline = dispatch_clock::now() + std::chrono::milliseconds(graceMs);
+	for (unsigned int i = 0; i < DISPATCH_MAX_LANES; ++i)
+	{
+		std::lock_guard<std::mutex> lock(lanes[i].mutex);
+		lanes[i].stopping = true;
+		lanes[i].changed.notify_all();
+	}
+	bool stopped = true;
+	for (unsigned int i = 0; i < DISPATCH_MAX_LANES; ++i)
+	{
+		Lane& lane = lanes[i];
+		if (!lane.thread.joinable())
+			continue;
+		bool exited;
+		{
+			std::unique_lock<std::mutex> lock(lane.mutex);
+			exited = lane.changed.wait_until(lock, deadline, [&lane]() { return lane.exited; });
+		}
+		if (exited)
+		{
+			lane.thread.join();
+			lane.provider.store(nullptr, std::memory_order_release);
+		}
+		else
+		{
+			// Stuck in its provider. The lane stays bound to it and refuses
+			//   work, should the dispatcher be started again.
+			lane.thread.detach();
+			stopped = false;
+		}
+	}
+	return stopped;
+}
+
+bool volume_dispatch(DispatchCommand const& command, DispatchResult& result)
+{
+	if (!running.load(std::memory_order_acquire))
+		return false;
+
+	Call* call = acquire_call();
+	if (!call)
+	{
+		// Every slot is held by lanes that are still stuck
+		mpvc_metrics.providerErrors.fetch_add(1, std::memory_order_relaxed);
+		result.status = MediaPlayerVolumeControlProvider::STATUS_ERROR;
+		if (command.op == DispatchCommand::BATCH && result.statuses)
+			std::fill(result.statuses, result.statuses + command.count, MediaPlayerVolumeControlProvider::STATUS_ERROR);
+		return true;
+	}
+	call->op = command.op;
+	call->value = command.value;
+	call->mute = command.mute;
+	call->duration = command.duration;
+	call->presses = command.presses;
+	// Keeps its capacity, so only ever allocates for a longer target name
+	//   than seen before
+	if (command.target)
+		call->target.assign(*command.target);
+	else
+		call->target.clear();
+	// Assigning over the commands there are reuses their targets' storage
+	if (command.op == DispatchCommand::BATCH)
+		call->commands.assign(command.commands, command.commands + command.count);
+	call->returned = false;
+	call->found = 0;
+	for (unsigned int i = 0; i < DISPATCH_MAX_LANES; ++i)
+	{
+		LaneResult& laneResult = call->results[i];
+		laneResult.queued = laneResult.finished = laneResult.timedOut = laneResult.refused = false;
+		laneResult.status = MediaPlayerVolumeControlProvider::STATUS_NOT_FOUND;
+	}
+
+	unsigned int pending = 0;
+	{
+		VolumeControlSnapshot providers;
+		dispatch_clock::time_point now = dispatch_clock::now();
+		for (VolumeControlSnapshot::const_iterator start = providers.begin(), end = providers.end(); start != end; ++start)
+		{
+			int index = get_lane(*start);
+			if (index < 0)
+			{
+				mpvc_metrics.providerErrors.fetch_add(1, std::memory_order_relaxed);
+				continue;
+			}
+			LaneResult& laneResult = call->results[index];
+			unsigned int budget = (*start)->latency_budget();
+			std::chrono::milliseconds budgetMs(budget ? budget : defaultBudget);
+			laneResult.deadline = now + budgetMs;
+			// Set before the lane can see the call
+			laneResult.queued = true;
+			call->refs.fetch_add(1, std::memory_order_relaxed);
+			if (enqueue(lanes[index], call, now - budgetMs))
+				++pending;
+			else
+			{
+				// Reported right away instead of waiting out the budget
+				laneResult.queued = false;
+				laneResult.refused = true;
+				release_call(call);
+				mpvc_metrics.providerErrors.fetch_add(1, std::memory_order_relaxed);
+			}
+		}
+	}
+
+	std::unique_lock<std::mutex> lock(call->mutex);
+	while (pending)
+	{
+		// A list is only complete with every provider in it, so is a batch
+		//   whose commands may be for players of different providers
+		if (policy == DISPATCH_FIRST_WINS && command.op != DispatchCommand::LIST && command.op != DispatchCommand::BATCH && call->found)
+			break;
+		// Count the lanes that are done or out of time, and find the next
+		//   deadline to wake up at
+		dispatch_clock::time_point now = dispatch_clock::now(), next = dispatch_clock::time_point::max();
+		pending = 0;
+		for (unsigned int i = 0; i < DISPATCH_MAX_LANES; ++i)
+		{
+			LaneResult& laneResult = call->results[i];
+			if (!laneResult.queued || laneResult.finished || laneResult.timedOut)
+				continue;
+			if (laneResult.deadline <= now)
+			{
+				laneResult.timedOut = true;
+				// Still queued behind a slow call, the lane won't run it and
+				//   the slot is free again once the others let go of it
+				if (unqueue(lanes[i], call))
+					release_call(call);
+				continue;
+			}
+			++pending;
+			if (laneResult.deadline < next)
+				next = laneResult.deadline;
+		}
+		if (pending)
+			call->done.wait_until(lock, next);
+	}
+	call->returned = true;
+
+	// Collected under the lock. A lane writes its result before it sets
+	//   finished under the lock, so only finished results are read, one that
+	//   timed out may still be written to.
+	if (command.op == DispatchCommand::BATCH && result.statuses)
+		std::fill(result.statuses, result.statuses + command.count, MediaPlayerVolumeControlProvider::STATUS_NOT_FOUND);
+	bool failed = false;
+	for (unsigned int i = 0; i < DISPATCH_MAX_LANES; ++i)
+	{
+		LaneResult& laneResult = call->results[i];
+		if (laneResult.refused)
+			failed = true;
+		if (!laneResult.finished || laneResult.timedOut)
+			continue;
+		if (laneResult.status == MediaPlayerVolumeControlProvider::STATUS_ERROR)
+			failed = true;
+		// A command is found if any provider found it, failed if one failed
+		//   and none found it
+		if (command.op == DispatchCommand::BATCH && result.statuses)
+			for (size_t j = 0; j < command.count; ++j)
+				if (laneResult.statuses[j] == MediaPlayerVolumeControlProvider::STATUS_FOUND || (laneResult.statuses[j] == MediaPlayerVolumeControlProvider::STATUS_ERROR && result.statuses[j] == MediaPlayerVolumeControlProvider::STATUS_NOT_FOUND))
+					result.statuses[j] = laneResult.statuses[j];
+		if (laneResult.status != MediaPlayerVolumeControlProvider::STATUS_FOUND)
+			continue;
+		if (command.op == DispatchCommand::GET)
+		{
+			if (result.status != MediaPlayerVolumeControlProvider::STATUS_FOUND)
+			{
+				result.volume = laneResult.volume;
+				result.muted = laneResult.muted;
+			}
+		}
+		else if (command.op == DispatchCommand::LIST && result.targets)
+			result.targets->insert(result.targets->end(), laneResult.targets.begin(), laneResult.targets.end());
+		result.status = MediaPlayerVolumeControlProvider::STATUS_FOUND;
+	}
+	// Nothing found, and some provider failed or couldn't take the command
+	if (result.status != MediaPlayerVolumeControlProvider::STATUS_FOUND && failed)
+		result.status = MediaPlayerVolumeControlProvider::STATUS_ERROR;
+	lock.unlock();
+	release_call(call);
+	return true;
+}
+
+// On the lanes of every provider, or of only that one. That one only gets
+//   its lane if it has one already, it may be on its way out.
+static bool queue_warm_up(MediaPlayerVolumeControlProvider* only)
+{
+	if (!running.load(std::memory_order_acquire))
+		return false;
+	Call* call = acquire_call();
+	if (!call)
+		return false;
+	call->op = DispatchCommand::WARM_UP;
+	call->target.clear();
+	// Nobody waits, nothing it does is late
+	call->returned = true;
+	call->found = 0;
+	for (unsigned int i = 0; i < DISPATCH_MAX_LANES; ++i)
+	{
+		LaneResult& laneResult = call->results[i];
+		laneResult.queued = laneResult.finished = laneResult.timedOut = laneResult.refused = false;
+		laneResult.status = MediaPlayerVolumeControlProvider::STATUS_NOT_FOUND;
+		laneResult.deadline = dispatch_clock::time_point::max();
+	}
+
+	bool queued = false;
+	VolumeControlSnapshot providers;
+	for (VolumeControlSnapshot::const_iterator start = providers.begin(), end = providers.end(); start != end; ++start)
+	{
+		if (only && *start != only)
+			continue;
+		int index = only ? find_lane(*start) : get_lane(*start);
+		if (index < 0)
+			continue;
+		call->results[index].queued = true;
+		call->refs.fetch_add(1, std::memory_order_relaxed);
+		if (enqueue(lanes[index], call, dispatch_clock::now() - std::chrono::milliseconds(defaultBudget)))
+			queued = true;
+		else
+			release_call(call);
+	}
+	release_call(call);
+	return queued;
+}
+
+bool volume_dispatch_warm_up()
+{
+	return queue_warm_up(NULL);
+}
+
+bool volume_dispatch_warm_up(MediaPlayerVolumeControlProvider* provider)
+{
+	return queue_warm_up(provider);
+}
+
+void volume_dispatch_detach(MediaPlayerVolumeControlProvider* provider)
+{
+	std::lock_guard<std::mutex> lanesLock(lanesMutex);
+	for (unsigned int i = 0; i < DISPATCH_MAX_LANES; ++i)
+	{
+		Lane& lane = lanes[i];
+		if (lane.provider.load(std::memory_order_relaxed) != provider)
+			continue;
+		std::unique_lock<std::mutex> lock(lane.mutex);
+		while ((lane.count || lane.busy) && !lane.exited)
+			lane.changed.wait(lock);
+		lane.provider.store(nullptr, std::memory_order_release);
+	}
+}
+
+// Lanes must not outlive their std::thread objects, for exits that skip
+//   volume_dispatch_stop
+struct __volume_dispatch_cleanup {
+	~__volume_dispatch_cleanup()
+	{
+		volume_dispatch_stop(0);
+	}
+} __volume_dispatch_cleanup_inst;
@@ -0,0 +1,107 @@
+#pragma once
+#ifndef __VOLUME_DISPATCH_HPP__
+#define __VOLUME_DISPATCH_HPP__
+
+#include "unicode.h"
+
+#include <vector>
+
+#include "volume_control.hpp"
+
+// Runs the commands of volume_control.hpp on every provider concurrently,
+//   each provider on a worker thread of its own (a lane), so a hung backend
+//   only stalls itself. The caller waits at most for the latency budget of
+//   the slowest provider; results arriving after a provider's budget ran out
+//   are dropped and counted in mpvc_metrics.lateResults.
+//
+// The commands reach a provider only from its lane while the dispatcher
+//   runs, which also keeps its COM objects in the lane's multithreaded
+//   apartment. Before it's started and after it's stopped they run serially
+//   on the calling thread. That doesn't make a provider single threaded:
+//   the fade thread calls fade_write (see fade_engine.hpp), its backend's
+//   own threads deliver events, and the serial calls after a stop that
+//   gave up on a stuck lane run next to it, so providers keep their own
+//   locks.
+//
+// Calls and lanes live in fixed tables, dispatching doesn't allocate once a
+//   provider's lane is up.
+
+#define DISPATCH_MAX_LANES 8
+// Calls in flight, including the ones still running late on some lane
+#define DISPATCH_SLOTS 8
+// Calls waiting on one lane behind the one it runs, a busy provider gets
+//   no more than that and reports an error for the rest
+#define DISPATCH_LANE_BACKLOG 2
+// Milliseconds, for providers without a budget of their own
+#define DISPATCH_DEFAULT_BUDGET 250
+
+enum DispatchPolicy
+{
+	// Return as soon as one provider found a session, the others finish in
+	//   the background. Listing always waits for all.
+	DISPATCH_FIRST_WINS = 0,
+	// Wait for every provider (or its budget)
+	DISPATCH_BROADCAST = 1
+};
+
+struct DispatchCommand
+{
+	enum Op { CHANGE, MUTE, SET_VOLUME, FADE, SET_MUTE, GET, LIST, BATCH, WARM_UP };
+
+	Op op;
+	float value;
+	bool mute;
+	// Copied into the call, may go away once volume_dispatch returns
+	MediaPlayerVolumeControlProvider::target_type const* target;
+	// FADE, milliseconds
+	unsigned int duration;
+	// CHANGE, see VolumeCommand
+	unsigned int presses;
+	// BATCH, copied like target
+	MediaPlayerVolumeControlProvider::VolumeCommand const* commands;
+	size_t count;
+
+	explicit DispatchCommand(Op op, float value = 0.f, bool mute = false, MediaPlayerVolumeControlProvider::target_type const* target = NULL, unsigned int duration = 0, unsigned int presses = 1) : op(op), value(value), mute(mute), target(target), duration(duration), presses(presses), commands(), count() { }
+	DispatchCommand(MediaPlayerVolumeControlProvider::VolumeCommand const* commands, size_t count) : op(BATCH), value(), mute(), target(), duration(), presses(1), commands(commands), count(count) { }
+};
+
+struct DispatchResult
+{
+	MediaPlayerVolumeControlProvider::VOLUME_CHANGE_STATUS status;
+	// GET
+	float volume;
+	bool muted;
+	// LIST appends here, the other commands leave it alone
+	std::vector<MediaPlayerVolumeControlProvider::TargetState>* targets;
+	// BATCH, one per command
+	MediaPlayerVolumeControlProvider::VOLUME_CHANGE_STATUS* statuses;
+
+	DispatchResult(std::vector<MediaPlayerVolumeControlProvider::TargetState>* targets = NULL) : status(MediaPlayerVolumeControlProvider::STATUS_NOT_FOUND), volume(), muted(), targets(targets), statuses() { }
+	explicit DispatchResult(MediaPlayerVolumeControlProvider::VOLUME_CHANGE_STATUS* statuses) : status(MediaPlayerVolumeControlProvider::STATUS_NOT_FOUND), volume(), muted(), targets(), statuses(statuses) { }
+};
+
+// defaultBudget in milliseconds, 0 for DISPATCH_DEFAULT_BUDGET
+void volume_dispatch_start(DispatchPolicy policy, unsigned int defaultBudget);
+// Gives busy lanes graceMs to finish. Returns false if some didn't, their
+//   providers must not be deleted then.
+bool volume_dispatch_stop(unsigned int graceMs);
+
+// Returns false if the dispatcher isn't running, the caller has to run the
+//   command itself then
+bool volume_dispatch(DispatchCommand const& command, DispatchResult& result);
+
+// Queues a warm up on every provider's lane without waiting for it, so the
+//   lanes and the providers' caches are up before the first key press.
+//   Returns false if it wasn't queued anywhere, like when the dispatcher
+//   isn't running.
+bool volume_dispatch_warm_up();
+// The same for one provider whose backend told it about something the
+//   next command would have to look at first. May be called from the
+//   backend's threads, the provider must already have its lane.
+bool volume_dispatch_warm_up(MediaPlayerVolumeControlProvider* provider);
+
+// Waits until the provider's lane is idle and unbinds it, for deleting a
+//   provider after remove_volume_control
+void volume_dispatch_detach(MediaPlayerVolumeControlProvider* provider);
+
+#endif // __VOLUME_DISPATCH_HPP__
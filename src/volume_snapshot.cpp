@@ -0,0 +1,339 @@
+#include "unicode.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#ifdef _WIN32
+#include <Windows.h>
+#include <tchar.h>
+#endif
+
+#include "volume_snapshot.hpp"
+
+static std::mutex snapshotMutex;
+static std::condition_variable snapshotChanged;
+// Sorted by name, names are unique
+static std::vector<VolumeSnapshotEntry> snapshotIndex;
+// Changes made to the index and the last one written out
+static unsigned long changes = 0;
+static unsigned long written = 0;
+static std::basic_string<TCHAR> snapshotPath;
+static bool running = false;
+// Set once an index was loaded, recording and looking up do nothing before,
+//   so RememberVolumes: 0 and replays don't remember anything within a run
+static bool enabled = false;
+static bool stopping = false;
+static std::thread writerThread;
+
+static bool name_less(VolumeSnapshotEntry const& entry, std::string const& name)
+{
+	return entry.name < name;
+}
+static bool entry_less(VolumeSnapshotEntry const& a, VolumeSnapshotEntry const& b)
+{
+	return a.name < b.name;
+}
+
+static uint32_t fnv1a(unsigned char const* data, size_t size)
+{
+	uint32_t hash = 2166136261u;
+	for (unsigned char const* end = data + size; data != end; ++data)
+		hash = (hash ^ *data) * 16777619u;
+	return hash;
+}
+
+static void put_u16(std::vector<unsigned char>& out, unsigned int value)
+{
+	out.push_back((unsigned char)value);
+	out.push_back((unsigned char)(value >> 8));
+}
+static void put_u32(std::vector<unsigned char>& out, uint32_t value)
+{
+	put_u16(out, value & 0xFFFF);
+	put_u16(out, value >> 16);
+}
+static unsigned int get_u16(unsigned char const* p)
+{
+	return p[0] | (p[1] << 8);
+}
+static uint32_t get_u32(unsigned char const* p)
+{
+	return get_u16(p) | ((uint32_t)get_u16(p + 2) << 16);
+}
+
+void volume_snapshot_encode(std::vector<VolumeSnapshotEntry> const& entries, std::vector<unsigned char>& out)
+{
+	out.clear();
+	out.reserve(16 + entries.size() * 16);
+	out.push_back('M');
+	out.push_back('P');
+	out.push_back('V');
+	out.push_back('S');
+	put_u16(out, VOLUME_SNAPSHOT_VERSION);
+	put_u16(out, 0);
+	size_t countPos = out.size();
+	put_u32(out, 0);
+	uint32_t count = 0;
+	for (std::vector<VolumeSnapshotEntry>::const_iterator start = entries.begin(), end = entries.end(); start != end; ++start)
+	{
+		std::string const& name = start->name;
+		// No process name gets there, it isn't worth a wider length
+		if (name.empty() || name.length() > 255)
+			continue;
+		out.push_back(start->flags);
+		out.push_back((unsigned char)name.length());
+		float volume = std::min<float>(std::max<float>(start->volume, 0.f), 1.f);
+		put_u16(out, (unsigned int)(volume * 65535.f + .5f));
+		out.insert(out.end(), name.begin(), name.end());
+		++count;
+	}
+	for (int i = 0; i < 4; ++i)
+		out[countPos + i] = (unsigned char)(count >> (8 * i));
+	put_u32(out, fnv1a(out.data(), out.size()));
+}
+
+bool volume_snapshot_decode(unsigned char const* data, size_t size, std::vector<VolumeSnapshotEntry>& out)
+{
+	out.clear();
+	if (size < 16 || memcmp(data, "MPVS", 4) != 0 || get_u16(data + 4) != VOLUME_SNAPSHOT_VERSION)
+		return false;
+	size -= 4;
+	if (get_u32(data + size) != fnv1a(data, size))
+		return false;
+
+	uint32_t count = get_u32(data + 8);
+	// At least 5 bytes each, a bogus count can't make it allocate much
+	if (count > (size - 12) / 5)
+		return false;
+	out.reserve(count);
+	unsigned char const *p = data + 12, *end = data + size;
+	for (uint32_t i = 0; i < count; ++i)
+	{
+		if (end - p < 4 || end - p - 4 < p[1])
+		{
+			out.clear();
+			return false;
+		}
+		VolumeSnapshotEntry entry;
+		entry.flags = p[0];
+		entry.volume = get_u16(p + 2) / 65535.f;
+		entry.name.assign((char const*)p + 4, p[1]);
+		p += 4 + p[1];
+		out.push_back(std::move(entry));
+	}
+
+	// Written sorted, only edited files need this
+	if (!std::is_sorted(out.begin(), out.end(), entry_less))
+	{
+		std::stable_sort(out.begin(), out.end(), entry_less);
+		// The last of each name wins
+		std::vector<VolumeSnapshotEntry>::iterator kept = out.begin();
+		for (std::vector<VolumeSnapshotEntry>::iterator start = out.begin() + 1, last = out.end(); start != last; ++start)
+			if (start->name == kept->name)
+				*kept = std::move(*start);
+			else
+				*++kept = std::move(*start);
+		out.erase(kept + 1, out.end());
+	}
+	return true;
+}
+
+static FILE* open_file(std::basic_string<TCHAR> const& path, TCHAR const* mode)
+{
+#ifdef _WIN32
+	return _tfopen(path.c_str(), mode);
+#else
+	return fopen(path.c_str(), mode);
+#endif
+}
+
+static bool read_file(std::basic_string<TCHAR> const& path, std::vector<unsigned char>& out)
+{
+	out.clear();
+	FILE* f = open_file(path, _T("rb"));
+	if (!f)
+		return false;
+	unsigned char buffer[16384];
+	for (size_t n; (n = fread(buffer, 1, sizeof(buffer), f)) != 0; )
+		out.insert(out.end(), buffer, buffer + n);
+	bool ret = !ferror(f);
+	fclose(f);
+	return ret;
+}
+
+// Through a temporary file, so a crash leaves the old snapshot or the new
+//   one but never half of one
+static bool write_file(std::basic_string<TCHAR> const& path, std::vector<unsigned char> const& data)
+{
+	std::basic_string<TCHAR> tmpPath(path);
+	tmpPath.append(_T(".tmp"));
+	FILE* f = open_file(tmpPath, _T("wb"));
+	if (!f)
+		return false;
+	bool ret = fwrite(data.data(), 1, data.size(), f) == data.size();
+	ret = fclose(f) == 0 && ret;
+#ifdef _WIN32
+	ret = ret && MoveFileEx(tmpPath.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING);
+#else
+	ret = ret && rename(tmpPath.c_str(), path.c_str()) == 0;
+#endif
+	return ret;
+}
+
+bool volume_snapshot_load(std::basic_string<TCHAR> const& path)
+{
+	std::vector<unsigned char> data;
+	std::vector<VolumeSnapshotEntry> entries;
+	bool ret = true;
+	if (read_file(path, data))
+		ret = volume_snapshot_decode(data.data(), data.size(), entries);
+	std::lock_guard<std::mutex> lock(snapshotMutex);
+	snapshotIndex.swap(entries);
+	written = changes;
+	enabled = true;
+	return ret;
+}
+
+bool volume_snapshot_save(std::basic_string<TCHAR> const& path)
+{
+	std::vector<unsigned char> data;
+	{
+		std::lock_guard<std::mutex> lock(snapshotMutex);
+		volume_snapshot_encode(snapshotIndex, data);
+	}
+	return write_file(path, data);
+}
+
+size_t volume_snapshot_size()
+{
+	std::lock_guard<std::mutex> lock(snapshotMutex);
+	return snapshotIndex.size();
+}
+
+static void writer_main()
+{
+	std::unique_lock<std::mutex> lock(snapshotMutex);
+	for (;;)
+	{
+		while (!stopping && changes == written)
+			snapshotChanged.wait(lock);
+		// Gives the rest of a run of key presses time to come in
+		if (!stopping)
+			snapshotChanged.wait_for(lock, std::chrono::milliseconds(VOLUME_SNAPSHOT_WRITE_DELAY), []() { return stopping; });
+		if (changes != written)
+		{
+			std::vector<unsigned char> data;
+			volume_snapshot_encode(snapshotIndex, data);
+			unsigned long version = changes;
+			lock.unlock();
+			// A failed write is tried again with the next change
+			bool ok = write_file(snapshotPath, data);
+			lock.lock();
+			if (ok)
+				written = version;
+		}
+		if (stopping)
+			break;
+	}
+}
+
+bool volume_snapshot_start(std::basic_string<TCHAR> const& path)
+{
+	// A snapshot that doesn't check out is started over
+	volume_snapshot_load(path);
+	std::lock_guard<std::mutex> lock(snapshotMutex);
+	if (running)
+		return true;
+	snapshotPath = path;
+	stopping = false;
+	writerThread = std::thread(writer_main);
+	running = true;
+	return true;
+}
+
+void volume_snapshot_stop()
+{
+	{
+		std::lock_guard<std::mutex> lock(snapshotMutex);
+		enabled = false;
+		if (!running)
+			return;
+		running = false;
+		stopping = true;
+		snapshotChanged.notify_all();
+	}
+	writerThread.join();
+}
+
+// Called with the lock held, finds or adds the entry of a process
+static VolumeSnapshotEntry& entry_for(std::string const& name)
+{
+	std::vector<VolumeSnapshotEntry>::iterator it = std::lower_bound(snapshotIndex.begin(), snapshotIndex.end(), name, name_less);
+	if (it == snapshotIndex.end() || it->name != name)
+	{
+		VolumeSnapshotEntry entry = { name, 0.f, 0 };
+		it = snapshotIndex.insert(it, std::move(entry));
+	}
+	return *it;
+}
+
+static void changed()
+{
+	++changes;
+	if (running)
+		snapshotChanged.notify_all();
+}
+
+void volume_snapshot_record_volume(std::string const& name, float volume)
+{
+	std::lock_guard<std::mutex> lock(snapshotMutex);
+	if (!enabled)
+		return;
+	VolumeSnapshotEntry& entry = entry_for(name);
+	if ((entry.flags & VolumeSnapshotEntry::HAS_VOLUME) && entry.volume == volume)
+		return;
+	entry.volume = volume;
+	entry.flags |= VolumeSnapshotEntry::HAS_VOLUME;
+	changed();
+}
+
+void volume_snapshot_record_mute(std::string const& name, bool muted)
+{
+	std::lock_guard<std::mutex> lock(snapshotMutex);
+	if (!enabled)
+		return;
+	VolumeSnapshotEntry& entry = entry_for(name);
+	unsigned char flags = (unsigned char)((entry.flags & ~VolumeSnapshotEntry::MUTED) | VolumeSnapshotEntry::HAS_MUTE | (muted ? VolumeSnapshotEntry::MUTED : 0));
+	if (flags == entry.flags)
+		return;
+	entry.flags = flags;
+	changed();
+}
+
+bool volume_snapshot_lookup(std::string const& name, VolumeSnapshotEntry& out)
+{
+	std::lock_guard<std::mutex> lock(snapshotMutex);
+	if (!enabled)
+		return false;
+	std::vector<VolumeSnapshotEntry>::const_iterator it = std::lower_bound(snapshotIndex.begin(), snapshotIndex.end(), name, name_less);
+	if (it == snapshotIndex.end() || it->name != name)
+		return false;
+	out = *it;
+	return true;
+}
+
+// The writer must not outlive its std::thread object, for exits that skip
+//   volume_snapshot_stop
+struct __volume_snapshot_cleanup {
+	~__volume_snapshot_cleanup()
+	{
+		volume_snapshot_stop();
+	}
+} __volume_snapshot_cleanup_inst;
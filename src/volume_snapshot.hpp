@@ -0,0 +1,67 @@
+#pragma once
+#ifndef __VOLUME_SNAPSHOT_HPP__
+#define __VOLUME_SNAPSHOT_HPP__
+
+#include "unicode.h"
+
+#include <stddef.h>
+
+#include <string>
+#include <vector>
+
+// The last volume and mute state set per application, so a player that
+//   restarts gets them back instead of the system's default. The providers
+//   record what they set and look the state up when a session of a player
+//   appears; both only touch an in-memory index sorted by process name.
+//
+// The index is written to a binary snapshot file by a thread of its own,
+//   a while after the first change, so a run of key presses is one write.
+//   The file is replaced as a whole, through a temporary one.
+//
+// Snapshot format, little endian:
+//   "MPVS", u16 version, u16 0, u32 entry count
+//   per entry: u8 flags (VolumeSnapshotEntry's), u8 name length,
+//     u16 volume (0..65535 for 0..1), the UTF-8 process name
+//   u32 FNV-1a of everything before it
+// A file that doesn't check out is ignored as a whole.
+
+#define VOLUME_SNAPSHOT_VERSION 1
+#define VOLUME_SNAPSHOT_FILE _T("volumes.bin")
+// Milliseconds between a change and writing it out
+#define VOLUME_SNAPSHOT_WRITE_DELAY 2000
+
+struct VolumeSnapshotEntry
+{
+	enum Flags { MUTED = 1, HAS_VOLUME = 2, HAS_MUTE = 4 };
+
+	// UTF-8
+	std::string name;
+	float volume;
+	unsigned char flags;
+};
+
+// Loads the snapshot at path and starts writing changes back to it
+bool volume_snapshot_start(std::basic_string<TCHAR> const& path);
+// Writes what's pending and stops the writer
+void volume_snapshot_stop();
+
+// Do nothing until volume_snapshot_start or volume_snapshot_load and after
+//   volume_snapshot_stop, nothing is remembered then, not even within the
+//   run
+void volume_snapshot_record_volume(std::string const& name, float volume);
+void volume_snapshot_record_mute(std::string const& name, bool muted);
+// False if nothing was recorded for the process
+bool volume_snapshot_lookup(std::string const& name, VolumeSnapshotEntry& out);
+
+// Replace the index with the file's / write it right away, for the
+//   benchmarks. A missing file loads as an empty index, either way the
+//   index is in use from then on.
+bool volume_snapshot_load(std::basic_string<TCHAR> const& path);
+bool volume_snapshot_save(std::basic_string<TCHAR> const& path);
+size_t volume_snapshot_size();
+
+// The file format, without the file
+void volume_snapshot_encode(std::vector<VolumeSnapshotEntry> const& entries, std::vector<unsigned char>& out);
+bool volume_snapshot_decode(unsigned char const* data, size_t size, std::vector<VolumeSnapshotEntry>& out);
+
+#endif // __VOLUME_SNAPSHOT_HPP__
@@ -0,0 +1,141 @@
+#include "unicode.h"
+
+#include <math.h>
+#include <stdlib.h>
+
+#include <algorithm>
+
+#include "volume_steps.hpp"
+
+#define LN10 2.302585092994046
+// Volumes read back from a provider are off by its rounding
+#define LEVEL_EPSILON 1e-5f
+// A step amount divided back out of a sum of presses is off by its rounding
+#define STEP_EPSILON 1e-4f
+
+struct StepTable
+{
+	// Ascending, 0 first and 1 last
+	float levels[STEP_MAX_LEVELS];
+	unsigned int count;
+};
+
+struct StepTables
+{
+	StepTable tables[VOLUME_SCALES][STEP_CLASSES];
+};
+
+// e^x for x <= 0 to about 1e-12, usable in constant expressions. The
+//   Taylor series of x / 1024 converges fast, squaring it 10 times gives
+//   back e^x.
+static constexpr double const_exp(double x)
+{
+	double y = x / 1024., term = 1., sum = 1.;
+	for (int i = 1; i < 12; ++i)
+	{
+		term *= y / i;
+		sum += term;
+	}
+	for (int i = 0; i < 10; ++i)
+		sum *= sum;
+	return sum;
+}
+
+static constexpr StepTable make_table(double decibels, VolumeScale scale)
+{
+	StepTable table = {};
+	unsigned int steps = (unsigned int)(-STEP_FLOOR_DB / decibels);
+	if (steps > STEP_MAX_LEVELS - 2)
+		steps = STEP_MAX_LEVELS - 2;
+	// From the lowest level up to 0 dB, 0 below them
+	table.levels[0] = 0.f;
+	for (unsigned int i = 0; i <= steps; ++i)
+	{
+		double db = -(double)(steps - i) * decibels;
+		table.levels[i + 1] = (float)const_exp(db * LN10 / (scale == SCALE_CUBIC ? 60. : 20.));
+	}
+	table.count = steps + 2;
+	return table;
+}
+
+static constexpr StepTables make_tables(double const (&decibels)[STEP_CLASSES])
+{
+	StepTables tables = {};
+	for (int scale = 0; scale < VOLUME_SCALES; ++scale)
+		for (int i = 0; i < STEP_CLASSES; ++i)
+			tables.tables[scale][i] = make_table(decibels[i], (VolumeScale)scale);
+	return tables;
+}
+
+static constexpr double defaultDecibels[STEP_CLASSES] = { 1., 3., 6., 10. };
+static constexpr StepTables defaultTables = make_tables(defaultDecibels);
+static_assert(defaultTables.tables[SCALE_AMPLITUDE][1].count == 22 && defaultTables.tables[SCALE_AMPLITUDE][1].levels[21] == 1.f, "the normal step's table goes from -60 dB to 0 dB");
+static_assert(defaultTables.tables[SCALE_AMPLITUDE][3].levels[6] > .316f && defaultTables.tables[SCALE_AMPLITUDE][3].levels[6] < .317f, "-10 dB is an amplitude of .316");
+
+// Set before the dispatcher starts, only read afterwards
+static StepCurve stepCurve = CURVE_LINEAR;
+static StepTables configuredTables;
+static StepTables const* stepTables = &defaultTables;
+
+static bool parse_decibels(std::string const& str, double (&out)[STEP_CLASSES])
+{
+	char const* p = str.c_str();
+	for (int i = 0; i < STEP_CLASSES; ++i)
+	{
+		char* end;
+		out[i] = strtod(p, &end);
+		if (end == p || !(out[i] >= STEP_MIN_DECIBELS && out[i] <= -STEP_FLOOR_DB))
+			return false;
+		while (*end == ' ')
+			++end;
+		if (*end != (i + 1 < STEP_CLASSES ? ',' : '\0'))
+			return false;
+		p = end + 1;
+	}
+	return true;
+}
+
+bool volume_steps_configure(StepCurve curve, std::string const& decibels)
+{
+	stepCurve = curve;
+	double parsed[STEP_CLASSES];
+	if (!parse_decibels(decibels, parsed))
+	{
+		stepTables = &defaultTables;
+		return false;
+	}
+	if (std::equal(parsed, parsed + STEP_CLASSES, defaultDecibels))
+		stepTables = &defaultTables;
+	else
+	{
+		configuredTables = make_tables(parsed);
+		stepTables = &configuredTables;
+	}
+	return true;
+}
+
+static int step_class(float amount)
+{
+	for (int i = 0; i < STEP_CLASSES; ++i)
+		if (fabsf(amount - volumeStepAmounts[i]) < STEP_EPSILON)
+			return i;
+	return -1;
+}
+
+float volume_step_target(float current, float delta, VolumeScale scale, unsigned int presses)
+{
+	int i;
+	if (stepCurve == CURVE_LINEAR || !presses || (i = step_class(fabsf(delta) / presses)) < 0)
+		return std::min<float>(std::max<float>(current + delta, 0.f), 1.f);
+
+	// The level after current (before it going down) and presses - 1 more
+	StepTable const& table = stepTables->tables[scale][i];
+	float const *begin = table.levels, *end = table.levels + table.count;
+	if (delta > 0.f)
+	{
+		size_t next = std::upper_bound(begin, end, current + LEVEL_EPSILON) - begin + (presses - 1);
+		return next >= table.count ? 1.f : table.levels[next];
+	}
+	size_t next = std::lower_bound(begin, end, current - LEVEL_EPSILON) - begin;
+	return next < presses ? 0.f : table.levels[next - presses];
+}
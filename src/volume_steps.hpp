@@ -0,0 +1,50 @@
+#pragma once
+#ifndef __VOLUME_STEPS_HPP__
+#define __VOLUME_STEPS_HPP__
+
+#include "unicode.h"
+
+#include <string>
+
+// Where a volume key's step goes. Linear steps (the default) add the key's
+//   amount to the volume, which is far too coarse at the low end to the ear.
+//   The decibel curve moves to the next level of a table whose levels are a
+//   fixed number of dB apart instead, so every step sounds the same.
+//
+// The tables are built at compile time for the default step sizes; a
+//   configured override is built once when it's set. A step is a binary
+//   search in its table, no log or pow on the way.
+
+enum StepCurve { CURVE_LINEAR = 0, CURVE_DECIBEL = 1 };
+
+// How a provider's volume relates to loudness
+enum VolumeScale
+{
+	// Amplitude factor, like ISimpleAudioVolume
+	SCALE_AMPLITUDE = 0,
+	// The cube root of it, PulseAudio's
+	SCALE_CUBIC = 1,
+	VOLUME_SCALES
+};
+
+#define STEP_CLASSES 4
+// The fine, normal, coarse and large steps (Ctrl, no modifier, Ctrl+Shift,
+//   Shift). Changes by other amounts, like "up 0.07", stay linear.
+constexpr float volumeStepAmounts[STEP_CLASSES] = { .01f, .05f, .10f, .20f };
+// Default dB per step of each class, and the lowest level above 0
+#define STEP_DEFAULT_DECIBELS "1,3,6,10"
+#define STEP_FLOOR_DB -60.
+#define STEP_MIN_DECIBELS .5
+#define STEP_MAX_LEVELS 128
+
+// decibels is a comma separated dB size per step class. Returns false if
+//   it doesn't parse, the default sizes stay then. Has to be called before
+//   the dispatcher starts.
+bool volume_steps_configure(StepCurve curve, std::string const& decibels);
+
+// The volume a change by delta from current leads to, clamped to 0..1.
+//   delta is presses key presses of a step each, on the decibel curve every
+//   one of them moves a level.
+float volume_step_target(float current, float delta, VolumeScale scale, unsigned int presses = 1);
+
+#endif // __VOLUME_STEPS_HPP__
@@ -0,0 +1,122 @@
+// Loads a backend plugin the way Plugins does and puts it through the ABI:
+//   lists its sessions, runs a batch against the first one, reads the
+//   result back and puts the session back the way it was. Exits 0 if the
+//   plugin did what the ABI says, 1 if it didn't and 2 if it couldn't be
+//   opened, for checking plugins built against plugin_abi.h.
+#include "unicode.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <string>
+#include <vector>
+
+#include "plugin_loader.hpp"
+#include "volume_control.hpp"
+
+typedef MediaPlayerVolumeControlProvider Provider;
+
+static void usage()
+{
+	fputs("Usage: mpvcplugin [OPTIONS] PLUGIN\n"
+		"  --names LIST           comma separated player names handed to the plugin\n", stderr);
+}
+
+static char const* status_name(Provider::VOLUME_CHANGE_STATUS status)
+{
+	return status == Provider::STATUS_FOUND ? "found" : status == Provider::STATUS_NOT_FOUND ? "not found" : "error";
+}
+
+static bool check_volume(Provider* provider, Provider::target_type const& target, float volume, bool muted)
+{
+	float gotVolume = -1.f;
+	bool gotMuted = !muted;
+	Provider::VOLUME_CHANGE_STATUS status = provider->volume_get(target, gotVolume, gotMuted);
+	if (status != Provider::STATUS_FOUND)
+	{
+		fprintf(stderr, "get %s: %s\n", target.c_str(), status_name(status));
+		return false;
+	}
+	// Backends keep the volume in their own steps
+	if (fabsf(gotVolume - volume) > .01f || gotMuted != muted)
+	{
+		fprintf(stderr, "get %s: %.3f%s, expected %.3f%s\n", target.c_str(), gotVolume, gotMuted ? " muted" : "", volume, muted ? " muted" : "");
+		return false;
+	}
+	return true;
+}
+
+int main(int argc, char** argv)
+{
+	char const* path = NULL;
+	std::string names;
+	for (int i = 1; i < argc; ++i)
+	{
+		if (strcmp(argv[i], "--names") == 0 && i + 1 < argc)
+			names = argv[++i];
+		else if (argv[i][0] != '-' && !path)
+			path = argv[i];
+		else
+		{
+			usage();
+			return 2;
+		}
+	}
+	if (!path)
+	{
+		usage();
+		return 2;
+	}
+
+	static char const* const results[] = { "opened", "backend not present", "couldn't be loaded", "not a plugin of this version", "failed to start" };
+	Provider* provider;
+	PluginOpenResult result = plugin_open(path, names, provider);
+	if (result != PLUGIN_OPENED)
+	{
+		fprintf(stderr, "%s: %s\n", path, results[result]);
+		return 2;
+	}
+	printf("%s: %s, budget %u ms\n", path, results[result], provider->latency_budget());
+
+	std::vector<Provider::TargetState> targets;
+	provider->volume_list(targets);
+	for (std::vector<Provider::TargetState>::iterator start = targets.begin(), end = targets.end(); start != end; ++start)
+		printf("  %s %.3f%s\n", start->name.c_str(), start->volume, start->muted ? " muted" : "");
+	if (targets.empty())
+	{
+		fputs("no sessions to check with\n", stderr);
+		delete provider;
+		return 1;
+	}
+
+	Provider::TargetState const& target = targets.front();
+	Provider::VolumeCommand const commands[] = {
+		Provider::VolumeCommand(Provider::VolumeCommand::SET_VOLUME, target.name, .25f),
+		Provider::VolumeCommand(Provider::VolumeCommand::CHANGE, target.name, .05f),
+		Provider::VolumeCommand(Provider::VolumeCommand::SET_MUTE, target.name, 1.f),
+		Provider::VolumeCommand(Provider::VolumeCommand::SET_VOLUME, "mpvcplugin: no such player", .5f)
+	};
+	Provider::VOLUME_CHANGE_STATUS const expected[] = { Provider::STATUS_FOUND, Provider::STATUS_FOUND, Provider::STATUS_FOUND, Provider::STATUS_NOT_FOUND };
+	size_t const count = sizeof(commands) / sizeof(commands[0]);
+	Provider::VOLUME_CHANGE_STATUS statuses[count];
+	bool ok = true;
+	if (provider->volume_batch(commands, count, statuses) != Provider::STATUS_FOUND)
+		ok = false;
+	for (size_t i = 0; i < count; ++i)
+		if (statuses[i] != expected[i])
+		{
+			fprintf(stderr, "batch command %u: %s, expected %s\n", (unsigned int)i + 1, status_name(statuses[i]), status_name(expected[i]));
+			ok = false;
+		}
+	ok = check_volume(provider, target.name, .30f, true) && ok;
+	provider->mute_set(target.name, false);
+	ok = check_volume(provider, target.name, .30f, false) && ok;
+
+	provider->volume_set(target.name, target.volume);
+	provider->mute_set(target.name, target.muted);
+	// Shuts the plugin down and unloads it
+	delete provider;
+	puts(ok ? "ok" : "FAILED");
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,205 @@
+// Plays a timeline recorded with RecordTimeline (or --record) back against
+//   the fake provider: the keys go through the key state machine, the
+//   dispatcher and the fade engine like they did live, the sessions come and
+//   go as recorded, and the recorded latencies of the volume and mute calls
+//   become the fake provider's write latency. Prints what the keys did and
+//   how long each took, so a field report becomes a repeatable test.
+//
+// Events are played as fast as they go unless --realtime is given, which
+//   keeps the recorded pace. With --max-latency-us the run fails (exit 1)
+//   if some key took longer, for use as a regression check.
+#include "unicode.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include "call_stats.hpp"
+#include "fade_engine.hpp"
+#include "fake_volume_control.hpp"
+#include "key_actions.hpp"
+#include "metrics.hpp"
+#include "timeline.hpp"
+#include "volume_control.hpp"
+#include "volume_dispatch.hpp"
+
+struct CallSummary
+{
+	uint64_t calls;
+	uint64_t failures;
+	uint64_t totalNs;
+	uint64_t maxNs;
+
+	CallSummary() : calls(), failures(), totalNs(), maxNs() { }
+};
+
+struct ReplayTotals
+{
+	unsigned long keys;
+	unsigned long volumeChanges;
+	unsigned long mutes;
+	unsigned long sessionsAdded;
+	unsigned long sessionsRemoved;
+	unsigned long deviceChanges;
+	unsigned long calls;
+
+	ReplayTotals() : keys(), volumeChanges(), mutes(), sessionsAdded(), sessionsRemoved(), deviceChanges(), calls() { }
+};
+
+static void usage()
+{
+	fputs("Usage: mpvcreplay [OPTIONS] TIMELINE\n"
+		"  --realtime             keep the recorded pace between events\n"
+		"  --fade-time MS         ramp the volume keys' steps like FadeTime\n"
+		"  --max-latency-us N     fail if a key took longer than N microseconds\n"
+		"  --verbose              print every volume change of the fake provider\n", stderr);
+}
+
+static uint64_t percentile(std::vector<uint64_t> const& sorted, unsigned int percent)
+{
+	return sorted[(sorted.size() - 1) * percent / 100];
+}
+
+int main(int argc, char** argv)
+{
+	char const* path = NULL;
+	bool realtime = false, verbose = false;
+	unsigned int fadeTime = 0;
+	uint64_t maxLatencyUs = 0;
+	for (int i = 1; i < argc; ++i)
+	{
+		if (strcmp(argv[i], "--realtime") == 0)
+			realtime = true;
+		else if (strcmp(argv[i], "--verbose") == 0)
+			verbose = true;
+		else if (strcmp(argv[i], "--fade-time") == 0 && i + 1 < argc)
+			fadeTime = (unsigned int)strtoul(argv[++i], NULL, 10);
+		else if (strcmp(argv[i], "--max-latency-us") == 0 && i + 1 < argc)
+			maxLatencyUs = strtoull(argv[++i], NULL, 10);
+		else if (argv[i][0] != '-' && !path)
+			path = argv[i];
+		else
+		{
+			usage();
+			return 2;
+		}
+	}
+	if (!path)
+	{
+		usage();
+		return 2;
+	}
+
+	std::vector<TimelineEvent> events;
+	if (!timeline_read(path, events))
+	{
+		fprintf(stderr, "%s: not a timeline or unreadable\n", path);
+		return 2;
+	}
+
+	FakeVolumeControlProvider* provider = new FakeVolumeControlProvider(verbose);
+	add_volume_control(provider);
+	volume_dispatch_start(DISPATCH_BROADCAST, 0);
+	fade_engine_start(fadeTime);
+
+	KeyStateMachine keys;
+	ReplayTotals totals;
+	CallSummary calls[CALL_SITES];
+	std::vector<uint64_t> latencies;
+	latencies.reserve(events.size());
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	for (std::vector<TimelineEvent>::const_iterator event = events.begin(); event != events.end(); ++event)
+	{
+		if (realtime)
+			std::this_thread::sleep_until(start + std::chrono::microseconds(event->time));
+		switch (event->type)
+		{
+		case TimelineEvent::EVENT_KEY_DOWN:
+		case TimelineEvent::EVENT_KEY_UP:
+			{
+				++totals.keys;
+				std::chrono::steady_clock::time_point keyStart = std::chrono::steady_clock::now();
+				KeyAction action = event->type == TimelineEvent::EVENT_KEY_DOWN ? keys.key_down(event->key, event->modifiers, false) : keys.key_up(event->key);
+				if (action.type == KeyAction::ACTION_VOLUME_CHANGE)
+				{
+					volume_change(action.amount);
+					++totals.volumeChanges;
+				}
+				else if (action.type == KeyAction::ACTION_MUTE)
+				{
+					volume_mute();
+					++totals.mutes;
+				}
+				else
+					break;
+				latencies.push_back((uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - keyStart).count());
+			}
+			break;
+		case TimelineEvent::EVENT_SESSION_ADDED:
+			provider->add_session(event->name, event->volume);
+			++totals.sessionsAdded;
+			break;
+		case TimelineEvent::EVENT_SESSION_REMOVED:
+			provider->remove_session(event->name);
+			++totals.sessionsRemoved;
+			break;
+		case TimelineEvent::EVENT_DEVICES_CHANGED:
+			++totals.deviceChanges;
+			break;
+		case TimelineEvent::EVENT_CALL:
+			{
+				++totals.calls;
+				if (event->value >= CALL_SITES)
+					break;
+				CallSummary& summary = calls[event->value];
+				++summary.calls;
+				if (event->error)
+					++summary.failures;
+				summary.totalNs += event->ns;
+				summary.maxNs = std::max(summary.maxNs, event->ns);
+				// The writes the keys lead to take as long as they last did
+				if (event->value == CALL_SET_MASTER_VOLUME || event->value == CALL_SET_MUTE)
+					provider->set_write_latency((unsigned int)(event->ns / 1000));
+			}
+			break;
+		}
+	}
+	std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+
+	// Stopping drops the fades where they are, the last ones get to finish
+	if (fadeTime)
+		std::this_thread::sleep_for(std::chrono::milliseconds(fadeTime + 2 * FADE_TICK_MS));
+	fade_engine_stop();
+	bool stopped = volume_dispatch_stop(5000);
+
+	printf("events %lu in %.1f ms (recorded %.1f ms)\n", (unsigned long)events.size(), elapsed.count(), events.empty() ? 0. : events.back().time / 1000.);
+	printf("keys %lu volume_changes %lu mutes %lu\n", totals.keys, totals.volumeChanges, totals.mutes);
+	printf("sessions_added %lu sessions_removed %lu device_changes %lu calls %lu\n", totals.sessionsAdded, totals.sessionsRemoved, totals.deviceChanges, totals.calls);
+	printf("writes %lu late_results %llu\n", provider->get_writes(), (unsigned long long)mpvc_metrics.lateResults.load());
+	int ret = 0;
+	if (!latencies.empty())
+	{
+		std::sort(latencies.begin(), latencies.end());
+		printf("key_latency_us min %.1f median %.1f p99 %.1f max %.1f\n", latencies.front() / 1000., percentile(latencies, 50) / 1000., percentile(latencies, 99) / 1000., latencies.back() / 1000.);
+		if (maxLatencyUs && latencies.back() > maxLatencyUs * 1000)
+		{
+			fprintf(stderr, "a key took %.1f us, over the limit of %llu us\n", latencies.back() / 1000., (unsigned long long)maxLatencyUs);
+			ret = 1;
+		}
+	}
+	for (unsigned int i = 0; i < CALL_SITES; ++i)
+		if (calls[i].calls)
+			printf("call %s calls %llu failures %llu mean_us %.1f max_us %.1f\n", call_site_name(i), (unsigned long long)calls[i].calls, (unsigned long long)calls[i].failures, calls[i].totalNs / 1000. / calls[i].calls, calls[i].maxNs / 1000.);
+	if (stopped)
+	{
+		for (std::vector<FakeVolumeControlProvider::Session>::const_iterator session = provider->get_sessions().begin(); session != provider->get_sessions().end(); ++session)
+			printf("session %s volume %.3f%s\n", session->processName.c_str(), session->volume, session->muted ? " muted" : "");
+		delete_volume_controls();
+	}
+	return ret;
+}
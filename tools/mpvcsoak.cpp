@@ -0,0 +1,231 @@
+// Soak test of the portable build: drives millions of volume key presses
+//   through the key state machine, the dispatcher and the fade engine to
+//   the fake provider, with players coming and going and the config being
+//   read and written again in between, like weeks of use compressed into
+//   minutes. It samples the resident and private memory, the heap in use
+//   and the open file descriptors along the way.
+//
+// Growth is judged after a warm-up of the first quarter of the presses: the
+//   lowest sample of the last quarter against the highest one before the
+//   half. Only growth that keeps going shows up as that difference, the
+//   run fails (exit 1) if it is over the limits.
+#include "unicode.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include "resource.h"
+#include "fade_engine.hpp"
+#include "fake_volume_control.hpp"
+#include "key_actions.hpp"
+#include "memory_usage.hpp"
+#include "mpvc_config.hpp"
+#include "volume_control.hpp"
+#include "volume_dispatch.hpp"
+#include "volume_snapshot.hpp"
+#include "volume_steps.hpp"
+
+// Players started and stopped in turn, the remembered volumes stay bounded
+#define SOAK_PLAYERS 32
+// Players running at any time
+#define SOAK_RUNNING 4
+
+MPVCConfig mpvc_config;
+
+static KeyStateMachine keys;
+
+struct SoakSample
+{
+	unsigned long presses;
+	MemoryUsage usage;
+};
+
+static void usage()
+{
+	fputs("Usage: mpvcsoak [OPTIONS]\n"
+		"  --presses N            volume key presses in all (default 2000000)\n"
+		"  --churn N              a player stops and another starts every N presses (default 100)\n"
+		"  --reload N             the config is read and written again every N presses (default 10000)\n"
+		"  --fade-time MS         ramp the volume keys' steps like FadeTime\n"
+		"  --samples N            memory samples taken (default 40)\n"
+		"  --max-growth-kb N      fail if the private memory grew by more (default 256)\n"
+		"  --max-heap-growth-kb N fail if the heap in use grew by more (default 64)\n", stderr);
+}
+
+static void press(MediaKey key, unsigned int modifiers)
+{
+	KeyAction action = keys.key_down(key, modifiers, false);
+	if (action.type == KeyAction::ACTION_VOLUME_CHANGE)
+		volume_change(action.amount);
+	else if (action.type == KeyAction::ACTION_MUTE)
+		volume_mute();
+	keys.key_up(key);
+}
+
+// The presses of a user going up and down, with a mute now and then
+static void press_round(unsigned long i)
+{
+	press(i & 1 ? MEDIAKEY_VOLUME_DOWN : MEDIAKEY_VOLUME_UP, i & 2 ? MODIFIER_SHIFT : i & 4 ? MODIFIER_CONTROL : MODIFIER_NONE);
+	if (i % 16 == 15)
+		press(MEDIAKEY_VOLUME_MUTE, MODIFIER_NONE);
+}
+
+static std::string player_name(unsigned long i)
+{
+	char name[16];
+	snprintf(name, sizeof name, "player%lu", i % SOAK_PLAYERS);
+	return name;
+}
+
+// What a config reload does: the file read, the settings applied and the
+//   file written back. The dispatcher is idle between presses, so the step
+//   tables can be rebuilt.
+static bool reload_config(unsigned long i)
+{
+	if (!mpvc_config.read_config())
+		return false;
+	mpvc_config.stepCurve = i & 1;
+	mpvc_config.stepDecibels = i & 2 ? "2,4,8,12" : STEP_DEFAULT_DECIBELS;
+	volume_steps_configure((StepCurve)mpvc_config.stepCurve, mpvc_config.stepDecibels);
+	mpvc_config.keyBindings = i & 4 ? "Shift+VolumeUp=up 0.1; Ctrl+Mute=set 0.5; Alt+Mute=target player1" : "";
+	std::string error;
+	if (!key_bindings_configure(mpvc_config.keyBindings, error))
+		return false;
+	return mpvc_config.write_config();
+}
+
+static bool take_sample(unsigned long presses, std::vector<SoakSample>& samples)
+{
+	SoakSample sample;
+	sample.presses = presses;
+	if (!memory_usage_read(sample.usage))
+		return false;
+	samples.push_back(sample);
+	printf("%12lu %12llu %12llu %12llu %6llu\n", presses, (unsigned long long)(sample.usage.residentBytes / 1024), (unsigned long long)(sample.usage.privateBytes / 1024),
+		(unsigned long long)(sample.usage.heapBytes / 1024), (unsigned long long)sample.usage.handles);
+	fflush(stdout);
+	return true;
+}
+
+// Bytes the lowest late sample is over the highest early one, 0 if none
+static uint64_t growth(std::vector<SoakSample> const& samples, uint64_t MemoryUsage::* field)
+{
+	size_t count = samples.size(), warmedUp = count / 4, half = count / 2, lastQuarter = count - count / 4;
+	if (half <= warmedUp || lastQuarter >= count)
+		return 0;
+	uint64_t early = 0, late = UINT64_MAX;
+	for (size_t i = warmedUp; i < half; ++i)
+		early = std::max(early, samples[i].usage.*field);
+	for (size_t i = lastQuarter; i < count; ++i)
+		late = std::min(late, samples[i].usage.*field);
+	return late > early ? late - early : 0;
+}
+
+int main(int argc, char** argv)
+{
+	unsigned long presses = 2000000, churn = 100, reload = 10000;
+	unsigned int fadeTime = 0, sampleCount = 40;
+	unsigned long long maxGrowthKb = 256, maxHeapGrowthKb = 64;
+	for (int i = 1; i < argc; ++i)
+	{
+		if (strcmp(argv[i], "--presses") == 0 && i + 1 < argc)
+			presses = strtoul(argv[++i], NULL, 10);
+		else if (strcmp(argv[i], "--churn") == 0 && i + 1 < argc)
+			churn = strtoul(argv[++i], NULL, 10);
+		else if (strcmp(argv[i], "--reload") == 0 && i + 1 < argc)
+			reload = strtoul(argv[++i], NULL, 10);
+		else if (strcmp(argv[i], "--fade-time") == 0 && i + 1 < argc)
+			fadeTime = (unsigned int)strtoul(argv[++i], NULL, 10);
+		else if (strcmp(argv[i], "--samples") == 0 && i + 1 < argc)
+			sampleCount = (unsigned int)strtoul(argv[++i], NULL, 10);
+		else if (strcmp(argv[i], "--max-growth-kb") == 0 && i + 1 < argc)
+			maxGrowthKb = strtoull(argv[++i], NULL, 10);
+		else if (strcmp(argv[i], "--max-heap-growth-kb") == 0 && i + 1 < argc)
+			maxHeapGrowthKb = strtoull(argv[++i], NULL, 10);
+		else
+		{
+			usage();
+			return 2;
+		}
+	}
+	if (presses < 1 || sampleCount < 4)
+	{
+		usage();
+		return 2;
+	}
+
+	// The config and the remembered volumes of the run, not the user's
+	char dir[] = "/tmp/mpvcsoak.XXXXXX";
+	if (!mkdtemp(dir))
+	{
+		perror("mkdtemp");
+		return 2;
+	}
+	setenv("XDG_CONFIG_HOME", dir, 1);
+	if (!mpvc_config.read_config())
+	{
+		fputs("Couldn't write the config\n", stderr);
+		return 2;
+	}
+	volume_snapshot_start(mpvc_config.configDir + VOLUME_SNAPSHOT_FILE);
+
+	FakeVolumeControlProvider* provider = new FakeVolumeControlProvider();
+	unsigned long started = 0, stopped = 0;
+	for (; started < SOAK_RUNNING; ++started)
+		provider->add_session(player_name(started), .5f);
+	add_volume_control(provider);
+	volume_dispatch_start(DISPATCH_BROADCAST, 0);
+	fade_engine_start(fadeTime);
+
+	printf("%12s %12s %12s %12s %6s\n", "presses", "resident kB", "private kB", "heap kB", "fds");
+	std::vector<SoakSample> samples;
+	samples.reserve(sampleCount + 1);
+	unsigned long sampleEvery = std::max<unsigned long>(presses / sampleCount, 1), reloads = 0;
+	bool ok = take_sample(0, samples);
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	for (unsigned long i = 1; i <= presses && ok; ++i)
+	{
+		press_round(i);
+		if (churn && i % churn == 0)
+		{
+			provider->remove_session(player_name(stopped++));
+			provider->add_session(player_name(started++), .5f);
+		}
+		if (reload && i % reload == 0 && !reload_config(reloads++))
+		{
+			fputs("Couldn't reload the config\n", stderr);
+			ok = false;
+		}
+		if (i % sampleEvery == 0)
+			ok = take_sample(i, samples) && ok;
+	}
+	std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+	volume_dispatch_stop(1000);
+	fade_engine_stop();
+	delete_volume_controls();
+	volume_snapshot_stop();
+	unlink((mpvc_config.configDir + VOLUME_SNAPSHOT_FILE).c_str());
+	unlink((mpvc_config.configDir + "config.txt").c_str());
+	rmdir(mpvc_config.configDir.c_str());
+	rmdir(dir);
+
+	uint64_t privateGrowth = growth(samples, &MemoryUsage::privateBytes), heapGrowth = growth(samples, &MemoryUsage::heapBytes), fdGrowth = growth(samples, &MemoryUsage::handles);
+	printf("%lu presses, %lu player changes and %lu config reloads in %.1f s\n", presses, stopped, reloads, elapsed.count());
+	printf("growth after warm-up: private %llu kB, heap %llu kB, %llu fds\n", (unsigned long long)(privateGrowth / 1024), (unsigned long long)(heapGrowth / 1024), (unsigned long long)fdGrowth);
+	if (!ok)
+		return 2;
+	if (privateGrowth / 1024 > maxGrowthKb || heapGrowth / 1024 > maxHeapGrowthKb || fdGrowth)
+	{
+		fputs("memory or descriptors kept growing\n", stderr);
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,166 @@
+// Checks that a backend which never returns doesn't take the others down
+//   with it: a provider hanging in every command sits next to a working
+//   fake one while volume keys are pressed, under both dispatch policies.
+//   Every press has to reach the fake session in time, and the hung
+//   provider has to hold no more than the call it hangs in. A provider that
+//   fails has to be reported when nothing found the player. Exits 0 if so
+//   and 1 otherwise.
+#include "unicode.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+
+#include "fake_volume_control.hpp"
+#include "volume_control.hpp"
+#include "volume_dispatch.hpp"
+
+typedef MediaPlayerVolumeControlProvider Provider;
+
+// Milliseconds the hung provider gets, short to keep the run short
+#define STALL_BUDGET 50
+
+class HungVolumeControlProvider : public MediaPlayerVolumeControlProvider
+{
+private:
+	std::mutex mutex;
+	std::condition_variable released;
+	bool release;
+	unsigned int entered;
+public:
+	HungVolumeControlProvider() : mutex(), released(), release(), entered() { }
+
+	// Lets the command it hangs in and every later one return
+	void unblock()
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		release = true;
+		released.notify_all();
+	}
+	unsigned int commands_entered()
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		return entered;
+	}
+private:
+	virtual void apply_batch(VolumeCommand const*, size_t count, VOLUME_CHANGE_STATUS* statuses)
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		++entered;
+		while (!release)
+			released.wait(lock);
+		std::fill(statuses, statuses + count, STATUS_NOT_FOUND);
+	}
+	virtual unsigned int dispatch_budget()
+	{
+		return STALL_BUDGET;
+	}
+};
+
+class FailingVolumeControlProvider : public MediaPlayerVolumeControlProvider
+{
+private:
+	virtual void apply_batch(VolumeCommand const*, size_t count, VOLUME_CHANGE_STATUS* statuses)
+	{
+		std::fill(statuses, statuses + count, STATUS_ERROR);
+	}
+};
+
+// Its error is the answer on its own, a player found elsewhere wins over it
+static bool run_failing(DispatchPolicy policy)
+{
+	char const* name = policy == DISPATCH_FIRST_WINS ? "first wins" : "broadcast";
+	FailingVolumeControlProvider* failing = new FailingVolumeControlProvider();
+	add_volume_control(failing);
+	volume_dispatch_start(policy, STALL_BUDGET);
+	Provider::VOLUME_CHANGE_STATUS alone = volume_change(.001f);
+
+	FakeVolumeControlProvider* fake = new FakeVolumeControlProvider();
+	fake->add_session(Provider::target_type("failing"), 0.f);
+	add_volume_control(fake);
+	Provider::VOLUME_CHANGE_STATUS withPlayer = volume_change(.001f);
+
+	volume_dispatch_stop(1000);
+	remove_volume_control(failing);
+	remove_volume_control(fake);
+	synchronize_volume_controls();
+	delete failing;
+	delete fake;
+	printf("%s: failing provider alone %d, next to a player %d\n", name, (int)alone, (int)withPlayer);
+	if (alone != Provider::STATUS_ERROR || withPlayer != Provider::STATUS_FOUND)
+	{
+		fprintf(stderr, "%s: the failing provider's error was lost or won over the player\n", name);
+		return false;
+	}
+	return true;
+}
+
+static bool run(DispatchPolicy policy, unsigned long presses)
+{
+	char const* name = policy == DISPATCH_FIRST_WINS ? "first wins" : "broadcast";
+	HungVolumeControlProvider* hung = new HungVolumeControlProvider();
+	FakeVolumeControlProvider* fake = new FakeVolumeControlProvider();
+	// A session of its own per run, nothing carried over
+	Provider::target_type player(policy == DISPATCH_FIRST_WINS ? "first" : "broadcast");
+	fake->add_session(player, 0.f);
+	add_volume_control(hung);
+	add_volume_control(fake);
+	volume_dispatch_start(policy, STALL_BUDGET);
+
+	bool ok = true;
+	unsigned long found = 0;
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	for (unsigned long i = 0; i < presses; ++i)
+		if (volume_change(.001f) == Provider::STATUS_FOUND)
+			++found;
+	double elapsedMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+	float volume = -1.f;
+	bool muted = false;
+	fake->volume_get(player, volume, muted);
+	unsigned int entered = hung->commands_entered();
+	printf("%s: %lu of %lu presses found the player in %.0f ms, volume %.3f, hung provider entered %u times\n", name, found, presses, elapsedMs, volume, entered);
+	if (found != presses || fabsf(volume - presses * .001f) > .0005f)
+	{
+		fprintf(stderr, "%s: presses were lost next to the hung provider\n", name);
+		ok = false;
+	}
+	// The first press waits out the budget at most, the rest don't wait
+	if (elapsedMs > 4 * STALL_BUDGET)
+	{
+		fprintf(stderr, "%s: presses kept waiting for the hung provider\n", name);
+		ok = false;
+	}
+
+	hung->unblock();
+	volume_dispatch_stop(1000);
+	remove_volume_control(hung);
+	remove_volume_control(fake);
+	synchronize_volume_controls();
+	delete hung;
+	delete fake;
+	return ok;
+}
+
+int main(int argc, char** argv)
+{
+	unsigned long presses = 25;
+	if (argc == 3 && strcmp(argv[1], "--presses") == 0)
+		presses = strtoul(argv[2], NULL, 10);
+	else if (argc != 1)
+	{
+		fputs("Usage: mpvcstall [--presses N]\n", stderr);
+		return 2;
+	}
+	bool ok = run(DISPATCH_BROADCAST, presses);
+	ok = run(DISPATCH_FIRST_WINS, presses) && ok;
+	ok = run_failing(DISPATCH_BROADCAST) && ok;
+	ok = run_failing(DISPATCH_FIRST_WINS) && ok;
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,71 @@
+// Prints the statistics a running mpVolCtrl publishes in shared memory. The
+//   segment is only mapped and copied, the application isn't woken up.
+#include "unicode.h"
+
+#include <stdio.h>
+
+#ifdef _WIN32
+#include <Windows.h>
+#include <tchar.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#include "handles.hpp"
+#include "stats_segment.hpp"
+
+static StatsSegmentLayout const* map_segment()
+{
+#ifdef _WIN32
+	// The view keeps the mapping alive
+	UniqueWin32Handle hMapping(OpenFileMappingA(FILE_MAP_READ, FALSE, stats_segment_name().c_str()));
+	if (!hMapping)
+		return NULL;
+	void* p = MapViewOfFile(hMapping.get(), FILE_MAP_READ, 0, 0, sizeof(StatsSegmentLayout));
+	return (StatsSegmentLayout const*)p;
+#else
+	UniqueFd fd(shm_open(stats_segment_name().c_str(), O_RDONLY | O_CLOEXEC, 0));
+	if (!fd)
+		return NULL;
+	void* p = MAP_FAILED;
+	struct stat st;
+	if (fstat(fd.get(), &st) == 0 && (size_t)st.st_size >= sizeof(StatsSegmentLayout))
+		p = mmap(NULL, sizeof(StatsSegmentLayout), PROT_READ, MAP_SHARED, fd.get(), 0);
+	return p == MAP_FAILED ? NULL : (StatsSegmentLayout const*)p;
+#endif
+}
+
+#ifdef _WIN32
+int _tmain()
+#else
+int main()
+#endif
+{
+	StatsSegmentLayout const* layout = map_segment();
+	if (!layout)
+	{
+		fputs("mpVolCtrl is not running\n", stderr);
+		return 2;
+	}
+	StatsSnapshot snapshot;
+	if (!stats_segment_read(layout, snapshot))
+	{
+		fputs("Unknown statistics segment version\n", stderr);
+		return 3;
+	}
+
+	printf("keypresses_handled %llu\n", (unsigned long long)snapshot.keypressesHandled);
+	printf("coalesced_events %llu\n", (unsigned long long)snapshot.coalescedEvents);
+	printf("sessions_cached %llu\n", (unsigned long long)snapshot.sessionsCached);
+	printf("provider_errors %llu\n", (unsigned long long)snapshot.providerErrors);
+	printf("com_errors %llu\n", (unsigned long long)snapshot.comErrors);
+	printf("hook_reinstalls %llu\n", (unsigned long long)snapshot.hookReinstalls);
+	printf("ipc_commands %llu\n", (unsigned long long)snapshot.ipcCommands);
+	printf("targets_updated %llu\n", (unsigned long long)snapshot.targetsUpdated);
+	for (uint32_t i = 0; i < snapshot.targetCount && i < sizeof snapshot.targets / sizeof *snapshot.targets; ++i)
+		printf("target %.*s %.4f %u\n", (int)sizeof snapshot.targets[i].name, snapshot.targets[i].name, snapshot.targets[i].volume, (unsigned int)snapshot.targets[i].muted);
+	return 0;
+}